@@ -29,6 +29,10 @@ def after_build(source, target, env):
     files_to_copy = [x for x in files_to_copy if x.endswith(
         'partitions.bin') == False]
 
+    # Strip out files generated directly into the build folder (www.bin)
+    files_to_copy = [x for x in files_to_copy if os.path.dirname(
+        os.path.abspath(x)) != os.path.abspath(builddir)]
+
     # print(files_to_copy)
     # print(len(files_to_copy))
 
@@ -51,7 +55,7 @@ def after_buildfs(source, target, env):
     cmd.append(env.get('ESP32_APP_OFFSET'))
     cmd.append(env.get('PROGNAME')+".bin")
     # This value should be read from 'PARTITIONS_TABLE_CSV'
-    cmd.append("0x1c0000")
+    cmd.append("0x190000")
     cmd.append(env.get('PROGNAME')+".bin")
     # This value should be read from 'PARTITIONS_TABLE_CSV'
     cmd.append("0x370000")
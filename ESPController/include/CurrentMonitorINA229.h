@@ -36,10 +36,36 @@ https://www.ti.com/lit/ds/symlink/ina229-q1.pdf?ts=1599057970767
 
 #include <Arduino.h>
 #include <SPI.h>
+#include "coulomb_counter.h"
 
 #ifndef CURRENTMONITORINA229_H_
 #define CURRENTMONITORINA229_H_
 
+struct ina229_sample_stats
+{
+    // Readings triggered by the conversion ready alert
+    uint32_t samples;
+    // Readings taken without an alert (start up, or the alert stalled)
+    uint32_t polled;
+    // Conversions which completed without being read
+    uint32_t missed;
+    // Expected time between alerts, from ADC_CONFIG conversion times and averaging
+    uint32_t conversion_us;
+    uint32_t last_interval_us;
+    // Measured alert rate in millihertz
+    uint32_t sample_rate_mhz;
+    // Difference between two consecutive alert intervals
+    uint32_t average_jitter_us;
+    uint32_t max_jitter_us;
+    // Time from the alert to the start of the SPI burst
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+    // Length of the SPI burst
+    uint32_t last_spi_us;
+    uint32_t max_spi_us;
+    uint64_t spi_busy_us;
+};
+
 class CurrentMonitorINA229
 {
     // This structure is held in EEPROM, it has the same register/values
@@ -176,7 +202,8 @@ public:
         registers.shunt_millivolt = 50;
 
         // SLOWALERT = Wait for full sample averaging time before triggering alert (about 1.5 seconds)
-        registers.R_DIAG_ALRT = bit(DIAG_ALRT_FIELD::SLOWALERT);
+        // CNVR = Pull the ALERT pin low at the end of each conversion, reading DIAG_ALRT releases it again
+        registers.R_DIAG_ALRT = bit(DIAG_ALRT_FIELD::SLOWALERT) | bit(DIAG_ALRT_FIELD::CNVR);
 
         // This is not enabled by default
         // The 16 bit register provides a resolution of 1ppm/°C/LSB
@@ -191,6 +218,7 @@ public:
         registers.R_TEMP_LIMIT = 0x2800; // 80 degrees C
 
         CalculateLSB();
+        CalculateFixedPoint();
 
         // Default Power limit = 5kW
         registers.R_PWR_LIMIT = (uint16_t)((5000.0F / registers.CURRENT_LSB / 3.2F) / 256.0F); // 5kW
@@ -221,21 +249,26 @@ public:
                    bool TemperatureCompEnabled);
 
     void GuessSOC();
-    void TakeReadings();
+    // alert_us is the esp_timer time of the conversion ready alert, zero when polled
+    void TakeReadings(int64_t alert_us = 0);
+    void GetSampleStats(ina229_sample_stats *copy);
 
-    uint32_t calc_milliamphour_out()  const{ return milliamphour_out - milliamphour_out_offset; }
-    uint32_t calc_milliamphour_in()  const{ return milliamphour_in - milliamphour_in_offset; }
-    uint32_t calc_daily_milliamphour_out()  const{ return daily_milliamphour_out; }
-    uint32_t calc_daily_milliamphour_in()  const{ return daily_milliamphour_in; }
+    // True when the conversion ready alert has not produced a reading for a few conversion periods,
+    // the ALERT pin is shared with the limit alerts so stays low while a limit is exceeded
+    bool SampleOverdue(int64_t now) const
+    {
+        return (now - last_sample_us) > 3 * (int64_t)conversion_us;
+    }
 
     float calc_charge_efficiency_factor()  const{ return registers.charge_efficiency_factor; }
     float calc_state_of_charge()  const{ return SOC / 100.0F; }
 
-    float calc_voltage()  const{ return voltage; }
-    float calc_current()  const{ return current; }
-    float calc_power()  const{ return power; }
+    float calc_voltage()  const{ return voltage_mV / 1000.0F; }
+    float calc_current()  const{ return current_mA / 1000.0F; }
+    float calc_power()  const{ return power_mW / 1000.0F; }
     uint16_t calc_shuntcalibration()  const{ return registers.R_SHUNT_CAL; }
-    int16_t calc_temperature()  const{ return (int16_t)temperature; }
+    // 7.8125 m°C/LSB
+    int16_t calc_temperature()  const{ return temperature_raw / 128; }
     uint16_t calc_shunttempcoefficient()  const{ return registers.R_SHUNT_TEMPCO; }
     float calc_tailcurrentamps()  const{ return registers.tail_current_amps; }
     float calc_fullychargedvoltage()  const{ return registers.fully_charged_voltage; }
@@ -261,32 +294,52 @@ public:
 
     bool calc_tempcompenabled() const { return (registers.R_CONFIG & bit(5)) != 0; }
 
-    uint16_t calc_alerts()
+    // DIAG_ALRT as read by the last TakeReadings
+    uint16_t calc_alerts() const
     {
-        registers.R_DIAG_ALRT = read16bits(INA_REGISTER::DIAG_ALRT);
-        return registers.R_DIAG_ALRT & ALL_ALERT_BITS;
+        return diag_alrt_value & ALL_ALERT_BITS;
     }
     void SetSOC(uint16_t value);
+    void ResetDailyAmpHourCounters();
 
-    void ResetDailyAmpHourCounters() {
-        daily_milliamphour_out=0;
-        daily_milliamphour_in=0;
-    }
+    // Consistent copy of the shadow coulomb counter, for the Ah readings and saving to NVS
+    void GetCoulombCounter(coulomb_counter *copy);
+    void RestoreCoulombCounter(const coulomb_counter *saved);
 
 private:
     uint16_t SOC = 0;
-    float voltage = 0;
-    float current = 0;
-    float power = 0;
-    float temperature = 0;
+    // Readings are held as fixed point integers, only the calc_ functions convert to float
+    int32_t voltage_mV = 0;
+    int32_t current_mA = 0;
+    int32_t power_mW = 0;
+    int16_t temperature_raw = 0;
 
     const float full_scale_adc = 40.96F;
-    // const float CoulombsToAmpHours = 1.0F / 3600.0F;
-    const float CoulombsToMilliAmpHours = 1.0F / 3.6F;
 
-    uint8_t max_soc_reset_counter = 0;
-    int64_t soc_reset_time;
-    int32_t last_charge_coulombs = 0;
+    // Fixed point copies of the register/battery settings, see CalculateFixedPoint
+    uint32_t current_lsb_nA = 0;
+    uint32_t vbus_divider = 1;
+    int32_t fully_charged_mV = 0;
+    int32_t tail_current_mA = 0;
+    uint32_t charge_efficiency_x100 = 0;
+    uint32_t conversion_us = 0;
+
+    // Zero while not in the charging tail period
+    int64_t soc_reset_time = 0;
+    // CHARGE register (sign extended raw value) at the last reading
+    int64_t last_charge_raw = 0;
+    // Totals are integrated here rather than in the INA229, protected by counter_lock
+    coulomb_counter counter = {};
+    portMUX_TYPE counter_lock = portMUX_INITIALIZER_UNLOCKED;
+
+    int64_t last_sample_us = 0;
+    int64_t first_alert_us = 0;
+    int64_t last_alert_us = 0;
+    uint32_t last_good_interval_us = 0;
+    uint32_t jitter_count = 0;
+    uint64_t jitter_total_us = 0;
+    ina229_sample_stats sample_stats = {};
+    portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
 
     // Pointer to SPI object class  NOTE: MUTEX OVER SPI PORT MUST BE HANDLED EXTERNALLY TO THIS CLASS
     SPIClass *SPI_Ptr = nullptr;
@@ -299,24 +352,13 @@ private:
 
     eeprom_regs registers;
 
-    uint32_t milliamphour_out_lifetime=0;
-    uint32_t milliamphour_in_lifetime=0;
-
-    uint32_t daily_milliamphour_out=0;
-    uint32_t daily_milliamphour_in=0;
-
-    uint32_t milliamphour_out=0;
-    uint32_t milliamphour_in=0;
-
-    uint32_t milliamphour_out_offset=0;
-    uint32_t milliamphour_in_offset=0;
-
     volatile uint16_t diag_alrt_value = 0;
 
     uint8_t readRegisterValue(INA_REGISTER r) const;
     uint8_t writeRegisterValue(INA_REGISTER r) const;
     void CalculateLSB();
-    
+    void CalculateFixedPoint();
+
     uint16_t read16bits(INA_REGISTER r);
     uint16_t write16bits(INA_REGISTER r, uint16_t value);
     void SetINA229Registers();
@@ -324,16 +366,19 @@ private:
     float Energy();
     float ShuntVoltage();
 
-    int32_t ChargeInCoulombsAsInt();
-
     int32_t readInt20(INA_REGISTER r);
     uint32_t readUInt24(INA_REGISTER r);
     uint32_t spi_readUint24(INA_REGISTER r);
     uint64_t spi_readUint40(INA_REGISTER r);
-    int64_t spi_readInt40(INA_REGISTER r);
+    void spi_readFrame(INA_REGISTER r, uint8_t *data, uint8_t length);
 
-    void CalculateAmpHourCounts();
-    uint16_t CalculateSOC() const;
+    void CalculateAmpHourCounts(int64_t charge_raw);
+    uint16_t CalculateSOC();
+    uint64_t CapacityInNanoCoulombs() const
+    {
+        return (uint64_t)registers.batterycapacity_amphour * 1000 * COULOMB_COUNTER_NC_PER_MAH;
+    }
+    void RecordSample(int64_t alert_us, int64_t start, int64_t end);
 
     // Convert an int16 to a uint16 2 compliment value
     uint16_t ConvertTo2sComp(int16_t value) const
@@ -371,25 +416,6 @@ private:
         return v;
     }
 
-    // Calculated power output.  Output value in watts. Unsigned representation. Positive value.
-    float Power()
-    {
-        // POWER Power [W] = 3.2 x CURRENT_LSB x POWER
-        return (float)spi_readUint24(INA_REGISTER::POWER) * (float)3.2 * registers.CURRENT_LSB * registers.vbus_divider;
-    }
-
-    // The INA228 device has an internal temperature sensor which can measure die temperature from –40 °C to +125°C.
-    float DieTemperature()
-    {
-        // The accuracy of the temperature sensor is ±2 °C across the operational temperature range. The temperature
-        // value is stored inside the DIETEMP register
-        // Internal die temperature measurement.
-        // Case unsigned to int16 to cope with negative temperatures
-        // Two's complement value. Conversion factor: 7.8125 m°C/LSB
-        float dietemp = ConvertFrom2sComp(read16bits(INA_REGISTER::DIETEMP));
-        return dietemp * (float)0.0078125;
-    }
-
     float TemperatureLimit()
     {
         // Case unsigned to int16 to cope with negative temperatures
@@ -397,15 +423,6 @@ private:
         return temp * (float)0.0078125;
     }
 
-    // Calculated current output in Amperes.
-    // In the way this circuit is designed, NEGATIVE current indicates DISCHARGE of the battery
-    // POSITIVE current indicates CHARGE of the battery
-    float Current()
-    {
-        // Current. Two's complement value.
-        return -(registers.CURRENT_LSB * (float)readInt20(INA_REGISTER::CURRENT));
-    }
-
     void ResetChargeEnergyRegisters()
     {
         // BIT 14
@@ -66,6 +66,9 @@ PCB WITH RS485/CANBUS/TFT DISPLAY
 #define RS485_TX GPIO_NUM_22
 #define RS485_ENABLE GPIO_NUM_25
 
+// Length of the TWAI driver transmit queue (frames)
+#define CANBUS_TX_QUEUE_LENGTH 32
+
 struct TouchScreenValues
 {
     bool touched;
@@ -89,9 +92,11 @@ public:
         xDisplayMutex = xSemaphoreCreateMutex();
         xi2cMutex = xSemaphoreCreateMutex();
         RS485Mutex = xSemaphoreCreateMutex();
+        CANMutex = xSemaphoreCreateMutex();
     }
 
     void ConfigureI2C(void (*TCA6408Interrupt)(void), void (*TCA9534AInterrupt)(void), void (*TCA6416Interrupt)(void));
+    void AttachINA229Interrupt(void (*INA229Interrupt)(void));
     void SetOutputState(uint8_t outputId, RelayState state);
     uint8_t ReadTCA6408InputRegisters();
     uint8_t ReadTCA9534InputRegisters();
@@ -101,7 +106,7 @@ public:
     SPIClass *VSPI_Ptr();
 
     void Led(uint8_t bits);
-    void ConfigureCAN(uint16_t canbusbaudrate) const;
+    void ConfigureCAN(uint16_t canbusbaudrate, const twai_filter_config_t &filter) const;
     void ConfigurePins();
     void TFTScreenBacklight(bool Status);
 
@@ -214,6 +219,33 @@ public:
         return true;
     }
 
+    // Held while the TWAI driver is used (canbus_tx) or reinstalled (ConfigureCAN from canbus_rx)
+    bool GetCANMutex()
+    {
+        if (CANMutex == NULL)
+            return false;
+
+        // Wait 100ms max
+        if (xSemaphoreTake(CANMutex, pdMS_TO_TICKS(100)) == pdFALSE)
+        {
+            ESP_LOGE(TAG, "Unable to get CAN mutex");
+            return false;
+        }
+        return true;
+    }
+    bool ReleaseCANMutex()
+    {
+        if (CANMutex == NULL)
+            return false;
+
+        if (xSemaphoreGive(CANMutex) == pdFALSE)
+        {
+            ESP_LOGE(TAG, "Unable to release CAN mutex");
+            return false;
+        }
+        return true;
+    }
+
     // Infinite loop flashing the LED RED/WHITE
     void Halt(RGBLED colour)
     {
@@ -247,6 +279,7 @@ private:
     SemaphoreHandle_t xDisplayMutex = NULL;
     SemaphoreHandle_t xi2cMutex = NULL;
     SemaphoreHandle_t RS485Mutex = NULL;
+    SemaphoreHandle_t CANMutex = NULL;
 
     // Input pin state for TCA9534
     uint8_t TCA9534APWR_Input;
@@ -0,0 +1,42 @@
+#ifndef DIYBMS_CANBUS_FRAMES_H_
+#define DIYBMS_CANBUS_FRAMES_H_
+
+#include "defines.h"
+#include "Rules.h"
+#include "canbus_transport.h"
+
+// Cache of the outgoing CAN frames for the active protocol.
+// The victron_message_* / pylon_message_* / pylonHV_message_* encoders are run once after each
+// rules pass (rules_task) and store their payloads here, the transmit path only copies the
+// ready made 8 byte payloads into the TWAI driver.
+//
+// PylonForce H2 frames are stored under their extended identifier without the equipment
+// address (for example 0x4210), canbus_frame_send adds the address or shortens it to the
+// standard 11 bit identifier (0x421) depending on the request from the inverter.
+
+// Largest number of different frames for one protocol
+#define CANBUS_FRAME_CACHE_SIZE 24
+
+struct can_frame_stats
+{
+    uint32_t identifier;
+    uint32_t sent;
+    // Sends where the payload was different to the previous send of this frame
+    uint32_t changed;
+};
+
+struct can_frame_cache_stats
+{
+    uint32_t rebuilds;
+    uint32_t last_rebuild_us;
+    uint32_t max_rebuild_us;
+};
+
+void canbus_frame_store(uint32_t identifier, const void *data, uint8_t length);
+void canbus_frames_rebuild();
+esp_err_t canbus_frame_send(uint32_t identifier, uint32_t address);
+uint8_t canbus_frames_get_stats(can_frame_stats *list, uint8_t listSize, can_frame_cache_stats *cache);
+
+extern diybms_eeprom_settings mysettings;
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DIYBMS_CANBUS_MULTIPACK_H_
+#define DIYBMS_CANBUS_MULTIPACK_H_
+
+#include "defines.h"
+#include "Rules.h"
+#include <driver/twai.h>
+
+// Multi-pack aggregation for several controllers (batteries in parallel) on one CAN bus.
+// Every controller broadcasts a summary of its pack every MULTIPACK_SUMMARY_PERIOD_MS using
+// identifier MULTIPACK_SUMMARY_ID + canbus_equipment_addr.  The controller with the lowest
+// address which is still being heard is the master, it alone talks to the inverter and sends
+// the combined limits of all the packs, the others only send their summary.
+
+#define MULTIPACK_SUMMARY_ID 0x7A0
+#define MULTIPACK_MAXIMUM_PACKS 16
+#define MULTIPACK_SUMMARY_PERIOD_MS 500
+// A pack is dropped from the aggregation if its summary is older than this
+#define MULTIPACK_PEER_TIMEOUT_MS 2000
+// Bits in an 8 byte standard frame, including worst case bit stuffing
+#define MULTIPACK_FRAME_BITS 135
+
+#define MULTIPACK_FLAG_RUNNING 0x01
+#define MULTIPACK_FLAG_SOC_VALID 0x02
+
+// Summary frame layout:
+// 0-1 lowest cell mV, 2-3 highest cell mV, 4 SOC %, 5 bits 0-3 flags,
+// 5 bits 4-7 + 6 + 7 charge current limit (10 bits, 1A) and discharge current limit (10 bits, 1A)
+struct multipack_summary
+{
+    uint16_t lowest_cell_mv;
+    uint16_t highest_cell_mv;
+    uint8_t soc;
+    uint8_t flags;
+    // 0.1A
+    uint16_t charge_current;
+    uint16_t discharge_current;
+};
+
+struct multipack_stats
+{
+    // Packs included in the last aggregation, including this one
+    uint8_t packs;
+    bool master;
+    uint8_t master_address;
+    uint32_t sent;
+    uint32_t received;
+    // Summaries received with our own address (two controllers with the same address)
+    uint32_t conflicts;
+    // Packs dropped after MULTIPACK_PEER_TIMEOUT_MS without a summary
+    uint32_t expired;
+    // Age of the oldest summary used in the last aggregation
+    uint32_t oldest_age_ms;
+    uint32_t max_age_ms;
+    // Summary frames as a share of the bus capacity, 1/1000
+    uint32_t bus_load_permille;
+};
+
+void multipack_update();
+bool multipack_is_master();
+bool multipack_apply_limits(int16_t *charge_current, int16_t *discharge_current);
+void multipack_apply_soc(uint16_t *soc);
+uint32_t multipack_service();
+void multipack_receive(const twai_message_t &message, int64_t received_us);
+void multipack_get_stats(multipack_stats *copy);
+
+extern diybms_eeprom_settings mysettings;
+extern Rules rules;
+extern currentmonitoring_struct currentMonitor;
+extern ControllerState _controller_state;
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef DIYBMS_CANBUS_RX_H_
+#define DIYBMS_CANBUS_RX_H_
+
+#include "defines.h"
+#include "Rules.h"
+#include <driver/twai.h>
+
+// Receive side of the CAN bus emulations.
+// Each protocol has a table of the CAN identifiers it listens to, the TWAI hardware acceptance
+// filter is derived from that table so unrelated bus traffic doesn't wake the canbus_rx task.
+// The filter can't be exact for every list of identifiers, anything it lets through which isn't
+// in the table is counted and dropped.
+
+// received_us is esp_timer_get_time() when the frame was taken from the receive queue
+typedef void (*can_rx_handler)(const twai_message_t &message, int64_t received_us);
+
+struct can_rx_entry
+{
+    uint32_t identifier;
+    // 29 bit identifier
+    bool extended;
+    can_rx_handler handler;
+    // Identifier bits which are ignored, so one entry can handle a range of identifiers
+    uint32_t mask;
+};
+
+// Largest protocol table, plus the multi-pack summary entry
+#define CANBUS_RX_TABLE_MAXIMUM 8
+
+struct can_rx_stats
+{
+    // Frames which passed the acceptance filter
+    uint32_t received;
+    uint32_t dispatched;
+    // Passed the acceptance filter, but no handler in the table
+    uint32_t unhandled;
+    // Time spent in the handlers
+    uint64_t busy_us;
+    uint32_t max_handler_us;
+};
+
+twai_filter_config_t canbus_rx_select(CanBusProtocolEmulation protocol);
+bool canbus_rx_select_needed();
+void canbus_rx_dispatch(const twai_message_t &message, int64_t received_us);
+void canbus_rx_get_stats(can_rx_stats *stats);
+
+extern diybms_eeprom_settings mysettings;
+extern uint32_t canbus_no_request_messages_count;
+extern int64_t canbus_last_305_message_time;
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef DIYBMS_CANBUS_SCHEDULER_H_
+#define DIYBMS_CANBUS_SCHEDULER_H_
+
+#include "defines.h"
+#include "Rules.h"
+#include <driver/twai.h>
+
+// Periodic CAN transmit scheduler.
+// Each outgoing message has its own period, deadline (longest allowed gap between two sends)
+// and priority.  Frames are placed into the TWAI driver transmit queue without blocking,
+// when the queue is too full the message stays due and is retried on the next pass, so a
+// slow bus delays informational frames rather than the charge/discharge limits.
+
+// Largest number of entries in a protocol schedule
+#define CANBUS_SCHEDULE_MAXIMUM 16
+
+// Only sent while the controller is in the Running state
+#define CAN_SCHEDULE_RUNNING_ONLY 0x01
+// Protects the inverter/charger (charge limits), sent before any other due message
+#define CAN_SCHEDULE_CRITICAL 0x02
+
+struct can_schedule_entry
+{
+    // CAN identifier, the payload comes from the frame cache (canbus_frames.h)
+    uint32_t identifier;
+    uint16_t period_ms;
+    // Longest acceptable gap between two successful sends
+    uint16_t deadline_ms;
+    // 0 = highest
+    uint8_t priority;
+    uint8_t flags;
+};
+
+struct can_schedule_stats
+{
+    uint32_t identifier;
+    uint32_t sent;
+    uint32_t missed_deadlines;
+    // Times the message was due but couldn't be queued (transmit queue full or bus not running)
+    uint32_t deferred;
+    // Lateness of the send compared to when it was due
+    uint32_t average_jitter_us;
+    uint32_t max_jitter_us;
+    // Longest gap between two sends
+    uint32_t max_interval_ms;
+};
+
+uint32_t canbus_scheduler_service();
+uint8_t canbus_scheduler_get_stats(can_schedule_stats *list, uint8_t listSize);
+
+extern diybms_eeprom_settings mysettings;
+extern ControllerState _controller_state;
+
+#endif
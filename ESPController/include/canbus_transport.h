@@ -0,0 +1,42 @@
+#ifndef DIYBMS_CANBUS_TRANSPORT_H_
+#define DIYBMS_CANBUS_TRANSPORT_H_
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <driver/twai.h>
+
+// Link between the CAN protocol code (frame cache, scheduler, receive dispatch) and the bus.
+// The controller uses the ESP32 TWAI driver.  On Linux a SocketCAN interface (for example vcan0)
+// can be used instead, so the protocol encoders can be run against an inverter simulator.
+// Frames are always passed as twai_message_t.
+
+struct canbus_transport
+{
+    const char *name;
+    // Queue a frame, must not block
+    esp_err_t (*transmit)(const twai_message_t &message);
+    // Wait up to timeout_ms for a frame, ESP_ERR_TIMEOUT if nothing arrived
+    esp_err_t (*receive)(twai_message_t &message, uint32_t timeout_ms);
+    // Number of frames which can be queued without blocking, 0 while the bus isn't running
+    uint8_t (*tx_space)();
+    // Called after a failed transmit, restarts the bus if needed
+    void (*recover)();
+    // Wait until every queued frame has been sent, ESP_ERR_TIMEOUT if they haven't after timeout_ms
+    esp_err_t (*wait_tx_done)(uint32_t timeout_ms);
+};
+
+extern const canbus_transport canbus_twai_transport;
+
+#if defined(__linux__)
+extern const canbus_transport canbus_socketcan_transport;
+esp_err_t canbus_socketcan_open(const char *interface);
+#endif
+
+void canbus_set_transport(const canbus_transport *transport);
+const canbus_transport *canbus_get_transport();
+bool send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const uint8_t length);
+
+extern uint32_t canbus_messages_sent;
+extern uint32_t canbus_messages_failed_sent;
+
+#endif
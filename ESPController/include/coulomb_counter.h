@@ -0,0 +1,42 @@
+#ifndef DIYBMS_COULOMB_COUNTER_H_
+#define DIYBMS_COULOMB_COUNTER_H_
+
+#include <stdint.h>
+
+// Shadow coulomb counter for the internal INA229 current monitor.
+// Charge in and out are integrated separately from the change in the INA229 CHARGE register, so
+// the totals are unaffected by the chip register being reset or wrapping.  SOC calibration
+// (reaching the charging tail, or a new SOC from the web page) only moves the reference point,
+// the totals themselves are never reset.
+// Plain integer maths with no ESP32 dependencies, so it can also be compiled on a PC.
+
+// Nano-coulombs in one milliamp hour
+#define COULOMB_COUNTER_NC_PER_MAH 3600000000ULL
+
+// Saved to NVS as a blob, changing this structure discards the stored copy
+struct coulomb_counter
+{
+    // Lifetime totals
+    uint64_t in_nC;
+    uint64_t out_nC;
+    // Totals when the SOC was last calibrated, and the battery charge at that point
+    uint64_t reference_in_nC;
+    uint64_t reference_out_nC;
+    int64_t reference_charge_nC;
+    // Totals when the daily counters were last reset
+    uint64_t daily_in_nC;
+    uint64_t daily_out_nC;
+};
+
+void coulomb_counter_add(coulomb_counter *c, int64_t delta_nC);
+void coulomb_counter_calibrate(coulomb_counter *c, uint64_t capacity_nC, uint16_t soc);
+void coulomb_counter_reset_daily(coulomb_counter *c);
+int64_t coulomb_counter_charge(const coulomb_counter *c, uint32_t efficiency_x100);
+uint16_t coulomb_counter_soc(const coulomb_counter *c, uint64_t capacity_nC, uint32_t efficiency_x100);
+
+inline uint32_t coulomb_counter_mAh(uint64_t nC)
+{
+    return (uint32_t)(nC / COULOMB_COUNTER_NC_PER_MAH);
+}
+
+#endif
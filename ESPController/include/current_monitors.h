@@ -0,0 +1,70 @@
+#ifndef DIYBMS_CURRENT_MONITORS_H_
+#define DIYBMS_CURRENT_MONITORS_H_
+
+#include "defines.h"
+
+// Set of current monitors (shunts), for example one per bank or separate charge and load paths.
+// Instance 0 is the main monitor from the settings (currentMonitoringDevice/ModBusAddress),
+// which can be the internal INA229, the others are DIYBMS MODBUS or PZEM-017 devices on RS485.
+//
+// Readings of each instance are kept separately and combined into the global currentMonitor
+// after every update:
+//   current, power and amp hour counters are the sum of all the monitors
+//   state of charge is weighted by battery capacity, monitors without a capacity (PZEM-017) are ignored
+//   voltage, limits, relay and configuration values come from the main monitor
+//   readings are only valid when every monitor has a valid, fresh reading
+// With a single monitor the combined values are the same as that monitor.
+//
+// RS485 monitors are polled round robin, one request at a time.  After each poll the bus is left idle
+// so requests from this scheduler use no more than CURRENTMON_RS485_BUS_BUDGET_PERCENT of the bus time,
+// leaving space for configuration writes, and each monitor is polled at most every CURRENTMON_POLL_INTERVAL_MS.
+
+// Shortest time between two polls of the same monitor
+#define CURRENTMON_POLL_INTERVAL_MS 2000
+// Share of the RS485 bus time used by polling
+#define CURRENTMON_RS485_BUS_BUDGET_PERCENT 50
+// Give up waiting for the reply (or failure) of a poll.  Timeouts, bad replies and exception replies
+// are all reported by the MODBUS master well before this, which completes the poll straight away
+#define CURRENTMON_POLL_TIMEOUT_MS 5000
+// Readings are stale after this many poll intervals without an update
+#define CURRENTMON_STALE_FACTOR 3
+
+struct currentmon_instance_stats
+{
+    CurrentMonitorDevice device;
+    uint8_t address;
+    bool valid;
+    bool stale;
+    float voltage;
+    float current;
+    float power;
+    float stateofcharge;
+    // RS485 requests
+    uint32_t polls;
+    uint32_t replies;
+    uint32_t failures;
+    // Average time between readings
+    uint32_t interval_ms;
+    // Age of the latest reading
+    uint32_t age_ms;
+    // Request to reply time of the last poll
+    uint32_t busy_us;
+};
+
+void currentmon_configure(const diybms_eeprom_settings *settings);
+uint8_t currentmon_count();
+int8_t currentmon_find(CurrentMonitorDevice device);
+int8_t currentmon_find_address(uint8_t address, CurrentMonitorDevice *device = nullptr);
+bool currentmon_identity(uint8_t index, CurrentMonitorDevice *device, uint8_t *address);
+
+void currentmon_get(uint8_t index, currentmonitoring_struct *readings);
+void currentmon_store(uint8_t index, const currentmonitoring_struct &readings);
+void currentmon_invalidate(uint8_t index);
+void currentmon_aggregate(currentmonitoring_struct *total, int64_t now);
+
+int8_t currentmon_next_poll(int64_t now, uint32_t *wait_ms, CurrentMonitorDevice *device, uint8_t *address);
+void currentmon_poll_complete(uint8_t address, bool success, int64_t now);
+
+uint8_t currentmon_get_stats(currentmon_instance_stats *list, uint8_t listSize, int64_t now);
+
+#endif
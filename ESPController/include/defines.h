@@ -46,7 +46,8 @@ enum ISRTYPE : uint32_t
   TCA6408A = 1 << 0,
   TCA9534 = 1 << 1,
   TCA6416A = 1 << 2,
-  TFTTOUCH = 1 << 3
+  TFTTOUCH = 1 << 3,
+  INA229 = 1 << 4
 };
 
 enum VictronDVCC : uint8_t
@@ -111,6 +112,17 @@ enum CurrentMonitorDevice : uint8_t
   DIYBMS_CURRENT_MON_INTERNAL = 0x02
 };
 
+// Largest number of current monitors (shunts), the first is the main monitor in the settings
+#define CURRENTMON_MAXIMUM 8
+
+// Extra current monitor on the RS485 bus, only MODBUS device types
+struct currentmon_additional_settings
+{
+  CurrentMonitorDevice device;
+  // Zero means the slot is not used
+  uint8_t address;
+};
+
 // Number of rules as defined in Rules.h (enum Rule)
 // This value is 1 + MAXIMUM_RuleNumber
 #define RELAY_RULES 17  //BOTANETA old value 16
@@ -158,6 +170,7 @@ struct diybms_eeprom_settings
   bool currentMonitoringEnabled;
   uint8_t currentMonitoringModBusAddress;
   CurrentMonitorDevice currentMonitoringDevice;
+  currentmon_additional_settings currentMonitoring_additional[CURRENTMON_MAXIMUM - 1];
 
   uint16_t currentMonitoring_shuntmv;
   uint16_t currentMonitoring_shuntmaxcur;
@@ -239,6 +252,8 @@ struct diybms_eeprom_settings
   bool mqtt_enabled;
   // Only report basic cell data (voltage and temperture) over MQTT
   bool mqtt_basic_cell_reporting;
+  // Publish cell data as one message per bank, instead of one per cell
+  bool mqtt_bank_payloads;
   char mqtt_uri[128 + 1];
   char mqtt_topic[32 + 1];
   char mqtt_username[32 + 1];
@@ -251,11 +266,15 @@ struct diybms_eeprom_settings
   char influxdb_apitoken[128 + 1];
   char influxdb_orgid[128 + 1];
   uint8_t influxdb_loggingFreqSeconds;
+  // Compress uploads with gzip (Content-Encoding: gzip)
+  bool influxdb_gzip;
 
   // Holds a bit pattern indicating which "tiles" are visible on the web gui
   uint16_t tileconfig[5];
 
   uint8_t canbus_equipment_addr;  // battery index on the same canbus for PYLONFORCE, 0 - 15, default 0
+  // Several controllers on the same canbus present one combined battery (canbus_multipack.h)
+  bool canbus_multipack;
   char homeassist_apikey[24+1];
 };
 
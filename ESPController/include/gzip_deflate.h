@@ -0,0 +1,24 @@
+#ifndef gzip_deflate_H_
+#define gzip_deflate_H_
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Small gzip (RFC 1952) compressor for text payloads which are already held in RAM.
+// Uses LZ77 with a single entry hash table and the fixed Huffman codes from RFC 1951,
+// which suits repetitive text (such as InfluxDB line protocol) without the ~300KB
+// of working memory that a full zlib/miniz compressor needs.
+
+// Entries in the hash table (must be a power of 2), uses 2 bytes each
+#define GZIP_HASH_SIZE 4096
+// Input must be smaller than this, positions are held in 16 bits
+#define GZIP_MAXIMUM_INPUT 65535
+
+/// @brief Compress input into a complete gzip stream
+/// @param hashTable working memory of GZIP_HASH_SIZE entries, provided by the caller
+/// @return Length of the gzip stream, zero if it didn't fit in the output buffer
+size_t gzip_compress(const uint8_t *input, size_t length, uint8_t *output, size_t outputLen, uint16_t *hashTable);
+
+#endif
@@ -9,6 +9,7 @@ static constexpr const char *const TAG = "diybms-hist";
 #include "defines.h"
 #include "Rules.h"
 #include "circular_buffer.hpp"
+#include "json_writer.hpp"
 #include <esp_http_server.h>
 
 class History
@@ -103,202 +104,120 @@ public:
             h[i] = historic_readings.peek(i);
         }
 
-        int bufferused = 0;
+        httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLenMax);
 
-        // TIME
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "{\"time\":[");
+        json.beginObject();
+
+        json.beginArray("time");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%ld", h[i].historic_time);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt64(h[i].historic_time);
         }
+        json.endArray();
 
-        // stateofcharge
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"stateofcharge\":[");
+        json.beginArray("stateofcharge");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%.2f", h[i].stateofcharge);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addFloat(h[i].stateofcharge, 2);
         }
+        json.endArray();
 
-        // voltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"voltage\":[");
+        json.beginArray("voltage");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%.2f", h[i].voltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addFloat(h[i].voltage, 2);
         }
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
-
-        // voltrange
-        bufferused = 0;
+        json.endArray();
 
-        // milliamphour_in
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"milliamphour_in\":[");
+        json.beginArray("milliamphour_in");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].milliamphour_in);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].milliamphour_in);
         }
+        json.endArray();
 
-        // milliamphour_out
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"milliamphour_out\":[");
+        json.beginArray("milliamphour_out");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].milliamphour_out);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].milliamphour_out);
         }
+        json.endArray();
 
-        // current
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"current\":[");
+        json.beginArray("current");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%.4f", h[i].current);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addFloat(h[i].current);
         }
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
-
-        // voltrange
-        bufferused = 0;
+        json.endArray();
 
-        // highestExternalTemp
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestExternalTemp\":[");
+        json.beginArray("highestExternalTemp");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%i", h[i].highestExternalTemp);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addInt(h[i].highestExternalTemp);
         }
+        json.endArray();
 
-        // lowestExternalTemp
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"lowestExternalTemp\":[");
+        json.beginArray("lowestExternalTemp");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%i", h[i].lowestExternalTemp);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addInt(h[i].lowestExternalTemp);
         }
+        json.endArray();
 
-        // lowestBankVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"lowestBankVoltage\":[");
+        json.beginArray("lowestBankVoltage");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].lowestBankVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].lowestBankVoltage);
         }
+        json.endArray();
 
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
-
-        // voltrange
-        bufferused = 0;
-
-        // HighestBankVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestBankVoltage\":[");
+        json.beginArray("highestBankVoltage");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].highestBankVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].highestBankVoltage);
         }
+        json.endArray();
 
-        // HighestBankRange
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestBankRange\":[");
+        json.beginArray("highestBankRange");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].highestBankRange);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].highestBankRange);
         }
-        // highestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestCellVoltage\":[");
+        json.endArray();
+
+        json.beginArray("highestCellVoltage");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].highestCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].highestCellVoltage);
         }
-        // Address highestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"address_HighCellV\":[");
+        json.endArray();
+
+        json.beginArray("address_HighCellV");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].address_HighCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].address_HighCellVoltage);
         }
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
+        json.endArray();
 
-        // voltrange
-        bufferused = 0;
-
-        // lowestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"lowestCellVoltage\":[");
+        json.beginArray("lowestCellVoltage");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].lowestCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].lowestCellVoltage);
         }
+        json.endArray();
 
-        // Address highestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"address_LowCellV\":[");
+        json.beginArray("address_LowCellV");
         for (uint16_t i = 0; i < size; i++)
         {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].address_LowCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
+            json.addUInt(h[i].address_LowCellVoltage);
         }
+        json.endArray();
 
-        // Closing tag
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "]}");
-
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
+        json.endObject();
 
         free(h);
 
-        // Indicate last chunk (zero byte length)
-        return httpd_resp_send_chunk(req, buffer, 0);
+        return json.finish();
     }
 };
 
@@ -4,11 +4,62 @@
 #pragma once
 
 #include "defines.h"
+#include "Rules.h"
+#include "store_forward.h"
+#include "gzip_deflate.h"
+
+// Longest line of each measurement written by influx_format_sample, largest value of every field
+#define INFLUX_TIMESTAMP_MAXIMUM " 4294967295"
+#define INFLUX_FLOAT_MAXIMUM "-340282346638528859811704183484516925440.0000"
+#define INFLUX_CELL_LINE_MAXIMUM (sizeof("cells,cell=15_127 v=65.5350,i=-128i,e=-128i,b=false" INFLUX_TIMESTAMP_MAXIMUM "\n") - 1)
+#define INFLUX_BANK_LINE_MAXIMUM (sizeof("banks,bank=15 v=4294967.2950,r=65535i" INFLUX_TIMESTAMP_MAXIMUM "\n") - 1)
+#define INFLUX_CURRENT_LINE_MAXIMUM (sizeof("current v=" INFLUX_FLOAT_MAXIMUM ",c=" INFLUX_FLOAT_MAXIMUM ",p=" INFLUX_FLOAT_MAXIMUM \
+                                            ",soc=" INFLUX_FLOAT_MAXIMUM ",in=4294967295i,out=4294967295i" INFLUX_TIMESTAMP_MAXIMUM "\n") - 1)
+#define INFLUX_RULES_LINE_MAXIMUM (sizeof("rules active=255i" INFLUX_TIMESTAMP_MAXIMUM "\n") - 1 + RELAY_RULES * (sizeof(",r16=false") - 1))
+
+// Line protocol of the largest snapshot (every cell and bank, current and rules)
+#define INFLUX_SAMPLE_MAXIMUM (maximum_controller_cell_modules * INFLUX_CELL_LINE_MAXIMUM + \
+                               maximum_number_of_banks * INFLUX_BANK_LINE_MAXIMUM +         \
+                               INFLUX_CURRENT_LINE_MAXIMUM + INFLUX_RULES_LINE_MAXIMUM)
+
+// Holds one complete snapshot, so a sample is never dropped for being too large (vsnprintf needs the terminator)
+#define INFLUX_BUFFER_SIZE 10240
+static_assert(INFLUX_BUFFER_SIZE > INFLUX_SAMPLE_MAXIMUM, "Line buffer can't hold the largest sample");
+// Compressed output, line protocol is typically 4:1 so anything larger is sent uncompressed
+#define INFLUX_GZIP_BUFFER_SIZE 4096
+static_assert(INFLUX_BUFFER_SIZE < GZIP_MAXIMUM_INPUT, "Line buffer too large to compress");
+
+// RAM used to hold samples during an outage, before they spill to SD/LittleFS
+#define INFLUX_REPLAY_RAM_SIZE 8192
+// Maximum stored samples sent after each live write, in as many POSTs as the line buffer needs
+#define INFLUX_REPLAY_BATCH 4
+
+struct influx_write_stats
+{
+    uint32_t writes;
+    uint32_t failures;
+    uint32_t last_bytes;
+    uint32_t last_latency_ms;
+    uint32_t max_latency_ms;
+    uint32_t average_latency_ms;
+    uint64_t total_bytes;
+    // Compression, bytes before and after
+    uint32_t gzip_batches;
+    uint32_t gzip_fallbacks;
+    uint64_t gzip_bytes_in;
+    uint64_t gzip_bytes_out;
+    uint64_t gzip_time_us;
+};
 
 void influx_task_action();
+void influx_settings_changed();
+void influx_get_stats(influx_write_stats *stats);
+void influx_get_sf_stats(store_forward_stats *stats);
 
 extern uint8_t TotalNumberOfCells();
 extern diybms_eeprom_settings mysettings;
 extern bool wifi_isconnected;
+extern Rules rules;
+extern currentmonitoring_struct currentMonitor;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,399 @@
+#ifndef JSON_WRITER_HPP_
+#define JSON_WRITER_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+/// Output for json_writer which sends each full buffer as part of an HTTP chunked response
+class httpd_chunk_sink
+{
+public:
+  explicit httpd_chunk_sink(httpd_req_t *req) : req_(req) {}
+
+  esp_err_t write(const char *data, size_t length)
+  {
+    bytes_sent() += length;
+    return httpd_resp_send_chunk(req_, data, length);
+  }
+
+  esp_err_t finish(const char *data, size_t length)
+  {
+    if (length > 0)
+    {
+      esp_err_t err = write(data, length);
+      if (err != ESP_OK)
+      {
+        return err;
+      }
+    }
+    // Zero length chunk indicates end of response
+    return httpd_resp_send_chunk(req_, nullptr, 0);
+  }
+
+  /// Running total of bytes passed to httpd by every chunk sink.  Only the httpd task
+  /// writes to it, so the difference before/after a handler is the size of its response.
+  static uint32_t &bytes_sent()
+  {
+    static uint32_t total = 0;
+    return total;
+  }
+
+private:
+  httpd_req_t *req_;
+};
+
+/// Output for json_writer where the whole document must fit inside the buffer (for example a websocket frame)
+class fixed_buffer_sink
+{
+public:
+  esp_err_t write(const char *, size_t) { return ESP_ERR_NO_MEM; }
+  // Output is left in the buffer for the caller
+  esp_err_t finish(const char *, size_t) { return ESP_OK; }
+};
+
+/// Streaming JSON writer, emits directly into a fixed size buffer which is passed to
+/// TSink::write each time it fills.  No heap allocation and output is never truncated,
+/// commas between values are tracked automatically.
+///
+/// Values inside an object need a name, values inside an array use the overloads without one.
+template <class TSink>
+class json_writer
+{
+public:
+  json_writer(TSink sink, char *buffer, size_t bufferLen) : sink_(sink), buffer_(buffer), bufferLen_(bufferLen) {}
+
+  void beginObject() { beginContainer(nullptr, '{'); }
+  void beginObject(const char *name) { beginContainer(name, '{'); }
+  void endObject() { endContainer('}'); }
+
+  void beginArray() { beginContainer(nullptr, '['); }
+  void beginArray(const char *name) { beginContainer(name, '['); }
+  void endArray() { endContainer(']'); }
+
+  void addUInt(uint32_t value)
+  {
+    separator();
+    writeUnsigned(value);
+  }
+  void addUInt(const char *name, uint32_t value)
+  {
+    key(name);
+    writeUnsigned(value);
+  }
+
+  void addInt(int32_t value)
+  {
+    separator();
+    writeSigned(value);
+  }
+  void addInt(const char *name, int32_t value)
+  {
+    key(name);
+    writeSigned(value);
+  }
+
+  void addUInt64(uint64_t value)
+  {
+    separator();
+    writeUnsigned(value);
+  }
+  void addUInt64(const char *name, uint64_t value)
+  {
+    key(name);
+    writeUnsigned(value);
+  }
+
+  void addFloat(float value, uint8_t decimals = 4)
+  {
+    separator();
+    writeFloat(value, decimals);
+  }
+  void addFloat(const char *name, float value, uint8_t decimals = 4)
+  {
+    key(name);
+    writeFloat(value, decimals);
+  }
+
+  void addBool(bool value)
+  {
+    separator();
+    write(value ? "true" : "false");
+  }
+  void addBool(const char *name, bool value)
+  {
+    key(name);
+    write(value ? "true" : "false");
+  }
+
+  void addString(const char *value)
+  {
+    separator();
+    writeString(value);
+  }
+  void addString(const char *name, const char *value)
+  {
+    key(name);
+    writeString(value);
+  }
+
+  void addNull()
+  {
+    separator();
+    write("null");
+  }
+  void addNull(const char *name)
+  {
+    key(name);
+    write("null");
+  }
+
+  /// Output JSON which has already been formatted, no validation is performed
+  void addRaw(const char *name, const char *json, size_t length)
+  {
+    key(name);
+    write(json, length);
+  }
+
+  /// Continue the value started by addRaw, allows large values to be streamed in pieces
+  void appendRaw(const char *json, size_t length) { write(json, length); }
+
+  /// Sends any remaining buffered output and ends the response
+  /// @return First error reported by the sink
+  esp_err_t finish()
+  {
+    if (result_ == ESP_OK)
+    {
+      result_ = sink_.finish(buffer_, used_);
+    }
+    used_ = 0;
+    return result_;
+  }
+
+  /// Sends any buffered output, but does not end the response
+  void flush()
+  {
+    if (used_ > 0 && result_ == ESP_OK)
+    {
+      result_ = sink_.write(buffer_, used_);
+    }
+    used_ = 0;
+  }
+
+  /// @return Number of bytes currently in the buffer (not yet sent to the sink)
+  size_t buffered() const { return used_; }
+  /// @return Total number of bytes generated
+  size_t length() const { return total_; }
+  /// @return ESP_OK unless the sink has reported an error
+  esp_err_t result() const { return result_; }
+
+private:
+  TSink sink_;
+  char *buffer_;
+  size_t bufferLen_;
+  size_t used_ = 0;
+  size_t total_ = 0;
+  esp_err_t result_ = ESP_OK;
+
+  // One bit per nesting level, set once the container has a value (so needs a comma before the next)
+  uint32_t hasValue_ = 0;
+  uint8_t depth_ = 0;
+
+  void separator()
+  {
+    uint32_t bit = 1U << depth_;
+    if (hasValue_ & bit)
+    {
+      put(',');
+    }
+    hasValue_ |= bit;
+  }
+
+  void key(const char *name)
+  {
+    separator();
+    writeString(name);
+    put(':');
+  }
+
+  void beginContainer(const char *name, char c)
+  {
+    if (name == nullptr)
+    {
+      separator();
+    }
+    else
+    {
+      key(name);
+    }
+    put(c);
+    depth_++;
+    hasValue_ &= ~(1U << depth_);
+  }
+
+  void endContainer(char c)
+  {
+    put(c);
+    hasValue_ &= ~(1U << depth_);
+    depth_--;
+  }
+
+  void put(char c)
+  {
+    if (used_ == bufferLen_)
+    {
+      flush();
+    }
+    if (result_ == ESP_OK)
+    {
+      buffer_[used_++] = c;
+      total_++;
+    }
+  }
+
+  void write(const char *s, size_t length)
+  {
+    while (length > 0 && result_ == ESP_OK)
+    {
+      if (used_ == bufferLen_)
+      {
+        flush();
+        continue;
+      }
+      size_t n = bufferLen_ - used_;
+      if (n > length)
+      {
+        n = length;
+      }
+      memcpy(&buffer_[used_], s, n);
+      used_ += n;
+      total_ += n;
+      s += n;
+      length -= n;
+    }
+  }
+
+  void write(const char *s) { write(s, strlen(s)); }
+
+  /// Output the result of snprintf, which returns the length it wanted rather than what fitted
+  void writeTemp(const char *temp, int n, size_t size)
+  {
+    if (n < 0)
+    {
+      // Encoding error
+      write("null");
+      return;
+    }
+    if ((size_t)n >= size)
+    {
+      n = size - 1;
+    }
+    write(temp, n);
+  }
+
+  template <typename T>
+  void writeFormatted(const char *format, T value)
+  {
+    char temp[24];
+    int n = snprintf(temp, sizeof(temp), format, value);
+    writeTemp(temp, n, sizeof(temp));
+  }
+
+  /// Integers are converted directly, snprintf is much slower for the common case of a few digits.
+  /// Templated so 32 bit values don't use 64 bit division.
+  template <typename T>
+  void writeUnsigned(T value)
+  {
+    // Longest uint64 has 20 digits
+    char temp[20];
+    char *p = &temp[sizeof(temp)];
+    do
+    {
+      *--p = (char)('0' + (uint8_t)(value % 10));
+      value /= 10;
+    } while (value != 0);
+    write(p, &temp[sizeof(temp)] - p);
+  }
+
+  void writeSigned(int32_t value)
+  {
+    if (value < 0)
+    {
+      put('-');
+      // Negate as unsigned so INT32_MIN works
+      writeUnsigned(0U - (uint32_t)value);
+      return;
+    }
+    writeUnsigned((uint32_t)value);
+  }
+
+  void writeFloat(float value, uint8_t decimals)
+  {
+    if (isnan(value) || isinf(value))
+    {
+      // Not valid JSON
+      write("null");
+      return;
+    }
+    // Large enough for every float up to 8 decimal places
+    char temp[52];
+    int n = snprintf(temp, sizeof(temp), "%.*f", decimals, value);
+    if (n >= (int)sizeof(temp))
+    {
+      // Too many decimals requested, use the exponent form which always fits
+      n = snprintf(temp, sizeof(temp), "%.*e", decimals > 8 ? 8 : decimals, value);
+    }
+    writeTemp(temp, n, sizeof(temp));
+  }
+
+  void writeString(const char *s)
+  {
+    if (s == nullptr)
+    {
+      write("null");
+      return;
+    }
+
+    put('"');
+    while (*s)
+    {
+      char c = *s++;
+      switch (c)
+      {
+      case '"':
+        write("\\\"", 2);
+        break;
+      case '\\':
+        write("\\\\", 2);
+        break;
+      case '\n':
+        write("\\n", 2);
+        break;
+      case '\r':
+        write("\\r", 2);
+        break;
+      case '\t':
+        write("\\t", 2);
+        break;
+      default:
+        if ((uint8_t)c < 0x20)
+        {
+          writeFormatted("\\u%04x", (unsigned int)c);
+        }
+        else
+        {
+          put(c);
+        }
+      }
+    }
+    put('"');
+  }
+};
+
+typedef json_writer<httpd_chunk_sink> httpd_json_writer;
+
+#endif
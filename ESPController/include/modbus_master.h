@@ -0,0 +1,61 @@
+#ifndef DIYBMS_MODBUS_MASTER_H_
+#define DIYBMS_MODBUS_MASTER_H_
+
+#include "defines.h"
+#include "HAL_ESP32.h"
+#include <driver/uart.h>
+
+// MODBUS RTU master for the RS485 port (external current monitors, PZEM-017).
+// Requests are queued by modbus_send_request and sent back to back by modbus_master_task.
+// The UART raises a receive timeout event once the line has been idle for
+// MODBUS_RX_TIMEOUT_SYMBOLS characters (the t3.5 end of frame gap), so a reply is processed
+// as soon as it has ended rather than after a fixed delay.  Requests without a valid reply
+// are retried MODBUS_RETRIES times.
+
+// Number of bytes of the largest MODBUS request we make (including CRC)
+#define MODBUS_MAX_REQUEST_LENGTH 36
+// Depth of the request queue
+#define MODBUS_REQUEST_QUEUE_LENGTH 8
+// Longest modbus_send_request waits for space in a full queue, a device which has stopped
+// replying takes around 0.5 seconds per request with the retries
+#define MODBUS_REQUEST_QUEUE_TIMEOUT_MS 1000
+// Time allowed for the device to start replying, added to the transmission times
+#define MODBUS_RESPONSE_TIMEOUT_MS 150
+#define MODBUS_RETRIES 2
+// Idle time (in characters) which ends a frame, rounded up from 3.5
+#define MODBUS_RX_TIMEOUT_SYMBOLS 4
+// Number of different slave addresses to keep statistics for (CURRENTMON_MAXIMUM plus broadcast/spare)
+#define MODBUS_MAXIMUM_DEVICES 10
+
+// Called with a reply which has passed the CRC check and matches the request
+typedef void (*modbus_reply_handler)(const uint8_t *frame, uint16_t length);
+// Called when a request has failed after all retries, or the device replied with an exception
+typedef void (*modbus_failed_handler)(uint8_t address);
+
+struct modbus_device_stats
+{
+    uint8_t address;
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t retries;
+    // Requests which failed after all retries
+    uint32_t failed;
+    uint32_t timeouts;
+    uint32_t crc_errors;
+    // Exception replies (function code with the top bit set)
+    uint32_t exceptions;
+    // Start of the request to the end of the reply
+    uint32_t last_rtt_us;
+    uint32_t average_rtt_us;
+    uint32_t max_rtt_us;
+};
+
+void modbus_master_begin(uart_port_t port, QueueHandle_t uart_events, modbus_reply_handler reply, modbus_failed_handler failed);
+bool modbus_send_request(const uint8_t *cmd, size_t size);
+[[noreturn]] void modbus_master_task(void *);
+uint16_t calculateCRC(const uint8_t *f, uint8_t bufferSize);
+uint8_t modbus_get_stats(modbus_device_stats *list, uint8_t listSize);
+
+extern HAL_ESP32 hal;
+
+#endif
@@ -7,10 +7,77 @@
 #include "Rules.h"
 #include "PacketRequestGenerator.h"
 #include "PacketReceiveProcessor.h"
+#include "store_forward.h"
+#include "mqtt_format.h"
 
 #include <mqtt_client.h>
 #define MQTT_SUSCRIBE_TOPIC "setparameter"
 
+// Cell data is only published when it changes by at least this much...
+#define MQTT_CELL_DEADBAND_MV 5
+#define MQTT_CELL_DEADBAND_TEMPERATURE 1
+// ...or hasn't been published for this long
+#define MQTT_CELL_KEEPALIVE_SECONDS 300
+
+// Number of cell messages sent per call to mqtt1 adapts between these limits
+#define MQTT_CELL_BUDGET_MIN 4
+#define MQTT_CELL_BUDGET_MAX 32
+#define MQTT_CELL_BUDGET_STEP 4
+
+// Flow control, based on the number of bytes waiting in the esp-mqtt outbox.
+// Above REDUCED, low priority (detailed cell) messages are dropped and cells are sent less often,
+// above CRITICAL only status/rule/output messages are sent. Nothing is queued beyond MAXIMUM.
+#define MQTT_OUTBOX_RESUME_BYTES 2048
+#define MQTT_OUTBOX_REDUCED_BYTES 8192
+#define MQTT_OUTBOX_CRITICAL_BYTES 16384
+#define MQTT_OUTBOX_MAXIMUM_BYTES 32768
+
+enum mqtt_priority : uint8_t
+{
+    MQTT_PRIORITY_LOW = 0,
+    MQTT_PRIORITY_NORMAL = 1,
+    MQTT_PRIORITY_HIGH = 2
+};
+
+enum mqtt_flow_state : uint8_t
+{
+    MQTT_FLOW_NORMAL = 0,
+    MQTT_FLOW_REDUCED = 1,
+    MQTT_FLOW_CRITICAL = 2
+};
+
+// Size of the MQTT client output buffer when packed bank messages are enabled
+#define MQTT_BANK_OUT_BUFFER_SIZE 4096
+
+// While the broker can't be reached a sample is stored every N calls to mqtt1 (every 30 seconds),
+// once reconnected one stored sample is published to TOPIC/replay per call (if the outbox isn't busy)
+#define MQTT_STORE_EVERY_CALLS 6
+#define MQTT_REPLAY_RAM_SIZE 4096
+// Replay JSON for 128 cells and 16 banks
+#define MQTT_REPLAY_PAYLOAD_SIZE 1920
+
+struct mqtt_publish_stats
+{
+    uint32_t cells_published;
+    uint32_t cells_suppressed;
+    uint32_t cells_failed;
+    uint8_t cell_budget;
+    uint32_t bank_messages;
+    uint32_t bank_too_large;
+    mqtt_flow_state flow_state;
+    uint32_t outbox_bytes;
+    uint32_t outbox_high_water;
+    uint16_t outbox_pending;
+    uint16_t outbox_pending_high_water;
+    uint32_t dropped_low;
+    uint32_t dropped_normal;
+    uint32_t dropped_high;
+    uint32_t publish_count;
+    uint64_t publish_time_us;
+    uint16_t connections;
+    uint16_t disconnections;
+};
+
 void stopMqtt();
 void connectToMqtt();
 void mqtt3(const Rules *rules,const RelayState *previousRelayState);
@@ -22,6 +89,9 @@ void mqtt1(const currentmonitoring_struct *currentMonitor,const Rules *rules);
 void GeneralStatusPayload(const PacketRequestGenerator *prg, const PacketReceiveProcessor *receiveProc, uint16_t requestq_count,const Rules *rules);
 void BankLevelInformation(const Rules *rules);
 void RuleStatus(const Rules *rules);
+void mqtt_get_stats(mqtt_publish_stats *stats);
+void mqtt_get_sf_stats(store_forward_stats *stats);
+void mqtt_bank_snapshot();
 
 
 extern uint8_t TotalNumberOfCells();
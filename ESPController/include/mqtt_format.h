@@ -0,0 +1,52 @@
+#ifndef DIYBMS_MQTT_FORMAT_H_
+#define DIYBMS_MQTT_FORMAT_H_
+
+#pragma once
+
+#include "defines.h"
+#include "json_writer.hpp"
+
+// Topic and payload formatting for mqtt.cpp, kept apart from the esp-mqtt client so it also builds on the host
+
+// Longest topic, allows for the 32 character prefix plus "/modbus_A255" etc.
+#define MQTT_TOPIC_LENGTH (32 + 16)
+// Payloads are formatted into fixed buffers of these sizes
+#define MQTT_PAYLOAD_ARENA_SIZE 512
+#define MQTT_RULE_PAYLOAD_ARENA_SIZE 192
+
+typedef json_writer<fixed_buffer_sink> mqtt_payload_writer;
+
+// Topics are formatted once (when MQTT connects or the bank configuration changes), not on every publish
+struct mqtt_topic_table
+{
+    char status[MQTT_TOPIC_LENGTH];
+    char rule[MQTT_TOPIC_LENGTH];
+    char output[MQTT_TOPIC_LENGTH];
+    char current[MQTT_TOPIC_LENGTH];
+    uint8_t current_address;
+    char bank[maximum_number_of_banks][MQTT_TOPIC_LENGTH];
+    char cells[maximum_number_of_banks][MQTT_TOPIC_LENGTH];
+    char replay[MQTT_TOPIC_LENGTH];
+};
+
+// Per cell topics TOPIC/BANK/MODULE, packed into a single allocation sized for the current configuration
+struct mqtt_cell_topic_table
+{
+    char *arena;
+    uint16_t offset[maximum_controller_cell_modules];
+    uint8_t banks;
+    uint8_t series;
+};
+
+void mqtt_format_topics(mqtt_topic_table *topics, const char *prefix, uint8_t current_address);
+void mqtt_format_current_topic(mqtt_topic_table *topics, const char *prefix, uint8_t current_address);
+bool mqtt_format_cell_topics(mqtt_cell_topic_table *table, const char *prefix, uint8_t banks, uint8_t series);
+
+inline const char *mqtt_cell_topic(const mqtt_cell_topic_table &table, uint8_t cell)
+{
+    return &table.arena[table.offset[cell]];
+}
+
+void mqtt_cell_payload(mqtt_payload_writer &json, const CellModuleInfo &cell, bool detail);
+
+#endif
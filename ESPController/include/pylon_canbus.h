@@ -3,8 +3,29 @@
 
 #include "defines.h"
 #include "Rules.h"
+#include "canbus_frames.h"
+#include "canbus_multipack.h"
 #include <driver/twai.h>
 
+// Number of PylonForce H2 replies kept to calculate the reply time percentiles
+#define PYLONFORCE_REPLY_SAMPLES 128
+// Longest wait for a reply burst to leave the transmit queue
+#define PYLONFORCE_REPLY_TIMEOUT_MS 50
+
+struct pylonforce_reply_stats
+{
+    uint32_t requests;
+    // Reply frames which could not be queued, or were not in the frame cache
+    uint32_t failed_frames;
+    // Reply still in the transmit queue after PYLONFORCE_REPLY_TIMEOUT_MS
+    uint32_t timeouts;
+    // Request received to last reply frame sent
+    uint32_t last_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+};
+
 void pylon_message_356();
 void pylon_message_35e();
 void pylon_message_351();
@@ -13,23 +34,24 @@ void pylon_message_359();
 void pylon_message_35c();
 
 
-void pylonHV_message_0x4210(bool extend);
-void pylonHV_message_0x4220(bool extend);
-void pylonHV_message_0x4230(bool extend);
-void pylonHV_message_0x4240(bool extend);
-void pylonHV_message_0x4250(bool extend);
-void pylonHV_message_0x4260(bool extend);
-void pylonHV_message_0x4270(bool extend);
-void pylonHV_message_0x4280(bool extend);
-void pylonHV_message_0x4290(bool extend);
-void pylonHV_message_0x42A0(bool extend);
+void pylonHV_message_0x4210();
+void pylonHV_message_0x4220();
+void pylonHV_message_0x4230();
+void pylonHV_message_0x4240();
+void pylonHV_message_0x4250();
+void pylonHV_message_0x4260();
+void pylonHV_message_0x4270();
+void pylonHV_message_0x4280();
+void pylonHV_message_0x4290();
+void pylonHV_message_0x42A0();
 
-void pylonHV_message_0x7320(bool extend);
-void pylonHV_message_0x7330_0x7340(bool extend);
-void pylonHV_message_0x7310(bool extend);
+void pylonHV_message_0x7320();
+void pylonHV_message_0x7330_0x7340();
+void pylonHV_message_0x7310();
 
-void pylonHV_send_message_info(bool extend);
-void pylonHV_send_message_status(bool extend);
+void pylonHV_send_message_info(bool extend, int64_t received_us);
+void pylonHV_send_message_status(bool extend, int64_t received_us);
+void pylonHV_get_reply_stats(pylonforce_reply_stats *stats);
 
 
 extern uint8_t TotalNumberOfCells();
@@ -42,6 +64,5 @@ extern uint32_t canbus_messages_failed_sent;
 extern uint32_t canbus_messages_sent;
 extern uint32_t canbus_messages_received;
 
-extern void send_canbus_message(uint32_t identifier, const uint8_t *buffer,const uint8_t length);
 
 #endif
\ No newline at end of file
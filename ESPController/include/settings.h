@@ -5,6 +5,7 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "Rules.h"
+#include "coulomb_counter.h"
 
 #include "ArduinoJson.h"
 bool ValidateGetSetting(esp_err_t err, const char *key);
@@ -30,6 +31,9 @@ void DefaultConfiguration(diybms_eeprom_settings *settings);
 void SaveWIFI(const wifi_eeprom_settings *wifi);
 bool LoadWIFI(wifi_eeprom_settings *wifi);
 
+void SaveCoulombCounter(const coulomb_counter *counter);
+bool LoadCoulombCounter(coulomb_counter *counter);
+
 void GenerateSettingsJSONDocument(DynamicJsonDocument *doc, diybms_eeprom_settings *settings);
 void JSONToSettings(DynamicJsonDocument &doc, diybms_eeprom_settings *settings);
 
@@ -0,0 +1,146 @@
+#ifndef store_forward_H_
+#define store_forward_H_
+
+#pragma once
+
+#include "defines.h"
+#include "Rules.h"
+#include "HAL_ESP32.h"
+#include "FS.h"
+
+// Samples of the BMS state are kept while InfluxDB/MQTT can't be reached, and sent once the network returns.
+// Records go into a RAM ring buffer first, once that is full they are appended to a spill file
+// on the SD card (or LittleFS if no card is fitted).
+
+// Largest record, 128 cells and 16 banks
+#define SF_MAX_RECORD_SIZE (sizeof(sf_sample_header) + maximum_number_of_banks * sizeof(sf_sample_bank) + maximum_controller_cell_modules * sizeof(sf_sample_cell))
+
+// Maximum size of the spill file
+#define SF_SPILL_MAX_BYTES_SD (4UL * 1024UL * 1024UL)
+#define SF_SPILL_MAX_BYTES_LITTLEFS (128UL * 1024UL)
+
+struct __attribute__((packed)) sf_sample_header
+{
+    // Seconds since epoch
+    uint32_t timestamp;
+    uint8_t banks;
+    uint8_t series;
+    // Bit 0 = current monitor readings valid
+    uint8_t flags;
+    uint8_t active_rules;
+    // Bit per rule outcome
+    uint32_t rules;
+    float current_voltage;
+    float current_amps;
+    float current_power;
+    float stateofcharge;
+    uint32_t milliamphour_in;
+    uint32_t milliamphour_out;
+};
+
+struct __attribute__((packed)) sf_sample_bank
+{
+    uint32_t voltagemV;
+    uint16_t rangemV;
+};
+
+struct __attribute__((packed)) sf_sample_cell
+{
+    uint16_t voltagemV;
+    int8_t internalTemp;
+    int8_t externalTemp;
+    // Bit 0 = valid, bit 1 = in bypass
+    uint8_t flags;
+};
+
+#define SF_FLAG_CURRENT_VALID 0x01
+#define SF_CELL_VALID 0x01
+#define SF_CELL_BYPASS 0x02
+
+/// @brief Pointers into a sample record
+struct sf_sample_view
+{
+    sf_sample_header header;
+    const sf_sample_bank *banks;
+    const sf_sample_cell *cells;
+};
+
+struct store_forward_stats
+{
+    // Records waiting (RAM + spill file)
+    uint32_t depth;
+    uint32_t ram_bytes;
+    uint32_t spill_bytes;
+    uint32_t spill_records;
+    uint32_t stored;
+    uint32_t dropped;
+    uint32_t replayed;
+    uint32_t replayed_bytes;
+    uint32_t replay_ms;
+};
+
+/// @brief Bounded FIFO of variable length records, RAM first then a spill file
+class store_forward_queue
+{
+public:
+    store_forward_queue(const char *filename, size_t ramSize) : filename_(filename), ramSize_(ramSize) {}
+
+    /// @brief Add a record to the end of the queue
+    /// @return false if the queue is full (record is dropped)
+    bool push(const uint8_t *data, uint16_t length);
+
+    /// @brief Copy a waiting record, without removing it
+    /// @param index 0 is the oldest record
+    /// @return Length of the record, zero if there is no such record
+    uint16_t peek(uint8_t index, uint8_t *buffer, uint16_t bufferLen);
+
+    /// @brief Remove the oldest records, once they have been sent
+    void pop(uint8_t count, uint32_t bytes, uint32_t milliseconds);
+
+    bool empty() const { return ramRecords_ == 0 && fileRecords_ == 0; }
+
+    void getStats(store_forward_stats *stats) const;
+
+private:
+    const char *filename_;
+    size_t ramSize_;
+
+    uint8_t *ram_ = nullptr;
+    size_t ramHead_ = 0;
+    size_t ramUsed_ = 0;
+    uint32_t ramRecords_ = 0;
+
+    bool fileOnSD_ = false;
+    uint32_t fileRecords_ = 0;
+    uint32_t fileBytes_ = 0;
+    uint32_t fileReadOffset_ = 0;
+    bool fileChecked_ = false;
+
+    uint32_t stored_ = 0;
+    uint32_t dropped_ = 0;
+    uint32_t replayed_ = 0;
+    uint32_t replayedBytes_ = 0;
+    uint32_t replayMs_ = 0;
+
+    void ramRead(size_t offset, uint8_t *data, size_t length) const;
+    void ramWrite(size_t offset, const uint8_t *data, size_t length);
+    bool filePush(const uint8_t *data, uint16_t length);
+    uint16_t filePeek(uint8_t index, uint8_t *buffer, uint16_t bufferLen);
+    void filePop(uint8_t count);
+    fs::FS *lockFileSystem(bool onSD);
+    void unlockFileSystem(bool onSD);
+    void fileReset();
+};
+
+uint16_t sf_capture_sample(uint8_t *buffer, uint16_t bufferLen);
+bool sf_decode_sample(const uint8_t *buffer, uint16_t length, sf_sample_view *view);
+
+extern uint8_t TotalNumberOfCells();
+extern diybms_eeprom_settings mysettings;
+extern Rules rules;
+extern currentmonitoring_struct currentMonitor;
+extern HAL_ESP32 hal;
+extern bool _sd_card_installed;
+extern avrprogramsettings _avrsettings;
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "defines.h"
 #include "Rules.h"
+#include "canbus_frames.h"
+#include "canbus_multipack.h"
 #include <driver/twai.h>
 
 void victron_message_370_371();
@@ -16,7 +18,6 @@ void victron_message_373();
 void victron_message_35f();
 void victron_message_374_375_376_377();
 
-extern void send_canbus_message(uint32_t identifier, const uint8_t *buffer,const uint8_t length);
 
 extern uint8_t TotalNumberOfCells();
 extern Rules rules;
@@ -0,0 +1,80 @@
+#ifndef DIYBMSWebServer_Assets_H_
+#define DIYBMSWebServer_Assets_H_
+
+#pragma once
+
+#include <esp_http_server.h>
+#include "json_writer.hpp"
+
+// Static web files (javascript, css and images) are held in the "www" data partition instead of
+// being compiled into the firmware, so they can be updated separately and keep the OTA image small.
+// The image is built by prebuild_generate_web_partition.py, the partition is memory mapped and
+// files are sent straight from flash without copying.
+//
+// Layout: web_assets_header, web_assets_entry[count] sorted by path, then the file data
+
+#define WEB_ASSETS_MAGIC 0x57575744
+#define WEB_ASSETS_VERSION 1
+#define WEB_ASSETS_PARTITION_SUBTYPE 0x40
+
+#define WEB_ASSETS_PATH_LENGTH 32
+#define WEB_ASSETS_ETAG_LENGTH 20
+
+// Files larger than this are sent as several chunks
+#define WEB_ASSETS_CHUNK_SIZE 8192
+
+// Bit set in web_assets_entry.flags when the file is gzip compressed
+#define WEB_ASSETS_FLAG_GZIP 0x01
+
+enum class web_assets_mimetype : uint8_t
+{
+    text_css = 0,
+    application_javascript = 1,
+    image_x_icon = 2,
+    image_png = 3
+};
+
+struct __attribute__((packed)) web_assets_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    // Bytes following this header (index and file data)
+    uint32_t data_length;
+    // CRC32 of the bytes following this header
+    uint32_t crc32;
+};
+static_assert(sizeof(web_assets_header) == 16, "web_assets_header must be 16 bytes");
+
+struct __attribute__((packed)) web_assets_entry
+{
+    // Null terminated, for example "/pagecode.js"
+    char path[WEB_ASSETS_PATH_LENGTH];
+    // Offset from the start of the partition
+    uint32_t offset;
+    uint32_t length;
+    // Null terminated, including the quotes
+    char etag[WEB_ASSETS_ETAG_LENGTH];
+    web_assets_mimetype mimetype;
+    uint8_t flags;
+    uint16_t reserved;
+};
+static_assert(sizeof(web_assets_entry) == 64, "web_assets_entry must be 64 bytes");
+
+struct web_assets_stats
+{
+    uint32_t served;
+    uint32_t not_modified;
+    uint32_t not_found;
+    uint64_t bytes_sent;
+    uint32_t uploads;
+};
+
+bool web_assets_partition_present();
+bool web_assets_init();
+bool web_assets_valid();
+esp_err_t web_assets_send(httpd_req_t *req);
+esp_err_t web_assets_upload_handler(httpd_req_t *req);
+void writeWebAssetStats(httpd_json_writer &json);
+
+#endif
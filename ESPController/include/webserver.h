@@ -34,6 +34,7 @@ void stop_webserver(httpd_handle_t server);
 
 void saveConfiguration();
 void setNoStoreCacheControl(httpd_req_t *req);
+void SetCacheAndETag(httpd_req_t *req, const char *ETag);
 
 esp_err_t SendSuccess(httpd_req_t *req);
 esp_err_t SendFailure(httpd_req_t *req);
@@ -0,0 +1,47 @@
+#ifndef DIYBMSWebServer_Buffer_Pool_H_
+#define DIYBMSWebServer_Buffer_Pool_H_
+
+#pragma once
+
+#include <esp_http_server.h>
+#include "defines.h"
+
+// Number of BUFSIZE buffers shared by HTTP requests being handled at the same time
+#define HTTP_BUFFER_POOL_SIZE 3
+
+struct http_buffer_pool_stats
+{
+    /// @brief Total number of buffers handed out
+    uint32_t acquired;
+    /// @brief Requests rejected with 503 because every buffer was in use
+    uint32_t exhausted;
+    uint8_t in_use;
+    /// @brief Highest number of buffers in use at the same time
+    uint8_t max_in_use;
+};
+
+/// @brief Borrows a buffer from the pool for the lifetime of a single request,
+/// it is returned to the pool when the object goes out of scope.
+/// Never blocks, check the object is valid before use.
+class http_buffer
+{
+public:
+    http_buffer();
+    ~http_buffer();
+
+    http_buffer(const http_buffer &) = delete;
+    http_buffer &operator=(const http_buffer &) = delete;
+
+    explicit operator bool() const { return data_ != nullptr; }
+    char *data() const { return data_; }
+    size_t size() const { return BUFSIZE; }
+
+private:
+    char *data_;
+    int8_t index_;
+};
+
+esp_err_t http_buffer_send_busy(httpd_req_t *req);
+void http_buffer_pool_get_stats(http_buffer_pool_stats *stats);
+
+#endif
@@ -18,7 +18,7 @@ bool GetKeyValue(const char *buffer, const char *key, uint32_t *value, bool urlE
 bool GetKeyValue(const char *buffer, const char *key, float *value, bool urlEncoded);
 bool GetKeyValue(const char *buffer, const char *key, bool *value, bool urlEncoded);
 
-bool getPostDataIntoBuffer(httpd_req_t *req);
+bool getPostDataIntoBuffer(httpd_req_t *req, char *buffer, size_t bufferLen);
 void url_decode(char *str, char *buf);
 char from_hex(char ch);
 
@@ -34,6 +34,4 @@ void setCookie(httpd_req_t *req);
 esp_err_t httpd_req_get_cookie_val(httpd_req_t *req, const char *cookie_name, char *val, size_t *val_size);
 esp_err_t httpd_cookie_key_value(const char *cookie_str, const char *key, char *val, size_t *val_size);
 
-extern char httpbuf[BUFSIZE];
-
 #endif
\ No newline at end of file
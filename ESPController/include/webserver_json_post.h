@@ -27,6 +27,7 @@ extern avrprogramsettings _avrsettings;
 extern wifi_eeprom_settings _wificonfig;
 
 extern void stopMqtt();
+extern void influx_settings_changed();
 extern void ConfigureRS485();
 extern bool CurrentMonitorSetSOC(float value);
 extern bool CurrentMonitorResetDailyAmpHourCounters();
@@ -40,36 +41,36 @@ extern void DefaultConfiguration(diybms_eeprom_settings *_myset);
 extern bool SaveWIFIJson(const wifi_eeprom_settings* setting);
 extern void randomCharacters(char *value, int length);
 
-esp_err_t post_savebankconfig_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_saventp_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savemqtt_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_saveglobalsetting_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_restartcontroller_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_saveinfluxdbsetting_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_saveconfigurationtoflash_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savewificonfigtosdcard_json_handler(httpd_req_t *req, bool);
-esp_err_t post_savesetting_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savestorage_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_visibletiles_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savedisplaysetting_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_resetcounters_json_handler(httpd_req_t *req, bool);
-esp_err_t post_sdmount_json_handler(httpd_req_t *req, bool);
-esp_err_t post_sdunmount_json_handler(httpd_req_t *req, bool);
-esp_err_t post_enableavrprog_json_handler(httpd_req_t *req, bool);
-esp_err_t post_disableavrprog_json_handler(httpd_req_t *req, bool);
-esp_err_t post_savers485settings_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savechargeconfig_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savecmrelay_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_setsoc_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_setBattCyclesCount_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_resetdailyahcount_json_handler(httpd_req_t *req, bool);
-esp_err_t post_savecmbasic_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savecmadvanced_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_avrprog_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_savecurrentmon_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_restoreconfig_json_handler(httpd_req_t *req, bool urlEncoded);
-esp_err_t post_homeassistant_apikey_json_handler(httpd_req_t *req, bool urlEncoded);
+esp_err_t post_savebankconfig_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_saventp_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savemqtt_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_saveglobalsetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_restartcontroller_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_saveinfluxdbsetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_saveconfigurationtoflash_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savewificonfigtosdcard_json_handler(httpd_req_t *req, char *, size_t, bool);
+esp_err_t post_savesetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savestorage_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_visibletiles_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savedisplaysetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_resetcounters_json_handler(httpd_req_t *req, char *, size_t, bool);
+esp_err_t post_sdmount_json_handler(httpd_req_t *req, char *, size_t, bool);
+esp_err_t post_sdunmount_json_handler(httpd_req_t *req, char *, size_t, bool);
+esp_err_t post_enableavrprog_json_handler(httpd_req_t *req, char *, size_t, bool);
+esp_err_t post_disableavrprog_json_handler(httpd_req_t *req, char *, size_t, bool);
+esp_err_t post_savers485settings_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savechargeconfig_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savecmrelay_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_setsoc_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_setBattCyclesCount_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_resetdailyahcount_json_handler(httpd_req_t *req, char *, size_t, bool);
+esp_err_t post_savecmbasic_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savecmadvanced_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_avrprog_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_savecurrentmon_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_saverules_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_restoreconfig_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
+esp_err_t post_homeassistant_apikey_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded);
 esp_err_t save_data_handler(httpd_req_t *req);
 
 #endif
@@ -21,13 +21,42 @@
 
 #include "CurrentMonitorINA229.h"
 #include "history.h"
+#include "json_writer.hpp"
+
+// Cached /ha response, 16 banks of 16 modules
+#define HA_CACHE_SIZE 4096
+
+// Header of the /api/monitorbin response, all values are little endian
+#define API_MODULE_DATA_VERSION 1
+struct __attribute__((packed)) api_module_data_header
+{
+  uint8_t version;
+  // Size of this header, newer versions may add fields to the end
+  uint8_t header_length;
+  uint8_t banks;
+  uint8_t series;
+  // Incremented each time all the modules have been read
+  uint32_t generation;
+  uint32_t uptime;
+  uint16_t modules;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(api_module_data_header) == 16, "api_module_data_header must be 16 bytes");
 
 esp_err_t api_handler(httpd_req_t *req);
 esp_err_t content_handler_downloadfile(httpd_req_t *req);
 esp_err_t ha_handler(httpd_req_t *req);
 
-esp_err_t SendFileInChunks(httpd_req_t *req, FS &filesystem, const char *filename);
-int fileSystemListDirectory(char *buffer, size_t bufferLen, fs::FS &fs, const char *dirname, uint8_t levels);
+esp_err_t SendFileInChunks(httpd_req_t *req, FS &filesystem, const char *filename, char *buffer, size_t bufferLen);
+void fileSystemListDirectory(httpd_json_writer &json, fs::FS &fs, const char *dirname);
+void writeApiRouteStats(httpd_json_writer &json);
+void writeHomeAssistantStats(httpd_json_writer &json);
+void api_scan_completed();
+template <class TSink>
+void writeMonitorSummary(json_writer<TSink> &json);
+template <class TSink>
+void writeBankSummary(json_writer<TSink> &json);
 
 extern diybms_eeprom_settings mysettings;
 extern PacketRequestGenerator prg;
@@ -0,0 +1,37 @@
+#ifndef DIYBMSWebServer_Metrics_H_
+#define DIYBMSWebServer_Metrics_H_
+
+#pragma once
+
+#include <esp_http_server.h>
+#include "defines.h"
+#include "Rules.h"
+#include "PacketRequestGenerator.h"
+#include "PacketReceiveProcessor.h"
+
+// Largest number of tasks reported by GetTaskStackInfo
+#define MAXIMUM_REPORTED_TASKS 24
+
+struct task_stack_info
+{
+    const char *name;
+    uint32_t hwm;
+};
+
+esp_err_t metrics_handler(httpd_req_t *req);
+
+extern diybms_eeprom_settings mysettings;
+extern PacketRequestGenerator prg;
+extern PacketReceiveProcessor receiveProc;
+extern Rules rules;
+extern currentmonitoring_struct currentMonitor;
+extern RelayState previousRelayState[RELAY_TOTAL];
+
+extern uint32_t canbus_messages_received;
+extern uint32_t canbus_messages_sent;
+extern uint32_t canbus_messages_failed_sent;
+extern uint32_t canbus_messages_received_error;
+
+extern uint8_t GetTaskStackInfo(task_stack_info *list, uint8_t listSize);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef DIYBMSWebServer_Websocket_H_
+#define DIYBMSWebServer_Websocket_H_
+
+#pragma once
+
+#include <esp_http_server.h>
+#include "defines.h"
+
+// Maximum number of browsers receiving live telemetry at the same time
+#define WEBSOCKET_MAX_TELEMETRY_CLIENTS 4
+
+struct websocket_telemetry_stats
+{
+    uint32_t frames_sent;
+    uint32_t bytes_sent;
+    uint32_t full_updates;
+    uint32_t delta_updates;
+    /// @brief Updates not sent because the client had not acknowledged the previous one
+    uint32_t backpressure_skipped;
+    uint32_t send_failures;
+    uint8_t clients;
+};
+
+esp_err_t ws_handler(httpd_req_t *req);
+void websocket_telemetry_snapshot();
+void websocket_telemetry_get_stats(websocket_telemetry_stats *stats);
+
+extern httpd_handle_t _myserver;
+extern diybms_eeprom_settings mysettings;
+
+#endif
@@ -9,6 +9,11 @@ import hashlib
 
 Import("env")
 
+def embed_web_assets():
+    # Build with -DDIYBMS_EMBED_WEB_ASSETS to compile every web file into the firmware (no www partition)
+    build_flags = env.ParseFlags(env['BUILD_FLAGS'])
+    return 'DIYBMS_EMBED_WEB_ASSETS' in [x if type(x) == str else x[0] for x in build_flags.get('CPPDEFINES')]
+
 def prepare_embedded_files(data_dir, include_dir, filenamePrefix):
     #This routine takes every file in the web_temp folder and converts
     #to a byte array suitable for embedding into flash to avoid using SPIFF or LITTLEFS
@@ -21,6 +26,11 @@ def prepare_embedded_files(data_dir, include_dir, filenamePrefix):
  
     all_files = glob.glob(os.path.join(data_dir, '*.*'))
 
+    if embed_web_assets() == False:
+        # Static files are served from the www partition (prebuild_generate_web_partition.py),
+        # only the page template needs to be part of the firmware
+        all_files = [x for x in all_files if os.path.basename(x) == 'default.htm']
+
     sha1sum = hashlib.sha1()
 
     with open(os.path.join(include_dir,filenamePrefix+'_Blobs.h'), 'w') as blobs,  open(os.path.join(include_dir,filenamePrefix+'.h'), 'w') as f:
@@ -0,0 +1,109 @@
+""" prebuild_generate_web_partition for DIYBMS """
+import os
+import sys
+import glob
+import struct
+import hashlib
+import zlib
+
+Import("env")
+
+# Must match include/web_assets.h
+WEB_ASSETS_MAGIC = 0x57575744
+WEB_ASSETS_VERSION = 1
+HEADER_FORMAT = "<IHHII"
+ENTRY_FORMAT = "<32sII20sBBH"
+
+MIME_TYPES = {'.css': 0, '.js': 1, '.ico': 2, '.png': 3}
+
+
+def partition_fields(csv_file, name):
+    with open(csv_file, 'r') as f:
+        for line in f:
+            fields = [x.strip() for x in line.split('#')[0].split(',')]
+            if len(fields) >= 5 and fields[0] == name:
+                return fields
+    raise Exception("Partition {} not found in {}".format(name, csv_file))
+
+
+def partition_offset(csv_file, name):
+    return partition_fields(csv_file, name)[3]
+
+
+def partition_size(csv_file, name):
+    return int(partition_fields(csv_file, name)[4], 0)
+
+
+def prepare_web_partition(data_dir, output_file):
+    # Packs the static web files (already gzipped by prebuild_compress.py) into a single
+    # image for the "www" data partition, so they are not compiled into the firmware.
+    # default.htm is not included, it is processed as a template by the firmware.
+
+    print('prebuild_generate_web_partition.py')
+
+    assets = []
+    for file in glob.glob(os.path.join(data_dir, '*.*')):
+        name = os.path.basename(file)
+        gzip = name.endswith('.gz')
+        path = '/' + (name[:-3] if gzip else name)
+        extension = os.path.splitext(path)[1]
+        if extension not in MIME_TYPES:
+            continue
+
+        with open(file, 'rb') as source:
+            data = source.read()
+
+        if len(path) >= 32:
+            raise Exception("Path too long {}".format(path))
+
+        etag = '"' + hashlib.sha1(data).hexdigest()[:8] + '"'
+        assets.append((path, data, etag, MIME_TYPES[extension], 1 if gzip else 0))
+
+    # Sorted, so the firmware can use a binary search
+    assets.sort(key=lambda a: a[0].encode())
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+    offset = header_size + entry_size * len(assets)
+
+    index = b''
+    data = b''
+    for (path, content, etag, mime, flags) in assets:
+        print("Packing {} {} bytes".format(path, len(content)))
+        index += struct.pack(ENTRY_FORMAT, path.encode(), offset + len(data), len(content), etag.encode(), mime, flags, 0)
+        data += content
+        # Keep each file word aligned
+        data += b'\0' * (-len(data) % 4)
+
+    body = index + data
+    header = struct.pack(HEADER_FORMAT, WEB_ASSETS_MAGIC, WEB_ASSETS_VERSION, len(assets), len(body), zlib.crc32(body) & 0xFFFFFFFF)
+
+    os.makedirs(os.path.dirname(output_file), exist_ok=True)
+    with open(output_file, 'wb') as f:
+        f.write(header + body)
+
+    print("Web partition image {} bytes".format(len(header) + len(body)))
+
+
+def check_image_sizes(source, target, env):
+    # The app slots shrank (0x1B0000 to 0x180000) to make room for the www partition,
+    # fail the build rather than produce a firmware which can't be flashed or updated
+    for (image, name) in [(target[0].get_abspath(), 'app0'), (output_file, 'www')]:
+        size = os.path.getsize(image)
+        limit = partition_size(partitions_csv, name)
+        print("{} {} bytes, {} partition {} bytes ({:.1f}% used)".format(os.path.basename(image), size, name, limit, 100.0 * size / limit))
+        if size > limit:
+            sys.stderr.write("Error: {} is {} bytes larger than the {} partition\n".format(image, size - limit, name))
+            env.Exit(1)
+
+
+project_dir = env.get('PROJECT_DIR')
+partitions_csv = os.path.join(project_dir, 'diybms_partitions.csv')
+output_file = os.path.join(env.subst("$BUILD_DIR"), "www.bin")
+
+prepare_web_partition(os.path.join(project_dir, 'web_temp'), output_file)
+
+# Flashed alongside the firmware on USB upload, for OTA upload the file via the web page
+env.Append(FLASH_EXTRA_IMAGES=[(partition_offset(partitions_csv, 'www'), output_file)])
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", check_image_sizes)
@@ -71,18 +71,56 @@ void CurrentMonitorINA229::CalculateLSB()
     // registers.R_SHUNT_CAL = ((uint32_t)registers.R_SHUNT_CAL * 985) / 1000;
 }
 
-// Sets SOC by setting "fake" in/out amphour counts
+// Conversion time in microseconds for the VBUSCT/VSHCT/VTCT fields of ADC_CONFIG
+static const uint16_t conversion_time_us[8] = {50, 84, 150, 280, 540, 1052, 2074, 4120};
+// Number of samples for the AVG field of ADC_CONFIG
+static const uint16_t averaging_count[8] = {1, 4, 16, 64, 128, 256, 512, 1024};
+
+// Integer copies of the settings used by TakeReadings, so each reading avoids float maths
+void CurrentMonitorINA229::CalculateFixedPoint()
+{
+    current_lsb_nA = (uint32_t)(registers.CURRENT_LSB * 1000000000.0F + 0.5F);
+    vbus_divider = (uint32_t)registers.vbus_divider;
+    fully_charged_mV = (int32_t)(registers.fully_charged_voltage * 1000.0F + 0.5F);
+    tail_current_mA = (int32_t)(registers.tail_current_amps * 1000.0F + 0.5F);
+    charge_efficiency_x100 = (uint32_t)(registers.charge_efficiency_factor * 100.0F + 0.5F);
+
+    uint16_t adc = registers.R_ADC_CONFIG;
+    uint32_t single = conversion_time_us[(adc >> 9) & B111] + conversion_time_us[(adc >> 6) & B111] + conversion_time_us[(adc >> 3) & B111];
+    conversion_us = single * averaging_count[adc & B111];
+
+    ESP_LOGI(TAG, "CURRENT_LSB=%u nA, conversion period=%u us", current_lsb_nA, conversion_us);
+}
+
+// Sets SOC by moving the reference point of the coulomb counter, the Ah counts are not changed
 // value=8212 = 82.12%
 void CurrentMonitorINA229::SetSOC(uint16_t value)
 {
-    // Assume battery is fully charged
-    milliamphour_in = 1000 * (uint32_t)registers.batterycapacity_amphour;
-    // And we have consumed this much...
-    milliamphour_out = (uint32_t)((1.0F - ((float)value / 10000.0F)) * milliamphour_in);
-
-    // Zero out readings using the offsets
-    milliamphour_out_offset = milliamphour_out;
-    milliamphour_in_offset = milliamphour_in;
+    portENTER_CRITICAL(&counter_lock);
+    coulomb_counter_calibrate(&counter, CapacityInNanoCoulombs(), value);
+    portEXIT_CRITICAL(&counter_lock);
+}
+
+void CurrentMonitorINA229::ResetDailyAmpHourCounters()
+{
+    portENTER_CRITICAL(&counter_lock);
+    coulomb_counter_reset_daily(&counter);
+    portEXIT_CRITICAL(&counter_lock);
+}
+
+void CurrentMonitorINA229::GetCoulombCounter(coulomb_counter *copy)
+{
+    portENTER_CRITICAL(&counter_lock);
+    *copy = counter;
+    portEXIT_CRITICAL(&counter_lock);
+}
+
+void CurrentMonitorINA229::RestoreCoulombCounter(const coulomb_counter *saved)
+{
+    portENTER_CRITICAL(&counter_lock);
+    counter = *saved;
+    portEXIT_CRITICAL(&counter_lock);
+    SOC = CalculateSOC();
 }
 
 uint8_t CurrentMonitorINA229::readRegisterValue(INA_REGISTER r) const
@@ -150,34 +188,6 @@ uint32_t CurrentMonitorINA229::spi_readUint24(INA_REGISTER r)
     return value;
 }
 
-int64_t CurrentMonitorINA229::spi_readInt40(INA_REGISTER r)
-{
-    SPI_Ptr->beginTransaction(_spisettings);
-    digitalWrite(chipselectpin, LOW);
-    SPI_Ptr->write(readRegisterValue(r));
-    uint8_t a = SPI_Ptr->transfer(0);
-    uint8_t b = SPI_Ptr->transfer(0);
-    uint8_t c = SPI_Ptr->transfer(0);
-    uint8_t d = SPI_Ptr->transfer(0);
-    uint8_t e = SPI_Ptr->transfer(0);
-    digitalWrite(chipselectpin, HIGH);
-    SPI_Ptr->endTransaction();
-
-    // Check if a twos compliment negative number
-    uint64_t reply = (a & 0x80) ? (uint64_t)0xFFFFFF0000000000 : 0;
-
-    reply += (uint64_t)a << 32;
-    reply += (uint64_t)b << 24;
-    reply += (uint64_t)c << 16;
-    reply += (uint64_t)d << 8;
-    reply += (uint64_t)e;
-
-    // ESP_LOGD(TAG, "Read register 0x%02x");
-
-    // Cast to signed integer (which also sorts out the negative sign if applicable)
-    return (int64_t)reply;
-}
-
 uint64_t CurrentMonitorINA229::spi_readUint40(INA_REGISTER r)
 {
     SPI_Ptr->beginTransaction(_spisettings);
@@ -201,6 +211,21 @@ uint64_t CurrentMonitorINA229::spi_readUint40(INA_REGISTER r)
     return value;
 }
 
+// Reads a single register inside an SPI transaction already started by the caller
+// data receives the register value, MSB first
+void CurrentMonitorINA229::spi_readFrame(INA_REGISTER r, uint8_t *data, uint8_t length)
+{
+    uint8_t frame[6];
+    assert(length < sizeof(frame));
+
+    frame[0] = readRegisterValue(r);
+    memset(&frame[1], 0, length);
+    digitalWrite(chipselectpin, LOW);
+    SPI_Ptr->transfer(frame, length + 1);
+    digitalWrite(chipselectpin, HIGH);
+    memcpy(data, &frame[1], length);
+}
+
 // Read a 24 bit (3 byte) unsigned integer into a uint32 (including right shift 4 bits)
 uint32_t CurrentMonitorINA229::readUInt24(INA_REGISTER r)
 {
@@ -214,16 +239,6 @@ float CurrentMonitorINA229::Energy()
     return 16.0F * 3.2F * registers.CURRENT_LSB * energy;
 }
 
-// Charge in Coulombs.
-// The raw value is 40 bit, but we frequently reset this back to zero so it prevents
-// overflow and keeps inside the int32 limits
-// NEGATIVE value means battery is being charged
-int32_t CurrentMonitorINA229::ChargeInCoulombsAsInt()
-{
-    // Calculated charge output. Output value is in Coulombs.Two's complement value.  40bit number stored in int64
-    return registers.CURRENT_LSB * (float)spi_readInt40(INA_REGISTER::CHARGE);
-}
-
 // Bus voltage output. Two's complement value, however always positive.  Value in bits 23 to 4
 float CurrentMonitorINA229::BusVoltage()
 {
@@ -270,124 +285,197 @@ float CurrentMonitorINA229::ShuntVoltage()
     return (float)(((int64_t)vshunt) * 78125UL) / 1000000000.0;
 }
 
-void CurrentMonitorINA229::TakeReadings()
+void CurrentMonitorINA229::TakeReadings(int64_t alert_us)
 {
-    voltage = BusVoltage();
-    current = Current();
-    power = Power();
+    uint8_t vbus[3];
+    uint8_t cur[3];
+    uint8_t pwr[3];
+    uint8_t dietemp[2];
+    uint8_t charge[5];
+    uint8_t diag[2];
+
+    // The INA229 doesn't auto increment the register address, so each register needs its own
+    // chip select frame, but they are sent back to back in one SPI transaction
+    int64_t start = esp_timer_get_time();
+    SPI_Ptr->beginTransaction(_spisettings);
+    spi_readFrame(INA_REGISTER::VBUS, vbus, sizeof(vbus));
+    spi_readFrame(INA_REGISTER::CURRENT, cur, sizeof(cur));
+    spi_readFrame(INA_REGISTER::POWER, pwr, sizeof(pwr));
+    spi_readFrame(INA_REGISTER::DIETEMP, dietemp, sizeof(dietemp));
+    spi_readFrame(INA_REGISTER::CHARGE, charge, sizeof(charge));
+    // Reading DIAG_ALRT clears CNVRF, which releases the ALERT pin ready for the next conversion
+    spi_readFrame(INA_REGISTER::DIAG_ALRT, diag, sizeof(diag));
+    SPI_Ptr->endTransaction();
+    int64_t end = esp_timer_get_time();
+
+    diag_alrt_value = ((uint16_t)diag[0] << 8) | diag[1];
+
+    // Bus voltage, 20 bits in bits 23 to 4, always positive. 195.3125uV is the LSB
+    uint32_t busVoltage = ((((uint32_t)vbus[0] << 16) | ((uint32_t)vbus[1] << 8) | vbus[2]) >> 4) & 0x000FFFFF;
+    voltage_mV = (int32_t)(((uint64_t)busVoltage * (uint64_t)0x1DCD65 / (uint64_t)0x989680) * vbus_divider);
+
+    // Current, 20 bit two's complement in bits 23 to 4 (shift up to bit 31 then back down to keep the sign)
+    // In the way this circuit is designed, NEGATIVE current indicates DISCHARGE of the battery
+    // POSITIVE current indicates CHARGE of the battery
+    int32_t rawcurrent = (int32_t)((((uint32_t)cur[0] << 24) | ((uint32_t)cur[1] << 16) | ((uint32_t)cur[2] << 8))) >> 12;
+    current_mA = -(int32_t)(((int64_t)rawcurrent * current_lsb_nA) / 1000000);
+
+    // POWER Power [W] = 3.2 x CURRENT_LSB x POWER
+    uint32_t rawpower = ((uint32_t)pwr[0] << 16) | ((uint32_t)pwr[1] << 8) | pwr[2];
+    power_mW = (int32_t)(((uint64_t)rawpower * current_lsb_nA * 16 / 5 / 1000000) * vbus_divider);
 
     // https://github.com/stuartpittaway/diyBMSv4ESP32/issues/240
     // INA229 is reported to have poor calculation of power at low levels
     // this workaround overrides the power value below 200W
-    auto pow_val = voltage * abs(current);
-    ESP_LOGD(TAG, "V=%.4f, I=%.4f, P=%.2f, Calc_P=%.2f", voltage, current, power, pow_val);
-    if (pow_val < 200) { power = pow_val; }
+    int32_t calc_power_mW = (int32_t)(((int64_t)voltage_mV * abs(current_mA)) / 1000);
+    ESP_LOGD(TAG, "V=%i mV, I=%i mA, P=%i mW, Calc_P=%i mW", voltage_mV, current_mA, power_mW, calc_power_mW);
+    if (calc_power_mW < 200000)
+    {
+        power_mW = calc_power_mW;
+    }
+
+    // Two's complement value. Conversion factor: 7.8125 m°C/LSB
+    temperature_raw = (int16_t)(((uint16_t)dietemp[0] << 8) | dietemp[1]);
+
+    // Charge, 40 bit two's complement, shifted up to bit 63 and back down to keep the sign
+    uint64_t rawcharge = ((uint64_t)charge[0] << 32) | ((uint64_t)charge[1] << 24) | ((uint64_t)charge[2] << 16) | ((uint64_t)charge[3] << 8) | charge[4];
 
-    temperature = DieTemperature();
+    CalculateAmpHourCounts(((int64_t)(rawcharge << 24)) >> 24);
     SOC = CalculateSOC();
-    CalculateAmpHourCounts();
+
+    RecordSample(alert_us, start, end);
 }
 
-uint16_t CurrentMonitorINA229::CalculateSOC() const
+void CurrentMonitorINA229::RecordSample(int64_t alert_us, int64_t start, int64_t end)
 {
-    float milliamphour_in_scaled = ((float)milliamphour_in / 100.0F) * registers.charge_efficiency_factor;
-    float milliamphour_batterycapacity = 1000.0F * (uint32_t)registers.batterycapacity_amphour;
-    float difference = milliamphour_in_scaled - (float)milliamphour_out;
+    portENTER_CRITICAL(&stats_lock);
+    last_sample_us = end;
+
+    ina229_sample_stats &st = sample_stats;
+    st.conversion_us = conversion_us;
+    st.last_spi_us = (uint32_t)(end - start);
+    st.spi_busy_us += st.last_spi_us;
+    if (st.last_spi_us > st.max_spi_us)
+    {
+        st.max_spi_us = st.last_spi_us;
+    }
 
-    float answer = 100 * (difference / milliamphour_batterycapacity);
-    if (answer < 0)
+    if (alert_us == 0)
     {
-        // We have taken more out of the battery than put in, so must be zero SoC (or more likely out of calibration)
-        return 0;
+        st.polled++;
     }
+    else
+    {
+        st.samples++;
+        st.last_latency_us = (uint32_t)(start - alert_us);
+        if (st.last_latency_us > st.max_latency_us)
+        {
+            st.max_latency_us = st.last_latency_us;
+        }
 
-    // Store result as fixed point decimal
-    uint16_t SOC = 100 * answer;
+        if (first_alert_us == 0)
+        {
+            first_alert_us = alert_us;
+        }
+        else
+        {
+            uint32_t interval = (uint32_t)(alert_us - last_alert_us);
+            st.last_interval_us = interval;
 
-    // Add a hard upper limit 999.99%
-    if (SOC > 99999)
-    {
-        SOC = (uint16_t)99999;
+            if (interval > conversion_us + conversion_us / 2)
+            {
+                // One or more conversions completed without being read
+                st.missed += (interval + conversion_us / 2) / conversion_us - 1;
+            }
+            else
+            {
+                if (last_good_interval_us != 0)
+                {
+                    uint32_t jitter = interval > last_good_interval_us ? interval - last_good_interval_us : last_good_interval_us - interval;
+                    jitter_total_us += jitter;
+                    jitter_count++;
+                    st.average_jitter_us = (uint32_t)(jitter_total_us / jitter_count);
+                    if (jitter > st.max_jitter_us)
+                    {
+                        st.max_jitter_us = jitter;
+                    }
+                }
+                last_good_interval_us = interval;
+            }
+        }
+        last_alert_us = alert_us;
     }
+    portEXIT_CRITICAL(&stats_lock);
+}
 
-    return SOC;
+void CurrentMonitorINA229::GetSampleStats(ina229_sample_stats *copy)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *copy = sample_stats;
+    if (sample_stats.samples > 1 && last_alert_us > first_alert_us)
+    {
+        copy->sample_rate_mhz = (uint32_t)(((uint64_t)(sample_stats.samples - 1) * 1000000000ULL) / (uint64_t)(last_alert_us - first_alert_us));
+    }
+    portEXIT_CRITICAL(&stats_lock);
 }
 
-void CurrentMonitorINA229::CalculateAmpHourCounts()
+// State of charge as fixed point (8212 = 82.12%)
+uint16_t CurrentMonitorINA229::CalculateSOC()
 {
-    // We amp-hour count using units of 18 coulombs = 5mAh, to avoid rounding issues
+    portENTER_CRITICAL(&counter_lock);
+    uint16_t value = coulomb_counter_soc(&counter, CapacityInNanoCoulombs(), charge_efficiency_x100);
+    portEXIT_CRITICAL(&counter_lock);
+    return value;
+}
 
+// charge_raw is the sign extended CHARGE register, POSITIVE change means charge taken out of the battery
+void CurrentMonitorINA229::CalculateAmpHourCounts(int64_t charge_raw)
+{
     // If we don't have a voltage reading, ignore the coulombs - also means
     // Ah counting won't work without voltage reading on the INA228 chip
-    if (voltage > 0)
+    if (voltage_mV > 0)
     {
-        int32_t charge_coulombs = ChargeInCoulombsAsInt();
-        int32_t difference = charge_coulombs - last_charge_coulombs;
+        // Difference in 40 bit arithmetic, so a wrap of the CHARGE register still gives the right answer
+        int64_t delta_raw = ((int64_t)((uint64_t)(charge_raw - last_charge_raw) << 24)) >> 24;
+        last_charge_raw = charge_raw;
 
-        // Have we used up more than 5mAh of energy?
-        // if not, ignore for now and await next cycle
-        if (abs(difference) >= 18)
-        {
-            if (difference > 0)
-            {
-                // Amp hour out
-                // Integer divide (18 coulombs)
-                int32_t integer_divide = (difference / 18);
-                // Subtract remainder
-                last_charge_coulombs = charge_coulombs - (difference - (integer_divide * 18));
-                // Chunks of 5mAh
-                uint32_t a = integer_divide * 5;
-                milliamphour_out += a;
-                milliamphour_out_lifetime += a;
-                daily_milliamphour_out += a;
-            }
-            else
-            {
-                // Make it positive, for counting amp hour in
-                difference = abs(difference);
-                int32_t integer_divide = (difference / 18);
-                // Add on remainder
-                last_charge_coulombs = charge_coulombs + (difference - (integer_divide * 18));
-                // chunks of 5mAh
-                uint32_t a = integer_divide * 5;
-                milliamphour_in += a;
-                milliamphour_in_lifetime += a;
-                daily_milliamphour_in += a;
-            }
-        }
+        portENTER_CRITICAL(&counter_lock);
+        coulomb_counter_add(&counter, delta_raw * current_lsb_nA);
+        portEXIT_CRITICAL(&counter_lock);
     }
 
-    // Periodically we need to reset the energy register to prevent it overflowing
-    // if we do this too frequently we get incorrect readings over the long term
-    // 360000 = 100Amp Hour
-    if (abs(last_charge_coulombs) > (int32_t)360000)
+    // Keep the CHARGE register well away from overflow (the CHARGEOF flag), the reading has just been
+    // taken at the end of a conversion so nothing is lost by clearing it now
+    if (llabs(last_charge_raw) > (1LL << 38))
     {
         ResetChargeEnergyRegisters();
-        last_charge_coulombs = 0;
+        last_charge_raw = 0;
     }
 
     // Now to test if we need to reset SOC to 100% ?
     // Check if voltage is over the fully_charged_voltage and current UNDER tail_current_amps
-    if (voltage >= registers.fully_charged_voltage && current > 0 && current < registers.tail_current_amps)
+    if (voltage_mV >= fully_charged_mV && current_mA > 0 && current_mA < tail_current_mA)
     {
-        // Battery has reached fully charged so wait for time counter to elapse
-        ESP_LOGI(TAG,"Battery has reached charging tail period");
-
-        if (esp_timer_get_time() > soc_reset_time)
+        int64_t now = esp_timer_get_time();
+        if (soc_reset_time == 0)
+        {
+            // Battery has reached fully charged so wait 3 minutes for time counter to elapse
+            ESP_LOGI(TAG, "Battery has reached charging tail period");
+            soc_reset_time = now + (3 * 60000000L);
+        }
+        else if (now > soc_reset_time)
         {
-            // Now we reset the SOC, by clearing the registers, at this point SOC returns to 100%
-            // This does have an annoying "feature" of clearing down Ah counts :-(
-            // TODO: FIX THIS - probably need a set of shadow variables to hold the internal SOC and AH counts
-            //                  but then when/how do we reset the Ah counts?
-            ResetChargeEnergyRegisters();
-            last_charge_coulombs = 0;
+            // Now we reset the SOC to 100%, the Ah counts carry on
             SetSOC(10000);
+            SOC = CalculateSOC();
+            // Only once per visit to the tail period
+            soc_reset_time = INT64_MAX;
         }
     }
     else
     {
-        // Voltage or current is out side of monitoring limits, so set timer to now + 3 minutes
-        int64_t soc_reset_time = esp_timer_get_time() + (3 * 60000000L);
+        // Voltage or current is out side of monitoring limits
+        soc_reset_time = 0;
     }
 }
 
@@ -434,8 +522,7 @@ void CurrentMonitorINA229::GuessSOC()
     SetSOC(soc);
 
     // Reset the daily counters
-    daily_milliamphour_in = 0;
-    daily_milliamphour_out = 0;
+    ResetDailyAmpHourCounters();
 }
 
 bool CurrentMonitorINA229::Configure(uint16_t shuntmv,
@@ -464,6 +551,7 @@ bool CurrentMonitorINA229::Configure(uint16_t shuntmv,
     registers.charge_efficiency_factor = chargeefficiency / 100.0;
 
     CalculateLSB();
+    CalculateFixedPoint();
 
     if (shuntcal != 0 && registers.R_SHUNT_CAL != shuntcal)
     {
@@ -280,10 +280,29 @@ void HAL_ESP32::Led(uint8_t bits)
     WriteTCA9534APWROutputState();
 }
 
-void HAL_ESP32::ConfigureCAN(uint16_t canbusbaudrate) const
+/// @brief Install (or reinstall) and start the TWAI driver
+/// @param filter Acceptance filter for the active protocol, see canbus_rx_select
+void HAL_ESP32::ConfigureCAN(uint16_t canbusbaudrate, const twai_filter_config_t &filter) const
 {
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) == ESP_OK)
+    {
+        // Driver is already installed, the acceptance filter can only be changed by reinstalling it
+        if (status.state == twai_state_t::TWAI_STATE_RUNNING)
+        {
+            twai_stop();
+        }
+        if (twai_driver_uninstall() != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to uninstall CAN driver");
+            return;
+        }
+    }
+
     // Initialize configuration structures using macro initializers
     twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(gpio_num_t::GPIO_NUM_16, gpio_num_t::GPIO_NUM_17, TWAI_MODE_NORMAL);
+    // Room for a full round of scheduled messages, so sending never has to wait
+    g_config.tx_queue_len = CANBUS_TX_QUEUE_LENGTH;
 
     twai_timing_config_t t_config;
     if (canbusbaudrate == 250)
@@ -296,23 +315,10 @@ void HAL_ESP32::ConfigureCAN(uint16_t canbusbaudrate) const
         t_config = TWAI_TIMING_CONFIG_500KBITS();
     }
 
-
-    // We need the CAN ids:
-    // * Pylontech LV battery: 0x305, 0x307
-    // * Pylontech Force HV battery: 0x4200, 0x8200, 0x8210
-    // from these ids we _can not_ derive a filter that makes sense, i.e.
-    // twai_filter_config_t f_config = {
-    //    .acceptance_code = 0x305<<21 & 0x307<<21 & 0x4200<<3 & 0x8200<<3 & 0x8210<<3, // 0
-    //    .acceptance_mask = 0x305<<21 | 0x307<<21 | 0x4200<<3 | 0x8200<<3 | 0x8210<<3, // 0x60E61080
-    //    .single_filter = true
-    // };
-    // ----> acceptance_code == 0, so we can only set ALL
-    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
-
     // Install CAN driver
-    if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK)
+    if (twai_driver_install(&g_config, &t_config, &filter) == ESP_OK)
     {
-        ESP_LOGI(TAG, "CAN driver installed.  Filter=%u Mask=%u", f_config.acceptance_code, f_config.acceptance_mask);
+        ESP_LOGI(TAG, "CAN driver installed.  Filter=%u Mask=%u", filter.acceptance_code, filter.acceptance_mask);
     }
     else
     {
@@ -417,6 +423,13 @@ static void ipc_interrupt_attach(void *param)
     attachInterrupt(params->pin, params->handler, FALLING);
 }
 
+// INA229 ALERT pin, pulled low at the end of each conversion (and on limit alerts)
+void HAL_ESP32::AttachINA229Interrupt(void (*INA229Interrupt)(void))
+{
+    isr_param ina229_param = {.pin = INA229_INTERRUPT_PIN, .handler = INA229Interrupt};
+    ipc_interrupt_attach(&ina229_param);
+}
+
 // Attempts connection to i2c device
 esp_err_t HAL_ESP32::Testi2cAddress(i2c_port_t port, uint8_t address)
 {
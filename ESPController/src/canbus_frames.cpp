@@ -0,0 +1,235 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+Outgoing CAN frames, encoded once per rules pass.
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-canframe";
+
+#include "canbus_frames.h"
+#include "victron_canbus.h"
+#include "pylon_canbus.h"
+
+#include <esp_timer.h>
+
+struct can_frame
+{
+  uint32_t identifier;
+  uint8_t length;
+  uint8_t data[8];
+};
+
+struct can_frame_slot
+{
+  can_frame frame;
+  // Frame was produced by the last rebuild
+  bool present;
+  // Payload of the previous send, to count changes
+  uint8_t last_sent_length;
+  uint8_t last_sent[8];
+  can_frame_stats stats;
+};
+
+// Filled by the encoders (rules task only), then copied into the live cache in one go
+static can_frame staging[CANBUS_FRAME_CACHE_SIZE];
+static uint8_t staging_count = 0;
+
+static can_frame_slot slots[CANBUS_FRAME_CACHE_SIZE];
+static uint8_t slot_count = 0;
+static CanBusProtocolEmulation cache_protocol = CanBusProtocolEmulation::CANBUS_DISABLED;
+static can_frame_cache_stats cache_stats = {};
+
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Called by the encoders to store their payload
+void canbus_frame_store(uint32_t identifier, const void *data, uint8_t length)
+{
+  if (staging_count >= CANBUS_FRAME_CACHE_SIZE)
+  {
+    ESP_LOGE(TAG, "Frame cache full 0x%x", identifier);
+    return;
+  }
+
+  can_frame &f = staging[staging_count++];
+  f.identifier = identifier;
+  f.length = length > sizeof(f.data) ? sizeof(f.data) : length;
+  memset(f.data, 0, sizeof(f.data));
+  memcpy(f.data, data, f.length);
+}
+
+static void encode_victron()
+{
+  victron_message_351();
+  victron_message_355();
+  victron_message_356();
+  victron_message_35a();
+  victron_message_35e();
+  victron_message_35f();
+  victron_message_370_371();
+  victron_message_372();
+  victron_message_373();
+  victron_message_374_375_376_377();
+}
+
+static void encode_pylon()
+{
+  pylon_message_351();
+  pylon_message_355();
+  pylon_message_356();
+  pylon_message_359();
+  pylon_message_35c();
+  pylon_message_35e();
+}
+
+static void encode_pylonforce()
+{
+  // Reply to 0x4200 status request
+  pylonHV_message_0x4210();
+  pylonHV_message_0x4220();
+  pylonHV_message_0x4230();
+  pylonHV_message_0x4240();
+  pylonHV_message_0x4250();
+  pylonHV_message_0x4260();
+  pylonHV_message_0x4270();
+  pylonHV_message_0x4280();
+  pylonHV_message_0x4290();
+  pylonHV_message_0x42A0();
+  // Reply to 0x4200 information request
+  pylonHV_message_0x7310();
+  pylonHV_message_0x7320();
+  pylonHV_message_0x7330_0x7340();
+}
+
+/// @brief Encode every frame of the active protocol, run after the rules have been processed
+void canbus_frames_rebuild()
+{
+  int64_t start = esp_timer_get_time();
+  CanBusProtocolEmulation protocol = mysettings.canbusprotocol;
+
+  staging_count = 0;
+  switch (protocol)
+  {
+  case CanBusProtocolEmulation::CANBUS_VICTRON:
+    encode_victron();
+    break;
+  case CanBusProtocolEmulation::CANBUS_PYLONTECH:
+    encode_pylon();
+    break;
+  case CanBusProtocolEmulation::CANBUS_PYLONFORCEH2:
+    encode_pylonforce();
+    break;
+  default:
+    break;
+  }
+
+  portENTER_CRITICAL(&cache_lock);
+  if (protocol != cache_protocol)
+  {
+    // Start again, including the statistics
+    memset(slots, 0, sizeof(slots));
+    slot_count = 0;
+    cache_protocol = protocol;
+  }
+
+  for (uint8_t i = 0; i < slot_count; i++)
+  {
+    slots[i].present = false;
+  }
+
+  for (uint8_t n = 0; n < staging_count; n++)
+  {
+    uint8_t i = 0;
+    while (i < slot_count && slots[i].frame.identifier != staging[n].identifier)
+    {
+      i++;
+    }
+    if (i == slot_count)
+    {
+      if (slot_count == CANBUS_FRAME_CACHE_SIZE)
+      {
+        continue;
+      }
+      slot_count++;
+      slots[i].stats.identifier = staging[n].identifier;
+    }
+    slots[i].frame = staging[n];
+    slots[i].present = true;
+  }
+  portEXIT_CRITICAL(&cache_lock);
+
+  uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+  cache_stats.rebuilds++;
+  cache_stats.last_rebuild_us = elapsed;
+  if (elapsed > cache_stats.max_rebuild_us)
+  {
+    cache_stats.max_rebuild_us = elapsed;
+  }
+}
+
+/// @brief Sends the cached payload for identifier
+/// @param address CAN identifier to send the frame with
+/// @return ESP_ERR_NOT_FOUND if the frame isn't available (for example 0x355 without a current monitor),
+/// ESP_FAIL if it couldn't be queued
+esp_err_t canbus_frame_send(uint32_t identifier, uint32_t address)
+{
+  can_frame frame;
+  int16_t index = -1;
+
+  portENTER_CRITICAL(&cache_lock);
+  for (uint8_t i = 0; i < slot_count; i++)
+  {
+    if (slots[i].frame.identifier == identifier && slots[i].present)
+    {
+      frame = slots[i].frame;
+      index = i;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&cache_lock);
+
+  if (index < 0)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  if (!send_canbus_message(address, frame.data, frame.length))
+  {
+    return ESP_FAIL;
+  }
+
+  // Statistics only count frames which were queued, compared against what was actually sent
+  portENTER_CRITICAL(&cache_lock);
+  can_frame_slot &slot = slots[index];
+  if (slot.stats.identifier == identifier)
+  {
+    slot.stats.sent++;
+    if (slot.last_sent_length != frame.length || memcmp(slot.last_sent, frame.data, frame.length) != 0)
+    {
+      slot.stats.changed++;
+      slot.last_sent_length = frame.length;
+      memcpy(slot.last_sent, frame.data, frame.length);
+    }
+  }
+  portEXIT_CRITICAL(&cache_lock);
+
+  return ESP_OK;
+}
+
+uint8_t canbus_frames_get_stats(can_frame_stats *list, uint8_t listSize, can_frame_cache_stats *cache)
+{
+  uint8_t count = 0;
+  portENTER_CRITICAL(&cache_lock);
+  for (uint8_t i = 0; i < slot_count && count < listSize; i++)
+  {
+    list[count++] = slots[i].stats;
+  }
+  *cache = cache_stats;
+  portEXIT_CRITICAL(&cache_lock);
+  return count;
+}
@@ -0,0 +1,349 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+Aggregation of several battery packs (one controller each) on a shared CAN bus.
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-multipack";
+
+#include "canbus_multipack.h"
+#include "canbus_transport.h"
+
+#include <esp_timer.h>
+
+struct multipack_peer
+{
+  multipack_summary summary;
+  int64_t received_us;
+  bool alive;
+};
+
+static multipack_peer peers[MULTIPACK_MAXIMUM_PACKS];
+// This controller, written by multipack_update, sent by multipack_service
+static multipack_summary local = {};
+static multipack_stats stats = {};
+
+// Only used by the rules task (multipack_update and the frame encoders)
+static multipack_summary combined = {};
+static bool combined_active = false;
+
+static bool master = true;
+
+static int64_t next_send_us = 0;
+static int64_t load_window_start_us = 0;
+static uint32_t load_window_frames = 0;
+
+static portMUX_TYPE multipack_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Limits and state of this pack, the same logic as the 0x351 (Victron/Pylontech) messages
+static void local_summary(multipack_summary *s)
+{
+  memset(s, 0, sizeof(multipack_summary));
+  s->lowest_cell_mv = rules.lowestCellVoltage;
+  s->highest_cell_mv = rules.highestCellVoltage;
+
+  if (_controller_state == ControllerState::Running)
+  {
+    s->flags |= MULTIPACK_FLAG_RUNNING;
+  }
+
+  if (rules.IsChargeAllowed(&mysettings) && !(rules.numberOfBalancingModules > 0 && mysettings.stopchargebalance == true))
+  {
+    s->charge_current = rules.DynamicChargeCurrent();
+  }
+
+  if (rules.IsDischargeAllowed(&mysettings))
+  {
+    s->discharge_current = mysettings.dischargecurrent;
+  }
+
+  if (mysettings.currentMonitoringEnabled && currentMonitor.validReadings && (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS || mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL))
+  {
+    s->soc = (uint8_t)rules.StateOfChargeWithRulesApplied(&mysettings, currentMonitor.stateofcharge);
+    s->flags |= MULTIPACK_FLAG_SOC_VALID;
+  }
+}
+
+static void encode(const multipack_summary &s, uint8_t *data)
+{
+  // Current limits are sent with 1A resolution
+  uint32_t charge = s.charge_current / 10;
+  uint32_t discharge = s.discharge_current / 10;
+  uint32_t currents = (charge > 0x3FF ? 0x3FF : charge) | ((discharge > 0x3FF ? 0x3FF : discharge) << 10);
+
+  data[0] = s.lowest_cell_mv & 0xFF;
+  data[1] = s.lowest_cell_mv >> 8;
+  data[2] = s.highest_cell_mv & 0xFF;
+  data[3] = s.highest_cell_mv >> 8;
+  data[4] = s.soc;
+  data[5] = (s.flags & 0x0F) | ((currents & 0x0F) << 4);
+  data[6] = (currents >> 4) & 0xFF;
+  data[7] = (currents >> 12) & 0xFF;
+}
+
+static void decode(const uint8_t *data, multipack_summary *s)
+{
+  uint32_t currents = (data[5] >> 4) | ((uint32_t)data[6] << 4) | ((uint32_t)data[7] << 12);
+
+  s->lowest_cell_mv = data[0] | (data[1] << 8);
+  s->highest_cell_mv = data[2] | (data[3] << 8);
+  s->soc = data[4];
+  s->flags = data[5] & 0x0F;
+  s->charge_current = (currents & 0x3FF) * 10;
+  s->discharge_current = ((currents >> 10) & 0x3FF) * 10;
+}
+
+/// @brief Refresh this pack's summary and combine it with the other packs, run after the rules (rules_task)
+void multipack_update()
+{
+  multipack_summary own;
+  local_summary(&own);
+
+  if (!mysettings.canbus_multipack)
+  {
+    portENTER_CRITICAL(&multipack_lock);
+    local = own;
+    master = true;
+    portEXIT_CRITICAL(&multipack_lock);
+    combined_active = false;
+    return;
+  }
+
+  int64_t now = esp_timer_get_time();
+  uint8_t address = mysettings.canbus_equipment_addr;
+
+  // Packs are in parallel, so a pack which can't charge (or discharge) stops the whole battery
+  // and the current is limited by the weakest pack, assuming the current is shared equally.
+  uint8_t packs = 1;
+  uint16_t min_charge = own.charge_current;
+  uint16_t min_discharge = own.discharge_current;
+  uint32_t soc_total = 0;
+  uint8_t soc_count = 0;
+  uint32_t oldest_ms = 0;
+  bool is_master = true;
+
+  combined = own;
+  if (own.flags & MULTIPACK_FLAG_SOC_VALID)
+  {
+    soc_total += own.soc;
+    soc_count++;
+  }
+
+  portENTER_CRITICAL(&multipack_lock);
+  local = own;
+  for (uint8_t i = 0; i < MULTIPACK_MAXIMUM_PACKS; i++)
+  {
+    multipack_peer &p = peers[i];
+    if (!p.alive || i == address)
+    {
+      continue;
+    }
+
+    uint32_t age_ms = (uint32_t)((now - p.received_us) / 1000);
+    if (age_ms > MULTIPACK_PEER_TIMEOUT_MS)
+    {
+      p.alive = false;
+      stats.expired++;
+      continue;
+    }
+
+    packs++;
+    if (i < address)
+    {
+      is_master = false;
+    }
+    if (age_ms > oldest_ms)
+    {
+      oldest_ms = age_ms;
+    }
+
+    const multipack_summary &s = p.summary;
+    if (s.charge_current < min_charge)
+    {
+      min_charge = s.charge_current;
+    }
+    if (s.discharge_current < min_discharge)
+    {
+      min_discharge = s.discharge_current;
+    }
+    if (s.lowest_cell_mv < combined.lowest_cell_mv)
+    {
+      combined.lowest_cell_mv = s.lowest_cell_mv;
+    }
+    if (s.highest_cell_mv > combined.highest_cell_mv)
+    {
+      combined.highest_cell_mv = s.highest_cell_mv;
+    }
+    if (s.flags & MULTIPACK_FLAG_SOC_VALID)
+    {
+      soc_total += s.soc;
+      soc_count++;
+    }
+  }
+
+  bool changed = is_master != master;
+  master = is_master;
+  stats.packs = packs;
+  stats.master = is_master;
+  stats.oldest_age_ms = oldest_ms;
+  if (oldest_ms > stats.max_age_ms)
+  {
+    stats.max_age_ms = oldest_ms;
+  }
+  if (is_master)
+  {
+    stats.master_address = address;
+  }
+  else
+  {
+    for (uint8_t i = 0; i < address; i++)
+    {
+      if (peers[i].alive)
+      {
+        stats.master_address = i;
+        break;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&multipack_lock);
+
+  uint32_t charge = (uint32_t)min_charge * packs;
+  uint32_t discharge = (uint32_t)min_discharge * packs;
+  combined.charge_current = charge > INT16_MAX ? INT16_MAX : charge;
+  combined.discharge_current = discharge > INT16_MAX ? INT16_MAX : discharge;
+  if (soc_count > 0)
+  {
+    combined.soc = (uint8_t)(soc_total / soc_count);
+    combined.flags |= MULTIPACK_FLAG_SOC_VALID;
+  }
+  // A single pack keeps its own values
+  combined_active = is_master && packs > 1;
+
+  if (changed)
+  {
+    ESP_LOGI(TAG, "%s, %u packs", is_master ? "Master" : "Slave", packs);
+  }
+}
+
+/// @brief True if this controller should talk to the inverter
+bool multipack_is_master()
+{
+  return master;
+}
+
+/// @brief Replace this pack's current limits (0.1A) with the combined limits of all the packs
+/// @return true if the limits were replaced (master of more than one pack)
+bool multipack_apply_limits(int16_t *charge_current, int16_t *discharge_current)
+{
+  if (!combined_active)
+  {
+    return false;
+  }
+  *charge_current = combined.charge_current;
+  *discharge_current = combined.discharge_current;
+  return true;
+}
+
+/// @brief Replace this pack's state of charge with the average of all the packs
+void multipack_apply_soc(uint16_t *soc)
+{
+  if (!combined_active || !(combined.flags & MULTIPACK_FLAG_SOC_VALID))
+  {
+    return;
+  }
+  *soc = combined.soc;
+}
+
+/// @brief Send this pack's summary when it is due (canbus_tx)
+/// @return Milliseconds until the next summary is due
+uint32_t multipack_service()
+{
+  if (!mysettings.canbus_multipack || mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_DISABLED)
+  {
+    return 1000;
+  }
+
+  int64_t now = esp_timer_get_time();
+  if (now >= next_send_us)
+  {
+    uint8_t data[8];
+    portENTER_CRITICAL(&multipack_lock);
+    encode(local, data);
+    portEXIT_CRITICAL(&multipack_lock);
+
+    if (send_canbus_message(MULTIPACK_SUMMARY_ID + (mysettings.canbus_equipment_addr & 0x0F), data, sizeof(data)))
+    {
+      portENTER_CRITICAL(&multipack_lock);
+      stats.sent++;
+      portEXIT_CRITICAL(&multipack_lock);
+    }
+
+    next_send_us += (int64_t)MULTIPACK_SUMMARY_PERIOD_MS * 1000;
+    if (next_send_us <= now)
+    {
+      next_send_us = now + (int64_t)MULTIPACK_SUMMARY_PERIOD_MS * 1000;
+    }
+  }
+
+  // Bus load of the summaries from every pack, over about one second
+  int64_t window_us = now - load_window_start_us;
+  if (window_us >= 1000000)
+  {
+    portENTER_CRITICAL(&multipack_lock);
+    uint32_t frames = stats.sent + stats.received;
+    uint32_t bits_per_second = (uint32_t)((uint64_t)(frames - load_window_frames) * MULTIPACK_FRAME_BITS * 1000000 / window_us);
+    stats.bus_load_permille = bits_per_second / (mysettings.canbusbaud == 250 ? 250 : 500);
+    load_window_frames = frames;
+    portEXIT_CRITICAL(&multipack_lock);
+    load_window_start_us = now;
+  }
+
+  return (uint32_t)((next_send_us - now + 999) / 1000);
+}
+
+/// @brief Summary frame from another pack (canbus_rx)
+void multipack_receive(const twai_message_t &message, int64_t received_us)
+{
+  if (message.data_length_code != 8)
+  {
+    return;
+  }
+
+  uint8_t address = message.identifier - MULTIPACK_SUMMARY_ID;
+  if (address >= MULTIPACK_MAXIMUM_PACKS)
+  {
+    return;
+  }
+
+  if (address == mysettings.canbus_equipment_addr)
+  {
+    ESP_LOGW(TAG, "Another controller is using address %u", address);
+    portENTER_CRITICAL(&multipack_lock);
+    stats.conflicts++;
+    portEXIT_CRITICAL(&multipack_lock);
+    return;
+  }
+
+  multipack_summary s;
+  decode(message.data, &s);
+
+  portENTER_CRITICAL(&multipack_lock);
+  peers[address].summary = s;
+  peers[address].received_us = received_us;
+  peers[address].alive = true;
+  stats.received++;
+  portEXIT_CRITICAL(&multipack_lock);
+}
+
+void multipack_get_stats(multipack_stats *copy)
+{
+  portENTER_CRITICAL(&multipack_lock);
+  *copy = stats;
+  portEXIT_CRITICAL(&multipack_lock);
+}
@@ -0,0 +1,248 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+Acceptance filter and message dispatch for received CAN frames.
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-canrx";
+
+#include "canbus_rx.h"
+#include "pylon_canbus.h"
+#include "canbus_multipack.h"
+
+#include <esp_timer.h>
+
+// Remote inverter should send a 305 message every few seconds
+// for now, keep track of last message.
+// TODO: in future, add timeout/error condition to shut down
+static void rx_keepalive(const twai_message_t &message, int64_t received_us)
+{
+  canbus_last_305_message_time = esp_timer_get_time();
+  canbus_no_request_messages_count = 0;
+}
+
+// Sleep/Awake Command control
+static void pylonforce_sleep(const twai_message_t &message, int64_t received_us)
+{
+  canbus_no_request_messages_count = 0;
+  // data[0] 0x55 = enter sleep status, 0xAA = wakeup (not supported)
+}
+
+// Charge/Discharge Command control
+static void pylonforce_charge_discharge(const twai_message_t &message, int64_t received_us)
+{
+  canbus_no_request_messages_count = 0;
+  // data[0] 0xAA = Force Charge, (close batt-relay) when the batt is in under-voltage protection
+  // data[1] 0xAA = Force Discharge, (close batt-relay) when the batt is in over-voltage protection
+  // (not supported)
+}
+
+// Request from inverter, the reply uses the same identifier format as the request.
+// Replies come from the frame cache and are queued as a single burst
+static void pylonforce_request(const twai_message_t &message, int64_t received_us)
+{
+  canbus_no_request_messages_count = 0;
+  if (!multipack_is_master())
+  {
+    // Another controller answers for all the packs
+    return;
+  }
+  bool extd = message.extd;
+  if (message.data[0] == 0x02)
+  {
+    // Hardware info
+    pylonHV_send_message_info(extd, received_us);
+  }
+  if (message.data[0] == 0x00)
+  {
+    // Status info
+    pylonHV_send_message_status(extd, received_us);
+  }
+}
+
+static const can_rx_entry victron_rx[] = {
+  {.identifier = 0x305, .extended = false, .handler = rx_keepalive},
+};
+
+static const can_rx_entry pylon_rx[] = {
+  {.identifier = 0x305, .extended = false, .handler = rx_keepalive},
+};
+
+static const can_rx_entry pylonforce_rx[] = {
+  {.identifier = 0x305, .extended = false, .handler = rx_keepalive},
+  {.identifier = 0x420, .extended = false, .handler = pylonforce_request},
+  {.identifier = 0x620, .extended = false, .handler = pylonforce_sleep},
+  {.identifier = 0x621, .extended = false, .handler = pylonforce_charge_discharge},
+  {.identifier = 0x4200, .extended = true, .handler = pylonforce_request},
+  {.identifier = 0x8200, .extended = true, .handler = pylonforce_sleep},
+  {.identifier = 0x8210, .extended = true, .handler = pylonforce_charge_discharge},
+};
+
+static const can_rx_entry multipack_rx = {.identifier = MULTIPACK_SUMMARY_ID, .extended = false, .handler = multipack_receive, .mask = MULTIPACK_MAXIMUM_PACKS - 1};
+
+static_assert(sizeof(pylonforce_rx) / sizeof(can_rx_entry) < CANBUS_RX_TABLE_MAXIMUM, "pylonforce_rx too large");
+
+static CanBusProtocolEmulation rx_protocol = CanBusProtocolEmulation::CANBUS_DISABLED;
+static bool rx_multipack = false;
+static can_rx_entry rx_table[CANBUS_RX_TABLE_MAXIMUM];
+static uint8_t rx_table_size = 0;
+static can_rx_stats rx_stats = {};
+
+static portMUX_TYPE rx_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief Smallest TWAI acceptance filter which passes every identifier in the table
+/// @details A mask bit of 1 means "don't care".  With only 11 bit or only 29 bit identifiers
+/// a single filter is used.  With both, dual filter mode is used: filter 1 compares the 11 bit
+/// identifiers and filter 2 the top 16 bits of the 29 bit identifiers.
+static twai_filter_config_t build_filter(const can_rx_entry *table, uint8_t size)
+{
+  bool have_std = false;
+  bool have_ext = false;
+  uint32_t std_code = 0, std_diff = 0;
+  uint32_t ext_code = 0, ext_diff = 0;
+
+  for (uint8_t i = 0; i < size; i++)
+  {
+    if (table[i].extended)
+    {
+      if (!have_ext)
+      {
+        ext_code = table[i].identifier;
+        have_ext = true;
+      }
+      ext_diff |= (ext_code ^ table[i].identifier) | table[i].mask;
+    }
+    else
+    {
+      if (!have_std)
+      {
+        std_code = table[i].identifier;
+        have_std = true;
+      }
+      std_diff |= (std_code ^ table[i].identifier) | table[i].mask;
+    }
+  }
+
+  twai_filter_config_t filter = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+  if (have_std && !have_ext)
+  {
+    // ID in bits 31:21, ignore RTR and the first two data bytes
+    filter.acceptance_code = std_code << 21;
+    filter.acceptance_mask = (std_diff << 21) | 0x001FFFFF;
+    filter.single_filter = true;
+  }
+  else if (have_ext && !have_std)
+  {
+    // ID in bits 31:3, ignore RTR
+    filter.acceptance_code = ext_code << 3;
+    filter.acceptance_mask = (ext_diff << 3) | 0x00000007;
+    filter.single_filter = true;
+  }
+  else if (have_std && have_ext)
+  {
+    // Filter 1 (bits 31:16) 11 bit ID in 15:5, RTR and data nibble don't care
+    // Filter 2 (bits 15:0) ID bits 28:13, bits 3:0 are shared with filter 1 so don't care
+    filter.acceptance_code = ((std_code << 5) << 16) | ((ext_code >> 13) & 0xFFF0);
+    filter.acceptance_mask = (((std_diff << 5) | 0x1F) << 16) | ((ext_diff >> 13) & 0xFFF0) | 0x000F;
+    filter.single_filter = false;
+  }
+
+  return filter;
+}
+
+static void use_table(const can_rx_entry *table, uint8_t size)
+{
+  memcpy(rx_table, table, size * sizeof(can_rx_entry));
+  rx_table_size = size;
+}
+
+/// @brief Switch to the receive table of the protocol
+/// @return Acceptance filter to install the TWAI driver with
+twai_filter_config_t canbus_rx_select(CanBusProtocolEmulation protocol)
+{
+  rx_table_size = 0;
+  switch (protocol)
+  {
+  case CanBusProtocolEmulation::CANBUS_VICTRON:
+    use_table(victron_rx, sizeof(victron_rx) / sizeof(can_rx_entry));
+    break;
+  case CanBusProtocolEmulation::CANBUS_PYLONTECH:
+    use_table(pylon_rx, sizeof(pylon_rx) / sizeof(can_rx_entry));
+    break;
+  case CanBusProtocolEmulation::CANBUS_PYLONFORCEH2:
+    use_table(pylonforce_rx, sizeof(pylonforce_rx) / sizeof(can_rx_entry));
+    break;
+  default:
+    // Nothing is read while CAN is disabled
+    break;
+  }
+
+  rx_multipack = mysettings.canbus_multipack;
+  if (rx_multipack && rx_table_size > 0)
+  {
+    // Summaries from the other controllers
+    rx_table[rx_table_size++] = multipack_rx;
+  }
+
+  rx_protocol = protocol;
+
+  twai_filter_config_t filter = build_filter(rx_table, rx_table_size);
+  ESP_LOGI(TAG, "Protocol %u, %u identifiers, filter code=0x%08x mask=0x%08x %s", protocol, rx_table_size,
+           filter.acceptance_code, filter.acceptance_mask, filter.single_filter ? "single" : "dual");
+  return filter;
+}
+
+/// @brief True if the protocol or multi-pack setting changed since the table and filter were selected
+bool canbus_rx_select_needed()
+{
+  return mysettings.canbusprotocol != rx_protocol || mysettings.canbus_multipack != rx_multipack;
+}
+
+/// @brief Call the handler registered for a received frame
+void canbus_rx_dispatch(const twai_message_t &message, int64_t received_us)
+{
+  ESP_LOGD(TAG, "ID: 0x%x, DLC: %u, flags: 0x%x", message.identifier, message.data_length_code, message.flags);
+  // Only formats the data if debug logging is enabled for this tag
+  ESP_LOG_BUFFER_HEX_LEVEL(TAG, message.data, message.data_length_code, ESP_LOG_DEBUG);
+
+  bool extended = message.extd != 0;
+  for (uint8_t i = 0; i < rx_table_size; i++)
+  {
+    if (rx_table[i].identifier == (message.identifier & ~rx_table[i].mask) && rx_table[i].extended == extended)
+    {
+      int64_t start = esp_timer_get_time();
+      rx_table[i].handler(message, received_us);
+      uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+      portENTER_CRITICAL(&rx_stats_lock);
+      rx_stats.received++;
+      rx_stats.dispatched++;
+      rx_stats.busy_us += elapsed;
+      if (elapsed > rx_stats.max_handler_us)
+      {
+        rx_stats.max_handler_us = elapsed;
+      }
+      portEXIT_CRITICAL(&rx_stats_lock);
+      return;
+    }
+  }
+
+  portENTER_CRITICAL(&rx_stats_lock);
+  rx_stats.received++;
+  rx_stats.unhandled++;
+  portEXIT_CRITICAL(&rx_stats_lock);
+}
+
+void canbus_rx_get_stats(can_rx_stats *stats)
+{
+  portENTER_CRITICAL(&rx_stats_lock);
+  *stats = rx_stats;
+  portEXIT_CRITICAL(&rx_stats_lock);
+}
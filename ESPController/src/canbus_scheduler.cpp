@@ -0,0 +1,284 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+Deadline based scheduling of the periodic CAN bus messages for the
+Victron and Pylontech (low voltage) protocols.
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-cansched";
+
+#include "canbus_scheduler.h"
+#include "canbus_frames.h"
+#include "canbus_transport.h"
+#include "canbus_multipack.h"
+
+#include <esp_timer.h>
+
+// Minimum CAN-IDs required by Victron are 0x351, 0x355, 0x356 and 0x35A.
+// 0x351 must be sent at least every 3 seconds, or Victron will stop charge/discharge
+// Both protocols expect every message once a second (some inverters alarm on missing frames),
+// when the bus is congested priority decides which message waits and the deadline how long.
+static const can_schedule_entry victron_schedule[] = {
+  {.identifier = 0x351, .period_ms = 1000, .deadline_ms = 3000, .priority = 0, .flags = CAN_SCHEDULE_CRITICAL},
+  {.identifier = 0x35a, .period_ms = 1000, .deadline_ms = 3000, .priority = 1, .flags = 0},
+  {.identifier = 0x355, .period_ms = 1000, .deadline_ms = 5000, .priority = 2, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x356, .period_ms = 1000, .deadline_ms = 5000, .priority = 2, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x372, .period_ms = 1000, .deadline_ms = 10000, .priority = 3, .flags = 0},
+  {.identifier = 0x373, .period_ms = 1000, .deadline_ms = 10000, .priority = 3, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x374, .period_ms = 1000, .deadline_ms = 10000, .priority = 3, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x375, .period_ms = 1000, .deadline_ms = 10000, .priority = 3, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x376, .period_ms = 1000, .deadline_ms = 10000, .priority = 3, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x377, .period_ms = 1000, .deadline_ms = 10000, .priority = 3, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  // Informational (names and versions)
+  {.identifier = 0x35e, .period_ms = 1000, .deadline_ms = 30000, .priority = 4, .flags = 0},
+  {.identifier = 0x35f, .period_ms = 1000, .deadline_ms = 30000, .priority = 4, .flags = 0},
+  {.identifier = 0x370, .period_ms = 1000, .deadline_ms = 30000, .priority = 4, .flags = 0},
+  {.identifier = 0x371, .period_ms = 1000, .deadline_ms = 30000, .priority = 4, .flags = 0},
+};
+
+// Pylontech low voltage battery emulation
+// https://github.com/PaulSturbo/DIY-BMS-CAN/blob/main/SEPLOS%20BMS%20CAN%20Protocoll%20V1.0.pdf
+// https://www.setfirelabs.com/green-energy/pylontech-can-reading-can-replication
+// https://github.com/juamiso/PYLON_EMU
+static const can_schedule_entry pylon_schedule[] = {
+  {.identifier = 0x351, .period_ms = 1000, .deadline_ms = 3000, .priority = 0, .flags = CAN_SCHEDULE_CRITICAL},
+  {.identifier = 0x359, .period_ms = 1000, .deadline_ms = 3000, .priority = 1, .flags = 0},
+  {.identifier = 0x35c, .period_ms = 1000, .deadline_ms = 3000, .priority = 1, .flags = 0},
+  {.identifier = 0x355, .period_ms = 1000, .deadline_ms = 5000, .priority = 2, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x356, .period_ms = 1000, .deadline_ms = 5000, .priority = 2, .flags = CAN_SCHEDULE_RUNNING_ONLY},
+  {.identifier = 0x35e, .period_ms = 1000, .deadline_ms = 30000, .priority = 4, .flags = 0},
+};
+
+static_assert(sizeof(victron_schedule) / sizeof(can_schedule_entry) <= CANBUS_SCHEDULE_MAXIMUM, "victron_schedule too large");
+static_assert(sizeof(pylon_schedule) / sizeof(can_schedule_entry) <= CANBUS_SCHEDULE_MAXIMUM, "pylon_schedule too large");
+
+struct can_schedule_state
+{
+  int64_t next_due_us;
+  int64_t last_sent_us;
+  uint64_t total_jitter_us;
+  bool deadline_missed;
+};
+
+static CanBusProtocolEmulation active_protocol = CanBusProtocolEmulation::CANBUS_DISABLED;
+static const can_schedule_entry *schedule = nullptr;
+static uint8_t schedule_size = 0;
+static can_schedule_state state[CANBUS_SCHEDULE_MAXIMUM];
+static can_schedule_stats stats[CANBUS_SCHEDULE_MAXIMUM];
+
+/// @brief Switch to the schedule of the given protocol, everything becomes due immediately
+static void select_schedule(CanBusProtocolEmulation protocol)
+{
+  switch (protocol)
+  {
+  case CanBusProtocolEmulation::CANBUS_VICTRON:
+    schedule = victron_schedule;
+    schedule_size = sizeof(victron_schedule) / sizeof(can_schedule_entry);
+    break;
+  case CanBusProtocolEmulation::CANBUS_PYLONTECH:
+    schedule = pylon_schedule;
+    schedule_size = sizeof(pylon_schedule) / sizeof(can_schedule_entry);
+    break;
+  default:
+    // PylonForce H2 only answers requests from the inverter (canbus_rx)
+    schedule = nullptr;
+    schedule_size = 0;
+    break;
+  }
+
+  int64_t now = esp_timer_get_time();
+  memset(state, 0, sizeof(state));
+  memset(stats, 0, sizeof(stats));
+  for (uint8_t i = 0; i < schedule_size; i++)
+  {
+    state[i].next_due_us = now;
+    stats[i].identifier = schedule[i].identifier;
+  }
+
+  active_protocol = protocol;
+  ESP_LOGI(TAG, "Protocol %u, %u scheduled messages", protocol, schedule_size);
+}
+
+/// @brief Which of two due entries to send first, overdue critical messages always win
+static bool sends_before(uint8_t a, uint8_t b)
+{
+  bool critical_a = (schedule[a].flags & CAN_SCHEDULE_CRITICAL) != 0;
+  bool critical_b = (schedule[b].flags & CAN_SCHEDULE_CRITICAL) != 0;
+  if (critical_a != critical_b)
+  {
+    return critical_a;
+  }
+  if (schedule[a].priority != schedule[b].priority)
+  {
+    return schedule[a].priority < schedule[b].priority;
+  }
+  return state[a].next_due_us < state[b].next_due_us;
+}
+
+static void record_send(uint8_t i, int64_t now)
+{
+  can_schedule_state &s = state[i];
+  can_schedule_stats &st = stats[i];
+
+  uint32_t jitter_us = (uint32_t)(now - s.next_due_us);
+  s.total_jitter_us += jitter_us;
+  st.sent++;
+  st.average_jitter_us = (uint32_t)(s.total_jitter_us / st.sent);
+  if (jitter_us > st.max_jitter_us)
+  {
+    st.max_jitter_us = jitter_us;
+  }
+
+  if (s.last_sent_us != 0)
+  {
+    uint32_t interval_ms = (uint32_t)((now - s.last_sent_us) / 1000);
+    if (interval_ms > st.max_interval_ms)
+    {
+      st.max_interval_ms = interval_ms;
+    }
+    if (interval_ms > schedule[i].deadline_ms && !s.deadline_missed)
+    {
+      st.missed_deadlines++;
+    }
+  }
+
+  s.last_sent_us = now;
+  s.deadline_missed = false;
+
+  // Keep to the original phase, unless we have fallen a whole period behind
+  s.next_due_us += (int64_t)schedule[i].period_ms * 1000;
+  if (s.next_due_us <= now)
+  {
+    s.next_due_us = now + (int64_t)schedule[i].period_ms * 1000;
+  }
+}
+
+/// @brief Queues every message which is due, in priority order
+/// @return Milliseconds until the next message is due
+uint32_t canbus_scheduler_service()
+{
+  if (mysettings.canbusprotocol != active_protocol)
+  {
+    select_schedule(mysettings.canbusprotocol);
+  }
+
+  if (schedule_size == 0)
+  {
+    return 1000;
+  }
+
+  int64_t now = esp_timer_get_time();
+
+  if (!multipack_is_master())
+  {
+    // Another controller talks to the inverter for all the packs (canbus_multipack.cpp),
+    // if it disappears everything is sent as soon as this controller takes over
+    for (uint8_t i = 0; i < schedule_size; i++)
+    {
+      state[i].next_due_us = now;
+      state[i].last_sent_us = 0;
+    }
+    return 100;
+  }
+  bool running = _controller_state == ControllerState::Running;
+
+  for (uint8_t i = 0; i < schedule_size; i++)
+  {
+    if (!running && (schedule[i].flags & CAN_SCHEDULE_RUNNING_ONLY))
+    {
+      // Not sent at the moment, send as soon as the controller is running
+      state[i].next_due_us = now;
+      state[i].last_sent_us = 0;
+      continue;
+    }
+
+    if (state[i].last_sent_us != 0 && !state[i].deadline_missed &&
+      now - state[i].last_sent_us > (int64_t)schedule[i].deadline_ms * 1000)
+    {
+      state[i].deadline_missed = true;
+      stats[i].missed_deadlines++;
+      ESP_LOGW(TAG, "Deadline missed 0x%x", schedule[i].identifier);
+    }
+  }
+
+  uint8_t space = canbus_get_transport()->tx_space();
+
+  for (;;)
+  {
+    // Find the most important message which is due
+    int16_t best = -1;
+    for (uint8_t i = 0; i < schedule_size; i++)
+    {
+      if (!running && (schedule[i].flags & CAN_SCHEDULE_RUNNING_ONLY))
+      {
+        continue;
+      }
+      if (state[i].next_due_us <= now && (best < 0 || sends_before(i, best)))
+      {
+        best = i;
+      }
+    }
+
+    if (best < 0)
+    {
+      break;
+    }
+
+    if (space == 0)
+    {
+      // Transmit queue is full, try again shortly, this message is still the first to go
+      stats[best].deferred++;
+      return 10;
+    }
+
+    esp_err_t result = canbus_frame_send(schedule[best].identifier, schedule[best].identifier);
+    if (result == ESP_ERR_NOT_FOUND)
+    {
+      // Nothing encoded for this frame (yet), check again next period
+      state[best].next_due_us = now + (int64_t)schedule[best].period_ms * 1000;
+      state[best].last_sent_us = 0;
+      continue;
+    }
+
+    if (result != ESP_OK)
+    {
+      // Driver didn't take it (queue filled up, bus error), the message stays due and is tried again shortly
+      stats[best].deferred++;
+      return 10;
+    }
+
+    space--;
+    record_send(best, esp_timer_get_time());
+  }
+
+  // Sleep until the next message is due
+  int64_t next = now + 1000000;
+  for (uint8_t i = 0; i < schedule_size; i++)
+  {
+    if (!running && (schedule[i].flags & CAN_SCHEDULE_RUNNING_ONLY))
+    {
+      continue;
+    }
+    if (state[i].next_due_us < next)
+    {
+      next = state[i].next_due_us;
+    }
+  }
+
+  uint32_t wait_ms = (uint32_t)((next - now + 999) / 1000);
+  return wait_ms == 0 ? 1 : wait_ms;
+}
+
+/// @brief Copy of the transmit statistics of the active schedule
+uint8_t canbus_scheduler_get_stats(can_schedule_stats *list, uint8_t listSize)
+{
+  uint8_t count = schedule_size < listSize ? schedule_size : listSize;
+  memcpy(list, stats, count * sizeof(can_schedule_stats));
+  return count;
+}
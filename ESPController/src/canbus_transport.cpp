@@ -0,0 +1,181 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+Sends CAN frames through the active transport, the ESP32 TWAI driver on the controller.
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-cantx";
+
+#include "canbus_transport.h"
+#include <string.h>
+#include <esp_log.h>
+
+#if !defined(__linux__)
+
+#include "defines.h"
+#include "HAL_ESP32.h"
+#include <esp_timer.h>
+
+/// ESP32 CAN bus status strings, used for periodic status reporting
+static const char *ESP32_TWAI_STATUS_STRINGS[] = {
+    "STOPPED",               // CAN_STATE_STOPPED
+    "RUNNING",               // CAN_STATE_RUNNING
+    "OFF / RECOVERY NEEDED", // CAN_STATE_BUS_OFF
+    "RECOVERY UNDERWAY"      // CAN_STATE_RECOVERING
+};
+
+static esp_err_t twai_transport_transmit(const twai_message_t &message)
+{
+  // canbus_scheduler checks for space in the queue first, so this doesn't wait
+  return twai_transmit(&message, 0);
+}
+
+static esp_err_t twai_transport_receive(twai_message_t &message, uint32_t timeout_ms)
+{
+  return twai_receive(&message, pdMS_TO_TICKS(timeout_ms));
+}
+
+static void twai_transport_recover();
+
+static uint8_t twai_transport_tx_space()
+{
+  twai_status_info_t status;
+  if (twai_get_status_info(&status) != ESP_OK)
+  {
+    return 0;
+  }
+
+  if (status.state != twai_state_t::TWAI_STATE_RUNNING)
+  {
+    // Nothing can be queued, start the bus recovery (no transmit will fail to do it)
+    twai_transport_recover();
+    return 0;
+  }
+
+  return status.msgs_to_tx >= CANBUS_TX_QUEUE_LENGTH ? 0 : CANBUS_TX_QUEUE_LENGTH - status.msgs_to_tx;
+}
+
+static void twai_transport_recover()
+{
+  twai_status_info_t status;
+  if (twai_get_status_info(&status) != ESP_OK)
+  {
+    return;
+  }
+
+  ESP_LOGI(TAG, "CAN STATUS: rx-q:%d, tx-q:%d, rx-err:%d, tx-err:%d, arb-lost:%d, bus-err:%d, state: %s",
+           status.msgs_to_rx, status.msgs_to_tx,
+           status.rx_error_counter, status.tx_error_counter,
+           status.arb_lost_count,
+           status.bus_error_count,
+           ESP32_TWAI_STATUS_STRINGS[status.state]);
+
+  if (status.state == twai_state_t::TWAI_STATE_BUS_OFF)
+  {
+    // When the bus is OFF we need to initiate recovery, transmit is not possible when in this state.
+    // Recovery appears to force it into STOPPED state
+    ESP_LOGW(TAG, "Initiating recovery");
+    twai_initiate_recovery();
+  }
+  else if (status.state == twai_state_t::TWAI_STATE_STOPPED)
+  {
+    // bus has stopped - restart it
+    esp_err_t startresult = twai_start();
+    ESP_LOGI(TAG, "Starting CANBUS %s", esp_err_to_name(startresult));
+  }
+  else if (status.state == twai_state_t::TWAI_STATE_RECOVERING)
+  {
+    // when the bus is in recovery mode transmit is not possible, so wait...
+    vTaskDelay(pdMS_TO_TICKS(250));
+  }
+}
+
+static esp_err_t twai_transport_wait_tx_done(uint32_t timeout_ms)
+{
+  // msgs_to_tx includes the frame in the transmit buffer, so 0 means the last frame is on the bus
+  int64_t end = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+  for (;;)
+  {
+    twai_status_info_t status;
+    if (twai_get_status_info(&status) != ESP_OK || status.state != twai_state_t::TWAI_STATE_RUNNING)
+    {
+      return ESP_ERR_INVALID_STATE;
+    }
+    if (status.msgs_to_tx == 0)
+    {
+      return ESP_OK;
+    }
+    if (esp_timer_get_time() > end)
+    {
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(1);
+  }
+}
+
+const canbus_transport canbus_twai_transport = {
+    .name = "twai",
+    .transmit = twai_transport_transmit,
+    .receive = twai_transport_receive,
+    .tx_space = twai_transport_tx_space,
+    .recover = twai_transport_recover,
+    .wait_tx_done = twai_transport_wait_tx_done,
+};
+
+static const canbus_transport *active_transport = &canbus_twai_transport;
+
+#else
+
+static const canbus_transport *active_transport = &canbus_socketcan_transport;
+
+#endif
+
+/// @brief Replace the transport, call before the CAN tasks are started
+void canbus_set_transport(const canbus_transport *transport)
+{
+  active_transport = transport;
+}
+
+const canbus_transport *canbus_get_transport()
+{
+  return active_transport;
+}
+
+/// @brief Places a frame into the transmit queue of the CAN transport, never blocks
+/// @return true if the frame was queued
+bool send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const uint8_t length)
+{
+  twai_message_t message;
+  message.identifier = identifier;
+  message.flags = TWAI_MSG_FLAG_NONE;
+  if(identifier > 0x7FF)message.flags = TWAI_MSG_FLAG_EXTD;
+  message.data_length_code = length;
+
+  memcpy(&message.data, buffer, length);
+
+  // If there is a bus error, we attempt to recover it later, transmitted messages are lost, but this
+  // isn't a problem, as they are repeated every few seconds.
+  esp_err_t result = canbus_get_transport()->transmit(message);
+
+  if (result == ESP_OK)
+  {
+    // Everything normal/good
+    ESP_LOGD(TAG, "Sent CAN message 0x%x", identifier);
+    canbus_messages_sent++;
+    return true;
+  }
+
+  // Something failed....
+  ESP_LOGE(TAG, "Failed to queue CANBUS message (0x%x)", result);
+  canbus_messages_failed_sent++;
+
+  canbus_get_transport()->recover();
+
+  return false;
+}
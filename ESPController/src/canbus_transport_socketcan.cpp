@@ -0,0 +1,173 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+CAN bus transport using a Linux SocketCAN interface, only built on Linux.
+
+To create a virtual bus for an inverter simulator:
+  sudo ip link add dev vcan0 type vcan
+  sudo ip link set up vcan0
+*/
+
+#if defined(__linux__)
+
+#include "canbus_transport.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/sockios.h>
+
+static int can_socket = -1;
+
+/// @brief Open and bind a raw CAN socket to the interface (for example "vcan0")
+esp_err_t canbus_socketcan_open(const char *interface)
+{
+  int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if (s < 0)
+  {
+    return ESP_FAIL;
+  }
+
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+  if (ioctl(s, SIOCGIFINDEX, &ifr) < 0)
+  {
+    close(s);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  struct sockaddr_can addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(s);
+    return ESP_FAIL;
+  }
+
+  if (can_socket >= 0)
+  {
+    close(can_socket);
+  }
+  can_socket = s;
+  return ESP_OK;
+}
+
+static esp_err_t socketcan_transmit(const twai_message_t &message)
+{
+  if (can_socket < 0)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  struct can_frame frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.can_id = message.identifier;
+  if (message.extd)
+  {
+    frame.can_id |= CAN_EFF_FLAG;
+  }
+  if (message.rtr)
+  {
+    frame.can_id |= CAN_RTR_FLAG;
+  }
+  frame.can_dlc = message.data_length_code > CAN_MAX_DLEN ? CAN_MAX_DLEN : message.data_length_code;
+  memcpy(frame.data, message.data, frame.can_dlc);
+
+  ssize_t written = send(can_socket, &frame, sizeof(frame), MSG_DONTWAIT);
+  if (written == sizeof(frame))
+  {
+    return ESP_OK;
+  }
+  return (errno == EAGAIN || errno == ENOBUFS) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+}
+
+static esp_err_t socketcan_receive(twai_message_t &message, uint32_t timeout_ms)
+{
+  if (can_socket < 0)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  struct pollfd p = {.fd = can_socket, .events = POLLIN, .revents = 0};
+  int ready = poll(&p, 1, (int)timeout_ms);
+  if (ready == 0)
+  {
+    return ESP_ERR_TIMEOUT;
+  }
+  if (ready < 0)
+  {
+    return ESP_FAIL;
+  }
+
+  struct can_frame frame;
+  if (read(can_socket, &frame, sizeof(frame)) != sizeof(frame))
+  {
+    return ESP_FAIL;
+  }
+
+  memset(&message, 0, sizeof(message));
+  message.extd = (frame.can_id & CAN_EFF_FLAG) ? 1 : 0;
+  message.rtr = (frame.can_id & CAN_RTR_FLAG) ? 1 : 0;
+  message.identifier = frame.can_id & (message.extd ? CAN_EFF_MASK : CAN_SFF_MASK);
+  message.data_length_code = frame.can_dlc;
+  memcpy(message.data, frame.data, frame.can_dlc);
+  return ESP_OK;
+}
+
+static uint8_t socketcan_tx_space()
+{
+  // The kernel queues the frames, a full queue shows up as ESP_ERR_TIMEOUT from transmit
+  return 32;
+}
+
+static void socketcan_recover()
+{
+  // Nothing to do, virtual interfaces don't go bus-off
+}
+
+static esp_err_t socketcan_wait_tx_done(uint32_t timeout_ms)
+{
+  // Poll the bytes still queued in the socket, 1ms at a time
+  for (uint32_t waited = 0;; waited++)
+  {
+    int queued = 0;
+    if (can_socket < 0 || ioctl(can_socket, SIOCOUTQ, &queued) < 0)
+    {
+      return ESP_ERR_INVALID_STATE;
+    }
+    if (queued == 0)
+    {
+      return ESP_OK;
+    }
+    if (waited >= timeout_ms)
+    {
+      return ESP_ERR_TIMEOUT;
+    }
+    usleep(1000);
+  }
+}
+
+const canbus_transport canbus_socketcan_transport = {
+    .name = "socketcan",
+    .transmit = socketcan_transmit,
+    .receive = socketcan_receive,
+    .tx_space = socketcan_tx_space,
+    .recover = socketcan_recover,
+    .wait_tx_done = socketcan_wait_tx_done,
+};
+
+#endif
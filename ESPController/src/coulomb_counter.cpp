@@ -0,0 +1,70 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+Shadow coulomb counter, see coulomb_counter.h
+*/
+
+#include "coulomb_counter.h"
+
+/// @brief Add the change in charge since the last reading
+/// @param delta_nC POSITIVE value is charge taken out of the battery (same sign as the INA229 CHARGE register)
+void coulomb_counter_add(coulomb_counter *c, int64_t delta_nC)
+{
+  if (delta_nC > 0)
+  {
+    c->out_nC += (uint64_t)delta_nC;
+  }
+  else
+  {
+    c->in_nC += (uint64_t)(-delta_nC);
+  }
+}
+
+/// @brief Set the state of charge, by moving the reference point
+/// @param soc fixed point, 8212 = 82.12%
+void coulomb_counter_calibrate(coulomb_counter *c, uint64_t capacity_nC, uint16_t soc)
+{
+  c->reference_in_nC = c->in_nC;
+  c->reference_out_nC = c->out_nC;
+  c->reference_charge_nC = (int64_t)((capacity_nC / 10000) * soc);
+}
+
+void coulomb_counter_reset_daily(coulomb_counter *c)
+{
+  c->daily_in_nC = c->in_nC;
+  c->daily_out_nC = c->out_nC;
+}
+
+/// @brief Charge held in the battery, charge in since the calibration is scaled by the charge efficiency
+/// @param efficiency_x100 fixed point, 9950 = 99.50%
+int64_t coulomb_counter_charge(const coulomb_counter *c, uint32_t efficiency_x100)
+{
+  uint64_t in = c->in_nC - c->reference_in_nC;
+  uint64_t out = c->out_nC - c->reference_out_nC;
+
+  // Split the multiply to avoid overflow
+  uint64_t in_scaled = (in / 10000) * efficiency_x100 + ((in % 10000) * efficiency_x100) / 10000;
+
+  return c->reference_charge_nC + (int64_t)in_scaled - (int64_t)out;
+}
+
+/// @return State of charge as fixed point (8212 = 82.12%), limited to 655.35%
+uint16_t coulomb_counter_soc(const coulomb_counter *c, uint64_t capacity_nC, uint32_t efficiency_x100)
+{
+  int64_t charge = coulomb_counter_charge(c, efficiency_x100);
+  int64_t one_hundredth = (int64_t)(capacity_nC / 10000);
+
+  if (charge <= 0 || one_hundredth == 0)
+  {
+    // We have taken more out of the battery than put in, so must be zero SoC (or more likely out of calibration)
+    return 0;
+  }
+
+  int64_t soc = charge / one_hundredth;
+  return soc > UINT16_MAX ? UINT16_MAX : (uint16_t)soc;
+}
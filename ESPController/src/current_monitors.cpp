@@ -0,0 +1,425 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+Multiple current monitors, per shunt readings combined into pack values.
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-curmons";
+
+#include "current_monitors.h"
+
+#include <esp_timer.h>
+
+struct currentmon_instance
+{
+  CurrentMonitorDevice device;
+  uint8_t address;
+  currentmonitoring_struct readings;
+  // Poll has been sent, waiting for the reply or failure
+  bool pending;
+  int64_t poll_start;
+  // Earliest time for the next poll of this monitor
+  int64_t next_poll;
+  // Timestamp of the previous valid reading
+  int64_t last_reading;
+  uint32_t interval_ms;
+  uint32_t polls;
+  uint32_t replies;
+  uint32_t failures;
+  uint32_t busy_us;
+};
+
+static currentmon_instance instances[CURRENTMON_MAXIMUM];
+static uint8_t instance_count = 0;
+// Round robin position of the scheduler
+static uint8_t next_index = 0;
+// Bus is left idle until this time to keep within the budget
+static int64_t bus_idle_until = 0;
+
+static portMUX_TYPE instance_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline bool is_rs485(CurrentMonitorDevice device)
+{
+  return device != CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL;
+}
+
+static bool is_stale(const currentmon_instance &inst, int64_t now)
+{
+  if (inst.last_reading == 0)
+  {
+    return true;
+  }
+
+  uint32_t expected_ms = inst.interval_ms > CURRENTMON_POLL_INTERVAL_MS ? inst.interval_ms : CURRENTMON_POLL_INTERVAL_MS;
+  return (now - inst.last_reading) > (int64_t)expected_ms * CURRENTMON_STALE_FACTOR * 1000;
+}
+
+/// @brief Build the list of monitors from the settings, clears all readings
+void currentmon_configure(const diybms_eeprom_settings *settings)
+{
+  portENTER_CRITICAL(&instance_lock);
+  memset(instances, 0, sizeof(instances));
+  instance_count = 0;
+  next_index = 0;
+  bus_idle_until = 0;
+
+  if (settings->currentMonitoringEnabled)
+  {
+    instances[0].device = settings->currentMonitoringDevice;
+    instances[0].address = settings->currentMonitoringModBusAddress;
+    instance_count = 1;
+
+    for (uint8_t i = 0; i < CURRENTMON_MAXIMUM - 1; i++)
+    {
+      const currentmon_additional_settings &cm = settings->currentMonitoring_additional[i];
+      if (cm.address != 0 && is_rs485(cm.device))
+      {
+        instances[instance_count].device = cm.device;
+        instances[instance_count].address = cm.address;
+        instance_count++;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&instance_lock);
+
+  ESP_LOGI(TAG, "%u current monitor(s)", instance_count);
+}
+
+// The accessors below take instance_lock, currentmon_configure can rebuild the list from the
+// httpd task at any time.  An index is only valid until the next settings save, callers which
+// need the device type and address together get them from the same call.
+
+uint8_t currentmon_count()
+{
+  portENTER_CRITICAL(&instance_lock);
+  uint8_t count = instance_count;
+  portEXIT_CRITICAL(&instance_lock);
+  return count;
+}
+
+/// @return Index of the first monitor of this type, -1 if there isn't one
+int8_t currentmon_find(CurrentMonitorDevice device)
+{
+  int8_t result = -1;
+  portENTER_CRITICAL(&instance_lock);
+  for (uint8_t i = 0; i < instance_count; i++)
+  {
+    if (instances[i].device == device)
+    {
+      result = i;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&instance_lock);
+  return result;
+}
+
+/// @param device set to the type of the monitor found (optional)
+/// @return Index of the RS485 monitor with this MODBUS address, -1 if there isn't one
+int8_t currentmon_find_address(uint8_t address, CurrentMonitorDevice *device)
+{
+  int8_t result = -1;
+  portENTER_CRITICAL(&instance_lock);
+  for (uint8_t i = 0; i < instance_count; i++)
+  {
+    if (is_rs485(instances[i].device) && instances[i].address == address)
+    {
+      result = i;
+      if (device != nullptr)
+      {
+        *device = instances[i].device;
+      }
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&instance_lock);
+  return result;
+}
+
+/// @brief Type and MODBUS address of one monitor, read together
+/// @return false if the index is out of range
+bool currentmon_identity(uint8_t index, CurrentMonitorDevice *device, uint8_t *address)
+{
+  bool result = false;
+  portENTER_CRITICAL(&instance_lock);
+  if (index < instance_count)
+  {
+    *device = instances[index].device;
+    *address = instances[index].address;
+    result = true;
+  }
+  portEXIT_CRITICAL(&instance_lock);
+  return result;
+}
+
+/// @brief Copy of the latest readings of one monitor
+void currentmon_get(uint8_t index, currentmonitoring_struct *readings)
+{
+  portENTER_CRITICAL(&instance_lock);
+  if (index < instance_count)
+  {
+    *readings = instances[index].readings;
+  }
+  else
+  {
+    memset(readings, 0, sizeof(currentmonitoring_struct));
+  }
+  portEXIT_CRITICAL(&instance_lock);
+}
+
+/// @brief Replace the readings of one monitor, the timestamp of valid readings is used for the polling rate
+void currentmon_store(uint8_t index, const currentmonitoring_struct &readings)
+{
+  portENTER_CRITICAL(&instance_lock);
+  if (index < instance_count)
+  {
+    currentmon_instance &inst = instances[index];
+    inst.readings = readings;
+    if (readings.validReadings)
+    {
+      if (inst.last_reading != 0 && readings.timestamp > inst.last_reading)
+      {
+        auto interval = (uint32_t)((readings.timestamp - inst.last_reading) / 1000);
+        // Moving average over roughly 8 readings
+        inst.interval_ms = inst.interval_ms == 0 ? interval : (inst.interval_ms * 7 + interval) / 8;
+      }
+      inst.last_reading = readings.timestamp;
+    }
+  }
+  portEXIT_CRITICAL(&instance_lock);
+}
+
+void currentmon_invalidate(uint8_t index)
+{
+  portENTER_CRITICAL(&instance_lock);
+  if (index < instance_count)
+  {
+    instances[index].readings.validReadings = false;
+  }
+  portEXIT_CRITICAL(&instance_lock);
+}
+
+/// @brief Combine the readings of all monitors into pack values
+/// @param total receives the combined values
+/// @param now esp_timer_get_time(), used for the staleness check
+void currentmon_aggregate(currentmonitoring_struct *total, int64_t now)
+{
+  portENTER_CRITICAL(&instance_lock);
+  if (instance_count == 0)
+  {
+    portEXIT_CRITICAL(&instance_lock);
+    memset(total, 0, sizeof(currentmonitoring_struct));
+    total->validReadings = false;
+    return;
+  }
+
+  // Voltage, limits and configuration come from the main monitor
+  *total = instances[0].readings;
+  bool valid = total->validReadings && !is_stale(instances[0], now);
+
+  if (instance_count > 1)
+  {
+    // State of charge weighted by capacity, capacity in Ah fits 32 bits for any number of monitors
+    uint32_t capacity = 0;
+    float weighted_soc = 0;
+
+    for (uint8_t i = 0; i < instance_count; i++)
+    {
+      const currentmonitoring_struct &r = instances[i].readings;
+
+      if (r.modbus.batterycapacityamphour > 0)
+      {
+        capacity += r.modbus.batterycapacityamphour;
+        weighted_soc += r.stateofcharge * r.modbus.batterycapacityamphour;
+      }
+
+      if (i == 0)
+      {
+        continue;
+      }
+
+      valid = valid && r.validReadings && !is_stale(instances[i], now);
+
+      total->modbus.current += r.modbus.current;
+      total->modbus.power += r.modbus.power;
+      total->modbus.milliamphour_out += r.modbus.milliamphour_out;
+      total->modbus.milliamphour_in += r.modbus.milliamphour_in;
+      total->modbus.daily_milliamphour_out += r.modbus.daily_milliamphour_out;
+      total->modbus.daily_milliamphour_in += r.modbus.daily_milliamphour_in;
+
+      if (r.modbus.temperature > total->modbus.temperature)
+      {
+        total->modbus.temperature = r.modbus.temperature;
+      }
+
+      // Alarm from any of the monitors
+      total->TemperatureOverLimit |= r.TemperatureOverLimit;
+      total->CurrentOverLimit |= r.CurrentOverLimit;
+      total->CurrentUnderLimit |= r.CurrentUnderLimit;
+      total->VoltageOverlimit |= r.VoltageOverlimit;
+      total->VoltageUnderlimit |= r.VoltageUnderlimit;
+      total->PowerOverLimit |= r.PowerOverLimit;
+
+      // Oldest reading
+      if (r.timestamp < total->timestamp)
+      {
+        total->timestamp = r.timestamp;
+      }
+    }
+
+    if (capacity > 0)
+    {
+      total->stateofcharge = weighted_soc / capacity;
+      total->modbus.raw_stateofcharge = (uint16_t)(total->stateofcharge * 100.0F);
+      total->modbus.batterycapacityamphour = capacity > UINT16_MAX ? UINT16_MAX : (uint16_t)capacity;
+    }
+  }
+
+  total->validReadings = valid;
+  portEXIT_CRITICAL(&instance_lock);
+}
+
+/// @brief Choose the next RS485 monitor to poll (round robin), keeps to one outstanding poll and the bus budget
+/// @param now esp_timer_get_time()
+/// @param wait_ms time until this should be called again
+/// @param device set to the type of the monitor to poll
+/// @param address set to the MODBUS address of the monitor to poll
+/// @return index of the monitor to poll, the poll is marked as sent.  -1 if nothing is due
+int8_t currentmon_next_poll(int64_t now, uint32_t *wait_ms, CurrentMonitorDevice *device, uint8_t *address)
+{
+  int8_t result = -1;
+  bool outstanding = false;
+  int64_t wait_until = now + 1000000;
+
+  portENTER_CRITICAL(&instance_lock);
+  for (uint8_t i = 0; i < instance_count; i++)
+  {
+    currentmon_instance &inst = instances[i];
+    if (inst.pending)
+    {
+      if ((now - inst.poll_start) > (int64_t)CURRENTMON_POLL_TIMEOUT_MS * 1000)
+      {
+        // Reply and failure never arrived (failures and exception replies are reported by
+        // ModbusRequestFailed), only a lost request gets here
+        inst.pending = false;
+        inst.failures++;
+        inst.readings.validReadings = false;
+      }
+      else
+      {
+        outstanding = true;
+      }
+    }
+  }
+
+  if (!outstanding)
+  {
+    if (now < bus_idle_until)
+    {
+      wait_until = bus_idle_until;
+    }
+    else
+    {
+      for (uint8_t n = 0; n < instance_count; n++)
+      {
+        uint8_t i = (next_index + n) % instance_count;
+        currentmon_instance &inst = instances[i];
+        if (!is_rs485(inst.device))
+        {
+          continue;
+        }
+        if (inst.next_poll <= now)
+        {
+          result = i;
+          *device = inst.device;
+          *address = inst.address;
+          inst.pending = true;
+          inst.poll_start = now;
+          inst.next_poll = now + (int64_t)CURRENTMON_POLL_INTERVAL_MS * 1000;
+          inst.polls++;
+          next_index = i + 1;
+          break;
+        }
+        if (inst.next_poll < wait_until)
+        {
+          wait_until = inst.next_poll;
+        }
+      }
+    }
+  }
+  portEXIT_CRITICAL(&instance_lock);
+
+  if (outstanding || result >= 0)
+  {
+    // Check again shortly for the reply
+    *wait_ms = 50;
+  }
+  else
+  {
+    auto ms = (uint32_t)((wait_until - now) / 1000);
+    *wait_ms = ms < 10 ? 10 : ms;
+  }
+
+  return result;
+}
+
+/// @brief Called with the result of a poll, the time the bus was busy sets the idle time after it
+void currentmon_poll_complete(uint8_t address, bool success, int64_t now)
+{
+  portENTER_CRITICAL(&instance_lock);
+  for (uint8_t i = 0; i < instance_count; i++)
+  {
+    currentmon_instance &inst = instances[i];
+    if (inst.pending && inst.address == address && is_rs485(inst.device))
+    {
+      inst.pending = false;
+      int64_t busy = now - inst.poll_start;
+      inst.busy_us = (uint32_t)busy;
+      bus_idle_until = now + busy * (100 - CURRENTMON_RS485_BUS_BUDGET_PERCENT) / CURRENTMON_RS485_BUS_BUDGET_PERCENT;
+      if (success)
+      {
+        inst.replies++;
+      }
+      else
+      {
+        inst.failures++;
+        inst.readings.validReadings = false;
+      }
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&instance_lock);
+}
+
+uint8_t currentmon_get_stats(currentmon_instance_stats *list, uint8_t listSize, int64_t now)
+{
+  uint8_t count = 0;
+  portENTER_CRITICAL(&instance_lock);
+  for (uint8_t i = 0; i < instance_count && count < listSize; i++)
+  {
+    const currentmon_instance &inst = instances[i];
+    currentmon_instance_stats &s = list[count++];
+    s.device = inst.device;
+    s.address = inst.address;
+    s.valid = inst.readings.validReadings;
+    s.stale = is_stale(inst, now);
+    s.voltage = inst.readings.modbus.voltage;
+    s.current = inst.readings.modbus.current;
+    s.power = inst.readings.modbus.power;
+    s.stateofcharge = inst.readings.stateofcharge;
+    s.polls = inst.polls;
+    s.replies = inst.replies;
+    s.failures = inst.failures;
+    s.interval_ms = inst.interval_ms;
+    s.age_ms = inst.last_reading == 0 ? 0 : (uint32_t)((now - inst.last_reading) / 1000);
+    s.busy_us = inst.busy_us;
+  }
+  portEXIT_CRITICAL(&instance_lock);
+  return count;
+}
@@ -0,0 +1,229 @@
+/*
+ ____  ____  _  _  ____  __  __  ___    _  _  __
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)  ( \/ )/. |
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \   \  /(_  _)
+(____/(____) (__) (____/(_/\/\_)(___/    \/   (_)
+
+  (c) 2017 to 2022 Stuart Pittaway
+*/
+
+#include "gzip_deflate.h"
+#include <string.h>
+#include <esp_rom_crc.h>
+
+static constexpr uint8_t HASH_BITS = 12;
+static_assert((1 << HASH_BITS) == GZIP_HASH_SIZE, "GZIP_HASH_SIZE must match HASH_BITS");
+
+static constexpr uint16_t MINIMUM_MATCH = 3;
+static constexpr uint16_t MAXIMUM_MATCH = 258;
+static constexpr uint16_t MAXIMUM_DISTANCE = 32768;
+
+// RFC 1951 3.2.5, length codes 257-285
+static const uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+// Distance codes 0-29
+static const uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                           193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                           6145, 8193, 12289, 16385, 24577};
+static const uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/// @brief Writes the deflate bit stream (least significant bit first) into a fixed buffer
+class bit_writer
+{
+public:
+    bit_writer(uint8_t *output, size_t outputLen) : output_(output), outputLen_(outputLen) {}
+
+    void putByte(uint8_t b)
+    {
+        if (used_ < outputLen_)
+        {
+            output_[used_++] = b;
+        }
+        else
+        {
+            overflow_ = true;
+        }
+    }
+
+    void putBits(uint32_t value, uint8_t count)
+    {
+        bits_ |= value << bitCount_;
+        bitCount_ += count;
+        while (bitCount_ >= 8)
+        {
+            putByte(bits_ & 0xFF);
+            bits_ >>= 8;
+            bitCount_ -= 8;
+        }
+    }
+
+    /// Huffman codes are packed starting with the most significant bit
+    void putCode(uint16_t code, uint8_t count)
+    {
+        uint16_t reversed = 0;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        putBits(reversed, count);
+    }
+
+    void alignToByte()
+    {
+        if (bitCount_ > 0)
+        {
+            putByte(bits_ & 0xFF);
+        }
+        bits_ = 0;
+        bitCount_ = 0;
+    }
+
+    void putUInt32(uint32_t value)
+    {
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            putByte((value >> (i * 8)) & 0xFF);
+        }
+    }
+
+    size_t used() const { return used_; }
+    bool overflow() const { return overflow_; }
+
+private:
+    uint8_t *output_;
+    size_t outputLen_;
+    size_t used_ = 0;
+    uint32_t bits_ = 0;
+    uint8_t bitCount_ = 0;
+    bool overflow_ = false;
+};
+
+/// @brief Fixed Huffman code for a literal/length symbol (0-287)
+static void putSymbol(bit_writer &bits, uint16_t symbol)
+{
+    if (symbol < 144)
+    {
+        bits.putCode(0x30 + symbol, 8);
+    }
+    else if (symbol < 256)
+    {
+        bits.putCode(0x190 + symbol - 144, 9);
+    }
+    else if (symbol < 280)
+    {
+        bits.putCode(symbol - 256, 7);
+    }
+    else
+    {
+        bits.putCode(0xC0 + symbol - 280, 8);
+    }
+}
+
+static void putMatch(bit_writer &bits, uint16_t length, uint16_t distance)
+{
+    uint8_t code = 28;
+    while (length_base[code] > length)
+    {
+        code--;
+    }
+    putSymbol(bits, 257 + code);
+    bits.putBits(length - length_base[code], length_extra[code]);
+
+    code = 29;
+    while (distance_base[code] > distance)
+    {
+        code--;
+    }
+    // Distance codes are all 5 bits long
+    bits.putCode(code, 5);
+    bits.putBits(distance - distance_base[code], distance_extra[code]);
+}
+
+static inline uint16_t hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (uint32_t)(v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+size_t gzip_compress(const uint8_t *input, size_t length, uint8_t *output, size_t outputLen, uint16_t *hashTable)
+{
+    if (length >= GZIP_MAXIMUM_INPUT)
+    {
+        return 0;
+    }
+
+    bit_writer bits(output, outputLen);
+
+    // Header, no file name or modification time
+    static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    for (auto b : header)
+    {
+        bits.putByte(b);
+    }
+
+    // Single final block, using fixed Huffman codes
+    bits.putBits(1, 1);
+    bits.putBits(1, 2);
+
+    // Holds position+1 of the last occurrence of each hash, zero if none
+    memset(hashTable, 0, GZIP_HASH_SIZE * sizeof(uint16_t));
+
+    size_t i = 0;
+    while (i < length && !bits.overflow())
+    {
+        uint16_t matchLength = 0;
+        uint16_t distance = 0;
+
+        if (i + MINIMUM_MATCH <= length)
+        {
+            uint16_t h = hash(&input[i]);
+            size_t candidate = hashTable[h];
+            hashTable[h] = i + 1;
+
+            if (candidate != 0 && i - (candidate - 1) <= MAXIMUM_DISTANCE)
+            {
+                candidate--;
+                size_t maximum = length - i;
+                if (maximum > MAXIMUM_MATCH)
+                {
+                    maximum = MAXIMUM_MATCH;
+                }
+                while (matchLength < maximum && input[candidate + matchLength] == input[i + matchLength])
+                {
+                    matchLength++;
+                }
+                distance = i - candidate;
+            }
+        }
+
+        if (matchLength >= MINIMUM_MATCH)
+        {
+            putMatch(bits, matchLength, distance);
+
+            // Remember the positions inside the match, so later text can refer to them
+            for (size_t j = i + 1; j < i + matchLength && j + MINIMUM_MATCH <= length; j++)
+            {
+                hashTable[hash(&input[j])] = j + 1;
+            }
+            i += matchLength;
+        }
+        else
+        {
+            putSymbol(bits, input[i]);
+            i++;
+        }
+    }
+
+    // End of block
+    putSymbol(bits, 256);
+    bits.alignToByte();
+
+    // Trailer
+    bits.putUInt32(esp_rom_crc32_le(0, input, length));
+    bits.putUInt32(length);
+
+    return bits.overflow() ? 0 : bits.used();
+}
@@ -13,6 +13,7 @@ static constexpr const char *const TAG = "diybms-influxdb";
 #include "influxdb.h"
 #include "string_utils.h"
 #include <esp_http_client.h>
+#include <stdarg.h>
 #include <string>
 
 /// Helper which encodes an integer type to a hex string.
@@ -112,144 +113,430 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-/// Maximum number of modules to generate data for in a single invocation.
-static constexpr uint8_t MAX_MODULES_PER_CALL = 16;
+// The client (and its TCP/TLS connection) is kept between writes
+static esp_http_client_handle_t http_client = nullptr;
+static volatile bool settings_changed = false;
 
-/// Generates and send module data to InfluxDB.
-void influx_task_action()
-{
+// Line protocol for one complete snapshot is built here, allocated on first use
+static char *line_buffer = nullptr;
 
-    if (!wifi_isconnected)
-    {
-        ESP_LOGE(TAG, "Influx enabled, but WIFI not connected");
-        return;
-    }
-
-    // Index of the first module to send data for, this is static to allow sending
-    // modules in smaller batches (16)
-    static uint8_t moduleIndex = 0;
-    esp_http_client_config_t config = {};
-    esp_http_client_handle_t http_client;
-    std::string authtoken;
-    std::string url;
-    std::string module_data;
-    module_data.reserve(768);
+// Samples waiting to be sent, after a network/server outage
+static store_forward_queue replay_queue("/sf_influx.bin", INFLUX_REPLAY_RAM_SIZE);
+static uint8_t sample_buffer[SF_MAX_RECORD_SIZE];
 
-    // Generate data to send to InfluxDB.
-    for (uint8_t remainingModules = MAX_MODULES_PER_CALL;
-         moduleIndex < TotalNumberOfCells() && remainingModules > 0;
-         remainingModules--, moduleIndex++)
-    {
-        // Only generate data for the module if it is valid.
-        if (cmi[moduleIndex].valid)
-        {
-            uint8_t bank = moduleIndex / mysettings.totalNumberOfSeriesModules;
-            uint8_t module_in_bank = moduleIndex - (bank * mysettings.totalNumberOfSeriesModules);
-            std::string module_id = std::to_string(bank).append("_").append(std::to_string(module_in_bank));
-            std::string module_internal_temp = std::to_string(cmi[moduleIndex].internalTemp).append("i");
-            std::string module_external_temp = std::to_string(cmi[moduleIndex].externalTemp).append("i");
-            std::string module_bypass = cmi[moduleIndex].inBypass ? "true" : "false";
-            std::string module_voltage = float_to_string(cmi[moduleIndex].voltagemV / 1000.0f);
-            /*
-                        ESP_LOGV(TAG, "Index:%d, bank:%d, module:%d, id:%s, voltage:%s, int-temp:%s, ext-temp:%s, bypass:%s",
-                                 moduleIndex, bank, module_in_bank,
-                                 module_id.c_str(),
-                                 module_voltage.c_str(),
-                                 module_internal_temp.c_str(),
-                                 module_external_temp.c_str(),
-                                 module_bypass.c_str());
-            */
-            // Data in LINE PROTOCOL format https://docs.influxdata.com/influxdb/v2.0/reference/syntax/line-protocol/
-
-            module_data.append("cells,cell=")
-                .append(module_id)
-                .append(" v=")
-                .append(module_voltage)
-                .append(",i=")
-                .append(module_internal_temp)
-                .append(",e=")
-                .append(module_external_temp)
-                .append(",b=")
-                .append(module_bypass)
-                .append("\n");
-        }
-    }
+static uint32_t influx_writes = 0;
+static uint32_t influx_failures = 0;
+static uint32_t influx_last_bytes = 0;
+static uint32_t influx_last_latency_ms = 0;
+static uint32_t influx_max_latency_ms = 0;
+static uint64_t influx_total_latency_ms = 0;
+static uint64_t influx_total_bytes = 0;
 
-    // Ensure moduleIndex remains within bounds.
-    if (moduleIndex > (TotalNumberOfCells() - 1))
-    {
-        moduleIndex = 0;
-    }
+// Allocated when compression is first used
+static uint8_t *gzip_buffer = nullptr;
+static uint16_t *gzip_hash_table = nullptr;
+static uint32_t gzip_batches = 0;
+static uint32_t gzip_fallbacks = 0;
+static uint64_t gzip_bytes_in = 0;
+static uint64_t gzip_bytes_out = 0;
+static uint64_t gzip_time_us = 0;
 
-    module_data.shrink_to_fit();
+void influx_settings_changed()
+{
+    // Client is rebuilt on the next write, by the task which owns it
+    settings_changed = true;
+}
 
-    // ESP_LOGD(TAG, "%s", module_data.c_str());
+void influx_get_stats(influx_write_stats *stats)
+{
+    stats->writes = influx_writes;
+    stats->failures = influx_failures;
+    stats->last_bytes = influx_last_bytes;
+    stats->last_latency_ms = influx_last_latency_ms;
+    stats->max_latency_ms = influx_max_latency_ms;
+    stats->average_latency_ms = influx_writes == 0 ? 0 : (uint32_t)(influx_total_latency_ms / influx_writes);
+    stats->total_bytes = influx_total_bytes;
+    stats->gzip_batches = gzip_batches;
+    stats->gzip_fallbacks = gzip_fallbacks;
+    stats->gzip_bytes_in = gzip_bytes_in;
+    stats->gzip_bytes_out = gzip_bytes_out;
+    stats->gzip_time_us = gzip_time_us;
+}
 
-    // If we did not generate any module data we can exit early, although this should never happen.
-    if (module_data.empty() || module_data.length() == 0)
+static void influx_cleanup()
+{
+    if (http_client != nullptr)
     {
-        ESP_LOGI(TAG, "No module data to send to InfluxDB");
-        return;
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_http_client_cleanup(http_client));
+        http_client = nullptr;
     }
+}
 
+/// @brief Create the HTTP client, URL and headers are only generated here (not on every write)
+static bool influx_init()
+{
     // Show URL we are logging to...
     ESP_LOGD(TAG, "URL %s", mysettings.influxdb_serverurl);
 
+    std::string url;
     url.reserve(sizeof(mysettings.influxdb_serverurl) + sizeof(mysettings.influxdb_orgid) + sizeof(mysettings.influxdb_databasebucket));
     url.append(mysettings.influxdb_serverurl);
     url.append("?org=").append(url_encode(mysettings.influxdb_orgid));
     url.append("&bucket=").append(url_encode(mysettings.influxdb_databasebucket));
-    url.shrink_to_fit();
+    // All timestamps are in seconds
+    url.append("&precision=s");
 
+    esp_http_client_config_t config = {};
     config.event_handler = http_event_handler;
     config.method = HTTP_METHOD_POST;
+    // Copied by esp_http_client_init
     config.url = url.c_str();
     config.timeout_ms = 5000;
-    // We are not going to re-use this in the next few seconds
-    config.keep_alive_enable = false;
+    // Connection is reused for the next write
+    config.keep_alive_enable = true;
 
     // Initialize http client and prepare to process the request.
     http_client = esp_http_client_init(&config);
 
     if (http_client == nullptr)
     {
-        ESP_LOGD(TAG, "esp_http_client_init return NULL");
+        ESP_LOGE(TAG, "esp_http_client_init return NULL");
+        return false;
+    }
+
+    // Set authorization header
+    std::string authtoken;
+    authtoken.reserve(sizeof(mysettings.influxdb_apitoken) + 6);
+    authtoken.append("Token ").append(mysettings.influxdb_apitoken);
+    esp_http_client_set_header(http_client, "Authorization", authtoken.c_str());
+
+    // Set Content-Encoding for the post payload
+    esp_http_client_set_header(http_client, "Content-Type", "text/plain");
+
+    return true;
+}
+
+/// @brief Append to the line buffer
+/// @return false if the buffer is full
+static bool __attribute__((format(printf, 2, 3))) appendLine(size_t &used, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(&line_buffer[used], INFLUX_BUFFER_SIZE - used, format, args);
+    va_end(args);
+
+    if (n < 0 || (size_t)n >= INFLUX_BUFFER_SIZE - used)
+    {
+        return false;
+    }
+    used += n;
+    return true;
+}
+
+/// @brief Generate line protocol for every cell, bank, the current monitor and rules, all with the sample timestamp
+/// @return false if it didn't fit in line_buffer (used is left unchanged)
+static bool influx_format_sample(const sf_sample_view &sample, size_t &used)
+{
+    // Only send our own timestamp once the clock is set, otherwise let the server use its own
+    char ts[16] = {0};
+    if (sample.header.timestamp != 0)
+    {
+        snprintf(ts, sizeof(ts), " %u", sample.header.timestamp);
+    }
+
+    size_t start = used;
+    bool ok = true;
+
+    // Data in LINE PROTOCOL format https://docs.influxdata.com/influxdb/v2.0/reference/syntax/line-protocol/
+    const uint8_t totalCells = sample.header.banks * sample.header.series;
+    for (uint8_t i = 0; i < totalCells && ok; i++)
+    {
+        const sf_sample_cell &cell = sample.cells[i];
+        // Only generate data for the module if it is valid.
+        if (cell.flags & SF_CELL_VALID)
+        {
+            uint8_t bank = i / sample.header.series;
+            uint8_t module_in_bank = i - (bank * sample.header.series);
+            ok = appendLine(used, "cells,cell=%u_%u v=%.4f,i=%ii,e=%ii,b=%s%s\n",
+                            bank, module_in_bank,
+                            cell.voltagemV / 1000.0f,
+                            cell.internalTemp,
+                            cell.externalTemp,
+                            (cell.flags & SF_CELL_BYPASS) ? "true" : "false",
+                            ts);
+        }
+    }
+
+    for (uint8_t bank = 0; bank < sample.header.banks && ok; bank++)
+    {
+        ok = appendLine(used, "banks,bank=%u v=%.4f,r=%ui%s\n", bank,
+                        sample.banks[bank].voltagemV / 1000.0f,
+                        sample.banks[bank].rangemV,
+                        ts);
+    }
+
+    if (ok && (sample.header.flags & SF_FLAG_CURRENT_VALID))
+    {
+        ok = appendLine(used, "current v=%.4f,c=%.4f,p=%.4f,soc=%.2f,in=%ui,out=%ui%s\n",
+                        sample.header.current_voltage,
+                        sample.header.current_amps,
+                        sample.header.current_power,
+                        sample.header.stateofcharge,
+                        sample.header.milliamphour_in,
+                        sample.header.milliamphour_out,
+                        ts);
+    }
+
+    if (ok)
+    {
+        // Rule outcomes as a single point, fields r0 to r16
+        ok = appendLine(used, "rules active=%ui", sample.header.active_rules);
+        for (uint8_t r = 0; r < RELAY_RULES && ok; r++)
+        {
+            ok = appendLine(used, ",r%u=%s", r, (sample.header.rules & (1UL << r)) ? "true" : "false");
+        }
+        ok = ok && appendLine(used, "%s\n", ts);
+    }
+
+    if (!ok)
+    {
+        used = start;
+    }
+    return ok;
+}
+
+/// @brief Compress the body into gzip_buffer
+/// @return Compressed length, zero if compression isn't possible (send uncompressed)
+static size_t influx_compress(const char *body, size_t length)
+{
+    if (gzip_buffer == nullptr)
+    {
+        gzip_buffer = (uint8_t *)malloc(INFLUX_GZIP_BUFFER_SIZE);
+        gzip_hash_table = (uint16_t *)malloc(GZIP_HASH_SIZE * sizeof(uint16_t));
+        if (gzip_buffer == nullptr || gzip_hash_table == nullptr)
+        {
+            ESP_LOGE(TAG, "No memory for compression");
+            free(gzip_buffer);
+            free(gzip_hash_table);
+            gzip_buffer = nullptr;
+            gzip_hash_table = nullptr;
+            return 0;
+        }
+    }
+
+    int64_t start = esp_timer_get_time();
+    size_t compressed = gzip_compress((const uint8_t *)body, length, gzip_buffer, INFLUX_GZIP_BUFFER_SIZE, gzip_hash_table);
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+    if (compressed == 0)
+    {
+        gzip_fallbacks++;
+        return 0;
+    }
+
+    gzip_batches++;
+    gzip_bytes_in += length;
+    gzip_bytes_out += compressed;
+    gzip_time_us += elapsed;
+    ESP_LOGD(TAG, "Compressed %u to %u bytes in %uus", length, compressed, elapsed);
+    return compressed;
+}
+
+/// @brief POST the body to InfluxDB using the persistent client
+static esp_err_t influx_write(const char *body, size_t length)
+{
+    if (settings_changed)
+    {
+        settings_changed = false;
+        influx_cleanup();
+    }
+
+    if (http_client == nullptr && !influx_init())
+    {
+        return ESP_FAIL;
+    }
+
+    size_t compressed = mysettings.influxdb_gzip ? influx_compress(body, length) : 0;
+    if (compressed > 0)
+    {
+        body = (const char *)gzip_buffer;
+        length = compressed;
+        esp_http_client_set_header(http_client, "Content-Encoding", "gzip");
+    }
+    else
+    {
+        esp_http_client_delete_header(http_client, "Content-Encoding");
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    // Add post data to the client.
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_http_client_set_post_field(http_client, body, length));
+
+    // Process the http request.
+    esp_err_t err = esp_http_client_perform(http_client);
+
+    uint32_t latency = (uint32_t)((esp_timer_get_time() - start) / 1000);
+
+    if (err == ESP_OK)
+    {
+        int status_code = esp_http_client_get_status_code(http_client);
+        if (status_code != 204)
+        {
+            ESP_LOGE(TAG, "HTTP error returned, status code = %d", status_code);
+            ESP_LOGD(TAG, "Content_length = %d", esp_http_client_get_content_length(http_client));
+            err = ESP_FAIL;
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Successful, %u bytes in %ums", length, latency);
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Error perform http request %s", esp_err_to_name(err));
+        // Start again with a fresh connection next time
+        influx_cleanup();
+    }
+
+    if (err == ESP_OK)
+    {
+        influx_writes++;
+        influx_last_bytes = length;
+        influx_last_latency_ms = latency;
+        influx_total_latency_ms += latency;
+        influx_total_bytes += length;
+        if (latency > influx_max_latency_ms)
+        {
+            influx_max_latency_ms = latency;
+        }
     }
     else
     {
-        // Set authorization header
-        authtoken.reserve(sizeof(mysettings.influxdb_apitoken));
-        authtoken.append("Token ").append(mysettings.influxdb_apitoken);
-        authtoken.shrink_to_fit();
-        esp_http_client_set_header(http_client, "Authorization", authtoken.c_str());
+        influx_failures++;
+    }
 
-        // Set Content-Encoding for the post payload
-        esp_http_client_set_header(http_client, "Content-Type", "text/plain");
+    return err;
+}
 
-        // Add post data to the client.
-        ESP_ERROR_CHECK(esp_http_client_set_post_field(http_client, module_data.c_str(), module_data.length()));
+/// @brief Send samples stored while InfluxDB couldn't be reached, oldest first.
+/// Limited to INFLUX_REPLAY_BATCH samples per logging interval so live data isn't delayed, each POST
+/// carries as many samples as fit in the line buffer (a single large sample fills it).
+static void influx_replay()
+{
+    uint8_t replayed = 0;
 
-        // Process the http request.
-        esp_err_t err = esp_http_client_perform(http_client);
+    while (replayed < INFLUX_REPLAY_BATCH)
+    {
+        size_t used = 0;
+        uint8_t count = 0;
 
-        if (err == ESP_OK)
+        while (replayed + count < INFLUX_REPLAY_BATCH)
         {
-            int status_code = esp_http_client_get_status_code(http_client);
-            if (status_code != 204)
+            uint16_t length = replay_queue.peek(count, sample_buffer, sizeof(sample_buffer));
+            sf_sample_view sample;
+            if (length == 0 || !sf_decode_sample(sample_buffer, length, &sample))
             {
-                ESP_LOGE(TAG, "HTTP error returned, status code = %d", status_code);
-                ESP_LOGD(TAG, "Content_length = %d", esp_http_client_get_content_length(http_client));
+                break;
             }
-            else
+            if (!influx_format_sample(sample, used))
             {
-                ESP_LOGI(TAG, "Successful");
+                // Full, this sample starts the next POST
+                break;
             }
+            count++;
         }
-        else
+
+        if (count == 0)
         {
-            ESP_LOGE(TAG, "Error perform http request %s", esp_err_to_name(err));
+            break;
         }
-        // Cleanup the http client.
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_http_client_cleanup(http_client));
+
+        int64_t start = esp_timer_get_time();
+        if (influx_write(line_buffer, used) != ESP_OK)
+        {
+            // Try again next interval
+            break;
+        }
+        replay_queue.pop(count, used, (uint32_t)((esp_timer_get_time() - start) / 1000));
+        replayed += count;
+    }
+
+    if (replayed > 0)
+    {
+        ESP_LOGI(TAG, "Replayed %u samples", replayed);
+    }
+}
+
+/// @brief Keep the sample until InfluxDB can be reached again
+static void influx_store(uint16_t length)
+{
+    // Without a timestamp the sample would be logged at the time it is replayed
+    const sf_sample_header *header = (const sf_sample_header *)sample_buffer;
+    if (header->timestamp != 0)
+    {
+        replay_queue.push(sample_buffer, length);
+    }
+}
+
+void influx_get_sf_stats(store_forward_stats *stats)
+{
+    replay_queue.getStats(stats);
+}
+
+/// Generates and send module data to InfluxDB.
+void influx_task_action()
+{
+    uint16_t length = sf_capture_sample(sample_buffer, sizeof(sample_buffer));
+    if (length == 0)
+    {
+        ESP_LOGE(TAG, "Unable to capture sample");
+        return;
+    }
+
+    if (!wifi_isconnected)
+    {
+        ESP_LOGE(TAG, "Influx enabled, but WIFI not connected");
+        influx_store(length);
+        return;
+    }
+
+    if (line_buffer == nullptr)
+    {
+        line_buffer = (char *)malloc(INFLUX_BUFFER_SIZE);
+        if (line_buffer == nullptr)
+        {
+            ESP_LOGE(TAG, "No memory for line buffer");
+            influx_store(length);
+            return;
+        }
+    }
+
+    sf_sample_view sample;
+    size_t used = 0;
+    sf_decode_sample(sample_buffer, length, &sample);
+    if (!influx_format_sample(sample, used))
+    {
+        ESP_LOGE(TAG, "Line protocol larger than %u bytes", INFLUX_BUFFER_SIZE);
+        return;
+    }
+
+    // If we did not generate any data we can exit early, although this should never happen.
+    if (used == 0)
+    {
+        ESP_LOGI(TAG, "No module data to send to InfluxDB");
+        return;
+    }
+
+    if (influx_write(line_buffer, used) != ESP_OK)
+    {
+        influx_store(length);
+        return;
+    }
+
+    // Live data has gone, now catch up with anything stored during an outage
+    if (!replay_queue.empty())
+    {
+        influx_replay();
     }
 }
@@ -74,6 +74,13 @@ extern "C"
 #include "mqtt.h"
 #include "victron_canbus.h"
 #include "pylon_canbus.h"
+#include "canbus_scheduler.h"
+#include "canbus_frames.h"
+#include "canbus_rx.h"
+#include "canbus_transport.h"
+#include "canbus_multipack.h"
+#include "modbus_master.h"
+#include "current_monitors.h"
 #include "string_utils.h"
 
 #include <SPI.h>
@@ -82,6 +89,10 @@ extern "C"
 #include "history.h"
 
 CurrentMonitorINA229 currentmon_internal = CurrentMonitorINA229();
+// Time of the last INA229 conversion ready alert, set by INA229Interrupt.  64 bits can't be
+// read in one go on the ESP32, so both sides hold the lock to avoid a torn value.
+static int64_t currentmon_internal_alert_us = 0;
+static portMUX_TYPE currentmon_alert_lock = portMUX_INITIALIZER_UNLOCKED;
 extern void randomCharacters(char *value, int length);
 const uart_port_t rs485_uart_num = UART_NUM_1;
 
@@ -100,9 +111,6 @@ bool wifi_isconnected = false;
 
 History history = History();
 
-// holds modbus data
-uint8_t frame[256];
-
 CardAction card_action = CardAction::Idle;
 
 // Screen variables in tft.cpp
@@ -116,6 +124,15 @@ extern void tftwakeup(TimerHandle_t xTimer);
 // HTTPD server handle in webserver.cpp
 extern httpd_handle_t _myserver;
 
+// Per-endpoint statistics in webserver_json_requests.cpp
+extern void writeApiRouteStats(httpd_json_writer &json);
+extern void writeHomeAssistantStats(httpd_json_writer &json);
+extern void api_scan_completed();
+
+// Static web files in the www partition, web_assets.cpp
+extern bool web_assets_init();
+extern void writeWebAssetStats(httpd_json_writer &json);
+
 wifi_eeprom_settings _wificonfig;
 
 Rules rules;
@@ -155,7 +172,6 @@ TaskHandle_t updatetftdisplay_task_handle = nullptr;
 TaskHandle_t periodic_task_handle = nullptr;
 TaskHandle_t interrupt_task_handle = nullptr;
 TaskHandle_t rs485_tx_task_handle = nullptr;
-TaskHandle_t rs485_rx_task_handle = nullptr;
 TaskHandle_t service_rs485_transmit_q_task_handle = nullptr;
 TaskHandle_t canbus_tx_task_handle = nullptr;
 TaskHandle_t canbus_rx_task_handle = nullptr;
@@ -165,10 +181,6 @@ CellModuleInfo cmi[maximum_controller_cell_modules];
 
 avrprogramsettings _avrsettings;
 
-// Number of bytes of the largest MODBUS request we make
-const uint16_t MAX_SEND_RS485_PACKET_LENGTH = 36;
-
-QueueHandle_t rs485_transmit_q_handle;
 QueueHandle_t request_q_handle;
 QueueHandle_t reply_q_handle;
 
@@ -178,6 +190,9 @@ QueueHandle_t reply_q_handle;
 #include "PacketRequestGenerator.h"
 #include "PacketReceiveProcessor.h"
 #include "webserver.h"
+#include "webserver_websocket.h"
+#include "webserver_buffer_pool.h"
+#include "webserver_metrics.h"
 
 PacketRequestGenerator prg = PacketRequestGenerator();
 PacketReceiveProcessor receiveProc = PacketReceiveProcessor();
@@ -209,6 +224,15 @@ void LED(uint8_t bits)
     // Wait until this task is triggered, when
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
+    // Push changed values to any browsers connected to the websocket
+    websocket_telemetry_snapshot();
+
+    // Copy the cells for the packed MQTT bank messages
+    mqtt_bank_snapshot();
+
+    // New scan generation for the API, Home Assistant response is regenerated on its next request
+    api_scan_completed();
+
     if (_tft_screen_available)
     {
       // Refresh the TFT display
@@ -249,6 +273,9 @@ void ConfigureRS485()
   }
 }
 
+void ProcessModbusReply(const uint8_t *frame, uint16_t len);
+void ModbusRequestFailed(uint8_t);
+
 void SetupRS485()
 {
   ESP_LOGD(TAG, "Setup RS485");
@@ -272,13 +299,16 @@ void SetupRS485()
   // Set UART1 pins(TX: IO23, RX: I022, RTS: IO18, CTS: Not used)
   ESP_ERROR_CHECK(uart_set_pin(rs485_uart_num, RS485_TX, RS485_RX, RS485_ENABLE, UART_PIN_NO_CHANGE));
 
-  // Install UART driver (we don't need an event queue here)
-  ESP_ERROR_CHECK(uart_driver_install(rs485_uart_num, 256, 256, 0, nullptr, 0));
+  // Install UART driver, the event queue signals the end of each received frame
+  QueueHandle_t uart_events = nullptr;
+  ESP_ERROR_CHECK(uart_driver_install(rs485_uart_num, 256, 256, 16, &uart_events, 0));
 
   // Set RS485 half duplex mode
   ESP_ERROR_CHECK(uart_set_mode(rs485_uart_num, uart_mode_t::UART_MODE_RS485_HALF_DUPLEX));
 
   ConfigureRS485();
+
+  modbus_master_begin(rs485_uart_num, uart_events, ProcessModbusReply, ModbusRequestFailed);
 }
 
 void mountSDCard()
@@ -853,6 +883,8 @@ void ProcessTCA9534Input_States(uint8_t v)
   }
 }
 
+void ProcessDIYBMSCurrentMonitorInternal();
+
 // Handles interrupt requests raised by ESP32 ISR routines
 [[noreturn]] void interrupt_task(void *)
 {
@@ -892,6 +924,26 @@ void ProcessTCA9534Input_States(uint8_t v)
       // The 9534 deals with internal LED outputs and spare IO on J10
       ProcessTCA9534Input_States(hal.ReadTCA9534InputRegisters());
     }
+
+    if ((ulInterruptStatus & ISRTYPE::INA229) != 0x00)
+    {
+      // INA229 has finished a conversion, read it straight away so the ALERT pin is released
+      if (mysettings.currentMonitoringEnabled == true &&
+          mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL &&
+          currentmon_internal.Available())
+      {
+        portENTER_CRITICAL(&currentmon_alert_lock);
+        int64_t alert_us = currentmon_internal_alert_us;
+        portEXIT_CRITICAL(&currentmon_alert_lock);
+
+        if (hal.GetVSPIMutex())
+        {
+          currentmon_internal.TakeReadings(alert_us);
+          ProcessDIYBMSCurrentMonitorInternal();
+          hal.ReleaseVSPIMutex();
+        }
+      }
+    }
   }
 }
 
@@ -924,6 +976,15 @@ void IRAM_ATTR TCA9534AInterrupt()
 {
   InterruptTrigger(ISRTYPE::TCA9534);
 }
+// Triggered when INA229 ALERT pin goes LOW (conversion ready)
+void IRAM_ATTR INA229Interrupt()
+{
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL_ISR(&currentmon_alert_lock);
+  currentmon_internal_alert_us = now;
+  portEXIT_CRITICAL_ISR(&currentmon_alert_lock);
+  InterruptTrigger(ISRTYPE::INA229);
+}
 
 const char *packetType(uint8_t cmd)
 {
@@ -1356,6 +1417,10 @@ void pulse_relay_off(const TimerHandle_t)
     // Run the rules
     ProcessRules();
 
+    // Combine with the other packs (multi-pack), then encode the outgoing CAN frames from this snapshot
+    multipack_update();
+    canbus_frames_rebuild();
+
     RelayState relay[RELAY_TOTAL];
 
     // Set defaults based on configuration
@@ -1869,35 +1934,6 @@ void wifi_init_sta(void)
   ESP_LOGD(TAG, "wifi_init_sta finished");
 }
 
-uint16_t calculateCRC(const uint8_t *f, uint8_t bufferSize)
-{
-  uint16_t flag;
-  uint16_t temp;
-  temp = 0xFFFF;
-  for (unsigned char i = 0; i < bufferSize; i++)
-  {
-    temp = temp ^ f[i];
-    for (unsigned char j = 1; j <= 8; j++)
-    {
-      flag = temp & 0x0001;
-      temp >>= 1;
-      if (flag)
-        temp ^= 0xA001;
-    }
-  }
-
-  return temp;
-/*
-  // Reverse byte order.
-  uint16_t temp2 = temp >> 8;
-  temp = (temp << 8) | temp2;
-  temp &= 0xFFFF;
-  // the returned value is already swapped
-  // crcLo byte is first & crcHi byte is last
-  return temp;
-  */
-}
-
 uint8_t SetMobusRegistersFromFloat(uint8_t *cmd, uint8_t ptr, float value)
 {
   FloatUnionType fut;
@@ -1937,7 +1973,7 @@ void PZEM017_SetShuntType(uint8_t modbusAddress, uint16_t shuntMaxCurrent)
     break;
   }
 
-  uint8_t cmd[MAX_SEND_RS485_PACKET_LENGTH];
+  uint8_t cmd[MODBUS_MAX_REQUEST_LENGTH];
   memset(&cmd, 0, sizeof(cmd));
 
   cmd[0] = modbusAddress;
@@ -1950,8 +1986,8 @@ void PZEM017_SetShuntType(uint8_t modbusAddress, uint16_t shuntMaxCurrent)
 
   ESP_LOGD(TAG, "Set PZEM017 max current %uA=%u", shuntMaxCurrent, shuntType);
 
-  // Blocking call
-  xQueueSend(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
+  // Waits for space in the request queue (MODBUS_REQUEST_QUEUE_TIMEOUT_MS)
+  modbus_send_request(cmd, sizeof(cmd));
 
   // Zero all data
   memset(&currentMonitor, 0, sizeof(currentmonitoring_struct));
@@ -1964,7 +2000,7 @@ void PZEM017_SetDeviceAddress(uint8_t newAddress)
   // the special "broadcast" address of 0xF8.  Technically the PZEM devices
   // support multiple devices on same RS485 bus, but DIYBMS doesn't....
 
-  uint8_t cmd[MAX_SEND_RS485_PACKET_LENGTH];
+  uint8_t cmd[MODBUS_MAX_REQUEST_LENGTH];
   memset(&cmd, 0, sizeof(cmd));
 
   // The configuration address (only 1 PZEM device can be connected)
@@ -1983,14 +2019,14 @@ void PZEM017_SetDeviceAddress(uint8_t newAddress)
   // Zero all data
   memset(&currentMonitor, 0, sizeof(currentmonitoring_struct));
   currentMonitor.validReadings = false;
-  xQueueSend(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
+  modbus_send_request(cmd, sizeof(cmd));
 }
 
 void currentMon_ConfigureBasic(uint16_t shuntmv, uint16_t shuntmaxcur, uint16_t batterycapacity, float fullchargevolt, float tailcurrent, float chargeefficiency)
 {
   auto chargeeff = (uint16_t)(chargeefficiency * 100.0F);
 
-  uint8_t cmd[MAX_SEND_RS485_PACKET_LENGTH];
+  uint8_t cmd[MODBUS_MAX_REQUEST_LENGTH];
   memset(&cmd, 0, sizeof(cmd));
 
   //	Write Multiple Holding Registers
@@ -2035,21 +2071,21 @@ void currentMon_ConfigureBasic(uint16_t shuntmv, uint16_t shuntmaxcur, uint16_t
   ptr = SetMobusRegistersFromFloat(cmd2, ptr, tailcurrent);
 
   memcpy(&cmd, &cmd2, sizeof(cmd2));
-  xQueueSend(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
+  modbus_send_request(cmd, sizeof(cmd));
 
   // Zero all data
   // memset(&currentMonitor, 0, sizeof(currentmonitoring_struct));
   currentMonitor.validReadings = false;
 }
 
-void currentMon_SetSOC(float newSOC)
+bool currentMon_SetSOC(uint8_t address, float newSOC)
 {
   auto value = (uint16_t)(newSOC * 100);
 
   //	Write Multiple Holding Registers
   uint8_t cmd2[] = {
       // The Slave Address
-      mysettings.currentMonitoringModBusAddress,
+      address,
       // The Function Code 16
       16,
       // Data Address of the first register (zero based so 26 = register 40027)
@@ -2065,15 +2101,15 @@ void currentMon_SetSOC(float newSOC)
       (uint8_t)(value >> 8),
       (uint8_t)(value & 0xFF)};
 
-  xQueueSend(rs485_transmit_q_handle, &cmd2, portMAX_DELAY);
+  return modbus_send_request(cmd2, sizeof(cmd2));
 }
 
-void currentMon_ResetDailyAmpHourCounters()
+bool currentMon_ResetDailyAmpHourCounters(uint8_t address)
 {
   //	Write Multiple Holding Registers
   uint8_t cmd2[] = {
       // The Slave Address
-      mysettings.currentMonitoringModBusAddress,
+      address,
       // The Function Code 16
       16,
       // Data Address of the first register (zero based so 11 = register 40012)
@@ -2095,52 +2131,73 @@ void currentMon_ResetDailyAmpHourCounters()
       0,
       0};
 
-  xQueueSend(rs485_transmit_q_handle, &cmd2, portMAX_DELAY);
+  return modbus_send_request(cmd2, sizeof(cmd2));
 }
 
 bool CurrentMonitorSetSOC(float newSOC)
 {
+  bool result = false;
   if (mysettings.currentMonitoringEnabled == true)
   {
     ESP_LOGI(TAG, "Set SOC");
-    if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
+    // Every monitor which counts charge, each shunt measures its share of the pack
+    CurrentMonitorDevice device;
+    uint8_t address;
+    for (uint8_t i = 0; currentmon_identity(i, &device, &address); i++)
     {
-      currentMon_SetSOC(newSOC);
-      return true;
-    }
+      if (device == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
+      {
+        if (currentMon_SetSOC(address, newSOC))
+        {
+          result = true;
+        }
+      }
 
-    if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
-    {
-      auto value = (uint16_t)(newSOC * 100);
-      currentmon_internal.SetSOC(value);
-      return true;
+      if (device == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
+      {
+        auto value = (uint16_t)(newSOC * 100);
+        currentmon_internal.SetSOC(value);
+        result = true;
+      }
     }
   }
 
-  return false;
+  return result;
 }
 
 bool CurrentMonitorResetDailyAmpHourCounters()
 {
+  bool result = false;
   if (mysettings.currentMonitoringEnabled == true)
   {
     ESP_LOGI(TAG, "Reset daily Ah counter");
-    if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
+    if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS ||
+        mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
     {
+      // Combined daily amp hours of all the monitors
       mysettings.numberofbatterycycles += currentMonitor.modbus.daily_milliamphour_out / mysettings.currentMonitoring_batterycapacity;
       saveConfiguration();
-      currentMon_ResetDailyAmpHourCounters();
-      return true;
     }
-    if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
+
+    CurrentMonitorDevice device;
+    uint8_t address;
+    for (uint8_t i = 0; currentmon_identity(i, &device, &address); i++)
     {
-      mysettings.numberofbatterycycles += currentmon_internal.calc_daily_milliamphour_out() / mysettings.currentMonitoring_batterycapacity;
-      saveConfiguration();
-      currentmon_internal.ResetDailyAmpHourCounters();
-      return true;
+      if (device == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
+      {
+        if (currentMon_ResetDailyAmpHourCounters(address))
+        {
+          result = true;
+        }
+      }
+      if (device == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
+      {
+        currentmon_internal.ResetDailyAmpHourCounters();
+        result = true;
+      }
     }
   }
-  return false;
+  return result;
 }
 
 void CurrentMonitorSetBasicSettings(uint16_t shuntmv, uint16_t shuntmaxcur, uint16_t batterycapacity, float fullchargevolt, float vbus_divider, float tailcurrent, float chargeefficiency)
@@ -2266,7 +2323,7 @@ Flag 2
 3|Relay Trigger on POL|Read write
 */
 
-  uint8_t cmd[MAX_SEND_RS485_PACKET_LENGTH];
+  uint8_t cmd[MODBUS_MAX_REQUEST_LENGTH];
   memset(&cmd, 0, sizeof(cmd));
 
   //	Write Multiple Holding Registers
@@ -2287,7 +2344,7 @@ Flag 2
   cmd[7] = flag1;
   cmd[8] = flag2;
 
-  xQueueSend(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
+  modbus_send_request(cmd, sizeof(cmd));
 
   ESP_LOGD(TAG, "Write register 10 = %u %u", flag1, flag2);
 
@@ -2433,10 +2490,10 @@ void currentMon_ConfigureAdvancedExternal(currentmonitoring_struct newvalues)
   ptr = SetMobusRegistersFromFloat(cmd2, ptr, newvalues.modbus.undercurrentlimit);
   ptr = SetMobusRegistersFromFloat(cmd2, ptr, newvalues.modbus.overpowerlimit);
 
-  uint8_t cmd[MAX_SEND_RS485_PACKET_LENGTH];
+  uint8_t cmd[MODBUS_MAX_REQUEST_LENGTH];
   memset(&cmd, 0, sizeof(cmd));
   memcpy(&cmd, &cmd2, sizeof(cmd2));
-  xQueueSend(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
+  modbus_send_request(cmd, sizeof(cmd));
 }
 
 // Save the current monitor advanced settings back to the device over MODBUS/RS485
@@ -2491,6 +2548,15 @@ void CurrentMonitorSetAdvancedSettings(currentmonitoring_struct newvalues)
   currentMonitor.validReadings = false;
 }
 
+// Combine the readings of all the current monitors into currentMonitor
+void UpdateCurrentMonitorAggregate()
+{
+  currentmonitoring_struct total;
+  currentmon_aggregate(&total, esp_timer_get_time());
+  currentMonitor = total;
+  TimeToSoCCalculation();
+}
+
 // Swap the two 16 bit words in a 32bit word
 static inline unsigned int word16swap32(unsigned int __bsx)
 {
@@ -2498,7 +2564,7 @@ static inline unsigned int word16swap32(unsigned int __bsx)
 }
 
 // Extract the current monitor MODBUS registers into our internal STRUCTURE variables
-void ProcessDIYBMSCurrentMonitorRegisterReply(uint8_t length)
+void ProcessDIYBMSCurrentMonitorRegisterReply(currentmonitoring_struct &cm, const uint8_t *frame, uint8_t length)
 {
   // ESP_LOGD(TAG, "Modbus len=%i, struct len=%i", length, sizeof(currentmonitor_raw_modbus));
 
@@ -2507,13 +2573,13 @@ void ProcessDIYBMSCurrentMonitorRegisterReply(uint8_t length)
   if (sizeof(currentmonitor_raw_modbus) != length)
   {
     // Abort if the packet sizes are different
-    memset(&currentMonitor.modbus, 0, sizeof(currentmonitor_raw_modbus));
-    currentMonitor.validReadings = false;
+    memset(&cm.modbus, 0, sizeof(currentmonitor_raw_modbus));
+    cm.validReadings = false;
     return;
   }
 
   // Now byte swap to align to ESP32 endiness, and copy as we go into new structure
-  auto *ptr = (uint8_t *)&currentMonitor.modbus;
+  auto *ptr = (uint8_t *)&cm.modbus;
   for (size_t i = 0; i < length; i += 2)
   {
     uint8_t temp = frame[3 + i];
@@ -2522,21 +2588,21 @@ void ProcessDIYBMSCurrentMonitorRegisterReply(uint8_t length)
   }
 
   // Finally, we have to fix the 32 bit fields
-  currentMonitor.modbus.milliamphour_out = word16swap32(currentMonitor.modbus.milliamphour_out);
-  currentMonitor.modbus.milliamphour_in = word16swap32(currentMonitor.modbus.milliamphour_in);
-  currentMonitor.modbus.daily_milliamphour_out = word16swap32(currentMonitor.modbus.daily_milliamphour_out);
-  currentMonitor.modbus.daily_milliamphour_in = word16swap32(currentMonitor.modbus.daily_milliamphour_in);
-  currentMonitor.modbus.firmwareversion = word16swap32(currentMonitor.modbus.firmwareversion);
-  currentMonitor.modbus.firmwaredatetime = word16swap32(currentMonitor.modbus.firmwaredatetime);
+  cm.modbus.milliamphour_out = word16swap32(cm.modbus.milliamphour_out);
+  cm.modbus.milliamphour_in = word16swap32(cm.modbus.milliamphour_in);
+  cm.modbus.daily_milliamphour_out = word16swap32(cm.modbus.daily_milliamphour_out);
+  cm.modbus.daily_milliamphour_in = word16swap32(cm.modbus.daily_milliamphour_in);
+  cm.modbus.firmwareversion = word16swap32(cm.modbus.firmwareversion);
+  cm.modbus.firmwaredatetime = word16swap32(cm.modbus.firmwaredatetime);
 
-  // ESP_LOG_BUFFER_HEXDUMP(TAG, &currentMonitor.modbus, sizeof(currentmonitor_raw_modbus), esp_log_level_t::ESP_LOG_DEBUG);
+  // ESP_LOG_BUFFER_HEXDUMP(TAG, &cm.modbus, sizeof(currentmonitor_raw_modbus), esp_log_level_t::ESP_LOG_DEBUG);
 
-  currentMonitor.timestamp = esp_timer_get_time();
+  cm.timestamp = esp_timer_get_time();
 
   // High byte
-  auto flag1 = (uint8_t)(currentMonitor.modbus.flags >> 8);
+  auto flag1 = (uint8_t)(cm.modbus.flags >> 8);
   // Low byte
-  auto flag2 = (uint8_t)(currentMonitor.modbus.flags);
+  auto flag2 = (uint8_t)(cm.modbus.flags);
 
   // ESP_LOGD(TAG, "Read relay trigger settings %u %u", flag1, flag2);
 
@@ -2551,15 +2617,15 @@ void ProcessDIYBMSCurrentMonitorRegisterReply(uint8_t length)
 9|ADC Range 0=±163.84 mV, 1=±40.96 mV (only 40.96mV supported by diyBMS)|Read only
 */
 
-  currentMonitor.TemperatureOverLimit = flag1 & bit(DIAG_ALRT_FIELD::TMPOL);
-  currentMonitor.CurrentOverLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTOL);
-  currentMonitor.CurrentUnderLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTUL);
-  currentMonitor.VoltageOverlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSOL);
-  currentMonitor.VoltageUnderlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSUL);
-  currentMonitor.PowerOverLimit = flag1 & bit(DIAG_ALRT_FIELD::POL);
+  cm.TemperatureOverLimit = flag1 & bit(DIAG_ALRT_FIELD::TMPOL);
+  cm.CurrentOverLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTOL);
+  cm.CurrentUnderLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTUL);
+  cm.VoltageOverlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSOL);
+  cm.VoltageUnderlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSUL);
+  cm.PowerOverLimit = flag1 & bit(DIAG_ALRT_FIELD::POL);
 
-  currentMonitor.TempCompEnabled = flag1 & B00000010;
-  currentMonitor.ADCRange4096mV = flag1 & B00000001;
+  cm.TempCompEnabled = flag1 & B00000010;
+  cm.ADCRange4096mV = flag1 & B00000001;
 
   /*
 8|Relay Trigger on TMPOL|Read write
@@ -2571,36 +2637,45 @@ void ProcessDIYBMSCurrentMonitorRegisterReply(uint8_t length)
 2|Existing Relay state (0=off)|Read write
 1|Factory reset bit (always 0 when read)|Read write
 */
-  currentMonitor.RelayTriggerTemperatureOverLimit = flag2 & bit(DIAG_ALRT_FIELD::TMPOL);
-  currentMonitor.RelayTriggerCurrentOverLimit = flag2 & bit(DIAG_ALRT_FIELD::SHNTOL);
-  currentMonitor.RelayTriggerCurrentUnderLimit = flag2 & bit(DIAG_ALRT_FIELD::SHNTUL);
-  currentMonitor.RelayTriggerVoltageOverlimit = flag2 & bit(DIAG_ALRT_FIELD::BUSOL);
-  currentMonitor.RelayTriggerVoltageUnderlimit = flag2 & bit(DIAG_ALRT_FIELD::BUSUL);
-  currentMonitor.RelayTriggerPowerOverLimit = flag2 & bit(DIAG_ALRT_FIELD::POL);
-  currentMonitor.RelayState = flag2 & B00000010;
+  cm.RelayTriggerTemperatureOverLimit = flag2 & bit(DIAG_ALRT_FIELD::TMPOL);
+  cm.RelayTriggerCurrentOverLimit = flag2 & bit(DIAG_ALRT_FIELD::SHNTOL);
+  cm.RelayTriggerCurrentUnderLimit = flag2 & bit(DIAG_ALRT_FIELD::SHNTUL);
+  cm.RelayTriggerVoltageOverlimit = flag2 & bit(DIAG_ALRT_FIELD::BUSOL);
+  cm.RelayTriggerVoltageUnderlimit = flag2 & bit(DIAG_ALRT_FIELD::BUSUL);
+  cm.RelayTriggerPowerOverLimit = flag2 & bit(DIAG_ALRT_FIELD::POL);
+  cm.RelayState = flag2 & B00000010;
   // Last bit is for factory reset (always zero)
 
-  currentMonitor.chargeefficiency = ((float)currentMonitor.modbus.raw_chargeefficiency) / 100.0F;
-  currentMonitor.stateofcharge = ((float)currentMonitor.modbus.raw_stateofcharge) / 100.0F;
+  cm.chargeefficiency = ((float)cm.modbus.raw_chargeefficiency) / 100.0F;
+  cm.stateofcharge = ((float)cm.modbus.raw_stateofcharge) / 100.0F;
 
-  currentMonitor.validReadings = true;
-
-  TimeToSoCCalculation();
+  cm.validReadings = true;
 }
 
 // Extract onboard/internal current monitor values into our internal STRUCTURE variables
 void ProcessDIYBMSCurrentMonitorInternal()
 {
-  memset(&currentMonitor.modbus, 0, sizeof(currentmonitor_raw_modbus));
-  currentMonitor.validReadings = false;
+  int8_t index = currentmon_find(CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL);
+  if (index < 0)
+  {
+    return;
+  }
+
+  currentmonitoring_struct cm;
+  memset(&cm, 0, sizeof(currentmonitoring_struct));
 
-  currentMonitor.timestamp = esp_timer_get_time();
-  currentMonitor.modbus.milliamphour_out = currentmon_internal.calc_milliamphour_out();
-  currentMonitor.modbus.milliamphour_in = currentmon_internal.calc_milliamphour_in();
-  currentMonitor.modbus.daily_milliamphour_out = currentmon_internal.calc_daily_milliamphour_out();
-  currentMonitor.modbus.daily_milliamphour_in = currentmon_internal.calc_daily_milliamphour_in();
-  currentMonitor.modbus.firmwareversion = (((uint32_t)GIT_VERSION_B1) << 16) + (uint32_t)GIT_VERSION_B2;
-  currentMonitor.modbus.firmwaredatetime = COMPILE_DATE_TIME_UTC_EPOCH;
+  cm.timestamp = esp_timer_get_time();
+
+  // Lifetime totals (not reset by SOC calibration), from one copy taken under the counter lock as
+  // the 64 bit counts are updated by the current monitor task
+  coulomb_counter totals;
+  currentmon_internal.GetCoulombCounter(&totals);
+  cm.modbus.milliamphour_out = coulomb_counter_mAh(totals.out_nC);
+  cm.modbus.milliamphour_in = coulomb_counter_mAh(totals.in_nC);
+  cm.modbus.daily_milliamphour_out = coulomb_counter_mAh(totals.out_nC - totals.daily_out_nC);
+  cm.modbus.daily_milliamphour_in = coulomb_counter_mAh(totals.in_nC - totals.daily_in_nC);
+  cm.modbus.firmwareversion = (((uint32_t)GIT_VERSION_B1) << 16) + (uint32_t)GIT_VERSION_B2;
+  cm.modbus.firmwaredatetime = COMPILE_DATE_TIME_UTC_EPOCH;
 
   /*
 16|TMPOL|Read only
@@ -2613,218 +2688,90 @@ void ProcessDIYBMSCurrentMonitorInternal()
 9|ADC Range 0=±163.84 mV, 1=±40.96 mV (only 40.96mV supported by diyBMS)|Read only
 */
   uint16_t flag1 = currentmon_internal.calc_alerts();
-  currentMonitor.TemperatureOverLimit = flag1 & bit(DIAG_ALRT_FIELD::TMPOL);
-  currentMonitor.CurrentOverLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTOL);
-  currentMonitor.CurrentUnderLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTUL);
-  currentMonitor.VoltageOverlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSOL);
-  currentMonitor.VoltageUnderlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSUL);
-  currentMonitor.PowerOverLimit = flag1 & bit(DIAG_ALRT_FIELD::POL);
-
-  currentMonitor.TempCompEnabled = currentmon_internal.calc_tempcompenabled();
-  currentMonitor.ADCRange4096mV = true;
+  cm.TemperatureOverLimit = flag1 & bit(DIAG_ALRT_FIELD::TMPOL);
+  cm.CurrentOverLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTOL);
+  cm.CurrentUnderLimit = flag1 & bit(DIAG_ALRT_FIELD::SHNTUL);
+  cm.VoltageOverlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSOL);
+  cm.VoltageUnderlimit = flag1 & bit(DIAG_ALRT_FIELD::BUSUL);
+  cm.PowerOverLimit = flag1 & bit(DIAG_ALRT_FIELD::POL);
+
+  cm.TempCompEnabled = currentmon_internal.calc_tempcompenabled();
+  cm.ADCRange4096mV = true;
   // mysettings.currentMonitoring_tempcompenabled = currentmon_internal.calc_tempcompenabled();
 
-  currentMonitor.RelayTriggerTemperatureOverLimit = false;
-  currentMonitor.RelayTriggerCurrentOverLimit = false;
-  currentMonitor.RelayTriggerCurrentUnderLimit = false;
-  currentMonitor.RelayTriggerVoltageOverlimit = false;
-  currentMonitor.RelayTriggerVoltageUnderlimit = false;
-  currentMonitor.RelayTriggerPowerOverLimit = false;
-  currentMonitor.RelayState = false;
-
-  currentMonitor.modbus.temperature = currentmon_internal.calc_temperature();
-  currentMonitor.modbus.temperaturelimit = currentmon_internal.calc_temperaturelimit();
-  currentMonitor.modbus.shunttempcoefficient = currentmon_internal.calc_shunttempcoefficient();
-  currentMonitor.modbus.batterycapacityamphour = currentmon_internal.calc_batterycapacityAh();
-  currentMonitor.modbus.shuntmaxcurrent = currentmon_internal.calc_shuntmaxcurrent();
-  currentMonitor.modbus.shuntmillivolt = currentmon_internal.calc_shuntmillivolt();
-  currentMonitor.modbus.shuntcal = currentmon_internal.calc_shuntcalibration();
-  currentMonitor.modbus.modelnumber = 0x229;
-  currentMonitor.modbus.power = currentmon_internal.calc_power();
-  currentMonitor.modbus.overpowerlimit = currentmon_internal.calc_overpowerlimit();
-  currentMonitor.modbus.voltage = currentmon_internal.calc_voltage();
-  currentMonitor.modbus.current = currentmon_internal.calc_current();
-  currentMonitor.modbus.shuntresistance = currentmon_internal.calc_shuntresistance();
-  currentMonitor.modbus.tailcurrentamps = currentmon_internal.calc_tailcurrentamps();
-  currentMonitor.chargeefficiency = currentmon_internal.calc_charge_efficiency_factor();
-  currentMonitor.stateofcharge = currentmon_internal.calc_state_of_charge();
-  currentMonitor.modbus.fullychargedvoltage = currentmon_internal.calc_fullychargedvoltage();
-  currentMonitor.modbus.overvoltagelimit = currentmon_internal.calc_overvoltagelimit();
-  currentMonitor.modbus.undervoltagelimit = currentmon_internal.calc_undervoltagelimit();
-  currentMonitor.modbus.overcurrentlimit = currentmon_internal.calc_overcurrentlimit();
-  currentMonitor.modbus.undercurrentlimit = currentmon_internal.calc_undercurrentlimit();
-
-  currentMonitor.validReadings = true;
-  TimeToSoCCalculation();
+  cm.RelayTriggerTemperatureOverLimit = false;
+  cm.RelayTriggerCurrentOverLimit = false;
+  cm.RelayTriggerCurrentUnderLimit = false;
+  cm.RelayTriggerVoltageOverlimit = false;
+  cm.RelayTriggerVoltageUnderlimit = false;
+  cm.RelayTriggerPowerOverLimit = false;
+  cm.RelayState = false;
+
+  cm.modbus.temperature = currentmon_internal.calc_temperature();
+  cm.modbus.temperaturelimit = currentmon_internal.calc_temperaturelimit();
+  cm.modbus.shunttempcoefficient = currentmon_internal.calc_shunttempcoefficient();
+  cm.modbus.batterycapacityamphour = currentmon_internal.calc_batterycapacityAh();
+  cm.modbus.shuntmaxcurrent = currentmon_internal.calc_shuntmaxcurrent();
+  cm.modbus.shuntmillivolt = currentmon_internal.calc_shuntmillivolt();
+  cm.modbus.shuntcal = currentmon_internal.calc_shuntcalibration();
+  cm.modbus.modelnumber = 0x229;
+  cm.modbus.power = currentmon_internal.calc_power();
+  cm.modbus.overpowerlimit = currentmon_internal.calc_overpowerlimit();
+  cm.modbus.voltage = currentmon_internal.calc_voltage();
+  cm.modbus.current = currentmon_internal.calc_current();
+  cm.modbus.shuntresistance = currentmon_internal.calc_shuntresistance();
+  cm.modbus.tailcurrentamps = currentmon_internal.calc_tailcurrentamps();
+  cm.chargeefficiency = currentmon_internal.calc_charge_efficiency_factor();
+  cm.stateofcharge = currentmon_internal.calc_state_of_charge();
+  cm.modbus.fullychargedvoltage = currentmon_internal.calc_fullychargedvoltage();
+  cm.modbus.overvoltagelimit = currentmon_internal.calc_overvoltagelimit();
+  cm.modbus.undervoltagelimit = currentmon_internal.calc_undervoltagelimit();
+  cm.modbus.overcurrentlimit = currentmon_internal.calc_overcurrentlimit();
+  cm.modbus.undercurrentlimit = currentmon_internal.calc_undercurrentlimit();
+
+  cm.validReadings = true;
+
+  currentmon_store(index, cm);
+  UpdateCurrentMonitorAggregate();
 
   /*
-  ESP_LOGD(TAG, "WDog = %u", currentMonitor.modbus.watchdogcounter);
-  ESP_LOGD(TAG, "SOC = %i", currentMonitor.stateofcharge);
+  ESP_LOGD(TAG, "WDog = %u", cm.modbus.watchdogcounter);
+  ESP_LOGD(TAG, "SOC = %i", cm.stateofcharge);
 
-  ESP_LOGD(TAG, "Volt = %f", currentMonitor.modbus.voltage);
-  ESP_LOGD(TAG, "Curr = %f", currentMonitor.modbus.current);
-  ESP_LOGD(TAG, "Temp = %i", currentMonitor.modbus.temperature);
+  ESP_LOGD(TAG, "Volt = %f", cm.modbus.voltage);
+  ESP_LOGD(TAG, "Curr = %f", cm.modbus.current);
+  ESP_LOGD(TAG, "Temp = %i", cm.modbus.temperature);
 
-  ESP_LOGD(TAG, "Out = %f", currentMonitor.modbus.milliamphour_in);
-  ESP_LOGD(TAG, "In = %f", currentMonitor.modbus.milliamphour_out);
+  ESP_LOGD(TAG, "Out = %f", cm.modbus.milliamphour_in);
+  ESP_LOGD(TAG, "In = %f", cm.modbus.milliamphour_out);
 
-  ESP_LOGD(TAG, "Ver = %x", currentMonitor.modbus.firmwareversion);
-  ESP_LOGD(TAG, "Date = %u", currentMonitor.modbus.firmwaredatetime);
+  ESP_LOGD(TAG, "Ver = %x", cm.modbus.firmwareversion);
+  ESP_LOGD(TAG, "Date = %u", cm.modbus.firmwaredatetime);
 */
 }
-/// ESP32 CAN bus status strings, used for periodic status reporting
-static const char *ESP32_TWAI_STATUS_STRINGS[] = {
-    "STOPPED",               // CAN_STATE_STOPPED
-    "RUNNING",               // CAN_STATE_RUNNING
-    "OFF / RECOVERY NEEDED", // CAN_STATE_BUS_OFF
-    "RECOVERY UNDERWAY"      // CAN_STATE_RECOVERING
-};
-
-void send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const uint8_t length)
-{
-  twai_message_t message;
-  message.identifier = identifier;
-  message.flags = TWAI_MSG_FLAG_NONE;
-  if(identifier > 0x7FF)message.flags = TWAI_MSG_FLAG_EXTD;
-  message.data_length_code = length;
-
-  memcpy(&message.data, buffer, length);
-
-  // If there is a bus error, we attempt to recover it later, transmitted messages are lost, but this
-  // isn't a problem, as they are repeated every few seconds.
-  esp_err_t result = twai_transmit(&message, pdMS_TO_TICKS(250));
-
-  if (result == ESP_OK)
-  {
-    // Everything normal/good
-    ESP_LOGD(TAG, "Sent CAN message 0x%x", identifier);
-    // ESP_LOG_BUFFER_HEX_LEVEL(TAG, &message, sizeof(twai_message_t), esp_log_level_t::ESP_LOG_DEBUG);
-    canbus_messages_sent++;
-    return;
-  }
-
-  // Something failed....
-  ESP_LOGE(TAG, "Failed to queue CANBUS message (0x%x)", result);
-  canbus_messages_failed_sent++;
-
-  twai_status_info_t status;
-  twai_get_status_info(&status);
-
-  ESP_LOGI(TAG, "CAN STATUS: rx-q:%d, tx-q:%d, rx-err:%d, tx-err:%d, arb-lost:%d, bus-err:%d, state: %s",
-           status.msgs_to_rx, status.msgs_to_tx,
-           status.rx_error_counter, status.tx_error_counter,
-           status.arb_lost_count,
-           status.bus_error_count,
-           ESP32_TWAI_STATUS_STRINGS[status.state]);
-
-  if (status.state == twai_state_t::TWAI_STATE_BUS_OFF)
-  {
-    // When the bus is OFF we need to initiate recovery, transmit is not possible when in this state.
-    // Recovery appears to force it into STOPPED state
-    ESP_LOGW(TAG, "Initiating recovery");
-    twai_initiate_recovery();
-  }
-  else if (status.state == twai_state_t::TWAI_STATE_STOPPED)
-  {
-    // bus has stopped - restart it
-    esp_err_t startresult = twai_start();
-    ESP_LOGI(TAG, "Starting CANBUS %s", esp_err_to_name(startresult));
-  }
-  else if (status.state == twai_state_t::TWAI_STATE_RECOVERING)
-  {
-    // when the bus is in recovery mode transmit is not possible, so wait...
-    vTaskDelay(pdMS_TO_TICKS(250));
-  }
-}
-
-
-
 [[noreturn]] void canbus_tx(void *)
 {
   for (;;)
   {
-    // Delay 1 second
-    vTaskDelay(pdMS_TO_TICKS(1000));
-
-    if (mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_PYLONTECH)
+    // The driver can't be used while canbus_rx reinstalls it for a new protocol
+    if (!hal.GetCANMutex())
     {
-      // Pylon Tech Battery Emulation
-      // https://github.com/PaulSturbo/DIY-BMS-CAN/blob/main/SEPLOS%20BMS%20CAN%20Protocoll%20V1.0.pdf
-      // https://www.setfirelabs.com/green-energy/pylontech-can-reading-can-replication
-      // https://github.com/juamiso/PYLON_EMU
-      // https://www.studocu.com/row/document/abasyn-university/electronics-engineering/can-bus-protocol-pylon-low-voltage-v1/17205338
-
-      /*
-      PYLON TECH battery transmits these values....
-
-      CAN ID – followed by 2 to 8 bytes of data:
-      0x351 – 14 02 74 0E 74 0E CC 01 – Battery voltage + current limits
-      0x355 – 1A 00 64 00 – State of Health (SOH) / State of Charge (SOC)
-      0x356 – 4e 13 02 03 04 05 – Voltage / Current / Temp
-      0x359 – 00 00 00 00 0A 50 4E – Protection & Alarm flags
-      0x35C – C0 00 – Battery charge request flags
-      0x35E – 50 59 4C 4F 4E 20 20 20 – Manufacturer name (“PYLON “)
-
-      If you are watching the bus, you will also see a 0x305 ID message which is output by the inverter once per second.
-*/
-      pylon_message_351();
-      vTaskDelay(pdMS_TO_TICKS(20));
-
-      if (_controller_state == ControllerState::Running)
-      {
-        pylon_message_355();
-        vTaskDelay(pdMS_TO_TICKS(20));
-        pylon_message_356();
-        vTaskDelay(pdMS_TO_TICKS(20));
-      }
-      pylon_message_359();
-      vTaskDelay(pdMS_TO_TICKS(20));
-      pylon_message_35c();
-      vTaskDelay(pdMS_TO_TICKS(20));
-      pylon_message_35e();
-      // Delay a little whilst sending packets to give ESP32 some breathing room and not flood the CANBUS
-      // vTaskDelay(pdMS_TO_TICKS(100));
-    }
-    
-    if (mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_VICTRON)
-    {
-      // minimum CAN-IDs required for the core functionality are 0x351, 0x355, 0x356 and 0x35A.
-
-      // 351 message must be sent at least every 3 seconds - or Victron will stop charge/discharge
-      victron_message_351();
-
-      // Delay a little whilst sending packets to give ESP32 some breathing room and not flood the CANBUS
-      vTaskDelay(pdMS_TO_TICKS(100));
-
-      // Advertise the diyBMS name on CANBUS
-      victron_message_370_371();
-      victron_message_35e();
-      victron_message_35a();
-      victron_message_372();
-      victron_message_35f();
-
-      vTaskDelay(pdMS_TO_TICKS(100));
-
-      if (_controller_state == ControllerState::Running)
-      {
-        victron_message_355();
-        victron_message_356();
-
-        vTaskDelay(pdMS_TO_TICKS(100));
-
-        // Detail about individual cells
-        victron_message_373();
-        victron_message_374_375_376_377();
-      }
+      vTaskDelay(pdMS_TO_TICKS(10));
+      continue;
     }
 
-    if(mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_PYLONFORCEH2){
-      // Delay 1 second
-      // wait to query Inverter on task canbus_rx
-      vTaskDelay(pdMS_TO_TICKS(5000));  //2seg
-      //pylonHV_send_message_status(false); //BOTANETA debug,  delete line for production
+    // Periodic messages for the active protocol (canbus_scheduler.cpp), sleeps until the next one is due.
+    // PylonForce H2 only replies to inverter requests, these are sent from canbus_rx
+    uint32_t wait_ms = canbus_scheduler_service();
+    // Summary for the other controllers (multi-pack)
+    uint32_t multipack_ms = multipack_service();
+    hal.ReleaseCANMutex();
 
+    if (multipack_ms < wait_ms)
+    {
+      wait_ms = multipack_ms;
     }
+    vTaskDelay(pdMS_TO_TICKS(wait_ms));
   }
 }
 
@@ -2839,75 +2786,25 @@ void send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const
       canbus_no_request_messages_count=0; //BOTANETA no-CAN
     }
 
+    if (canbus_rx_select_needed())
+    {
+      // Protocol changed, install the driver with the acceptance filter for the new protocol.
+      // canbus_tx is kept out of the driver while it is reinstalled
+      if (!hal.GetCANMutex())
+      {
+        continue;
+      }
+      hal.ConfigureCAN(mysettings.canbusbaud, canbus_rx_select(mysettings.canbusprotocol));
+      hal.ReleaseCANMutex();
+    }
+
     // Wait for message to be received, up to 20 seconds
     twai_message_t message;
-    esp_err_t res = twai_receive(&message, pdMS_TO_TICKS(20000));
+    esp_err_t res = canbus_get_transport()->receive(message, 20000);
     if (res == ESP_OK)
     {
       canbus_messages_received++;
-      ESP_LOGD(TAG, "CANBUS received message ID: %0x, DLC: %d, flags: %0x",
-               message.identifier, message.data_length_code, message.flags);
-
-      //BOTANETA debug message can         
-      uint8_t data[8];
-      for(uint8_t i=0; i <message.data_length_code; i++){
-        data[i]=message.data[i];
-      }
-      ESP_LOGD(TAG, "CANBUS received message ID:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
-                  message.identifier, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );         
-      
-      /*
-      if (!(message.flags & TWAI_MSG_FLAG_RTR))
-      {
-        ESP_LOG_BUFFER_HEXDUMP(TAG, message.data, message.data_length_code, ESP_LOG_DEBUG);
-      }*/
-
-          // Remote inverter should send a 305 message every few seconds
-          // for now, keep track of last message.
-          // TODO: in future, add timeout/error condition to shut down
-          if (message.identifier == 0x305)
-          {
-            canbus_last_305_message_time = esp_timer_get_time();
-          canbus_no_request_messages_count=0; //BOTANETA pylon_lv
-      }
-
-      //BOTANETA: wait request from inverter
-      if(mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_PYLONFORCEH2){
-        switch(message.identifier){
-          case 0x8200:
-          case 0x620: // Sleep/Awake Command control
-            {
-              canbus_no_request_messages_count=0;  //BOTANETA reset count
-              bool extd=message.extd; 
-              if(message.data[0]==0x55); //enter sleep status
-              if(message.data[0]==0xAA); //wakeup
-            }
-          break;
-
-          case 0x8210:
-          case 0x621:  // Charge/Discharge Command control
-            {
-              canbus_no_request_messages_count=0;  //BOTANETA reset count
-              bool extd=message.extd; 
-              if(message.data[0]==0xAA); //Force Charge, (close batt-relay) when the batt is in under-voltage protection, the realy is open  
-              if(message.data[1]==0xAA); //Force Discharge, (close batt-relay) when the batt is in over-voltage protection, the realy is open 
-            }
-          break;
-
-          case 0x4200:
-          case 0x420: //request from inverter
-            {
-              canbus_no_request_messages_count=0;  //BOTANETA reset count
-              bool extd=message.extd;
-              if(message.data[0]==0x02) pylonHV_send_message_info(extd);//send hardware info
-              if(message.data[0]==0x00) pylonHV_send_message_status(extd);//send status info
-            }
-          break;
-        }
-
-      }//end canbus_pylontech_hv
-
-
+      canbus_rx_dispatch(message, esp_timer_get_time());
     }
     else
     {
@@ -2921,238 +2818,156 @@ void send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const
   }
 }
 
-[[noreturn]] void service_rs485_transmit_q(void *)
+// Called by modbus_master_task with a reply which has passed the CRC check
+void ProcessModbusReply(const uint8_t *frame, uint16_t len)
 {
-  for (;;)
-  {
-    uint8_t cmd[MAX_SEND_RS485_PACKET_LENGTH];
-
-    if (rs485_transmit_q_handle != nullptr)
-    {
-      // Wait for a item in the queue, blocking indefinately
-      xQueueReceive(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
-
-      if (hal.GetRS485Mutex())
-      {
-        // Ensure we have empty receive buffer
-        // uart_flush_input(rs485_uart_num);
+  uint8_t id = frame[0];
 
-        // Default of 8 bytes for a modbus request (including CRC)
-        size_t packet_length = 8;
+  if (frame[1] & B10000000)
+  {
+    // Exception reply, modbus_master_task sends these to ModbusRequestFailed.  Never treat one as
+    // a reply to the masked function code, frame[2] is the exception code, not a byte count
+    ModbusRequestFailed(id);
+    return;
+  }
 
-        if (cmd[1] == 15 || cmd[1] == 16)
-        {
-          // Calculate length of this packet, add on extra data
-          // Force Multiple Coils (FC=15)
-          // https://www.simplymodbus.ca/FC15.htm
-          // Preset Multiple Registers (FC=16)
-          // https://www.simplymodbus.ca/FC16.htm
-          packet_length = 9 + cmd[6];
-        }
+  uint8_t cmd = frame[1] & B01111111;
+  uint8_t length = frame[2];
 
-        // Calculate the MODBUS CRC
-        auto temp = calculateCRC(cmd, (uint8_t)(packet_length - 2));
-        // Byte swap the Hi and Lo bytes
-        auto crc16 = (uint16_t)(temp << 8) | (temp >> 8);
-        cmd[packet_length - 2] = (uint8_t)(crc16 >> 8); // split crc into 2 bytes
-        cmd[packet_length - 1] = (uint8_t)(crc16 & 0xFF);
+  if (cmd == 6 && id == 248)
+  {
+    ESP_LOGI(TAG, "Reply to broadcast/change address");
+    return;
+  }
 
-        // Send the bytes (actually just put them into the TX FIFO buffer)
-        uart_write_bytes(rs485_uart_num, (char *)cmd, packet_length);
+  CurrentMonitorDevice device;
+  int8_t index = currentmon_find_address(id, &device);
+  if (index < 0)
+  {
+    // Dump out unhandled reply
+    ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
+    return;
+  }
 
-        hal.ReleaseRS485Mutex();
+  if (cmd == 3 || cmd == 4)
+  {
+    // Reply to a poll from rs485_tx
+    currentmon_poll_complete(id, true, esp_timer_get_time());
+  }
 
-        // Notify the receive task that a packet should be on its way
-        if (rs485_rx_task_handle != nullptr)
-        {
-          xTaskNotify(rs485_rx_task_handle, 0x00, eNotifyAction::eNoAction);
-        }
+  currentmonitoring_struct cm;
+  currentmon_get(index, &cm);
 
-        ESP_LOGD(TAG, "Send addr=%u, func=%u, len=%u", cmd[0], cmd[1], packet_length);
-        // Debug
-        // ESP_LOG_BUFFER_HEXDUMP(TAG, cmd, packet_length, esp_log_level_t::ESP_LOG_DEBUG);
+  if (device == CurrentMonitorDevice::PZEM_017)
+  {
+    if (cmd == 6)
+    {
+      ESP_LOGI(TAG, "Reply to set param");
+    }
+    else if (cmd == 3)
+    {
+      // 75mV shunt (hard coded for PZEM)
+      cm.modbus.shuntmillivolt = 75;
 
-        // Once we have notified the receive task, we pause here to avoid sending
-        // another request until the last one has been processed (or we timeout after 2 seconds)
-        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(2000));
+      // Shunt type 0x0000 - 0x0003 (100A/50A/200A/300A)
+      switch (((uint32_t)frame[9] << 8 | (uint32_t)frame[10]))
+      {
+      case 0:
+        cm.modbus.shuntmaxcurrent = 100;
+        break;
+      case 1:
+        cm.modbus.shuntmaxcurrent = 50;
+        break;
+      case 2:
+        cm.modbus.shuntmaxcurrent = 200;
+        break;
+      case 3:
+        cm.modbus.shuntmaxcurrent = 300;
+        break;
+      default:
+        cm.modbus.shuntmaxcurrent = 0;
       }
+      currentmon_store(index, cm);
+    }
+    else if (cmd == 4 && len == 21)
+    {
+      // ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
+
+      cm.validReadings = true;
+      cm.timestamp = esp_timer_get_time();
+      // voltage in 0.01V
+      cm.modbus.voltage = (float)((uint32_t)frame[3] << 8 | (uint32_t)frame[4]) / (float)100.0;
+      // current in 0.01A
+      cm.modbus.current = (float)((uint32_t)frame[5] << 8 | (uint32_t)frame[6]) / (float)100.0;
+      // power in 0.1W
+      cm.modbus.power = ((uint32_t)frame[7] << 8 | (uint32_t)frame[8] | (uint32_t)frame[9] << 24 | (uint32_t)frame[10] << 16) / 10.0F;
+      currentmon_store(index, cm);
+      UpdateCurrentMonitorAggregate();
     }
     else
     {
-      ESP_LOGE(TAG, "rs485_transmit_q_handle is NULL");
+      // Dump out unhandled reply
+      ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
     }
   }
-}
-
-// RS485 receive
-[[noreturn]] void rs485_rx(void *)
-{
-  for (;;)
+  // ESP_LOGD(TAG, "CRC pass Id=%u F=%u L=%u", id, cmd, length);
+  if (device == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
   {
-    // Wait until this task is triggered (sending queue task triggers it)
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-
-    // Delay 50ms for the data to arrive
-    vTaskDelay(pdMS_TO_TICKS(50));
-
-    uint16_t len = 0;
-
-    if (hal.GetRS485Mutex())
-    {
-      // Wait 200ms before timeout
-      len = (uint16_t)uart_read_bytes(rs485_uart_num, frame, sizeof(frame), pdMS_TO_TICKS(200));
-      hal.ReleaseRS485Mutex();
-    }
-
-    // Min packet length of 5 bytes
-    if (len > 5)
+    if (cmd == 3)
     {
-      uint8_t id = frame[0];
-
-      auto crc = (uint16_t)((frame[len - 2] << 8) | frame[len - 1]); // combine the crc Low & High bytes
-
-      auto temp = calculateCRC(frame, (uint8_t)(len - 2));
-      // Swap bytes to match MODBUS ordering
-      auto calculatedCRC = (uint16_t)(temp << 8) | (uint16_t)(temp >> 8);
-
-      // ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
-
-      if (calculatedCRC == crc)
-      {
-        // if the calculated crc matches the recieved crc continue to process data...
-        uint8_t RS485Error = frame[1] & B10000000;
-        if (RS485Error == 0)
-        {
-          uint8_t cmd = frame[1] & B01111111;
-          uint8_t length = frame[2];
-
-          ESP_LOGD(TAG, "Recv %i bytes, id=%u, cmd=%u", len, id, cmd);
-          // ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
+      ProcessDIYBMSCurrentMonitorRegisterReply(cm, frame, length);
+      currentmon_store(index, cm);
+      UpdateCurrentMonitorAggregate();
 
-          if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::PZEM_017)
-          {
-            if (cmd == 6 && id == 248)
-            {
-              ESP_LOGI(TAG, "Reply to broadcast/change address");
-            }
-            if (cmd == 6 && id == mysettings.currentMonitoringModBusAddress)
-            {
-              ESP_LOGI(TAG, "Reply to set param");
-            }
-            else if (cmd == 3 && id == mysettings.currentMonitoringModBusAddress)
-            {
-              // 75mV shunt (hard coded for PZEM)
-              currentMonitor.modbus.shuntmillivolt = 75;
-
-              // Shunt type 0x0000 - 0x0003 (100A/50A/200A/300A)
-              switch (((uint32_t)frame[9] << 8 | (uint32_t)frame[10]))
-              {
-              case 0:
-                currentMonitor.modbus.shuntmaxcurrent = 100;
-                break;
-              case 1:
-                currentMonitor.modbus.shuntmaxcurrent = 50;
-                break;
-              case 2:
-                currentMonitor.modbus.shuntmaxcurrent = 200;
-                break;
-              case 3:
-                currentMonitor.modbus.shuntmaxcurrent = 300;
-                break;
-              default:
-                currentMonitor.modbus.shuntmaxcurrent = 0;
-              }
-            }
-            else if (cmd == 4 && id == mysettings.currentMonitoringModBusAddress && len == 21)
-            {
-              // ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
-
-              // memset(&currentMonitor.modbus, 0, sizeof(currentmonitor_raw_modbus));
-              currentMonitor.validReadings = true;
-              currentMonitor.timestamp = esp_timer_get_time();
-              // voltage in 0.01V
-              currentMonitor.modbus.voltage = (float)((uint32_t)frame[3] << 8 | (uint32_t)frame[4]) / (float)100.0;
-              // current in 0.01A
-              currentMonitor.modbus.current = (float)((uint32_t)frame[5] << 8 | (uint32_t)frame[6]) / (float)100.0;
-              // power in 0.1W
-              currentMonitor.modbus.power = ((uint32_t)frame[7] << 8 | (uint32_t)frame[8] | (uint32_t)frame[9] << 24 | (uint32_t)frame[10] << 16) / 10.0F;
-            }
-            else
-            {
-              // Dump out unhandled reply
-              ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
-            }
-          }
-          // ESP_LOGD(TAG, "CRC pass Id=%u F=%u L=%u", id, cmd, length);
-          if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
-          {
-            if (id == mysettings.currentMonitoringModBusAddress && cmd == 3)
-            {
-              ProcessDIYBMSCurrentMonitorRegisterReply(length);
-
-              if (_tft_screen_available)
-              {
-                // Refresh the TFT display
-                xTaskNotify(updatetftdisplay_task_handle, 0x00, eNotifyAction::eNoAction);
-              }
-            }
-            else if (id == mysettings.currentMonitoringModBusAddress && cmd == 16)
-            {
-              ESP_LOGI(TAG, "Write multiple regs, success");
-            }
-            else
-            {
-              // Dump out unhandled reply
-              ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
-            }
-          }
-        }
-        else
-        {
-          ESP_LOGE(TAG, "RS485 error");
-          ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
-        }
-      }
-      else
+      if (_tft_screen_available)
       {
-        ESP_LOGE(TAG, "CRC error");
+        // Refresh the TFT display
+        xTaskNotify(updatetftdisplay_task_handle, 0x00, eNotifyAction::eNoAction);
       }
     }
+    else if (cmd == 16)
+    {
+      ESP_LOGI(TAG, "Write multiple regs, success");
+    }
     else
     {
-      // We didn't receive anything on RS485, record error and mark current monitor as invalid
-      ESP_LOGE(TAG, "Short packet %i bytes", len);
-
-      // Indicate that the current monitor values are now invalid/unknown
-      currentMonitor.validReadings = false;
+      // Dump out unhandled reply
+      ESP_LOG_BUFFER_HEXDUMP(TAG, frame, len, esp_log_level_t::ESP_LOG_DEBUG);
     }
+  }
+}
 
-    // Notify sending queue, to continue
-    xTaskNotify(service_rs485_transmit_q_task_handle, 0x00, eNotifyAction::eNoAction);
-
-  } // infinite loop
+// Called by modbus_master_task when a request has had no valid reply: no reply or bad replies after
+// all the retries, or an exception reply (which isn't retried).  An outstanding poll of this monitor
+// completes now as failed rather than waiting CURRENTMON_POLL_TIMEOUT_MS for current_monitors.cpp to
+// give up, so the next poll is sent after the normal bus idle time.
+void ModbusRequestFailed(uint8_t address)
+{
+  // Indicate that the current monitor values are now invalid/unknown
+  currentmon_poll_complete(address, false, esp_timer_get_time());
+  UpdateCurrentMonitorAggregate();
 }
 
-// RS485 transmit
+// RS485 transmit, polls the current monitors in turn (current_monitors.cpp)
 [[noreturn]] void rs485_tx(void *)
 {
-  uint8_t cmd[MAX_SEND_RS485_PACKET_LENGTH];
+  uint8_t cmd[MODBUS_MAX_REQUEST_LENGTH];
   memset(&cmd, 0, sizeof(cmd));
 
   for (;;)
   {
-    // Delay 4 seconds between requests
-    vTaskDelay(pdMS_TO_TICKS(4000));
+    uint32_t wait_ms = 1000;
 
     if (mysettings.currentMonitoringEnabled == true)
     {
-
-      if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
+      int8_t internal = currentmon_find(CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL);
+      if (internal >= 0)
       {
         if (currentmon_internal.Available())
         {
-          // Take readings from internal INA229 chip (on controller board)
-          if (hal.GetVSPIMutex())
+          // Readings from internal INA229 chip (on controller board) are taken by interrupt_task
+          // on the conversion ready alert, only poll if the alert has stopped arriving
+          if (currentmon_internal.SampleOverdue(esp_timer_get_time()) && hal.GetVSPIMutex())
           {
             currentmon_internal.TakeReadings();
             ProcessDIYBMSCurrentMonitorInternal();
@@ -3161,53 +2976,101 @@ void send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const
         }
         else
         {
-          currentMonitor.validReadings = false;
+          currentmon_invalidate(internal);
+          UpdateCurrentMonitorAggregate();
         }
       }
 
-      if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
+      CurrentMonitorDevice device;
+      uint8_t address;
+      int8_t index = currentmon_next_poll(esp_timer_get_time(), &wait_ms, &device, &address);
+      if (index >= 0)
       {
-        // This is the request we send to diyBMS current monitor, it pulls back 38 registers
-        // this is all the registers diyBMS current monitor has
-        // Holding Registers = command 3
-        cmd[0] = mysettings.currentMonitoringModBusAddress;
-        // Input registers - 46 of them (92 bytes + headers + crc = 83 byte reply)
-        cmd[1] = 3;
-        cmd[5] = 46;
-        xQueueSend(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
-      }
+        memset(&cmd, 0, sizeof(cmd));
+        cmd[0] = address;
 
-      if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::PZEM_017)
-      {
-        // ESP_LOGD(TAG, "RS485 TX");
-        cmd[0] = mysettings.currentMonitoringModBusAddress;
+        if (device == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
+        {
+          // This is the request we send to diyBMS current monitor, it pulls back 38 registers
+          // this is all the registers diyBMS current monitor has
+          // Holding Registers = command 3
+          // Input registers - 46 of them (92 bytes + headers + crc = 83 byte reply)
+          cmd[1] = 3;
+          cmd[5] = 46;
+        }
 
-        if (currentMonitor.modbus.shuntmillivolt == 0)
+        if (device == CurrentMonitorDevice::PZEM_017)
         {
-          ESP_LOGD(TAG, "PZEM_017 Read params");
-          cmd[1] = 0x03;
-          cmd[5] = 0x04;
+          currentmonitoring_struct cm;
+          currentmon_get(index, &cm);
+
+          if (cm.modbus.shuntmillivolt == 0)
+          {
+            ESP_LOGD(TAG, "PZEM_017 Read params %u", cmd[0]);
+            cmd[1] = 0x03;
+            cmd[5] = 0x04;
+          }
+          else
+          {
+            //  Read the standard voltage/current values
+            //   Input registers
+            cmd[1] = 0x04;
+            // Read 8 registers (0 to 8)
+            cmd[5] = 0x08;
+          }
         }
-        else
+
+        if (!modbus_send_request(cmd, sizeof(cmd)))
         {
-          // ESP_LOGD(TAG, "PZEM_017 Read values");
-          //  Read the standard voltage/current values
-          //   Input registers
-          cmd[1] = 0x04;
-          // Read 8 registers (0 to 8)
-          cmd[5] = 0x08;
+          currentmon_poll_complete(cmd[0], false, esp_timer_get_time());
         }
-        xQueueSend(rs485_transmit_q_handle, &cmd, portMAX_DELAY);
       }
-    } // end if
+    }
+
+    if (wait_ms > 1000)
+    {
+      wait_ms = 1000;
+    }
+    vTaskDelay(pdMS_TO_TICKS(wait_ms));
   }
 }
 
+// Save the internal current monitor coulomb counter to flash if it has changed.
+// Called every 10 minutes, so at most 144 NVS writes a day
+void SaveCoulombCounterIfChanged()
+{
+  static coulomb_counter last_saved = {};
+
+  if (mysettings.currentMonitoringEnabled == false ||
+      mysettings.currentMonitoringDevice != CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL ||
+      currentmon_internal.Available() == false)
+  {
+    return;
+  }
+
+  coulomb_counter now;
+  currentmon_internal.GetCoulombCounter(&now);
+
+  // Ignore less than 1mAh of movement, unless the SOC or daily reference has changed
+  uint64_t moved = (now.in_nC - last_saved.in_nC) + (now.out_nC - last_saved.out_nC);
+  if (moved < COULOMB_COUNTER_NC_PER_MAH &&
+      now.reference_charge_nC == last_saved.reference_charge_nC &&
+      now.reference_in_nC == last_saved.reference_in_nC &&
+      now.daily_in_nC == last_saved.daily_in_nC)
+  {
+    return;
+  }
+
+  SaveCoulombCounter(&now);
+  last_saved = now;
+}
+
 [[noreturn]] void periodic_task(void *)
 {
   uint8_t countdown_influx = mysettings.influxdb_loggingFreqSeconds;
   uint8_t countdown_mqtt1 = 5;
   uint8_t countdown_mqtt2 = 25;
+  uint16_t countdown_coulomb = 600;
 
   for (;;)
   {
@@ -3217,6 +3080,7 @@ void send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const
     countdown_influx--;
     countdown_mqtt1--;
     countdown_mqtt2--;
+    countdown_coulomb--;
 
     if (tftsleep_timer > 0)
     {
@@ -3246,12 +3110,20 @@ void send_canbus_message(const uint32_t identifier, const uint8_t *buffer, const
       countdown_mqtt2 = 25;
     }
 
+    // 10 minutes
+    if (countdown_coulomb == 0)
+    {
+      SaveCoulombCounterIfChanged();
+      countdown_coulomb = 600;
+    }
+
     // Influxdb - Variable interval
     if (countdown_influx == 0)
     {
       countdown_influx = mysettings.influxdb_loggingFreqSeconds;
 
-      if (mysettings.influxdb_enabled && wifi_isconnected && rules.invalidModuleCount == 0 && _controller_state == ControllerState::Running && rules.ruleOutcome(Rule::BMSError) == false)
+      // Runs without WIFI too, samples are stored until the network returns
+      if (mysettings.influxdb_enabled && rules.invalidModuleCount == 0 && _controller_state == ControllerState::Running && rules.ruleOutcome(Rule::BMSError) == false)
       {
         ESP_LOGI(TAG, "Influx task");
         influx_task_action();
@@ -3729,7 +3601,7 @@ struct log_level_t
 };
 
 // Default log levels to use for various components.
-const std::array<log_level_t, 22> log_levels =
+const std::array<log_level_t, 34> log_levels =
     {
         log_level_t{.tag = "*", .level = ESP_LOG_DEBUG},
         {.tag = "wifi", .level = ESP_LOG_WARN},
@@ -3748,9 +3620,21 @@ const std::array<log_level_t, 22> log_levels =
         {.tag = "diybms-webpost", .level = ESP_LOG_INFO},
         {.tag = "diybms-webreq", .level = ESP_LOG_INFO},
         {.tag = "diybms-web", .level = ESP_LOG_INFO},
+        {.tag = "diybms-ws", .level = ESP_LOG_INFO},
+        {.tag = "diybms-webbuf", .level = ESP_LOG_INFO},
+        {.tag = "diybms-metrics", .level = ESP_LOG_INFO},
+        {.tag = "diybms-sf", .level = ESP_LOG_INFO},
+        {.tag = "diybms-www", .level = ESP_LOG_INFO},
         {.tag = "diybms-set", .level = ESP_LOG_INFO},
         {.tag = "diybms-mqtt", .level = ESP_LOG_INFO},
         {.tag = "diybms-pylon", .level = ESP_LOG_INFO},
+        {.tag = "diybms-cansched", .level = ESP_LOG_INFO},
+        {.tag = "diybms-canframe", .level = ESP_LOG_INFO},
+        {.tag = "diybms-canrx", .level = ESP_LOG_INFO},
+        {.tag = "diybms-cantx", .level = ESP_LOG_INFO},
+        {.tag = "diybms-multipack", .level = ESP_LOG_INFO},
+        {.tag = "diybms-modbus", .level = ESP_LOG_INFO},
+        {.tag = "diybms-curmons", .level = ESP_LOG_INFO},
         {.tag = "diybms-pyforce", .level = ESP_LOG_INFO},
         {.tag = "curmon", .level = ESP_LOG_INFO}};
 
@@ -3873,6 +3757,9 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
 
   ESP_LOGI(TAG, "LittleFS mounted, total=%u, used=%u", LittleFS.totalBytes(), LittleFS.usedBytes());
 
+  // Web server falls back to a recovery upload page if this fails
+  web_assets_init();
+
   mountSDCard();
 
   // consoleConfigurationCheck needs to be after SD card mount, as it attempts to remove wifi.json if it exists
@@ -3901,6 +3788,7 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
 
   LoadConfiguration(&mysettings);
   ValidateConfiguration(&mysettings);
+  currentmon_configure(&mysettings);
 
   if (strlen(mysettings.homeassist_apikey) == 0)
   {
@@ -3942,9 +3830,20 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
           mysettings.currentMonitoring_shunttempcoefficient,
           mysettings.currentMonitoring_tempcompenabled);
 
-      currentmon_internal.GuessSOC();
+      coulomb_counter saved;
+      if (LoadCoulombCounter(&saved))
+      {
+        // Carry on from the last saved totals and SOC reference
+        currentmon_internal.RestoreCoulombCounter(&saved);
+      }
+      else
+      {
+        currentmon_internal.GuessSOC();
+      }
 
+      // Also clears any pending conversion ready alert
       currentmon_internal.TakeReadings();
+      hal.AttachINA229Interrupt(INA229Interrupt);
     }
     else
     {
@@ -3957,7 +3856,7 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
 
   // Switch CAN chip TJA1051T/3 ON
   hal.CANBUSEnable(true);
-  hal.ConfigureCAN(mysettings.canbusbaud);
+  hal.ConfigureCAN(mysettings.canbusbaud, canbus_rx_select(mysettings.canbusprotocol));
 
   // Serial pins IO2/IO32
   SERIAL_DATA.begin(mysettings.baudRate, SERIAL_8N1, 2, 32); // Serial for comms to modules
@@ -3966,10 +3865,6 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
 
   SetupRS485();
 
-  // Create queue for transmit, each request could be MAX_SEND_RS485_PACKET_LENGTH bytes long, depth of 3 items
-  rs485_transmit_q_handle = xQueueCreate(3, MAX_SEND_RS485_PACKET_LENGTH);
-  assert(rs485_transmit_q_handle);
-
   request_q_handle = xQueueCreate(30, sizeof(PacketStruct));
   assert(request_q_handle);
   prg.setQueueHandle(request_q_handle);
@@ -3992,14 +3887,13 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
   xTaskCreate(avrprog_task, "avrprog", 2450, &_avrsettings, configMAX_PRIORITIES - 3, &avrprog_task_handle);
 
   // High priority task
-  xTaskCreate(interrupt_task, "int", 2050, nullptr, configMAX_PRIORITIES - 1, &interrupt_task_handle);
+  xTaskCreate(interrupt_task, "int", 2900, nullptr, configMAX_PRIORITIES - 1, &interrupt_task_handle);
   xTaskCreate(sdcardlog_task, "sdlog", 3800, nullptr, 0, &sdcardlog_task_handle);
   xTaskCreate(sdcardlog_outputs_task, "sdout", 3200, nullptr, 0, &sdcardlog_outputs_task_handle);
   xTaskCreate(rule_state_change_task, "r_stat", 3000, nullptr, 0, &rule_state_change_task_handle);
 
   xTaskCreate(rs485_tx, "485_TX", 2940, nullptr, 1, &rs485_tx_task_handle);
-  xTaskCreate(rs485_rx, "485_RX", 2940, nullptr, 1, &rs485_rx_task_handle);
-  xTaskCreate(service_rs485_transmit_q, "485_Q", 2950, nullptr, 1, &service_rs485_transmit_q_task_handle);
+  xTaskCreate(modbus_master_task, "485_Q", 3400, nullptr, 1, &service_rs485_transmit_q_task_handle);
   xTaskCreate(canbus_tx, "CAN_Tx", 4096, nullptr, 1, &canbus_tx_task_handle);
   xTaskCreate(canbus_rx, "CAN_Rx", 2950, nullptr, 1, &canbus_rx_task_handle);
   xTaskCreate(transmit_task, "Tx", 1950, nullptr, configMAX_PRIORITIES - 3, &transmit_task_handle);
@@ -4044,12 +3938,12 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
 }
 
 /// @brief Convert an ESP32 core dump stored in FLASH to a JSON object fragment
-/// @param doc
-void ESPCoreDumpToJSON(JsonObject &doc)
+/// @param json
+void ESPCoreDumpToJSON(httpd_json_writer &json)
 {
   if (esp_core_dump_image_check() == ESP_OK)
   {
-    JsonObject core = doc.createNestedObject("coredump");
+    json.beginObject("coredump");
     // A valid core dump is in FLASH storage
 
     esp_core_dump_summary_t *summary = (esp_core_dump_summary_t *)malloc(sizeof(esp_core_dump_summary_t));
@@ -4059,81 +3953,79 @@ void ESPCoreDumpToJSON(JsonObject &doc)
       {
         char outputString[16];
 
-        core["exc_task"] = summary->exc_task;
-        core["app_elf_sha256"] = (char *)summary->app_elf_sha256;
-        core["dumpver"] = summary->core_dump_version;
+        json.addString("exc_task", summary->exc_task);
+        json.addString("app_elf_sha256", (char *)summary->app_elf_sha256);
+        json.addUInt("dumpver", summary->core_dump_version);
 
         ultoa(summary->exc_pc, outputString, 16);
-        core["exc_pc"] = outputString;
+        json.addString("exc_pc", outputString);
 
         ultoa(summary->exc_tcb, outputString, 16);
-        core["exc_tcb"] = outputString;
+        json.addString("exc_tcb", outputString);
 
-        core["bt_corrupted"] = summary->exc_bt_info.corrupted;
-        core["bt_depth"] = summary->exc_bt_info.depth;
-        auto backtrace = core.createNestedArray("backtrace");
+        json.addBool("bt_corrupted", summary->exc_bt_info.corrupted);
+        json.addUInt("bt_depth", summary->exc_bt_info.depth);
+        json.beginArray("backtrace");
         for (auto value : summary->exc_bt_info.bt)
         {
           ultoa(value, outputString, 16);
-          backtrace.add(outputString);
+          json.addString(outputString);
         }
+        json.endArray();
 
         ltoa(summary->ex_info.epcx_reg_bits, outputString, 2);
-        core["epcx_reg_bits"] = outputString;
+        json.addString("epcx_reg_bits", outputString);
         ltoa(summary->ex_info.exc_cause, outputString, 16);
-        core["exc_cause"] = outputString;
+        json.addString("exc_cause", outputString);
         ultoa(summary->ex_info.exc_vaddr, outputString, 16);
-        core["exc_vaddr"] = outputString;
+        json.addString("exc_vaddr", outputString);
 
-        auto exc_a = core.createNestedArray("exc_a");
+        json.beginArray("exc_a");
         for (auto value : summary->ex_info.exc_a)
         {
           ultoa(value, outputString, 16);
-          exc_a.add(outputString);
+          json.addString(outputString);
         }
-        auto epcx = core.createNestedArray("epcx");
+        json.endArray();
+        json.beginArray("epcx");
         for (auto value : summary->ex_info.epcx)
         {
           ultoa(value, outputString, 16);
-          epcx.add(outputString);
+          json.addString(outputString);
         }
+        json.endArray();
       }
     }
     free(summary);
+    json.endObject();
   }
 }
 
-/// @brief Generates a JSON document with diagnostic information about the running system
-/// @param req
-/// @param buffer
-/// @param bufferLenMax
-/// @return
-esp_err_t diagnosticJSON(httpd_req_t *req, char buffer[], int bufferLenMax)
+/// @brief Stack high water mark of the controller tasks
+/// @param list Array to fill
+/// @param listSize Number of elements in list
+/// @return Number of tasks written to list
+uint8_t GetTaskStackInfo(task_stack_info *list, uint8_t listSize)
 {
-  DynamicJsonDocument doc(2048);
-  JsonObject root = doc.to<JsonObject>();
-  JsonObject diag = root.createNestedObject("diagnostic");
-
-  diag["numtasks"] = uxTaskGetNumberOfTasks();
-  auto tasks = diag.createNestedArray("tasks");
+  uint8_t count = 0;
 
   // Array of pointers to the task handles we are going to examine
-  const std::array<TaskHandle_t *, 18> task_handle_ptrs =
+  const std::array<TaskHandle_t *, 17> task_handle_ptrs =
       {&sdcardlog_task_handle, &sdcardlog_outputs_task_handle, &rule_state_change_task_handle,
        &avrprog_task_handle, &enqueue_task_handle, &transmit_task_handle, &replyqueue_task_handle,
        &lazy_task_handle, &rule_task_handle, &voltageandstatussnapshot_task_handle, &updatetftdisplay_task_handle,
        &periodic_task_handle, &interrupt_task_handle, &rs485_tx_task_handle,
-       &rs485_rx_task_handle, &service_rs485_transmit_q_task_handle,
+       &service_rs485_transmit_q_task_handle,
        &canbus_tx_task_handle, &canbus_rx_task_handle};
 
   // Remember these are pointers to the handle
   for (auto h : task_handle_ptrs)
   {
-    if (*h != nullptr)
+    if (*h != nullptr && count < listSize)
     {
-      JsonObject nested = tasks.createNestedObject();
-      nested["name"] = pcTaskGetName(*h);
-      nested["hwm"] = uxTaskGetStackHighWaterMark(*h);
+      list[count].name = pcTaskGetName(*h);
+      list[count].hwm = uxTaskGetStackHighWaterMark(*h);
+      count++;
     }
   };
 
@@ -4145,24 +4037,286 @@ esp_err_t diagnosticJSON(httpd_req_t *req, char buffer[], int bufferLenMax)
 
   for (auto h : task_handles)
   {
-    if (h != nullptr)
+    if (h != nullptr && count < listSize)
     {
-      JsonObject nested = tasks.createNestedObject();
-      nested["name"] = pcTaskGetName(h);
-      nested["hwm"] = uxTaskGetStackHighWaterMark(h);
+      list[count].name = pcTaskGetName(h);
+      list[count].hwm = uxTaskGetStackHighWaterMark(h);
+      count++;
     }
   };
 
-  diag["FreeHeap"] = ESP.getFreeHeap();
-  diag["MinFreeHeap"] = ESP.getMinFreeHeap();
-  diag["HeapSize"] = ESP.getHeapSize();
-  diag["SdkVersion"] = ESP.getSdkVersion();
+  return count;
+}
+
+static void StoreForwardStatsToJSON(httpd_json_writer &json, const char *name, const store_forward_stats &sf)
+{
+  json.beginObject(name);
+  json.addUInt("depth", sf.depth);
+  json.addUInt("rambytes", sf.ram_bytes);
+  json.addUInt("spillbytes", sf.spill_bytes);
+  json.addUInt("spillrecords", sf.spill_records);
+  json.addUInt("stored", sf.stored);
+  json.addUInt("dropped", sf.dropped);
+  json.addUInt("replayed", sf.replayed);
+  json.addUInt("replayedbytes", sf.replayed_bytes);
+  // Replay throughput in bytes per second
+  json.addUInt("replaybps", sf.replay_ms == 0 ? 0 : (uint32_t)((uint64_t)sf.replayed_bytes * 1000 / sf.replay_ms));
+  json.endObject();
+}
+
+/// @brief Generates a JSON document with diagnostic information about the running system
+/// @param req
+/// @param buffer
+/// @param bufferLenMax
+/// @return
+esp_err_t diagnosticJSON(httpd_req_t *req, char buffer[], int bufferLenMax)
+{
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLenMax);
+
+  json.beginObject();
+  json.beginObject("diagnostic");
+
+  json.addUInt("numtasks", uxTaskGetNumberOfTasks());
+  json.beginArray("tasks");
+
+  task_stack_info tasks[MAXIMUM_REPORTED_TASKS];
+  uint8_t count = GetTaskStackInfo(tasks, MAXIMUM_REPORTED_TASKS);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    json.beginObject();
+    json.addString("name", tasks[i].name);
+    json.addUInt("hwm", tasks[i].hwm);
+    json.endObject();
+  }
+  json.endArray();
+
+  json.addUInt("FreeHeap", ESP.getFreeHeap());
+  json.addUInt("MinFreeHeap", ESP.getMinFreeHeap());
+  json.addUInt("HeapSize", ESP.getHeapSize());
+  json.addString("SdkVersion", ESP.getSdkVersion());
+
+  websocket_telemetry_stats ws;
+  websocket_telemetry_get_stats(&ws);
+  json.beginObject("websocket");
+  json.addUInt("clients", ws.clients);
+  json.addUInt("frames", ws.frames_sent);
+  json.addUInt("bytes", ws.bytes_sent);
+  json.addUInt("full", ws.full_updates);
+  json.addUInt("delta", ws.delta_updates);
+  json.addUInt("skipped", ws.backpressure_skipped);
+  json.addUInt("failed", ws.send_failures);
+  json.endObject();
+
+  http_buffer_pool_stats pool;
+  http_buffer_pool_get_stats(&pool);
+  json.beginObject("httpbuf");
+  json.addUInt("size", HTTP_BUFFER_POOL_SIZE);
+  json.addUInt("inuse", pool.in_use);
+  json.addUInt("maxinuse", pool.max_in_use);
+  json.addUInt("acquired", pool.acquired);
+  json.addUInt("exhausted", pool.exhausted);
+  json.endObject();
+
+  mqtt_publish_stats mqtt;
+  mqtt_get_stats(&mqtt);
+  json.beginObject("mqtt");
+  json.addUInt("published", mqtt.cells_published);
+  json.addUInt("suppressed", mqtt.cells_suppressed);
+  json.addUInt("failed", mqtt.cells_failed);
+  json.addUInt("budget", mqtt.cell_budget);
+  json.addUInt("bankmsgs", mqtt.bank_messages);
+  json.addUInt("banktoolarge", mqtt.bank_too_large);
+  json.addUInt("flow", mqtt.flow_state);
+  json.addUInt("outbox", mqtt.outbox_bytes);
+  json.addUInt("outboxhwm", mqtt.outbox_high_water);
+  json.addUInt("pending", mqtt.outbox_pending);
+  json.addUInt("pendinghwm", mqtt.outbox_pending_high_water);
+  json.addUInt("droppedlow", mqtt.dropped_low);
+  json.addUInt("droppednormal", mqtt.dropped_normal);
+  json.addUInt("droppedhigh", mqtt.dropped_high);
+  json.addUInt("publishes", mqtt.publish_count);
+  json.addUInt("publishavgus", mqtt.publish_count == 0 ? 0 : (uint32_t)(mqtt.publish_time_us / mqtt.publish_count));
+  json.addUInt("connections", mqtt.connections);
+  json.addUInt("disconnections", mqtt.disconnections);
+  json.endObject();
+
+  influx_write_stats influx;
+  influx_get_stats(&influx);
+  json.beginObject("influx");
+  json.addUInt("writes", influx.writes);
+  json.addUInt("failures", influx.failures);
+  json.addUInt("lastbytes", influx.last_bytes);
+  json.addUInt("lastms", influx.last_latency_ms);
+  json.addUInt("maxms", influx.max_latency_ms);
+  json.addUInt("avgms", influx.average_latency_ms);
+  json.addUInt64("bytes", influx.total_bytes);
+  json.addUInt("gzipbatches", influx.gzip_batches);
+  json.addUInt("gzipfallbacks", influx.gzip_fallbacks);
+  // Compression ratio x100 (uncompressed/compressed) and CPU time per batch
+  json.addUInt("gzipratio", influx.gzip_bytes_out == 0 ? 0 : (uint32_t)(influx.gzip_bytes_in * 100 / influx.gzip_bytes_out));
+  json.addUInt("gzipavgus", influx.gzip_batches == 0 ? 0 : (uint32_t)(influx.gzip_time_us / influx.gzip_batches));
+  // Upload time saved, estimated from the bytes not sent at the measured upload rate, less the time spent compressing
+  if (influx.total_bytes > 0 && influx.writes > 0)
+  {
+    uint64_t total_latency_ms = (uint64_t)influx.average_latency_ms * influx.writes;
+    int64_t saved_ms = (int64_t)((influx.gzip_bytes_in - influx.gzip_bytes_out) * total_latency_ms / influx.total_bytes) - (int64_t)(influx.gzip_time_us / 1000);
+    json.addInt("gzipsavedms", (int32_t)saved_ms);
+  }
+  json.endObject();
+
+  store_forward_stats sf;
+  influx_get_sf_stats(&sf);
+  StoreForwardStatsToJSON(json, "sfinflux", sf);
+  mqtt_get_sf_stats(&sf);
+  StoreForwardStatsToJSON(json, "sfmqtt", sf);
+
+  can_schedule_stats can[CANBUS_SCHEDULE_MAXIMUM];
+  uint8_t can_count = canbus_scheduler_get_stats(can, CANBUS_SCHEDULE_MAXIMUM);
+  json.beginArray("canschedule");
+  for (uint8_t i = 0; i < can_count; i++)
+  {
+    json.beginObject();
+    json.addUInt("id", can[i].identifier);
+    json.addUInt("sent", can[i].sent);
+    json.addUInt("missed", can[i].missed_deadlines);
+    json.addUInt("deferred", can[i].deferred);
+    json.addUInt("jitteravgus", can[i].average_jitter_us);
+    json.addUInt("jittermaxus", can[i].max_jitter_us);
+    json.addUInt("maxintervalms", can[i].max_interval_ms);
+    json.endObject();
+  }
+  json.endArray();
+
+  can_frame_stats frames[CANBUS_FRAME_CACHE_SIZE];
+  can_frame_cache_stats frame_cache;
+  uint8_t frame_count = canbus_frames_get_stats(frames, CANBUS_FRAME_CACHE_SIZE, &frame_cache);
+  json.addUInt("canframerebuilds", frame_cache.rebuilds);
+  json.addUInt("canframelastrebuildus", frame_cache.last_rebuild_us);
+  json.addUInt("canframemaxrebuildus", frame_cache.max_rebuild_us);
+  json.beginArray("canframes");
+  for (uint8_t i = 0; i < frame_count; i++)
+  {
+    json.beginObject();
+    json.addUInt("id", frames[i].identifier);
+    json.addUInt("sent", frames[i].sent);
+    json.addUInt("changed", frames[i].changed);
+    json.endObject();
+  }
+  json.endArray();
+
+  can_rx_stats rx;
+  canbus_rx_get_stats(&rx);
+  json.beginObject("canrx");
+  json.addUInt("received", rx.received);
+  json.addUInt("dispatched", rx.dispatched);
+  json.addUInt("unhandled", rx.unhandled);
+  json.addUInt64("busyus", rx.busy_us);
+  json.addUInt("maxhandlerus", rx.max_handler_us);
+  json.endObject();
+
+  if (mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_PYLONFORCEH2)
+  {
+    pylonforce_reply_stats reply;
+    pylonHV_get_reply_stats(&reply);
+    json.beginObject("pylonforcereply");
+    json.addUInt("requests", reply.requests);
+    json.addUInt("failedframes", reply.failed_frames);
+    json.addUInt("timeouts", reply.timeouts);
+    json.addUInt("lastus", reply.last_us);
+    json.addUInt("p50us", reply.p50_us);
+    json.addUInt("p99us", reply.p99_us);
+    json.addUInt("maxus", reply.max_us);
+    json.endObject();
+  }
+
+  modbus_device_stats modbus[MODBUS_MAXIMUM_DEVICES];
+  uint8_t modbus_count = modbus_get_stats(modbus, MODBUS_MAXIMUM_DEVICES);
+  json.beginArray("modbus");
+  for (uint8_t i = 0; i < modbus_count; i++)
+  {
+    json.beginObject();
+    json.addUInt("addr", modbus[i].address);
+    json.addUInt("requests", modbus[i].requests);
+    json.addUInt("replies", modbus[i].replies);
+    json.addUInt("retries", modbus[i].retries);
+    json.addUInt("failed", modbus[i].failed);
+    json.addUInt("timeouts", modbus[i].timeouts);
+    json.addUInt("crcerrors", modbus[i].crc_errors);
+    json.addUInt("exceptions", modbus[i].exceptions);
+    json.addUInt("rttus", modbus[i].last_rtt_us);
+    json.addUInt("rttavgus", modbus[i].average_rtt_us);
+    json.addUInt("rttmaxus", modbus[i].max_rtt_us);
+    json.endObject();
+  }
+  json.endArray();
+
+  currentmon_instance_stats monitors[CURRENTMON_MAXIMUM];
+  uint8_t monitor_count = currentmon_get_stats(monitors, CURRENTMON_MAXIMUM, esp_timer_get_time());
+  json.beginArray("currentmonitors");
+  for (uint8_t i = 0; i < monitor_count; i++)
+  {
+    json.beginObject();
+    json.addUInt("type", monitors[i].device);
+    json.addUInt("addr", monitors[i].address);
+    json.addUInt("polls", monitors[i].polls);
+    json.addUInt("replies", monitors[i].replies);
+    json.addUInt("failures", monitors[i].failures);
+    json.addUInt("intervalms", monitors[i].interval_ms);
+    json.addUInt("agems", monitors[i].age_ms);
+    json.addBool("stale", monitors[i].stale);
+    json.addUInt("busyus", monitors[i].busy_us);
+    json.endObject();
+  }
+  json.endArray();
+
+  if (mysettings.currentMonitoringEnabled && mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
+  {
+    ina229_sample_stats ina;
+    currentmon_internal.GetSampleStats(&ina);
+    json.beginObject("ina229");
+    json.addUInt("samples", ina.samples);
+    json.addUInt("polled", ina.polled);
+    json.addUInt("missed", ina.missed);
+    json.addUInt("conversionus", ina.conversion_us);
+    json.addUInt("intervalus", ina.last_interval_us);
+    json.addUInt("ratemhz", ina.sample_rate_mhz);
+    json.addUInt("jitteravgus", ina.average_jitter_us);
+    json.addUInt("jittermaxus", ina.max_jitter_us);
+    json.addUInt("latencyus", ina.last_latency_us);
+    json.addUInt("latencymaxus", ina.max_latency_us);
+    json.addUInt("spius", ina.last_spi_us);
+    json.addUInt("spimaxus", ina.max_spi_us);
+    json.addUInt64("spibusyus", ina.spi_busy_us);
+    json.endObject();
+  }
+
+  if (mysettings.canbus_multipack)
+  {
+    multipack_stats pack;
+    multipack_get_stats(&pack);
+    json.beginObject("multipack");
+    json.addUInt("packs", pack.packs);
+    json.addBool("master", pack.master);
+    json.addUInt("masteraddr", pack.master_address);
+    json.addUInt("sent", pack.sent);
+    json.addUInt("received", pack.received);
+    json.addUInt("conflicts", pack.conflicts);
+    json.addUInt("expired", pack.expired);
+    json.addUInt("oldestagems", pack.oldest_age_ms);
+    json.addUInt("maxagems", pack.max_age_ms);
+    json.addUInt("busloadpermille", pack.bus_load_permille);
+    json.endObject();
+  }
+
+  writeApiRouteStats(json);
+  writeHomeAssistantStats(json);
+  writeWebAssetStats(json);
 
-  ESPCoreDumpToJSON(diag);
+  ESPCoreDumpToJSON(json);
 
-  int bufferused = 0;
-  bufferused += serializeJson(doc, buffer, bufferLenMax);
-  return httpd_resp_send(req, buffer, bufferused);
+  json.endObject();
+  json.endObject();
+  return json.finish();
 }
 
 unsigned long wifitimer = 0;
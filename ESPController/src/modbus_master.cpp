@@ -0,0 +1,377 @@
+/*
+ ____  ____  _  _  ____  __  __  ___
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \
+(____/(____) (__) (____/(_/\/\_)(___/
+
+(c) 2021-2023 Stuart Pittaway
+
+MODBUS RTU master for the RS485 port, see modbus_master.h
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-modbus";
+
+#include "modbus_master.h"
+
+#include <esp_timer.h>
+
+struct modbus_request
+{
+  uint8_t data[MODBUS_MAX_REQUEST_LENGTH];
+  uint8_t length;
+};
+
+enum class modbus_result : uint8_t
+{
+  Reply,
+  Exception,
+  Timeout,
+  CRCError
+};
+
+static uart_port_t uart_port = UART_NUM_1;
+static QueueHandle_t uart_event_q = nullptr;
+static QueueHandle_t request_q = nullptr;
+static modbus_reply_handler reply_handler = nullptr;
+static modbus_failed_handler failed_handler = nullptr;
+
+// Reply being assembled, only used by modbus_master_task
+static uint8_t reply[256];
+
+static modbus_device_stats device_stats[MODBUS_MAXIMUM_DEVICES];
+static uint8_t device_count = 0;
+static uint64_t rtt_total_us[MODBUS_MAXIMUM_DEVICES];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+uint16_t calculateCRC(const uint8_t *f, uint8_t bufferSize)
+{
+  uint16_t flag;
+  uint16_t temp;
+  temp = 0xFFFF;
+  for (unsigned char i = 0; i < bufferSize; i++)
+  {
+    temp = temp ^ f[i];
+    for (unsigned char j = 1; j <= 8; j++)
+    {
+      flag = temp & 0x0001;
+      temp >>= 1;
+      if (flag)
+        temp ^= 0xA001;
+    }
+  }
+
+  // crcLo byte is first & crcHi byte is last
+  return temp;
+}
+
+/// @param port UART, already installed with an event queue
+/// @param uart_events event queue returned by uart_driver_install
+void modbus_master_begin(uart_port_t port, QueueHandle_t uart_events, modbus_reply_handler reply, modbus_failed_handler failed)
+{
+  uart_port = port;
+  uart_event_q = uart_events;
+  reply_handler = reply;
+  failed_handler = failed;
+
+  request_q = xQueueCreate(MODBUS_REQUEST_QUEUE_LENGTH, sizeof(modbus_request));
+  assert(request_q);
+
+  // End of frame is detected by the UART when the line is idle
+  ESP_ERROR_CHECK(uart_set_rx_timeout(uart_port, MODBUS_RX_TIMEOUT_SYMBOLS));
+}
+
+/// @brief Queue a request, the CRC is added when it is sent.  Waits up to MODBUS_REQUEST_QUEUE_TIMEOUT_MS
+/// while the queue is full
+/// @param cmd MODBUS frame, starting with the slave address
+/// @param size Size of cmd in bytes
+/// @return false if the request wasn't queued
+bool modbus_send_request(const uint8_t *cmd, size_t size)
+{
+  modbus_request req;
+  memset(&req, 0, sizeof(req));
+  memcpy(req.data, cmd, size < sizeof(req.data) ? size : sizeof(req.data));
+
+  // Default of 8 bytes for a modbus request (including CRC)
+  req.length = 8;
+
+  if (req.data[1] == 15 || req.data[1] == 16)
+  {
+    // Calculate length of this packet, add on extra data
+    // Force Multiple Coils (FC=15)
+    // https://www.simplymodbus.ca/FC15.htm
+    // Preset Multiple Registers (FC=16)
+    // https://www.simplymodbus.ca/FC16.htm
+    req.length = 9 + req.data[6];
+  }
+
+  if (req.length > sizeof(req.data))
+  {
+    ESP_LOGE(TAG, "Request too long %u", req.length);
+    return false;
+  }
+
+  if (request_q == nullptr)
+  {
+    return false;
+  }
+
+  if (xQueueSend(request_q, &req, pdMS_TO_TICKS(MODBUS_REQUEST_QUEUE_TIMEOUT_MS)) != pdTRUE)
+  {
+    ESP_LOGE(TAG, "Request queue full, id=%u, func=%u", req.data[0], req.data[1]);
+    return false;
+  }
+  return true;
+}
+
+// Bytes expected in the reply, 0 if unknown
+static uint16_t expected_reply_length(const modbus_request &req)
+{
+  switch (req.data[1])
+  {
+  case 3:
+  case 4:
+    // Address, function, byte count, 2 bytes per register, CRC
+    return 5 + 2 * (((uint16_t)req.data[4] << 8) | req.data[5]);
+  case 5:
+  case 6:
+  case 15:
+  case 16:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+static modbus_device_stats *find_device(uint8_t address)
+{
+  for (uint8_t i = 0; i < device_count; i++)
+  {
+    if (device_stats[i].address == address)
+    {
+      return &device_stats[i];
+    }
+  }
+
+  if (device_count == MODBUS_MAXIMUM_DEVICES)
+  {
+    // Share the last slot
+    return &device_stats[MODBUS_MAXIMUM_DEVICES - 1];
+  }
+
+  modbus_device_stats *d = &device_stats[device_count++];
+  memset(d, 0, sizeof(modbus_device_stats));
+  d->address = address;
+  return d;
+}
+
+// Sends the request and waits for the reply frame
+static modbus_result transact(const modbus_request &req, uint16_t *length, int64_t *rtt_us)
+{
+  uint32_t baud = 9600;
+  uart_get_baudrate(uart_port, &baud);
+  // 11 bits per character (start, 8 data, parity/stop, stop)
+  uint32_t character_us = 11000000UL / baud;
+  uint32_t timeout_us = (req.length + expected_reply_length(req) + MODBUS_RX_TIMEOUT_SYMBOLS) * character_us + MODBUS_RESPONSE_TIMEOUT_MS * 1000UL;
+
+  int64_t start = esp_timer_get_time();
+  if (hal.GetRS485Mutex())
+  {
+    // Throw away anything left over from a previous (late) reply
+    uart_flush_input(uart_port);
+    xQueueReset(uart_event_q);
+    // Send the bytes (actually just put them into the TX FIFO buffer)
+    uart_write_bytes(uart_port, (const char *)req.data, req.length);
+    hal.ReleaseRS485Mutex();
+  }
+  else
+  {
+    return modbus_result::Timeout;
+  }
+
+  ESP_LOGD(TAG, "Send addr=%u, func=%u, len=%u", req.data[0], req.data[1], req.length);
+
+  uint16_t len = 0;
+  for (;;)
+  {
+    int64_t remaining = (int64_t)timeout_us - (esp_timer_get_time() - start);
+    if (remaining <= 0)
+    {
+      return modbus_result::Timeout;
+    }
+
+    uart_event_t event;
+    if (xQueueReceive(uart_event_q, &event, pdMS_TO_TICKS(remaining / 1000) + 1) == pdFALSE)
+    {
+      return modbus_result::Timeout;
+    }
+
+    if (event.type == UART_DATA)
+    {
+      size_t available = event.size;
+      if (available > sizeof(reply) - len)
+      {
+        available = sizeof(reply) - len;
+      }
+      len += (uint16_t)uart_read_bytes(uart_port, &reply[len], available, 0);
+
+      if (event.timeout_flag && len > 0)
+      {
+        // Line has gone idle, end of frame
+        break;
+      }
+    }
+    else if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+    {
+      ESP_LOGE(TAG, "RX overflow");
+      uart_flush_input(uart_port);
+      xQueueReset(uart_event_q);
+      return modbus_result::CRCError;
+    }
+  }
+
+  *rtt_us = esp_timer_get_time() - start;
+  *length = len;
+
+  // Min packet length of 5 bytes
+  if (len < 5)
+  {
+    ESP_LOGE(TAG, "Short packet %u bytes", len);
+    return modbus_result::CRCError;
+  }
+
+  // CRC is sent low byte first
+  auto crc = (uint16_t)(reply[len - 2] | (reply[len - 1] << 8));
+  if (calculateCRC(reply, (uint8_t)(len - 2)) != crc)
+  {
+    ESP_LOGE(TAG, "CRC error");
+    return modbus_result::CRCError;
+  }
+
+  // 0xF8 is the PZEM "general" address, the device replies with it
+  if (reply[0] != req.data[0] || (reply[1] & B01111111) != req.data[1])
+  {
+    ESP_LOGW(TAG, "Unexpected reply id=%u, func=%u", reply[0], reply[1]);
+    return modbus_result::CRCError;
+  }
+
+  if (reply[1] & B10000000)
+  {
+    ESP_LOG_BUFFER_HEXDUMP(TAG, reply, len, esp_log_level_t::ESP_LOG_DEBUG);
+    return modbus_result::Exception;
+  }
+
+  return modbus_result::Reply;
+}
+
+/// @brief Sends the queued requests one after the other, no delay other than waiting for each reply
+[[noreturn]] void modbus_master_task(void *)
+{
+  modbus_request req;
+
+  for (;;)
+  {
+    // Wait for a item in the queue, blocking indefinately
+    xQueueReceive(request_q, &req, portMAX_DELAY);
+
+    // Calculate the MODBUS CRC, low byte first
+    auto crc16 = calculateCRC(req.data, (uint8_t)(req.length - 2));
+    req.data[req.length - 2] = (uint8_t)(crc16 & 0xFF);
+    req.data[req.length - 1] = (uint8_t)(crc16 >> 8);
+
+    modbus_result result = modbus_result::Timeout;
+    uint16_t length = 0;
+    int64_t rtt_us = 0;
+    uint8_t retries = 0;
+
+    for (uint8_t attempt = 0; attempt <= MODBUS_RETRIES; attempt++)
+    {
+      result = transact(req, &length, &rtt_us);
+
+      portENTER_CRITICAL(&stats_lock);
+      modbus_device_stats *d = find_device(req.data[0]);
+      if (attempt == 0)
+      {
+        d->requests++;
+      }
+      else
+      {
+        d->retries++;
+      }
+      if (result == modbus_result::Timeout)
+      {
+        d->timeouts++;
+      }
+      if (result == modbus_result::CRCError)
+      {
+        d->crc_errors++;
+      }
+      if (result == modbus_result::Exception)
+      {
+        d->exceptions++;
+      }
+      if (result == modbus_result::Reply)
+      {
+        uint8_t index = d - device_stats;
+        d->replies++;
+        d->last_rtt_us = (uint32_t)rtt_us;
+        rtt_total_us[index] += d->last_rtt_us;
+        d->average_rtt_us = (uint32_t)(rtt_total_us[index] / d->replies);
+        if (d->last_rtt_us > d->max_rtt_us)
+        {
+          d->max_rtt_us = d->last_rtt_us;
+        }
+      }
+      if (result != modbus_result::Reply && result != modbus_result::Exception && attempt == MODBUS_RETRIES)
+      {
+        d->failed++;
+      }
+      portEXIT_CRITICAL(&stats_lock);
+
+      // An exception is a valid answer from the device, repeating the request won't change it
+      if (result == modbus_result::Reply || result == modbus_result::Exception)
+      {
+        break;
+      }
+      retries++;
+    }
+
+    if (result == modbus_result::Reply)
+    {
+      ESP_LOGD(TAG, "Recv %u bytes, id=%u, cmd=%u, rtt=%ius, retries=%u", length, reply[0], reply[1], (int32_t)rtt_us, retries);
+      if (reply_handler != nullptr)
+      {
+        reply_handler(reply, length);
+      }
+    }
+    else
+    {
+      if (result == modbus_result::Exception)
+      {
+        // Exception code follows the function code
+        ESP_LOGE(TAG, "Exception %u from id=%u, func=%u", reply[2], req.data[0], req.data[1]);
+      }
+      else
+      {
+        ESP_LOGE(TAG, "No reply from id=%u, func=%u", req.data[0], req.data[1]);
+      }
+      // The request didn't do what was asked, the caller treats an exception the same as no reply
+      if (failed_handler != nullptr)
+      {
+        failed_handler(req.data[0]);
+      }
+    }
+  }
+}
+
+uint8_t modbus_get_stats(modbus_device_stats *list, uint8_t listSize)
+{
+  uint8_t count = 0;
+  portENTER_CRITICAL(&stats_lock);
+  for (uint8_t i = 0; i < device_count && count < listSize; i++)
+  {
+    list[count++] = device_stats[i];
+  }
+  portEXIT_CRITICAL(&stats_lock);
+  return count;
+}
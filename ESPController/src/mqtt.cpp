@@ -11,8 +11,6 @@
 static constexpr const char *const TAG = "diybms-mqtt";
 
 #include "mqtt.h"
-#include "string_utils.h"
-#include <string>
 
 bool mqttClient_connected = false;
 esp_mqtt_client_handle_t mqtt_client = nullptr;
@@ -21,6 +19,9 @@ uint16_t mqtt_error_transport_count = 0;
 uint16_t mqtt_connection_count = 0;
 uint16_t mqtt_disconnection_count = 0;
 
+// Protects the cell snapshot used for packed bank messages
+static SemaphoreHandle_t bank_snapshot_mutex = nullptr;
+
 bool checkMQTTReady()
 {
     if (!mysettings.mqtt_enabled)
@@ -47,36 +48,156 @@ bool checkMQTTReady()
     return true;
 }
 
+// Flow control, the state is decided by how much data is waiting in the esp-mqtt outbox
+static mqtt_flow_state flow_state = mqtt_flow_state::MQTT_FLOW_NORMAL;
+static uint32_t outbox_bytes = 0;
+static uint32_t outbox_high_water = 0;
+// Messages queued since the outbox was last seen empty
+static uint16_t outbox_pending = 0;
+static uint16_t outbox_pending_high_water = 0;
+static uint32_t mqtt_dropped[3] = {0, 0, 0};
+
+/// @brief Read the outbox size and decide which messages can be sent
+static void mqtt_flow_update()
+{
+    if (mqtt_client == nullptr)
+    {
+        return;
+    }
+
+    int size = esp_mqtt_client_get_outbox_size(mqtt_client);
+    outbox_bytes = size < 0 ? 0 : (uint32_t)size;
+
+    if (outbox_bytes == 0)
+    {
+        outbox_pending = 0;
+    }
+    if (outbox_bytes > outbox_high_water)
+    {
+        outbox_high_water = outbox_bytes;
+    }
+
+    mqtt_flow_state previous = flow_state;
+
+    // Step up immediately, step back down only once the outbox has drained (hysteresis)
+    if (outbox_bytes >= MQTT_OUTBOX_CRITICAL_BYTES)
+    {
+        flow_state = mqtt_flow_state::MQTT_FLOW_CRITICAL;
+    }
+    else if (outbox_bytes >= MQTT_OUTBOX_REDUCED_BYTES)
+    {
+        if (flow_state == mqtt_flow_state::MQTT_FLOW_NORMAL)
+        {
+            flow_state = mqtt_flow_state::MQTT_FLOW_REDUCED;
+        }
+    }
+    else if (outbox_bytes <= MQTT_OUTBOX_RESUME_BYTES)
+    {
+        flow_state = mqtt_flow_state::MQTT_FLOW_NORMAL;
+    }
+    else if (flow_state == mqtt_flow_state::MQTT_FLOW_CRITICAL)
+    {
+        flow_state = mqtt_flow_state::MQTT_FLOW_REDUCED;
+    }
+
+    if (previous != flow_state)
+    {
+        ESP_LOGW(TAG, "Flow state %u->%u, outbox=%u bytes, pending=%u", previous, flow_state, outbox_bytes, outbox_pending);
+    }
+}
+
+/// @brief Should a message of this priority be sent in the current flow state
+static bool mqtt_flow_allows(mqtt_priority priority)
+{
+    switch (flow_state)
+    {
+    case mqtt_flow_state::MQTT_FLOW_NORMAL:
+        return true;
+    case mqtt_flow_state::MQTT_FLOW_REDUCED:
+        return priority != mqtt_priority::MQTT_PRIORITY_LOW;
+    default:
+        return priority == mqtt_priority::MQTT_PRIORITY_HIGH;
+    }
+}
+
+static uint32_t mqtt_publish_count = 0;
+static uint64_t mqtt_publish_time_us = 0;
+
 /// Utility function for publishing an MQTT message.
 ///
 /// @param topic Topic to publish the message to.
 /// @param payload Message payload to be published.
-/// @param clear_payload When true @param payload will be cleared upon sending.
-static inline void publish_message(std::string const &topic, std::string &payload, bool clear_payload = true)
+/// @param length Length of payload in bytes.
+/// @param priority Low priority messages are dropped first when the outbox is filling up.
+/// @return true if the message was queued
+static bool publish_message(const char *topic, const char *payload, size_t length, mqtt_priority priority)
 {
     static constexpr int MQTT_QUALITY_OF_SERVICE = 0;
     static constexpr int MQTT_RETAIN_MESSAGE = 0;
 
-    if (mqtt_client != nullptr && mqttClient_connected)
+    if (mqtt_client == nullptr || !mqttClient_connected)
     {
-        int id = esp_mqtt_client_enqueue(mqtt_client, topic.c_str(),
-                                         payload.c_str(), payload.length(),
-                                         MQTT_QUALITY_OF_SERVICE, MQTT_RETAIN_MESSAGE, true);
+        return false;
+    }
 
-        if (id < 0)
-        {
-            ESP_LOGE(TAG, "Topic:%s, failed publish", topic.c_str());
-        }
+    if (!mqtt_flow_allows(priority) || outbox_bytes + length > MQTT_OUTBOX_MAXIMUM_BYTES)
+    {
+        mqtt_dropped[priority]++;
+        ESP_LOGD(TAG, "Topic:%s, dropped (flow control)", topic);
+        return false;
+    }
 
-        ESP_LOGD(TAG, "Topic:%s, ID:%d, Length:%i", topic.c_str(), id, payload.length());
-        // ESP_LOGV(TAG, "Payload:%s", payload.c_str());
+    int64_t start = esp_timer_get_time();
+    int id = esp_mqtt_client_enqueue(mqtt_client, topic, payload, length,
+                                     MQTT_QUALITY_OF_SERVICE, MQTT_RETAIN_MESSAGE, true);
+    mqtt_publish_time_us += esp_timer_get_time() - start;
+    mqtt_publish_count++;
+
+    ESP_LOGD(TAG, "Topic:%s, ID:%d, Length:%u", topic, id, length);
+    // ESP_LOGV(TAG, "Payload:%.*s", length, payload);
+
+    if (id < 0)
+    {
+        ESP_LOGE(TAG, "Topic:%s, failed publish", topic);
+        mqtt_dropped[priority]++;
+        return false;
+    }
+
+    // Approximate, updated properly on the next mqtt_flow_update
+    outbox_bytes += length + strlen(topic);
+    outbox_pending++;
+    if (outbox_pending > outbox_pending_high_water)
+    {
+        outbox_pending_high_water = outbox_pending;
     }
 
-    if (clear_payload)
+    return true;
+}
+
+/// @brief Finish the JSON payload and publish it
+static bool publish_json(const char *topic, mqtt_payload_writer &json, const char *payload, mqtt_priority priority)
+{
+    if (json.finish() != ESP_OK)
     {
-        payload.clear();
-        payload.shrink_to_fit();
+        ESP_LOGE(TAG, "Topic:%s, payload too large", topic);
+        return false;
     }
+    return publish_message(topic, payload, json.length(), priority);
+}
+
+static mqtt_topic_table topics;
+static mqtt_cell_topic_table cell_topics;
+
+// Payloads are built in these, one per calling task (mqtt1/mqtt2 run on the periodic task, mqtt3 on the rule task)
+static char payload_arena[MQTT_PAYLOAD_ARENA_SIZE];
+static char rule_payload_arena[MQTT_RULE_PAYLOAD_ARENA_SIZE];
+
+static void buildTopics()
+{
+    mqtt_format_topics(&topics, mysettings.mqtt_topic, mysettings.currentMonitoringModBusAddress);
+
+    // Cell topics are rebuilt on next use
+    cell_topics.banks = 0;
 }
 
 /// Utility function returning the uptime of the ESP32 in seconds.
@@ -145,13 +266,22 @@ void stopMqtt()
 // Connects to MQTT if required
 void connectToMqtt()
 {
-    ESP_LOGI(TAG, "MQTT counters: Err_Con=%u,Err_Trans=%u,Conn=%u,Disc=%u", mqtt_error_connection_count,
-             mqtt_error_transport_count, mqtt_connection_count, mqtt_disconnection_count);
+    ESP_LOGI(TAG, "MQTT counters: Err_Con=%u,Err_Trans=%u,Conn=%u,Disc=%u,Outbox HWM=%u,Dropped=%u/%u/%u", mqtt_error_connection_count,
+             mqtt_error_transport_count, mqtt_connection_count, mqtt_disconnection_count, outbox_high_water,
+             mqtt_dropped[0], mqtt_dropped[1], mqtt_dropped[2]);
 
     if (mysettings.mqtt_enabled && mqtt_client == nullptr)
     {
         ESP_LOGI(TAG, "esp_mqtt_client_init");
 
+        if (bank_snapshot_mutex == nullptr)
+        {
+            bank_snapshot_mutex = xSemaphoreCreateMutex();
+        }
+
+        // Settings may have changed since the last connection
+        buildTopics();
+
         // Need to preset variables in esp_mqtt_client_config_t otherwise LoadProhibited errors
         esp_mqtt_client_config_t mqtt_cfg{
             .event_handle = nullptr,
@@ -164,7 +294,8 @@ void connectToMqtt()
             .buffer_size = 512,
             // 30 seconds
             .reconnect_timeout_ms = 30000,
-            .out_buffer_size = 2048,
+            // Packed bank messages hold a whole bank of cells
+            .out_buffer_size = mysettings.mqtt_bank_payloads ? MQTT_BANK_OUT_BUFFER_SIZE : 2048,
             // 4 seconds
             .network_timeout_ms = 4000};
 
@@ -191,117 +322,77 @@ void connectToMqtt()
 void GeneralStatusPayload(const PacketRequestGenerator *prg, const PacketReceiveProcessor *receiveProc, uint16_t requestq_count, const Rules *rules)
 {
     ESP_LOGI(TAG, "General status payload");
-    std::string status;
-    status.reserve(400);
-    status.append("{\"banks\":")
-        .append(std::to_string(mysettings.totalNumberOfBanks))
-        .append(",\"cells\":")
-        .append(std::to_string(mysettings.totalNumberOfSeriesModules))
-        .append(",\"uptime\":")
-        .append(std::to_string(uptime_in_seconds()))
-        .append(",\"commserr\":")
-        .append(std::to_string(receiveProc->HasCommsTimedOut() ? 1 : 0))
-        .append(",\"sent\":")
-        .append(std::to_string(prg->packetsGenerated))
-        .append(",\"received\":")
-        .append(std::to_string(receiveProc->packetsReceived))
-        .append(",\"badcrc\":")
-        .append(std::to_string(receiveProc->totalCRCErrors))
-        .append(",\"ignored\":")
-        .append(std::to_string(receiveProc->totalNotProcessedErrors))
-        .append(",\"oos\":")
-        .append(std::to_string(receiveProc->totalOutofSequenceErrors))
-        .append(",\"sendqlvl\":")
-        .append(std::to_string(requestq_count))
-        .append(",\"roundtrip\":")
-        .append(std::to_string(receiveProc->packetTimerMillisecond));
+    mqtt_payload_writer json(fixed_buffer_sink(), payload_arena, sizeof(payload_arena));
+    json.beginObject();
+    json.addUInt("banks", mysettings.totalNumberOfBanks);
+    json.addUInt("cells", mysettings.totalNumberOfSeriesModules);
+    json.addUInt("uptime", uptime_in_seconds());
+    json.addUInt("commserr", receiveProc->HasCommsTimedOut() ? 1 : 0);
+    json.addUInt("sent", prg->packetsGenerated);
+    json.addUInt("received", receiveProc->packetsReceived);
+    json.addUInt("badcrc", receiveProc->totalCRCErrors);
+    json.addUInt("ignored", receiveProc->totalNotProcessedErrors);
+    json.addUInt("oos", receiveProc->totalOutofSequenceErrors);
+    json.addUInt("sendqlvl", requestq_count);
+    json.addUInt("roundtrip", receiveProc->packetTimerMillisecond);
 
     if (mysettings.dynamiccharge)
     {
-        status.append(",\"dynchargev\":")
-            .append(float_to_string(((float)rules->DynamicChargeVoltage()) / 10.0F))
-            .append(",\"dynchargec\":")
-            .append(float_to_string(((float)rules->DynamicChargeCurrent()) / 10.0F));
+        json.addFloat("dynchargev", ((float)rules->DynamicChargeVoltage()) / 10.0F);
+        json.addFloat("dynchargec", ((float)rules->DynamicChargeCurrent()) / 10.0F);
     }
 
-    status.append(",\"chgmode\":")
-        .append(std::to_string((unsigned int)rules->getChargingMode()))
-        .append(",\"chgtimer\":")
-        .append(std::to_string(rules->getChargingTimerSecondsRemaining()));
-
-    status.append("}");
+    json.addUInt("chgmode", (unsigned int)rules->getChargingMode());
+    json.addInt("chgtimer", rules->getChargingTimerSecondsRemaining());
+    json.endObject();
 
-    std::string topic = mysettings.mqtt_topic;
-    topic.append("/status");
-
-    publish_message(topic, status);
+    publish_json(topics.status, json, payload_arena, mqtt_priority::MQTT_PRIORITY_HIGH);
 }
 
 void BankLevelInformation(const Rules *rules)
 {
-    std::string bank_status;
-    bank_status.reserve(64);
     // Output bank level information (just voltage for now)
     for (int8_t bank = 0; bank < mysettings.totalNumberOfBanks; bank++)
     {
         ESP_LOGI(TAG, "Bank %d status payload", bank);
-        bank_status.clear();
-        bank_status.append("{\"voltage\":")
-            .append(float_to_string((float)(rules->bankvoltage.at(bank)) / 1000.0f))
-            .append(",\"range\":")
-            .append(std::to_string(rules->VoltageRangeInBank(bank)))
-            .append("}");
-        std::string topic = mysettings.mqtt_topic;
-        topic.append("/bank/").append(std::to_string(bank));
-        publish_message(topic, bank_status);
+        mqtt_payload_writer json(fixed_buffer_sink(), payload_arena, sizeof(payload_arena));
+        json.beginObject();
+        json.addFloat("voltage", (float)(rules->bankvoltage.at(bank)) / 1000.0f);
+        json.addUInt("range", rules->VoltageRangeInBank(bank));
+        json.endObject();
+        publish_json(topics.bank[bank], json, payload_arena, mqtt_priority::MQTT_PRIORITY_NORMAL);
     }
 }
 
+// JSON keys "0", "1", "2"... for the rule and output payloads
+static const char *const index_keys[] = {"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15", "16"};
+static_assert(sizeof(index_keys) / sizeof(index_keys[0]) >= RELAY_RULES, "index_keys too short");
+static_assert(sizeof(index_keys) / sizeof(index_keys[0]) >= RELAY_TOTAL, "index_keys too short");
+
 void RuleStatus(const Rules *rules)
 {
     ESP_LOGI(TAG, "Rule status payload");
-    std::string rule_status;
-    rule_status.reserve(128);
-    rule_status.append("{");
+    mqtt_payload_writer json(fixed_buffer_sink(), rule_payload_arena, sizeof(rule_payload_arena));
+    json.beginObject();
     for (uint8_t i = 0; i < RELAY_RULES; i++)
     {
-        rule_status.append("\"")
-            .append(std::to_string(i))
-            .append("\":")
-            .append(std::to_string(rules->ruleOutcome((Rule)i) ? 1 : 0));
-        if (i < (RELAY_RULES - 1))
-        {
-            rule_status.append(",");
-        }
+        json.addUInt(index_keys[i], rules->ruleOutcome((Rule)i) ? 1 : 0);
     }
-    rule_status.append("}");
-    std::string topic = mysettings.mqtt_topic;
-    topic.append("/rule");
-    publish_message(topic, rule_status);
+    json.endObject();
+    publish_json(topics.rule, json, rule_payload_arena, mqtt_priority::MQTT_PRIORITY_HIGH);
 }
 
 void OutputStatus(const RelayState *previousRelayState)
 {
     ESP_LOGI(TAG, "Outputs status payload");
-    std::string relay_status;
-    relay_status.reserve(128);
-    relay_status.append("{");
+    mqtt_payload_writer json(fixed_buffer_sink(), rule_payload_arena, sizeof(rule_payload_arena));
+    json.beginObject();
     for (uint8_t i = 0; i < RELAY_TOTAL; i++)
     {
-        relay_status.append("\"")
-            .append(std::to_string(i))
-            .append("\":")
-            .append(std::to_string((previousRelayState[i] == RelayState::RELAY_ON) ? 1 : 0));
-
-        if (i < (RELAY_TOTAL - 1))
-        {
-            relay_status.append(",");
-        }
+        json.addUInt(index_keys[i], (previousRelayState[i] == RelayState::RELAY_ON) ? 1 : 0);
     }
-    relay_status.append("}");
-    std::string topic = mysettings.mqtt_topic;
-    topic.append("/output");
-    publish_message(topic, relay_status);
+    json.endObject();
+    publish_json(topics.output, json, rule_payload_arena, mqtt_priority::MQTT_PRIORITY_HIGH);
 }
 
 void MQTTCurrentMonitoring(const currentmonitoring_struct *currentMonitor)
@@ -309,99 +400,495 @@ void MQTTCurrentMonitoring(const currentmonitoring_struct *currentMonitor)
     static int64_t lastcurrentMonitortimestamp = 0;
 
     ESP_LOGI(TAG, "MQTT Payload for current data");
-    std::string status;
-    status.reserve(256);
-    status.append("{\"valid\":").append(std::to_string(currentMonitor->validReadings ? 1 : 0));
+    mqtt_payload_writer json(fixed_buffer_sink(), payload_arena, sizeof(payload_arena));
+    json.beginObject();
+    json.addUInt("valid", currentMonitor->validReadings ? 1 : 0);
 
     if (currentMonitor->validReadings && currentMonitor->timestamp != lastcurrentMonitortimestamp)
     {
         // Send current monitor data if its valid and not sent before
-        status.append(",\"voltage\":").append(float_to_string(currentMonitor->modbus.voltage)).append(",\"current\":").append(float_to_string(currentMonitor->modbus.current)).append(",\"power\":").append(float_to_string(currentMonitor->modbus.power));
+        json.addFloat("voltage", currentMonitor->modbus.voltage);
+        json.addFloat("current", currentMonitor->modbus.current);
+        json.addFloat("power", currentMonitor->modbus.power);
 
         if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS || mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL)
         {
-            status.append(",\"mAhIn\":").append(std::to_string(currentMonitor->modbus.milliamphour_in)).append(",\"mAhOut\":").append(std::to_string(currentMonitor->modbus.milliamphour_out)).append(",\"DailymAhIn\":").append(std::to_string(currentMonitor->modbus.daily_milliamphour_in)).append(",\"DailymAhOut\":").append(std::to_string(currentMonitor->modbus.daily_milliamphour_out)).append(",\"temperature\":").append(std::to_string(currentMonitor->modbus.temperature)).append(",\"relayState\":").append(std::to_string(currentMonitor->RelayState ? 1 : 0)).append(",\"soc\":").append(float_to_string(currentMonitor->stateofcharge));
+            // Lifetime totals for the internal monitor, not reset by SOC calibration
+            json.addUInt("mAhIn", currentMonitor->modbus.milliamphour_in);
+            json.addUInt("mAhOut", currentMonitor->modbus.milliamphour_out);
+            json.addUInt("DailymAhIn", currentMonitor->modbus.daily_milliamphour_in);
+            json.addUInt("DailymAhOut", currentMonitor->modbus.daily_milliamphour_out);
+            json.addInt("temperature", currentMonitor->modbus.temperature);
+            json.addUInt("relayState", currentMonitor->RelayState ? 1 : 0);
+            json.addFloat("soc", currentMonitor->stateofcharge);
         }
     }
-    status.append("}");
+    json.endObject();
 
     lastcurrentMonitortimestamp = currentMonitor->timestamp;
 
-    std::string topic = mysettings.mqtt_topic;
-    topic.append("/modbus_A").append(std::to_string(mysettings.currentMonitoringModBusAddress));
-    publish_message(topic, status);
+    if (topics.current_address != mysettings.currentMonitoringModBusAddress)
+    {
+        mqtt_format_current_topic(&topics, mysettings.mqtt_topic, mysettings.currentMonitoringModBusAddress);
+    }
+
+    publish_json(topics.current, json, payload_arena, mqtt_priority::MQTT_PRIORITY_NORMAL);
+}
+
+// Values last sent for each cell, used to decide if the cell needs publishing again
+struct mqtt_cell_state
+{
+    int64_t timestamp;
+    uint16_t voltagemV;
+    int8_t externalTemp;
+    int8_t internalTemp;
+    bool inBypass;
+    bool bypassOverTemp;
+    bool published;
+};
+
+static mqtt_cell_state cell_state[maximum_controller_cell_modules];
+static uint8_t cell_state_count = 0;
+
+static uint32_t mqtt_cells_published = 0;
+static uint32_t mqtt_cells_suppressed = 0;
+static uint32_t mqtt_cells_failed = 0;
+static uint8_t mqtt_cell_budget = MQTT_CELL_BUDGET_MAX;
+static uint32_t mqtt_bank_messages = 0;
+static uint32_t mqtt_bank_too_large = 0;
+
+void mqtt_get_stats(mqtt_publish_stats *stats)
+{
+    stats->cells_published = mqtt_cells_published;
+    stats->cells_suppressed = mqtt_cells_suppressed;
+    stats->cells_failed = mqtt_cells_failed;
+    stats->cell_budget = mqtt_cell_budget;
+    stats->bank_messages = mqtt_bank_messages;
+    stats->bank_too_large = mqtt_bank_too_large;
+    stats->flow_state = flow_state;
+    stats->outbox_bytes = outbox_bytes;
+    stats->outbox_high_water = outbox_high_water;
+    stats->outbox_pending = outbox_pending;
+    stats->outbox_pending_high_water = outbox_pending_high_water;
+    stats->dropped_low = mqtt_dropped[mqtt_priority::MQTT_PRIORITY_LOW];
+    stats->dropped_normal = mqtt_dropped[mqtt_priority::MQTT_PRIORITY_NORMAL];
+    stats->dropped_high = mqtt_dropped[mqtt_priority::MQTT_PRIORITY_HIGH];
+    stats->publish_count = mqtt_publish_count;
+    stats->publish_time_us = mqtt_publish_time_us;
+    stats->connections = mqtt_connection_count;
+    stats->disconnections = mqtt_disconnection_count;
+}
+
+/// @brief Has the cell changed by more than the deadband (or not been sent for a while)
+static bool cellNeedsPublish(uint8_t i, int64_t now)
+{
+    const mqtt_cell_state &last = cell_state[i];
+
+    if (!last.published)
+    {
+        return true;
+    }
+    if (now - last.timestamp >= (int64_t)MQTT_CELL_KEEPALIVE_SECONDS * 1000000)
+    {
+        return true;
+    }
+    if (abs((int32_t)cmi[i].voltagemV - (int32_t)last.voltagemV) >= MQTT_CELL_DEADBAND_MV)
+    {
+        return true;
+    }
+    if (abs((int16_t)cmi[i].externalTemp - (int16_t)last.externalTemp) >= MQTT_CELL_DEADBAND_TEMPERATURE)
+    {
+        return true;
+    }
+    if (cmi[i].inBypass != last.inBypass || cmi[i].bypassOverTemp != last.bypassOverTemp)
+    {
+        return true;
+    }
+    if (mysettings.mqtt_basic_cell_reporting == false &&
+        abs((int16_t)cmi[i].internalTemp - (int16_t)last.internalTemp) >= MQTT_CELL_DEADBAND_TEMPERATURE)
+    {
+        return true;
+    }
+
+    return false;
 }
 
 void MQTTCellData()
 {
-    // Send a few MQTT packets and keep track so we send the next batch on following calls
+    // Keep track of where we got to, so the next call carries on from there if we run out of budget
     static uint8_t mqttStartModule = 0;
-    static constexpr uint8_t MAX_MODULES_PER_ITERATION = 8;
 
-    if (mqttStartModule > (TotalNumberOfCells() - 1))
+    const uint8_t totalCells = TotalNumberOfCells();
+
+    if (totalCells != cell_state_count)
     {
+        // Configuration changed, send everything again
+        memset(cell_state, 0, sizeof(cell_state));
+        cell_state_count = totalCells;
         mqttStartModule = 0;
     }
 
+    if (mqttStartModule > (totalCells - 1))
+    {
+        mqttStartModule = 0;
+    }
+
+    ESP_LOGI(TAG, "MQTT Payload for cell data");
+
+    const int64_t now = esp_timer_get_time();
     uint8_t counter = 0;
+    uint8_t skipped = 0;
+    bool failed = false;
     uint8_t i = mqttStartModule;
 
-    ESP_LOGI(TAG, "MQTT Payload for cell data");
+    // When the outbox is filling, send fewer cells and only the basic values
+    const bool detail = mysettings.mqtt_basic_cell_reporting == false && flow_state == mqtt_flow_state::MQTT_FLOW_NORMAL;
+    const mqtt_priority priority = detail ? mqtt_priority::MQTT_PRIORITY_LOW : mqtt_priority::MQTT_PRIORITY_NORMAL;
+    const uint8_t budget = flow_state == mqtt_flow_state::MQTT_FLOW_NORMAL ? mqtt_cell_budget : mqtt_cell_budget / 2;
 
-    std::string status;
-    status.reserve(128);
+    if (!mqtt_format_cell_topics(&cell_topics, mysettings.mqtt_topic, mysettings.totalNumberOfBanks, mysettings.totalNumberOfSeriesModules))
+    {
+        return;
+    }
 
-    while (i < TotalNumberOfCells() && counter < MAX_MODULES_PER_ITERATION)
+    // Check every cell once, publishing only those which have changed
+    for (uint8_t n = 0; n < totalCells; n++, i++)
     {
+        if (i >= totalCells)
+        {
+            i = 0;
+        }
+
         // Only send valid module data
-        if (cmi[i].valid)
+        if (!cmi[i].valid)
+        {
+            cell_state[i].published = false;
+            continue;
+        }
+
+        if (!cellNeedsPublish(i, now))
         {
+            skipped++;
+            continue;
+        }
 
-            uint8_t bank = i / mysettings.totalNumberOfSeriesModules;
-            uint8_t m = i - (bank * mysettings.totalNumberOfSeriesModules);
+        if (counter == budget)
+        {
+            // Out of budget, start from this cell next time
+            break;
+        }
+
+        mqtt_payload_writer json(fixed_buffer_sink(), payload_arena, sizeof(payload_arena));
+        mqtt_cell_payload(json, cmi[i], detail);
 
-            status.clear();
-            status.append("{\"voltage\":").append(float_to_string(cmi[i].voltagemV / 1000.0f)).append(",\"exttemp\":").append(std::to_string(cmi[i].externalTemp));
+        counter++;
 
-            if (mysettings.mqtt_basic_cell_reporting == false)
+        if (!publish_json(mqtt_cell_topic(cell_topics, i), json, payload_arena, priority))
+        {
+            // Try this cell again next time
+            failed = true;
+            mqtt_cells_failed++;
+            break;
+        }
+
+        mqtt_cells_published++;
+
+        mqtt_cell_state &last = cell_state[i];
+        last.timestamp = now;
+        last.voltagemV = cmi[i].voltagemV;
+        last.externalTemp = cmi[i].externalTemp;
+        last.internalTemp = cmi[i].internalTemp;
+        last.inBypass = cmi[i].inBypass;
+        last.bypassOverTemp = cmi[i].bypassOverTemp;
+        last.published = true;
+    }
+
+    mqtt_cells_suppressed += skipped;
+
+    // Adjust the number of messages per call, back off quickly if the client can't keep up
+    // and grow slowly while it can. This prevents flooding the ESP controllers wifi stack
+    // and potentially causing reboots/fatal exceptions
+    if (failed)
+    {
+        mqtt_cell_budget = mqtt_cell_budget / 2;
+        if (mqtt_cell_budget < MQTT_CELL_BUDGET_MIN)
+        {
+            mqtt_cell_budget = MQTT_CELL_BUDGET_MIN;
+        }
+    }
+    else if (counter == budget && budget == mqtt_cell_budget)
+    {
+        mqtt_cell_budget += MQTT_CELL_BUDGET_STEP;
+        if (mqtt_cell_budget > MQTT_CELL_BUDGET_MAX)
+        {
+            mqtt_cell_budget = MQTT_CELL_BUDGET_MAX;
+        }
+    }
+
+    ESP_LOGD(TAG, "Cells published=%u, unchanged=%u, budget=%u", counter, skipped, mqtt_cell_budget);
+
+    mqttStartModule = i;
+}
+
+// Copy of the cell data taken when a full scan of the modules has completed
+struct mqtt_bank_cell
+{
+    uint16_t voltagemV;
+    uint16_t BalanceCurrentCount;
+    int8_t externalTemp;
+    int8_t internalTemp;
+    bool valid;
+    bool inBypass;
+};
+
+static mqtt_bank_cell bank_snapshot[maximum_controller_cell_modules];
+static uint8_t bank_snapshot_banks = 0;
+static uint8_t bank_snapshot_series = 0;
+static bool bank_snapshot_pending = false;
+
+/// @brief Called when the cell data is consistent (all modules have replied), takes a copy for the packed bank messages
+void mqtt_bank_snapshot()
+{
+    if (!mysettings.mqtt_enabled || !mysettings.mqtt_bank_payloads || bank_snapshot_mutex == nullptr)
+    {
+        return;
+    }
+
+    // Don't wait, if the previous snapshot is being published just skip this one
+    if (xSemaphoreTake(bank_snapshot_mutex, 0) != pdTRUE)
+    {
+        return;
+    }
+
+    bank_snapshot_banks = mysettings.totalNumberOfBanks;
+    bank_snapshot_series = mysettings.totalNumberOfSeriesModules;
+
+    const uint8_t totalCells = TotalNumberOfCells();
+    for (uint8_t i = 0; i < totalCells; i++)
+    {
+        auto &c = bank_snapshot[i];
+        c.voltagemV = cmi[i].voltagemV;
+        c.BalanceCurrentCount = cmi[i].BalanceCurrentCount;
+        c.externalTemp = cmi[i].externalTemp;
+        c.internalTemp = cmi[i].internalTemp;
+        c.valid = cmi[i].valid;
+        c.inBypass = cmi[i].inBypass;
+    }
+    bank_snapshot_pending = true;
+
+    xSemaphoreGive(bank_snapshot_mutex);
+}
+
+/// @brief Output one field of every cell in the bank as a JSON array, invalid cells are null
+template <typename TFunc>
+static void bankArray(mqtt_payload_writer &json, const char *name, uint8_t first, uint8_t count, TFunc value)
+{
+    json.beginArray(name);
+    for (uint8_t i = first; i < first + count; i++)
+    {
+        if (bank_snapshot[i].valid)
+        {
+            json.addInt(value(bank_snapshot[i]));
+        }
+        else
+        {
+            json.addNull();
+        }
+    }
+    json.endArray();
+}
+
+static int32_t cellVoltage(const mqtt_bank_cell &c) { return c.voltagemV; }
+static int32_t cellExternalTemp(const mqtt_bank_cell &c) { return c.externalTemp; }
+static int32_t cellInternalTemp(const mqtt_bank_cell &c) { return c.internalTemp; }
+static int32_t cellBypass(const mqtt_bank_cell &c) { return c.inBypass ? 1 : 0; }
+static int32_t cellBalanceCount(const mqtt_bank_cell &c) { return c.BalanceCurrentCount; }
+
+/// @brief Publish one message per bank, containing arrays of the cell values in cmi[] order
+/// Topic is TOPIC/cells/BANK and payload is {"mV":[..],"exttemp":[..],"inttemp":[..],"bypass":[..],"mAh":[..]}
+void MQTTBankCellData()
+{
+    if (bank_snapshot_mutex == nullptr || xSemaphoreTake(bank_snapshot_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
+    {
+        return;
+    }
+
+    if (bank_snapshot_pending)
+    {
+        ESP_LOGI(TAG, "MQTT Payload for bank cell data");
+
+        static char payload[MQTT_BANK_OUT_BUFFER_SIZE - 128];
+
+        for (uint8_t bank = 0; bank < bank_snapshot_banks; bank++)
+        {
+            const uint8_t first = bank * bank_snapshot_series;
+
+            mqtt_payload_writer json(fixed_buffer_sink(), payload, sizeof(payload));
+            json.beginObject();
+            bankArray(json, "mV", first, bank_snapshot_series, cellVoltage);
+            bankArray(json, "exttemp", first, bank_snapshot_series, cellExternalTemp);
+            if (mysettings.mqtt_basic_cell_reporting == false && flow_state == mqtt_flow_state::MQTT_FLOW_NORMAL)
             {
-                status.append(",\"vMax\":").append(float_to_string(cmi[i].voltagemVMax / 1000.0f)).append(",\"vMin\":").append(float_to_string(cmi[i].voltagemVMin / 1000.0f)).append(",\"inttemp\":").append(std::to_string(cmi[i].internalTemp)).append(",\"bypass\":").append(std::to_string(cmi[i].inBypass ? 1 : 0)).append(",\"PWM\":").append(std::to_string((int)((float)cmi[i].PWMValue / (float)255.0 * 100))).append(",\"bypassT\":").append(std::to_string(cmi[i].bypassOverTemp ? 1 : 0)).append(",\"bpc\":").append(std::to_string(cmi[i].badPacketCount)).append(",\"mAh\":").append(std::to_string(cmi[i].BalanceCurrentCount));
+                bankArray(json, "inttemp", first, bank_snapshot_series, cellInternalTemp);
+                bankArray(json, "bypass", first, bank_snapshot_series, cellBypass);
+                bankArray(json, "mAh", first, bank_snapshot_series, cellBalanceCount);
             }
+            json.endObject();
 
-            status.append("}");
+            if (json.finish() != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Bank %u payload too large", bank);
+                mqtt_bank_too_large++;
+                continue;
+            }
 
-            std::string topic = mysettings.mqtt_topic;
-            topic.append("/").append(std::to_string(bank)).append("/").append(std::to_string(m));
-            publish_message(topic, status);
+            if (publish_message(topics.cells[bank], payload, json.length(), mqtt_priority::MQTT_PRIORITY_NORMAL))
+            {
+                mqtt_bank_messages++;
+            }
         }
 
-        counter++;
+        bank_snapshot_pending = false;
+    }
 
-        i++;
+    xSemaphoreGive(bank_snapshot_mutex);
+}
+
+// Samples taken while the broker couldn't be reached, only used by mqtt1 (periodic task)
+static store_forward_queue replay_queue("/sf_mqtt.bin", MQTT_REPLAY_RAM_SIZE);
+static uint8_t sample_buffer[SF_MAX_RECORD_SIZE];
+static char replay_payload[MQTT_REPLAY_PAYLOAD_SIZE];
+
+void mqtt_get_sf_stats(store_forward_stats *stats)
+{
+    replay_queue.getStats(stats);
+}
+
+/// @brief Keep a sample (every MQTT_STORE_EVERY_CALLS) while MQTT is enabled but not connected
+static void storeSample()
+{
+    static uint8_t calls = 0;
+
+    if (!mysettings.mqtt_enabled || ++calls < MQTT_STORE_EVERY_CALLS)
+    {
+        return;
     }
+    calls = 0;
 
-    // After transmitting this many packets over MQTT, store our current state and exit the function.
-    // this prevents flooding the ESP controllers wifi stack and potentially causing reboots/fatal exceptions
-    mqttStartModule = i;
+    uint16_t length = sf_capture_sample(sample_buffer, sizeof(sample_buffer));
+    // Samples without a timestamp are useless once replayed
+    if (length > 0 && ((const sf_sample_header *)sample_buffer)->timestamp != 0)
+    {
+        replay_queue.push(sample_buffer, length);
+    }
+}
+
+/// @brief Publish the oldest stored sample as a single JSON message on TOPIC/replay
+static void replaySample()
+{
+    uint16_t length = replay_queue.peek(0, sample_buffer, sizeof(sample_buffer));
+    sf_sample_view sample;
+    if (length == 0 || !sf_decode_sample(sample_buffer, length, &sample))
+    {
+        return;
+    }
+
+    mqtt_payload_writer json(fixed_buffer_sink(), replay_payload, sizeof(replay_payload));
+    json.beginObject();
+    json.addUInt("ts", sample.header.timestamp);
+    json.addUInt("banks", sample.header.banks);
+    json.addUInt("series", sample.header.series);
+
+    const uint8_t totalCells = sample.header.banks * sample.header.series;
+    json.beginArray("mV");
+    for (uint8_t i = 0; i < totalCells; i++)
+    {
+        if (sample.cells[i].flags & SF_CELL_VALID)
+        {
+            json.addUInt(sample.cells[i].voltagemV);
+        }
+        else
+        {
+            json.addNull();
+        }
+    }
+    json.endArray();
+    json.beginArray("exttemp");
+    for (uint8_t i = 0; i < totalCells; i++)
+    {
+        json.addInt(sample.cells[i].externalTemp);
+    }
+    json.endArray();
+    json.beginArray("bankv");
+    for (uint8_t bank = 0; bank < sample.header.banks; bank++)
+    {
+        json.addUInt(sample.banks[bank].voltagemV);
+    }
+    json.endArray();
+
+    if (sample.header.flags & SF_FLAG_CURRENT_VALID)
+    {
+        json.addFloat("v", sample.header.current_voltage);
+        json.addFloat("c", sample.header.current_amps);
+        json.addFloat("soc", sample.header.stateofcharge, 2);
+    }
+    json.endObject();
+
+    int64_t start = esp_timer_get_time();
+    bool sent = publish_json(topics.replay, json, replay_payload, mqtt_priority::MQTT_PRIORITY_LOW);
+    if (sent || json.result() != ESP_OK)
+    {
+        // Remove the sample once queued, or if it can never be sent
+        replay_queue.pop(1, sent ? json.length() : 0, (uint32_t)((esp_timer_get_time() - start) / 1000));
+    }
 }
 
 void mqtt1(const currentmonitoring_struct *currentMonitor, const Rules *rules)
 {
     if (!checkMQTTReady())
     {
+        storeSample();
         return;
     }
 
+    mqtt_flow_update();
+
+    // Send cell data less often while the outbox is draining, and not at all if it's critical
+    static uint8_t reduced_skip = 0;
+    bool send_cells = true;
+    if (flow_state == mqtt_flow_state::MQTT_FLOW_CRITICAL)
+    {
+        send_cells = false;
+    }
+    else if (flow_state == mqtt_flow_state::MQTT_FLOW_REDUCED)
+    {
+        reduced_skip++;
+        send_cells = (reduced_skip % 2) == 0;
+    }
+
     // If the BMS is in error, stop sending MQTT packets for the cell data
-    if (!rules->ruleOutcome(Rule::BMSError))
+    if (send_cells && !rules->ruleOutcome(Rule::BMSError))
     {
-        MQTTCellData();
+        if (mysettings.mqtt_bank_payloads)
+        {
+            MQTTBankCellData();
+        }
+        else
+        {
+            MQTTCellData();
+        }
     }
 
     if (mysettings.currentMonitoringEnabled)
     {
         MQTTCurrentMonitoring(currentMonitor);
     }
+
+    // Catch up after an outage, but only while live data is flowing freely
+    if (flow_state == mqtt_flow_state::MQTT_FLOW_NORMAL && !replay_queue.empty())
+    {
+        replaySample();
+    }
 }
 
 void mqtt2(const PacketReceiveProcessor *receiveProc,
@@ -414,6 +901,8 @@ void mqtt2(const PacketReceiveProcessor *receiveProc,
         return;
     }
 
+    mqtt_flow_update();
+
     GeneralStatusPayload(prg, receiveProc, requestq_count, rules);
     BankLevelInformation(rules);
 }
@@ -425,6 +914,8 @@ void mqtt3(const Rules *rules, const RelayState *previousRelayState)
         return;
     }
 
+    mqtt_flow_update();
+
     RuleStatus(rules);
     OutputStatus(previousRelayState);
 }
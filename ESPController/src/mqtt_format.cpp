@@ -0,0 +1,90 @@
+/*
+ ____  ____  _  _  ____  __  __  ___    _  _  __
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)  ( \/ )/. |
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \   \  /(_  _)
+(____/(____) (__) (____/(_/\/\_)(___/    \/   (_)
+
+  (c) 2017 to 2022 Stuart Pittaway
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-mqtt";
+
+#include "mqtt_format.h"
+
+void mqtt_format_current_topic(mqtt_topic_table *topics, const char *prefix, uint8_t current_address)
+{
+    topics->current_address = current_address;
+    snprintf(topics->current, sizeof(topics->current), "%s/modbus_A%u", prefix, current_address);
+}
+
+void mqtt_format_topics(mqtt_topic_table *topics, const char *prefix, uint8_t current_address)
+{
+    snprintf(topics->status, sizeof(topics->status), "%s/status", prefix);
+    snprintf(topics->rule, sizeof(topics->rule), "%s/rule", prefix);
+    snprintf(topics->output, sizeof(topics->output), "%s/output", prefix);
+    snprintf(topics->replay, sizeof(topics->replay), "%s/replay", prefix);
+    mqtt_format_current_topic(topics, prefix, current_address);
+    for (uint8_t bank = 0; bank < maximum_number_of_banks; bank++)
+    {
+        snprintf(topics->bank[bank], sizeof(topics->bank[bank]), "%s/bank/%u", prefix, bank);
+        snprintf(topics->cells[bank], sizeof(topics->cells[bank]), "%s/cells/%u", prefix, bank);
+    }
+}
+
+/// @brief Format the per cell topics, if the bank configuration has changed. Set banks to 0 to force a rebuild.
+/// @return false if out of memory
+bool mqtt_format_cell_topics(mqtt_cell_topic_table *table, const char *prefix, uint8_t banks, uint8_t series)
+{
+    if (table->arena != nullptr && table->banks == banks && table->series == series)
+    {
+        return true;
+    }
+
+    free(table->arena);
+    table->arena = nullptr;
+    table->banks = banks;
+    table->series = series;
+
+    // Prefix + "/BB/MMM" + null
+    const size_t each = strlen(prefix) + 8;
+    const uint8_t totalCells = banks * series;
+    table->arena = (char *)malloc(each * totalCells);
+    if (table->arena == nullptr)
+    {
+        ESP_LOGE(TAG, "No memory for cell topics");
+        table->banks = 0;
+        return false;
+    }
+
+    uint16_t offset = 0;
+    for (uint8_t i = 0; i < totalCells; i++)
+    {
+        table->offset[i] = offset;
+        offset += 1 + snprintf(&table->arena[offset], each, "%s/%u/%u", prefix, i / series, i % series);
+    }
+
+    return true;
+}
+
+/// @brief Cell values, detail adds the min/max, bypass and balance values
+void mqtt_cell_payload(mqtt_payload_writer &json, const CellModuleInfo &cell, bool detail)
+{
+    json.beginObject();
+    json.addFloat("voltage", cell.voltagemV / 1000.0f);
+    json.addInt("exttemp", cell.externalTemp);
+
+    if (detail)
+    {
+        json.addFloat("vMax", cell.voltagemVMax / 1000.0f);
+        json.addFloat("vMin", cell.voltagemVMin / 1000.0f);
+        json.addInt("inttemp", cell.internalTemp);
+        json.addUInt("bypass", cell.inBypass ? 1 : 0);
+        json.addInt("PWM", (int)((float)cell.PWMValue / (float)255.0 * 100));
+        json.addUInt("bypassT", cell.bypassOverTemp ? 1 : 0);
+        json.addUInt("bpc", cell.badPacketCount);
+        json.addUInt("mAh", cell.BalanceCurrentCount);
+    }
+
+    json.endObject();
+}
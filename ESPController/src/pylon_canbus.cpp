@@ -15,6 +15,9 @@ static constexpr const char *const TAG = "diybms-pylon";
 
 #include "pylon_canbus.h"
 
+#include <algorithm>
+#include <esp_timer.h>
+
 // 0x351 – Battery voltage + current limits
 void pylon_message_351()
 {
@@ -72,7 +75,21 @@ void pylon_message_351()
     data.battery_discharge_current_limit = mysettings.dischargecurrent;
   }
 
-  send_canbus_message(0x351, (uint8_t *)&data, sizeof(data351));
+  // Combined limits of all the packs, if this controller is the multi-pack master
+  if (multipack_apply_limits(&data.battery_charge_current_limit, &data.battery_discharge_current_limit))
+  {
+    // A pack which can't charge/discharge makes the combined limit zero, send the "stop" value as above
+    if (data.battery_charge_current_limit == 0)
+    {
+      data.battery_charge_current_limit = default_charge_current_limit;
+    }
+    if (data.battery_discharge_current_limit == 0)
+    {
+      data.battery_discharge_current_limit = default_discharge_current_limit;
+    }
+  }
+
+  canbus_frame_store(0x351, (uint8_t *)&data, sizeof(data351));
 }
 // 0x355 – 1A 00 64 00 – State of Health (SOH) / State of Charge (SOC)
 void pylon_message_355()
@@ -92,12 +109,13 @@ void pylon_message_355()
     data355 data;
     // 0 SOC value un16 1 %
     data.stateofchargevalue = rules.StateOfChargeWithRulesApplied(&mysettings, currentMonitor.stateofcharge);
+    multipack_apply_soc(&data.stateofchargevalue);
 
     //  2 SOH value un16 1 %
     // TODO: Need to determine this based on age of battery/cycles etc.
     data.stateofhealthvalue = 100;
 
-    send_canbus_message(0x355, (uint8_t *)&data, sizeof(data355));
+    canbus_frame_store(0x355, (uint8_t *)&data, sizeof(data355));
   }
 }
 
@@ -198,7 +216,7 @@ void pylon_message_359()
   data.byte5 = 0x50; // P
   data.byte6 = 0x4e; // N
 
-  send_canbus_message(0x359, (uint8_t *)&data, sizeof(data359));
+  canbus_frame_store(0x359, (uint8_t *)&data, sizeof(data359));
 }
 
 // 0x35C – C0 00 – Battery charge request flags
@@ -228,7 +246,7 @@ void pylon_message_35c()
     data.byte0 = data.byte0 | B01000000;
   }
 
-  send_canbus_message(0x35c, (uint8_t *)&data, sizeof(data35c));
+  canbus_frame_store(0x35c, (uint8_t *)&data, sizeof(data35c));
 }
 
 // 0x35E – 50 59 4C 4F 4E 20 20 20 – Manufacturer name ("PYLON ")
@@ -237,7 +255,7 @@ void pylon_message_35e()
   // Send 8 byte "magic string" PYLON (with 3 trailing spaces)
   // const char pylon[] = "\x50\x59\x4c\x4f\x4e\x20\x20\x20";
   uint8_t pylon[] = {0x50, 0x59, 0x4c, 0x4f, 0x4e, 0x20, 0x20, 0x20};
-  send_canbus_message(0x35e, (uint8_t *)&pylon, sizeof(pylon) - 1);
+  canbus_frame_store(0x35e, (uint8_t *)&pylon, sizeof(pylon) - 1);
 }
 
 // Battery voltage - 0x356 – 4e 13 02 03 04 05 – Voltage / Current / Temp
@@ -276,7 +294,7 @@ void pylon_message_356()
     data.temperature = 0;
   }
 
-  send_canbus_message(0x356, (uint8_t *)&data, sizeof(data356));
+  canbus_frame_store(0x356, (uint8_t *)&data, sizeof(data356));
 }
 
 
@@ -294,7 +312,7 @@ void pylon_message_356()
 ///////                                                                         ///////
 
 /* message info hardware and software */
-void pylonHV_message_0x7310(bool extend){
+void pylonHV_message_0x7310(){
   struct data7310
   {
     uint8_t hardware_version;
@@ -315,13 +333,11 @@ void pylonHV_message_0x7310(bool extend){
   data.hardware_version_minor = 0x01;
   data.software_version_major = 0x01;
   data.software_version_minor = 0x02;
-  uint32_t address=0x731;
-  if(extend)address=0x7310 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, (uint8_t *)&data, sizeof(data7310));
+  canbus_frame_store(0x7310, (uint8_t *)&data, sizeof(data7310));
 }
 
 /* message all cells, number of modules, cells for module, nominal voltage, capacity */
-void pylonHV_message_0x7320(bool extend){
+void pylonHV_message_0x7320(){
   struct data7320
   {
     uint16_t battery_series_cells;  // number of battery cells in series (over all modules/boxes)
@@ -339,33 +355,80 @@ void pylonHV_message_0x7320(bool extend){
   data.cell_qty_in_module = mysettings.totalNumberOfSeriesModules / data.battery_module_in_series_qty;
   data.voltage_level = (uint16_t)((uint32_t)mysettings.cellmaxmv * (uint32_t)mysettings.totalNumberOfSeriesModules / (uint32_t)1000);
   data.ah_number = mysettings.nominalbatcap;
-  uint32_t address=0x732;
-  if(extend)address=0x7320 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, (uint8_t *)&data, sizeof(data7320));
+  canbus_frame_store(0x7320, (uint8_t *)&data, sizeof(data7320));
 }
 
 /* messages name of Maker*/
-void pylonHV_message_0x7330_0x7340(bool extend){
+void pylonHV_message_0x7330_0x7340(){
   char buffer[16+1];
   memset( buffer, 0, sizeof(buffer) );
-  strncpy(buffer,hostname.c_str(),sizeof(buffer));
-  uint32_t address=0x733;
-  if(extend)address=0x7330 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address,(uint8_t *)&hostname, 8);
-  vTaskDelay(pdMS_TO_TICKS(60));
-  address=0x734;
-  if(extend)address=0x7340 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, (uint8_t *)&hostname[8], 8);
+  strncpy(buffer,hostname.c_str(),sizeof(buffer)-1);
+  canbus_frame_store(0x7330, &buffer[0], 8);
+  canbus_frame_store(0x7340, &buffer[8], 8);
 }
 
 
-void pylonHV_send_message_info(bool extend){
+// Identifiers of the replies, see canbus_frame_send for the address
+static const uint32_t pylonHV_info_frames[] = {0x7310, 0x7320, 0x7330, 0x7340};
+static const uint32_t pylonHV_status_frames[] = {0x4210, 0x4220, 0x4230, 0x4240, 0x4250, 0x4260, 0x4270, 0x4280, 0x4290, 0x42A0};
+
+// Time from receiving a request to the last reply frame leaving the controller
+static uint32_t reply_samples[PYLONFORCE_REPLY_SAMPLES];
+static uint8_t reply_sample_index = 0;
+static pylonforce_reply_stats reply_stats = {};
+static portMUX_TYPE reply_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Extended identifiers include the equipment address, standard 11 bit identifiers drop the last digit
+static uint32_t pylonHV_address(uint32_t identifier, bool extend){
+  return extend ? identifier + mysettings.canbus_equipment_addr : identifier >> 4;
+}
+
+/// @brief Queue the cached reply frames as one burst, then wait for the bus to send them
+/// @param received_us esp_timer_get_time() when the request was received
+static void pylonHV_reply(const uint32_t *frames, uint8_t count, bool extend, int64_t received_us){
   if (_controller_state != ControllerState::Running) return;
-  pylonHV_message_0x7310(extend);
-  delay(10);
-  pylonHV_message_0x7320(extend);
-  delay(10);
-  pylonHV_message_0x7330_0x7340(extend);
+
+  uint8_t failed = 0;
+  for (uint8_t i = 0; i < count; i++){
+    if (canbus_frame_send(frames[i], pylonHV_address(frames[i], extend)) != ESP_OK) failed++;
+  }
+
+  bool timeout = canbus_get_transport()->wait_tx_done(PYLONFORCE_REPLY_TIMEOUT_MS) != ESP_OK;
+  uint32_t elapsed = (uint32_t)(esp_timer_get_time() - received_us);
+
+  portENTER_CRITICAL(&reply_lock);
+  reply_stats.requests++;
+  reply_stats.failed_frames += failed;
+  if (timeout) reply_stats.timeouts++;
+  reply_stats.last_us = elapsed;
+  if (elapsed > reply_stats.max_us) reply_stats.max_us = elapsed;
+  reply_samples[reply_sample_index] = elapsed;
+  reply_sample_index = (reply_sample_index + 1) % PYLONFORCE_REPLY_SAMPLES;
+  portEXIT_CRITICAL(&reply_lock);
+
+  if (failed || timeout){
+    ESP_LOGW(TAG, "Reply incomplete, %u frames failed, %u us", failed, elapsed);
+  }
+}
+
+void pylonHV_send_message_info(bool extend, int64_t received_us){
+  pylonHV_reply(pylonHV_info_frames, sizeof(pylonHV_info_frames) / sizeof(uint32_t), extend, received_us);
+}
+
+/// @brief Reply time statistics, percentiles are over the last PYLONFORCE_REPLY_SAMPLES requests
+void pylonHV_get_reply_stats(pylonforce_reply_stats *stats){
+  uint32_t sorted[PYLONFORCE_REPLY_SAMPLES];
+  portENTER_CRITICAL(&reply_lock);
+  *stats = reply_stats;
+  memcpy(sorted, reply_samples, sizeof(sorted));
+  portEXIT_CRITICAL(&reply_lock);
+
+  uint32_t n = stats->requests < PYLONFORCE_REPLY_SAMPLES ? stats->requests : PYLONFORCE_REPLY_SAMPLES;
+  if (n == 0) return;
+  std::sort(sorted, sorted + n);
+  // Nearest rank
+  stats->p50_us = sorted[(n * 50 + 99) / 100 - 1];
+  stats->p99_us = sorted[(n * 99 + 99) / 100 - 1];
 }
 
 
@@ -374,7 +437,7 @@ void pylonHV_send_message_info(bool extend){
 ///////                                                                         ///////
 
 /* Voltage, current, temperature, soc, soh of pack battery system*/
-void pylonHV_message_0x4210(bool extend){
+void pylonHV_message_0x4210(){
   uint8_t data[8];
   uint16_t voltage=0;  //resolution 0.1V
   int16_t current=30000; // offset= 30000 =0.0A  scale 0.1A ;29985= -1.5A 30028=2.8A
@@ -390,6 +453,7 @@ void pylonHV_message_0x4210(bool extend){
     
      // 0 SOC value un16 1 %
     stateofchargevalue = rules.StateOfChargeWithRulesApplied(&mysettings, currentMonitor.stateofcharge);
+    multipack_apply_soc(&stateofchargevalue);
 
     //  2 SOH value un16 1 %
     // TODO: Need to determine this based on age of battery/cycles etc.
@@ -422,20 +486,18 @@ void pylonHV_message_0x4210(bool extend){
   data[6]=stateofchargevalue & 0xFF;
   data[7]=stateofhealthvalue & 0xFF;
 
-  uint32_t address=0x421;
-  if(extend)address=0x4210 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, data, 8);
+  canbus_frame_store(0x4210, data, 8);
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );
 }
 
 /* Charge voltage, discharge voltage, charge current, discharge current */
-void pylonHV_message_0x4220(bool extend){
+void pylonHV_message_0x4220(){
   uint8_t data[8];
   uint16_t charge_voltage=0;  //resolution 0.1v
   uint16_t discharge_voltage=0;
-  int16_t charge_current=30000;  //offset 3000A scale 0.1A 
-  int16_t discharge_current=30000; // default 0.0A
+  int16_t charge_current=0;  //scale 0.1A, sent with offset 3000A
+  int16_t discharge_current=0; // default 0.0A
 
   charge_voltage = mysettings.chargevolt;
   discharge_voltage = mysettings.dischargevolt;
@@ -448,18 +510,23 @@ void pylonHV_message_0x4220(bool extend){
     }else{
       // Default - normal behaviour (apply charging voltage and current)
       charge_voltage = rules.DynamicChargeVoltage();
-      charge_current += rules.DynamicChargeCurrent();
+      charge_current = rules.DynamicChargeCurrent();
     }
 
   }
 
   if(rules.IsDischargeAllowed(&mysettings)){
     // Set discharge current limits in normal operation
-    discharge_current -= mysettings.dischargecurrent; //BOTANETA test signed
+    discharge_current = mysettings.dischargecurrent;
   }else{
     // default 0.0A
   }
 
+  // Combined limits of all the packs, if this controller is the multi-pack master
+  multipack_apply_limits(&charge_current, &discharge_current);
+  charge_current = 30000 + charge_current;
+  discharge_current = 30000 - discharge_current; //BOTANETA test signed
+
   data[0]=charge_voltage & 0xFF;
   data[1]=charge_voltage >> 8;
   data[2]=discharge_voltage & 0xFF;
@@ -469,16 +536,14 @@ void pylonHV_message_0x4220(bool extend){
   data[6]=discharge_current & 0xFF;
   data[7]=discharge_current >> 8;
   
-  uint32_t address=0x422;
-  if(extend)address=0x4220 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, data, 8);
+  canbus_frame_store(0x4220, data, 8);
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );
 }
 
 
 /* Voltage and id from cell maximun and minimun*/
-void pylonHV_message_0x4230(bool extend){
+void pylonHV_message_0x4230(){
   uint8_t data[8];
   uint8_t id_cell_vmax=rules.address_HighestCellVoltage;
   uint16_t cell_vmax=rules.highestCellVoltage;
@@ -494,15 +559,13 @@ void pylonHV_message_0x4230(bool extend){
   data[6]=id_cell_vmin;
   data[7]=0x00;
 
-  uint32_t address=0x423;
-  if(extend)address=0x4230 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, data, 8);
+  canbus_frame_store(0x4230, data, 8);
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );
 }
 
 /* Temperature and id from cell maximun and minimun */
-void pylonHV_message_0x4240(bool extend){
+void pylonHV_message_0x4240(){
   struct data4240{
     uint16_t max_single_battery_cell_temperature; // temperature of the highest cell, resolution 0.1°C, offset 100°C
     uint16_t min_single_battery_cell_temperature; // temperature of the lowest cell, resolution 0.1°C, offset 100°C
@@ -528,16 +591,14 @@ void pylonHV_message_0x4240(bool extend){
     data.min_battery_cell_number = 2;
   }
 
-  uint32_t address=0x424;
-  if(extend)address=0x4240 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, (uint8_t *)&data, sizeof(data4240));
+  canbus_frame_store(0x4240, (uint8_t *)&data, sizeof(data4240));
   //uint8_t * dat = (uint8_t *)&data;
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //               address, dat[0], dat[1], dat[2], dat[3], dat[4], dat[5], dat[6], dat[7] );
 }
 
 /* Status, nº_cycles, error, alarm, protection*/
-void pylonHV_message_0x4250(bool extend){
+void pylonHV_message_0x4250(){
   uint8_t data[8];
   uint8_t status=0x00;
   //b7 reserve
@@ -631,16 +692,14 @@ void pylonHV_message_0x4250(bool extend){
   data[6]=protection & 0xFF;
   data[7]=protection >> 8;
 
-  uint32_t address=0x425;
-  if(extend)address=0x4250 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, data, 8);
+  canbus_frame_store(0x4250, data, 8);
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );
 }
 
 
 /* Module-pylontech max/min voltage, id_max/id_min */
-void pylonHV_message_0x4260(bool extend){
+void pylonHV_message_0x4260(){
   uint8_t data[8];
   uint16_t voltage=0xC3B4; //resolution 1mV, simulation 50100mV
 
@@ -653,15 +712,13 @@ void pylonHV_message_0x4260(bool extend){
   data[6]=0x01;
   data[7]=0x00;
 
-  uint32_t address=0x426;
-  if(extend)address=0x4260 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, data, 8);
+  canbus_frame_store(0x4260, data, 8);
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );
 }
 
 /* Module max/min temperature id_max/id_min */
-void pylonHV_message_0x4270(bool extend){
+void pylonHV_message_0x4270(){
   struct data4270{
     uint16_t max_single_battery_module_temperature; // temperature of the highest module, resolution 0.1°C, offset 100°C
     uint16_t min_single_battery_module_temperature; // temperature of the lowest module, resolution 0.1°C, offset 100°C
@@ -687,31 +744,27 @@ void pylonHV_message_0x4270(bool extend){
     data.min_battery_module_number = 0;
   }
 
-  uint32_t address=0x427;
-  if(extend)address=0x4270 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, (uint8_t *)&data, sizeof(data4270));
+  canbus_frame_store(0x4270, (uint8_t *)&data, sizeof(data4270));
   //uint8_t * dat = (uint8_t *)&data;
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, dat[0], dat[1], dat[2], dat[3], dat[4], dat[5], dat[6], dat[7] );
 }
 
 /* Charge Discharge forbiden mark */
-void pylonHV_message_0x4280(bool extend){
+void pylonHV_message_0x4280(){
   uint8_t data[8]{0};
   uint8_t no_charge=0xAA;  // charge != 0xAA;
   uint8_t no_discharge=0xAA;
 
   data[0]=rules.IsChargeAllowed(&mysettings)? 0x00 : no_charge; 
   data[1]=rules.IsDischargeAllowed(&mysettings)? 0x00 : no_discharge;
-  uint32_t address=0x428;
-  if(extend)address=0x4280 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, data, 8);
+  canbus_frame_store(0x4280, data, 8);
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );
 }
 
 /* System error list */
-void pylonHV_message_0x4290(bool extend){
+void pylonHV_message_0x4290(){
   uint8_t data[8]{0};
   uint8_t error=0;
   //b5..b7 reserve
@@ -724,15 +777,13 @@ void pylonHV_message_0x4290(bool extend){
   if(rules.ruleOutcome(Rule::BMSError))error |= 0b00010100;
   data[0]=error;
 
-  uint32_t address=0x429;
-  if(extend)address=0x4290 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address, data, 8);
+  canbus_frame_store(0x4290, data, 8);
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7] );
 }
 
 /* Terminal max/min temperature id_terminal*/
-void pylonHV_message_0x42A0(bool extend){
+void pylonHV_message_0x42A0(){
   struct data42A0{
     uint16_t terminal_max_temp=1350; //offset 100.0ºC resolution 0.1ºC, default 35.0ºC
     uint16_t terminal_min_temp=1350;
@@ -740,33 +791,12 @@ void pylonHV_message_0x42A0(bool extend){
     uint16_t id_terminal_min_temp=0;
   };
   data42A0 data;
-  uint32_t address=0x42A;
-  if(extend)address=0x42A0 + mysettings.canbus_equipment_addr;
-  send_canbus_message(address,(uint8_t *)&data, sizeof(data42A0));
+  canbus_frame_store(0x42A0, (uint8_t *)&data, sizeof(data42A0));
   //uint8_t * dat = (uint8_t *)&data;
   //ESP_LOGI("PYLON_HV", "Address:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x", 
   //                address, dat[0], dat[1], dat[2], dat[3], dat[4], dat[5], dat[6], dat[7] );
 }
 
-void pylonHV_send_message_status(bool extend){
-  if (_controller_state != ControllerState::Running)return;
-  pylonHV_message_0x4210(extend);
-  delay(10);
-  pylonHV_message_0x4220(extend);
-  delay(10);
-  pylonHV_message_0x4230(extend);
-  delay(10);
-  pylonHV_message_0x4240(extend);
-  delay(10);
-  pylonHV_message_0x4250(extend);
-  delay(10);
-  pylonHV_message_0x4260(extend);
-  delay(10);
-  pylonHV_message_0x4270(extend);
-  delay(10);
-  pylonHV_message_0x4280(extend);
-  delay(10);
-  pylonHV_message_0x4290(extend);
-  delay(10);
-  pylonHV_message_0x42A0(extend);
+void pylonHV_send_message_status(bool extend, int64_t received_us){
+  pylonHV_reply(pylonHV_status_frames, sizeof(pylonHV_status_frames) / sizeof(uint32_t), extend, received_us);
 }
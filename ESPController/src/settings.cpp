@@ -30,6 +30,7 @@ static const char rs485stopbits_JSONKEY[] = "rs485stopbits";
 static const char language_JSONKEY[] = "language";
 static const char mqtt_enabled_JSONKEY[] = "enabled";
 static const char mqtt_basic_cell_reporting_JSONKEY[] = "basiccellrpt";
+static const char mqtt_bank_payloads_JSONKEY[] = "bankpayloads";
 static const char mqtt_uri_JSONKEY[] = "uri";
 static const char mqtt_topic_JSONKEY[] = "topic";
 static const char mqtt_username_JSONKEY[] = "username";
@@ -40,10 +41,12 @@ static const char influxdb_databasebucket_JSONKEY[] = "bucket";
 static const char influxdb_orgid_JSONKEY[] = "org";
 static const char influxdb_serverurl_JSONKEY[] = "url";
 static const char influxdb_loggingFreqSeconds_JSONKEY[] = "logfreq";
+static const char influxdb_gzip_JSONKEY[] = "gzip";
 static const char canbusprotocol_JSONKEY[] = "canbusprotocol";
 static const char canbusinverter_JSONKEY[] = "canbusinverter";
 static const char canbusbaud_JSONKEY[] = "canbusbaud";
 static const char canbus_equipment_addr_JSONKEY[] = "canbusequip";
+static const char canbus_multipack_JSONKEY[] = "canbusmultipack";
 static const char nominalbatcap_JSONKEY[] = "nominalbatcap";
 static const char chargevolt_JSONKEY[] = "chargevolt";
 static const char chargecurrent_JSONKEY[] = "chargecurrent";
@@ -68,6 +71,7 @@ static const char current_value1_JSONKEY[] = "cur_val1";
 static const char current_value2_JSONKEY[] = "cur_val2";
 
 static const char currentMonitoringDevice_JSONKEY[] = "currentMonitoringDevice";
+static const char currentMonitoring_additional_JSONKEY[] = "currentMonitoringAdditional";
 static const char currentMonitoring_shuntmv_JSONKEY[] = "currentMonitoringShuntmv";
 static const char currentMonitoring_shuntmaxcur_JSONKEY[] = "currentMonitoringShuntMaxCur";
 static const char currentMonitoring_voltage_divider_vbus_JSONKEY[]="currentMonitoringVoltageDividerVbus"; //BOTANETA jsonkey
@@ -118,6 +122,7 @@ static const char loggingFrequencySeconds_NVSKEY[] = "logFreqSec";
 static const char currentMonitoringEnabled_NVSKEY[] = "curMonEnabled";
 static const char currentMonitoringModBusAddress_NVSKEY[] = "curMonMBAddress";
 static const char currentMonitoringDevice_NVSKEY[] = "curMonDevice";
+static const char currentMonitoring_additional_NVSKEY[] = "curMonAddition";
 static const char rs485baudrate_NVSKEY[] = "485baudrate";
 static const char rs485databits_NVSKEY[] = "485databits";
 static const char rs485parity_NVSKEY[] = "485parity";
@@ -126,6 +131,7 @@ static const char canbusprotocol_NVSKEY[] = "canbusprotocol";
 static const char canbusinverter_NVSKEY[] = "canbusinverter";
 static const char canbusbaud_NVSKEY[] = "canbusbaud";
 static const char canbus_equipment_addr_NVSKEY[]="canbusequip";
+static const char canbus_multipack_NVSKEY[] = "canbusmultipk";
 static const char nominalbatcap_NVSKEY[] = "nominalbatcap";
 static const char chargevolt_NVSKEY[] = "cha_volt";
 static const char chargecurrent_NVSKEY[] = "cha_current";
@@ -150,8 +156,10 @@ static const char preventcharging_NVSKEY[] = "preventchar";
 static const char preventdischarge_NVSKEY[] = "preventdis";
 static const char mqtt_enabled_NVSKEY[] = "mqttenable";
 static const char mqtt_basic_cell_reporting_NVSKEY[] = "basiccellrpt";
+static const char mqtt_bank_payloads_NVSKEY[] = "bankpayloads";
 static const char influxdb_enabled_NVSKEY[] = "infenabled";
 static const char influxdb_loggingFreqSeconds_NVSKEY[] = "inflogFreq";
+static const char influxdb_gzip_NVSKEY[] = "infgzip";
 static const char tileconfig_NVSKEY[] = "tileconfig";
 static const char ntpServer_NVSKEY[] = "ntpServer";
 static const char language_NVSKEY[] = "language";
@@ -385,12 +393,15 @@ void SaveConfiguration(diybms_eeprom_settings *settings)
         MACRO_NVSWRITE(currentMonitoringEnabled)
         MACRO_NVSWRITE(currentMonitoringModBusAddress)
         MACRO_NVSWRITE_UINT8(currentMonitoringDevice);
+        MACRO_NVSWRITEBLOB(currentMonitoring_additional);
         MACRO_NVSWRITE(rs485baudrate)
         MACRO_NVSWRITE_UINT8(rs485databits);
         MACRO_NVSWRITE_UINT8(rs485parity);
         MACRO_NVSWRITE_UINT8(rs485stopbits);
         MACRO_NVSWRITE_UINT8(canbusprotocol);
         MACRO_NVSWRITE_UINT8(canbusinverter);
+        MACRO_NVSWRITE_UINT8(canbus_equipment_addr);
+        MACRO_NVSWRITE(canbus_multipack);
 
         MACRO_NVSWRITE(currentMonitoring_shuntmv);
         MACRO_NVSWRITE(currentMonitoring_shuntmaxcur);
@@ -434,8 +445,10 @@ void SaveConfiguration(diybms_eeprom_settings *settings)
         MACRO_NVSWRITE(preventdischarge);
         MACRO_NVSWRITE(mqtt_enabled);
         MACRO_NVSWRITE(mqtt_basic_cell_reporting);
+        MACRO_NVSWRITE(mqtt_bank_payloads);
         MACRO_NVSWRITE(influxdb_enabled);
         MACRO_NVSWRITE(influxdb_loggingFreqSeconds);
+        MACRO_NVSWRITE(influxdb_gzip);
 
         MACRO_NVSWRITEBLOB(tileconfig);
 
@@ -513,6 +526,7 @@ void LoadConfiguration(diybms_eeprom_settings *settings)
         MACRO_NVSREAD(currentMonitoringEnabled);
         MACRO_NVSREAD(currentMonitoringModBusAddress);
         MACRO_NVSREAD_UINT8(currentMonitoringDevice);
+        MACRO_NVSREADBLOB(currentMonitoring_additional);
 
         MACRO_NVSREAD(currentMonitoring_shuntmv);
         MACRO_NVSREAD(currentMonitoring_shuntmaxcur);
@@ -539,6 +553,7 @@ void LoadConfiguration(diybms_eeprom_settings *settings)
         MACRO_NVSREAD_UINT8(canbusinverter);
         MACRO_NVSREAD(canbusbaud);
         MACRO_NVSREAD_UINT8(canbus_equipment_addr)
+        MACRO_NVSREAD(canbus_multipack);
         MACRO_NVSREAD(nominalbatcap);
         MACRO_NVSREAD(chargevolt);
         MACRO_NVSREAD(chargecurrent);
@@ -565,8 +580,10 @@ void LoadConfiguration(diybms_eeprom_settings *settings)
 
         MACRO_NVSREAD(mqtt_enabled);
         MACRO_NVSREAD(mqtt_basic_cell_reporting);
+        MACRO_NVSREAD(mqtt_bank_payloads);
         MACRO_NVSREAD(influxdb_enabled);
         MACRO_NVSREAD(influxdb_loggingFreqSeconds);
+        MACRO_NVSREAD(influxdb_gzip);
 
         MACRO_NVSREADBLOB(tileconfig);
 
@@ -618,11 +635,13 @@ void DefaultConfiguration(diybms_eeprom_settings *_myset)
     // EEPROM settings are invalid so default configuration
     _myset->mqtt_enabled = false;
     _myset->mqtt_basic_cell_reporting = false;
+    _myset->mqtt_bank_payloads = false;
 
     _myset->canbusprotocol = CanBusProtocolEmulation::CANBUS_DISABLED;
     _myset->canbusinverter = CanBusInverter::INVERTER_GENERIC;
 
     _myset->canbus_equipment_addr = 0;
+    _myset->canbus_multipack = false;
     _myset->canbusbaud=500;
     _myset->nominalbatcap = 280;    // Scale 1
     _myset->chargevolt = 565;       // Scale 0.1
@@ -657,6 +676,11 @@ void DefaultConfiguration(diybms_eeprom_settings *_myset)
     _myset->currentMonitoringEnabled = false;
     _myset->currentMonitoringModBusAddress = 90;
     _myset->currentMonitoringDevice = CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS;
+    for (uint8_t i = 0; i < CURRENTMON_MAXIMUM - 1; i++)
+    {
+        _myset->currentMonitoring_additional[i].device = CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS;
+        _myset->currentMonitoring_additional[i].address = 0;
+    }
 
     _myset->currentMonitoring_shuntmv = 50;
     _myset->currentMonitoring_shuntmaxcur = 150;
@@ -693,6 +717,7 @@ void DefaultConfiguration(diybms_eeprom_settings *_myset)
     strncpy(_myset->influxdb_databasebucket, "bucketname", sizeof(_myset->influxdb_databasebucket));
     strncpy(_myset->influxdb_orgid, "organisation", sizeof(_myset->influxdb_orgid));
     _myset->influxdb_loggingFreqSeconds = 15;
+    _myset->influxdb_gzip = false;
 
     _myset->timeZone = 0;
     _myset->minutesTimeZone = 0;
@@ -845,6 +870,47 @@ bool LoadWIFI(wifi_eeprom_settings *wifi)
     return result;
 }
 
+/// @brief Save the internal current monitor shadow coulomb counter into FLASH NVS
+/// @param counter
+void SaveCoulombCounter(const coulomb_counter *counter)
+{
+    const char *partname = "diybms-coulomb";
+    ESP_LOGD(TAG, "Save coulomb counter");
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(partname, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle", esp_err_to_name(err));
+    }
+    else
+    {
+        writeSettingBlob(nvs_handle, "counter", counter, sizeof(coulomb_counter));
+        ESP_ERROR_CHECK(nvs_commit(nvs_handle));
+        nvs_close(nvs_handle);
+    }
+}
+
+bool LoadCoulombCounter(coulomb_counter *counter)
+{
+    const char *partname = "diybms-coulomb";
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(partname, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        // Namespace doesn't exist until the first save
+        ESP_LOGW(TAG, "Error (%s) opening NVS handle", esp_err_to_name(err));
+        return false;
+    }
+
+    bool result = getSettingBlob(nvs_handle, "counter", counter, sizeof(coulomb_counter));
+    nvs_close(nvs_handle);
+
+    ESP_LOGI(TAG, "Load coulomb counter from FLASH - return %u", result);
+    return result;
+}
+
 // Validate configuration and force correction if needed.
 void ValidateConfiguration(diybms_eeprom_settings *settings)
 {
@@ -852,11 +918,43 @@ void ValidateConfiguration(diybms_eeprom_settings *settings)
     DefaultConfiguration(&defaults);
 
     // Check its not zero
-    if (settings->influxdb_loggingFreqSeconds < 5)
+    if (settings->influxdb_loggingFreqSeconds < 1)
     {
         settings->influxdb_loggingFreqSeconds = defaults.influxdb_loggingFreqSeconds;
     }
 
+    // Pack address is 4 bits on the CAN bus
+    if (settings->canbus_equipment_addr > 15)
+    {
+        settings->canbus_equipment_addr = defaults.canbus_equipment_addr;
+    }
+
+    // Additional current monitors are on the RS485 bus, so must be a MODBUS device with a unique address
+    for (uint8_t i = 0; i < CURRENTMON_MAXIMUM - 1; i++)
+    {
+        currentmon_additional_settings &cm = settings->currentMonitoring_additional[i];
+        if (cm.device != CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS && cm.device != CurrentMonitorDevice::PZEM_017)
+        {
+            cm.address = 0;
+        }
+        if (cm.address > 247 ||
+            (cm.address == settings->currentMonitoringModBusAddress && settings->currentMonitoringDevice != CurrentMonitorDevice::DIYBMS_CURRENT_MON_INTERNAL))
+        {
+            cm.address = 0;
+        }
+        for (uint8_t j = 0; j < i; j++)
+        {
+            if (settings->currentMonitoring_additional[j].address == cm.address)
+            {
+                cm.address = 0;
+            }
+        }
+        if (cm.address == 0)
+        {
+            cm.device = CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS;
+        }
+    }
+
     if (settings->rs485baudrate < 300)
     {
         settings->rs485baudrate = defaults.rs485baudrate;
@@ -1013,6 +1111,13 @@ void GenerateSettingsJSONDocument(DynamicJsonDocument *doc, diybms_eeprom_settin
     root[currentMonitoringModBusAddress_JSONKEY] = settings->currentMonitoringModBusAddress;
 
     root[currentMonitoringDevice_JSONKEY] = (uint8_t)settings->currentMonitoringDevice;
+    JsonArray cmadditional = root.createNestedArray(currentMonitoring_additional_JSONKEY);
+    for (uint8_t i = 0; i < CURRENTMON_MAXIMUM - 1; i++)
+    {
+        JsonObject cm = cmadditional.createNestedObject();
+        cm["device"] = (uint8_t)settings->currentMonitoring_additional[i].device;
+        cm["address"] = settings->currentMonitoring_additional[i].address;
+    }
     root[currentMonitoring_shuntmv_JSONKEY] = settings->currentMonitoring_shuntmv;
     root[currentMonitoring_shuntmaxcur_JSONKEY] = settings->currentMonitoring_shuntmaxcur;
     root[currentMonitoring_voltage_divider_vbus_JSONKEY] = settings->currentMonitoring_voltage_divider_vbus; //BOTANETA save  json value
@@ -1042,6 +1147,7 @@ void GenerateSettingsJSONDocument(DynamicJsonDocument *doc, diybms_eeprom_settin
     JsonObject mqtt = root.createNestedObject("mqtt");
     mqtt[mqtt_enabled_JSONKEY] = settings->mqtt_enabled;
     mqtt[mqtt_basic_cell_reporting_JSONKEY] = settings->mqtt_basic_cell_reporting;
+    mqtt[mqtt_bank_payloads_JSONKEY] = settings->mqtt_bank_payloads;
     mqtt[mqtt_uri_JSONKEY] = settings->mqtt_uri;
     mqtt[mqtt_topic_JSONKEY] = settings->mqtt_topic;
     mqtt[mqtt_username_JSONKEY] = settings->mqtt_username;
@@ -1054,6 +1160,7 @@ void GenerateSettingsJSONDocument(DynamicJsonDocument *doc, diybms_eeprom_settin
     influxdb[influxdb_orgid_JSONKEY] = settings->influxdb_orgid;
     influxdb[influxdb_serverurl_JSONKEY] = settings->influxdb_serverurl;
     influxdb[influxdb_loggingFreqSeconds_JSONKEY] = settings->influxdb_loggingFreqSeconds;
+    influxdb[influxdb_gzip_JSONKEY] = settings->influxdb_gzip;
 
     JsonObject outputs = root.createNestedObject("outputs");
     JsonArray d = outputs.createNestedArray("default");
@@ -1097,6 +1204,7 @@ void GenerateSettingsJSONDocument(DynamicJsonDocument *doc, diybms_eeprom_settin
     root[canbusinverter_JSONKEY] = (uint8_t)settings->canbusinverter;
     root[canbusbaud_JSONKEY] = settings->canbusbaud;
     root[canbus_equipment_addr_JSONKEY]=settings->canbus_equipment_addr;
+    root[canbus_multipack_JSONKEY] = settings->canbus_multipack;
     root[nominalbatcap_JSONKEY] = settings->nominalbatcap;
 
     root[chargevolt_JSONKEY] = settings->chargevolt;
@@ -1173,6 +1281,18 @@ void JSONToSettings(DynamicJsonDocument &doc, diybms_eeprom_settings *settings)
     settings->currentMonitoringModBusAddress = root[currentMonitoringModBusAddress_JSONKEY];
 
     settings->currentMonitoringDevice = (CurrentMonitorDevice)(uint8_t)root[currentMonitoringDevice_JSONKEY];
+
+    uint8_t cmindex = 0;
+    for (JsonVariant v : root[currentMonitoring_additional_JSONKEY].as<JsonArray>())
+    {
+        if (cmindex == CURRENTMON_MAXIMUM - 1)
+        {
+            break;
+        }
+        settings->currentMonitoring_additional[cmindex].device = (CurrentMonitorDevice)v["device"].as<uint8_t>();
+        settings->currentMonitoring_additional[cmindex].address = v["address"].as<uint8_t>();
+        cmindex++;
+    }
     settings->currentMonitoring_shuntmv = root[currentMonitoring_shuntmv_JSONKEY];
     settings->currentMonitoring_shuntmaxcur = root[currentMonitoring_shuntmaxcur_JSONKEY];
     settings->currentMonitoring_voltage_divider_vbus = root[currentMonitoring_voltage_divider_vbus_JSONKEY]; //BOTANETA load json value
@@ -1201,6 +1321,7 @@ void JSONToSettings(DynamicJsonDocument &doc, diybms_eeprom_settings *settings)
     settings->canbusinverter = (CanBusInverter)root[canbusinverter_JSONKEY];
     settings->canbusbaud = root[canbusbaud_JSONKEY];
     settings->canbus_equipment_addr=root[canbus_equipment_addr_JSONKEY];
+    settings->canbus_multipack = root[canbus_multipack_JSONKEY];
     settings->nominalbatcap = root[nominalbatcap_JSONKEY];
     settings->chargevolt = root[chargevolt_JSONKEY];
     settings->chargecurrent = root[chargecurrent_JSONKEY];
@@ -1236,6 +1357,7 @@ void JSONToSettings(DynamicJsonDocument &doc, diybms_eeprom_settings *settings)
     {
         settings->mqtt_enabled = mqtt[mqtt_enabled_JSONKEY];
         settings->mqtt_basic_cell_reporting=mqtt[mqtt_basic_cell_reporting_JSONKEY];
+        settings->mqtt_bank_payloads = mqtt[mqtt_bank_payloads_JSONKEY];
         strncpy(settings->mqtt_uri, mqtt[mqtt_uri_JSONKEY].as<String>().c_str(), sizeof(settings->mqtt_uri));
         strncpy(settings->mqtt_topic, mqtt[mqtt_topic_JSONKEY].as<String>().c_str(), sizeof(settings->mqtt_topic));
         strncpy(settings->mqtt_username, mqtt[mqtt_username_JSONKEY].as<String>().c_str(), sizeof(settings->mqtt_username));
@@ -1251,6 +1373,7 @@ void JSONToSettings(DynamicJsonDocument &doc, diybms_eeprom_settings *settings)
         strncpy(settings->influxdb_orgid, influxdb[influxdb_orgid_JSONKEY].as<String>().c_str(), sizeof(settings->influxdb_orgid));
         strncpy(settings->influxdb_serverurl, influxdb[influxdb_serverurl_JSONKEY].as<String>().c_str(), sizeof(settings->influxdb_serverurl));
         settings->influxdb_loggingFreqSeconds = influxdb[influxdb_loggingFreqSeconds_JSONKEY];
+        settings->influxdb_gzip = influxdb[influxdb_gzip_JSONKEY];
     }
 
     JsonObject outputs = root["outputs"];
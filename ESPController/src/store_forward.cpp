@@ -0,0 +1,404 @@
+/*
+ ____  ____  _  _  ____  __  __  ___    _  _  __
+(  _ \(_  _)( \/ )(  _ \(  \/  )/ __)  ( \/ )/. |
+ )(_) )_)(_  \  /  ) _ < )    ( \__ \   \  /(_  _)
+(____/(____) (__) (____/(_/\/\_)(___/    \/   (_)
+
+  (c) 2017 to 2022 Stuart Pittaway
+*/
+
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-sf";
+
+#include "store_forward.h"
+#include "LittleFS.h"
+#include "SD.h"
+#include <time.h>
+
+// Each record is stored as a 16 bit length followed by the data, in RAM and in the spill file
+static constexpr size_t RECORD_LENGTH_SIZE = sizeof(uint16_t);
+
+void store_forward_queue::ramRead(size_t offset, uint8_t *data, size_t length) const
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        data[i] = ram_[(offset + i) % ramSize_];
+    }
+}
+
+void store_forward_queue::ramWrite(size_t offset, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        ram_[(offset + i) % ramSize_] = data[i];
+    }
+}
+
+bool store_forward_queue::push(const uint8_t *data, uint16_t length)
+{
+    if (!fileChecked_)
+    {
+        // Spill file left over from before a reboot, we don't know what's in it
+        fileChecked_ = true;
+        fileOnSD_ = _sd_card_installed;
+        fileReset();
+    }
+
+    if (ram_ == nullptr)
+    {
+        ram_ = (uint8_t *)malloc(ramSize_);
+        if (ram_ == nullptr)
+        {
+            ESP_LOGE(TAG, "No memory for %s", filename_);
+        }
+    }
+
+    // Once records are in the file, new records must go there too (to keep them in order)
+    if (ram_ != nullptr && fileRecords_ == 0 && ramUsed_ + RECORD_LENGTH_SIZE + length <= ramSize_)
+    {
+        size_t tail = (ramHead_ + ramUsed_) % ramSize_;
+        ramWrite(tail, (const uint8_t *)&length, RECORD_LENGTH_SIZE);
+        ramWrite(tail + RECORD_LENGTH_SIZE, data, length);
+        ramUsed_ += RECORD_LENGTH_SIZE + length;
+        ramRecords_++;
+        stored_++;
+        return true;
+    }
+
+    if (filePush(data, length))
+    {
+        stored_++;
+        return true;
+    }
+
+    dropped_++;
+    return false;
+}
+
+uint16_t store_forward_queue::peek(uint8_t index, uint8_t *buffer, uint16_t bufferLen)
+{
+    if (index >= ramRecords_)
+    {
+        return filePeek(index - ramRecords_, buffer, bufferLen);
+    }
+
+    size_t offset = ramHead_;
+    uint16_t length;
+    for (uint8_t i = 0; i < index; i++)
+    {
+        ramRead(offset, (uint8_t *)&length, RECORD_LENGTH_SIZE);
+        offset += RECORD_LENGTH_SIZE + length;
+    }
+
+    ramRead(offset, (uint8_t *)&length, RECORD_LENGTH_SIZE);
+    if (length > bufferLen)
+    {
+        return 0;
+    }
+    ramRead(offset + RECORD_LENGTH_SIZE, buffer, length);
+    return length;
+}
+
+void store_forward_queue::pop(uint8_t count, uint32_t bytes, uint32_t milliseconds)
+{
+    replayed_ += count;
+    replayedBytes_ += bytes;
+    replayMs_ += milliseconds;
+
+    while (count > 0 && ramRecords_ > 0)
+    {
+        uint16_t length;
+        ramRead(ramHead_, (uint8_t *)&length, RECORD_LENGTH_SIZE);
+        ramHead_ = (ramHead_ + RECORD_LENGTH_SIZE + length) % ramSize_;
+        ramUsed_ -= RECORD_LENGTH_SIZE + length;
+        ramRecords_--;
+        count--;
+    }
+
+    if (ramRecords_ == 0)
+    {
+        ramHead_ = 0;
+    }
+
+    if (count > 0)
+    {
+        filePop(count);
+    }
+}
+
+fs::FS *store_forward_queue::lockFileSystem(bool onSD)
+{
+    if (!onSD)
+    {
+        return &LittleFS;
+    }
+
+    // VSPI bus may be in use by the AVR programmer
+    if (!_sd_card_installed || _avrsettings.programmingModeEnabled || !hal.GetVSPIMutex())
+    {
+        return nullptr;
+    }
+    return &SD;
+}
+
+void store_forward_queue::unlockFileSystem(bool onSD)
+{
+    if (onSD)
+    {
+        hal.ReleaseVSPIMutex();
+    }
+}
+
+void store_forward_queue::fileReset()
+{
+    fs::FS *fs = lockFileSystem(fileOnSD_);
+    if (fs != nullptr)
+    {
+        if (fs->exists(filename_))
+        {
+            fs->remove(filename_);
+        }
+        unlockFileSystem(fileOnSD_);
+    }
+
+    fileRecords_ = 0;
+    fileBytes_ = 0;
+    fileReadOffset_ = 0;
+}
+
+bool store_forward_queue::filePush(const uint8_t *data, uint16_t length)
+{
+    if (fileRecords_ == 0)
+    {
+        // Starting a new file, use the SD card if we have one
+        fileReset();
+        fileOnSD_ = _sd_card_installed;
+    }
+
+    const uint32_t maximum = fileOnSD_ ? SF_SPILL_MAX_BYTES_SD : SF_SPILL_MAX_BYTES_LITTLEFS;
+    if (fileBytes_ + RECORD_LENGTH_SIZE + length > maximum)
+    {
+        return false;
+    }
+
+    fs::FS *fs = lockFileSystem(fileOnSD_);
+    if (fs == nullptr)
+    {
+        return false;
+    }
+
+    bool ok = false;
+    File file = fs->open(filename_, FILE_APPEND);
+    if (file)
+    {
+        ok = file.write((const uint8_t *)&length, RECORD_LENGTH_SIZE) == RECORD_LENGTH_SIZE &&
+             file.write(data, length) == length;
+        file.close();
+    }
+    unlockFileSystem(fileOnSD_);
+
+    if (ok)
+    {
+        fileRecords_++;
+        fileBytes_ += RECORD_LENGTH_SIZE + length;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Write to %s failed", filename_);
+    }
+    return ok;
+}
+
+uint16_t store_forward_queue::filePeek(uint8_t index, uint8_t *buffer, uint16_t bufferLen)
+{
+    if (index >= fileRecords_)
+    {
+        return 0;
+    }
+
+    fs::FS *fs = lockFileSystem(fileOnSD_);
+    if (fs == nullptr)
+    {
+        return 0;
+    }
+
+    uint16_t result = 0;
+    File file = fs->open(filename_, FILE_READ);
+    if (file && file.seek(fileReadOffset_))
+    {
+        uint16_t length = 0;
+        for (uint8_t i = 0; i <= index; i++)
+        {
+            if (file.read((uint8_t *)&length, RECORD_LENGTH_SIZE) != RECORD_LENGTH_SIZE)
+            {
+                length = 0;
+                break;
+            }
+            if (i < index && !file.seek(length, SeekCur))
+            {
+                length = 0;
+                break;
+            }
+        }
+
+        if (length > 0 && length <= bufferLen && file.read(buffer, length) == length)
+        {
+            result = length;
+        }
+    }
+    if (file)
+    {
+        file.close();
+    }
+    unlockFileSystem(fileOnSD_);
+
+    if (result == 0)
+    {
+        // Can't read the file (card removed?), so give up on its contents
+        ESP_LOGE(TAG, "Read from %s failed, discarding %u records", filename_, fileRecords_);
+        dropped_ += fileRecords_;
+        fileReset();
+    }
+
+    return result;
+}
+
+void store_forward_queue::filePop(uint8_t count)
+{
+    if (count >= fileRecords_)
+    {
+        // All sent
+        fileReset();
+        return;
+    }
+
+    fs::FS *fs = lockFileSystem(fileOnSD_);
+    if (fs == nullptr)
+    {
+        return;
+    }
+
+    File file = fs->open(filename_, FILE_READ);
+    if (file && file.seek(fileReadOffset_))
+    {
+        for (uint8_t i = 0; i < count; i++)
+        {
+            uint16_t length;
+            if (file.read((uint8_t *)&length, RECORD_LENGTH_SIZE) != RECORD_LENGTH_SIZE)
+            {
+                break;
+            }
+            file.seek(length, SeekCur);
+            fileReadOffset_ += RECORD_LENGTH_SIZE + length;
+            fileRecords_--;
+        }
+    }
+    if (file)
+    {
+        file.close();
+    }
+    unlockFileSystem(fileOnSD_);
+}
+
+void store_forward_queue::getStats(store_forward_stats *stats) const
+{
+    stats->depth = ramRecords_ + fileRecords_;
+    stats->ram_bytes = ramUsed_;
+    stats->spill_bytes = fileBytes_ - fileReadOffset_;
+    stats->spill_records = fileRecords_;
+    stats->stored = stored_;
+    stats->dropped = dropped_;
+    stats->replayed = replayed_;
+    stats->replayed_bytes = replayedBytes_;
+    stats->replay_ms = replayMs_;
+}
+
+/// @brief Take a sample of the cells, banks, current monitor and rules
+/// @return Length of the record, zero if it doesn't fit in the buffer
+uint16_t sf_capture_sample(uint8_t *buffer, uint16_t bufferLen)
+{
+    sf_sample_header header = {};
+
+    // Timestamp is zero until SNTP has set the clock (later than 2020)
+    time_t now;
+    time(&now);
+    header.timestamp = now > 1577836800 ? (uint32_t)now : 0;
+
+    header.banks = mysettings.totalNumberOfBanks;
+    header.series = mysettings.totalNumberOfSeriesModules;
+    header.active_rules = rules.active_rule_count;
+    for (uint8_t r = 0; r < RELAY_RULES; r++)
+    {
+        if (rules.ruleOutcome((Rule)r))
+        {
+            header.rules |= (1UL << r);
+        }
+    }
+
+    if (mysettings.currentMonitoringEnabled && currentMonitor.validReadings)
+    {
+        header.flags |= SF_FLAG_CURRENT_VALID;
+        header.current_voltage = currentMonitor.modbus.voltage;
+        header.current_amps = currentMonitor.modbus.current;
+        header.current_power = currentMonitor.modbus.power;
+        header.stateofcharge = currentMonitor.stateofcharge;
+        header.milliamphour_in = currentMonitor.modbus.milliamphour_in;
+        header.milliamphour_out = currentMonitor.modbus.milliamphour_out;
+    }
+
+    const uint8_t totalCells = TotalNumberOfCells();
+    const size_t length = sizeof(sf_sample_header) + header.banks * sizeof(sf_sample_bank) + totalCells * sizeof(sf_sample_cell);
+    if (length > bufferLen)
+    {
+        return 0;
+    }
+
+    memcpy(buffer, &header, sizeof(header));
+    uint8_t *p = buffer + sizeof(header);
+
+    for (uint8_t bank = 0; bank < header.banks; bank++)
+    {
+        sf_sample_bank b;
+        b.voltagemV = rules.bankvoltage.at(bank);
+        b.rangemV = rules.VoltageRangeInBank(bank);
+        memcpy(p, &b, sizeof(b));
+        p += sizeof(b);
+    }
+
+    for (uint8_t i = 0; i < totalCells; i++)
+    {
+        sf_sample_cell c;
+        c.voltagemV = cmi[i].voltagemV;
+        c.internalTemp = cmi[i].internalTemp;
+        c.externalTemp = cmi[i].externalTemp;
+        c.flags = (cmi[i].valid ? SF_CELL_VALID : 0) | (cmi[i].inBypass ? SF_CELL_BYPASS : 0);
+        memcpy(p, &c, sizeof(c));
+        p += sizeof(c);
+    }
+
+    return (uint16_t)length;
+}
+
+/// @brief Check the record is complete and point the view at its contents
+bool sf_decode_sample(const uint8_t *buffer, uint16_t length, sf_sample_view *view)
+{
+    if (length < sizeof(sf_sample_header))
+    {
+        return false;
+    }
+
+    memcpy(&view->header, buffer, sizeof(sf_sample_header));
+
+    const size_t expected = sizeof(sf_sample_header) +
+                            view->header.banks * sizeof(sf_sample_bank) +
+                            view->header.banks * view->header.series * sizeof(sf_sample_cell);
+    if (length != expected)
+    {
+        return false;
+    }
+
+    // Structures are packed, so alignment isn't an issue
+    view->banks = (const sf_sample_bank *)(buffer + sizeof(sf_sample_header));
+    view->cells = (const sf_sample_cell *)(buffer + sizeof(sf_sample_header) + view->header.banks * sizeof(sf_sample_bank));
+    return true;
+}
@@ -23,13 +23,13 @@ void victron_message_370_371()
   memset( buffer, 0, sizeof(buffer) );
   strncpy(buffer,hostname.c_str(),sizeof(buffer));
 
-  send_canbus_message(0x370, (const uint8_t *)&buffer[0], 8);
-  send_canbus_message(0x371, (const uint8_t *)&buffer[8], 8);
+  canbus_frame_store(0x370, (const uint8_t *)&buffer[0], 8);
+  canbus_frame_store(0x371, (const uint8_t *)&buffer[8], 8);
 }
 
 void victron_message_35e()
 {
-  send_canbus_message(0x35e, (const uint8_t*)hostname.c_str(), 6);
+  canbus_frame_store(0x35e, (const uint8_t*)hostname.c_str(), 6);
 }
 
 void victron_message_35f()
@@ -51,7 +51,7 @@ void victron_message_35f()
 
   data.OnlinecapacityinAh = mysettings.nominalbatcap;
 
-  send_canbus_message(0x35f, (uint8_t *)&data, sizeof(data35f));
+  canbus_frame_store(0x35f, (uint8_t *)&data, sizeof(data35f));
 }
 
 void SetBankAndModuleText(char *buffer, uint8_t cellid)
@@ -78,28 +78,28 @@ void victron_message_374_375_376_377()
   {
     SetBankAndModuleText(data.text, rules.address_LowestCellVoltage);
     // Min. cell voltage id string [1]
-    send_canbus_message(0x374, (uint8_t *)&data, sizeof(candata));
+    canbus_frame_store(0x374, (uint8_t *)&data, sizeof(candata));
   }
 
   if (rules.address_HighestCellVoltage < maximum_controller_cell_modules)
   {
     SetBankAndModuleText(data.text, rules.address_HighestCellVoltage);
     // Max. cell voltage id string [1]
-    send_canbus_message(0x375, (uint8_t *)&data, sizeof(candata));
+    canbus_frame_store(0x375, (uint8_t *)&data, sizeof(candata));
   }
 
   if (rules.address_lowestExternalTemp < maximum_controller_cell_modules)
   {
     SetBankAndModuleText(data.text, rules.address_lowestExternalTemp);
     // Min. cell voltage id string [1]
-    send_canbus_message(0x376, (uint8_t *)&data, sizeof(candata));
+    canbus_frame_store(0x376, (uint8_t *)&data, sizeof(candata));
   }
 
   if (rules.address_highestExternalTemp < maximum_controller_cell_modules)
   {
     SetBankAndModuleText(data.text, rules.address_highestExternalTemp);
     // Min. cell voltage id string [1]
-    send_canbus_message(0x377, (uint8_t *)&data, sizeof(candata));
+    canbus_frame_store(0x377, (uint8_t *)&data, sizeof(candata));
   }
 }
 
@@ -174,7 +174,10 @@ void victron_message_351()
     data.maxdischargecurrent = mysettings.dischargecurrent;
   }
 
-  send_canbus_message(0x351, (uint8_t *)&data, sizeof(data351));
+  // Combined limits of all the packs, if this controller is the multi-pack master
+  multipack_apply_limits(&data.maxchargecurrent, &data.maxdischargecurrent);
+
+  canbus_frame_store(0x351, (uint8_t *)&data, sizeof(data351));
 }
 
 // S.o.C value
@@ -192,10 +195,11 @@ void victron_message_355()
     data355 data;
     // 0 SOC value un16 1 %
     data.stateofchargevalue = rules.StateOfChargeWithRulesApplied(&mysettings, currentMonitor.stateofcharge);
+    multipack_apply_soc(&data.stateofchargevalue);
     // 2 SOH value un16 1 %
     // data.stateofhealthvalue = 100;
 
-    send_canbus_message(0x355, (uint8_t *)&data, sizeof(data355));
+    canbus_frame_store(0x355, (uint8_t *)&data, sizeof(data355));
   }
 }
 
@@ -240,7 +244,7 @@ void victron_message_356()
     data.temperature = 0;
   }
 
-  send_canbus_message(0x356, (uint8_t *)&data, sizeof(data356));
+  canbus_frame_store(0x356, (uint8_t *)&data, sizeof(data356));
 }
 
 // Send alarm details to Victron over CANBUS
@@ -368,7 +372,7 @@ void victron_message_35a()
   // Log out the buffer for debugging
   ESP_LOG_BUFFER_HEX_LEVEL(TAG, &data, sizeof(data35a), ESP_LOG_DEBUG);
 
-  send_canbus_message(0x35a, (uint8_t *)&data, sizeof(data35a));
+  canbus_frame_store(0x35a, (uint8_t *)&data, sizeof(data35a));
 }
 
 void victron_message_372()
@@ -388,7 +392,7 @@ void victron_message_372()
   // data.numberofmodulesblockingdischarge = 0;
   // data.numberofmodulesoffline = rules.invalidModuleCount;
 
-  send_canbus_message(0x372, (uint8_t *)&data, sizeof(data372));
+  canbus_frame_store(0x372, (uint8_t *)&data, sizeof(data372));
 }
 
 void victron_message_373()
@@ -409,5 +413,5 @@ void victron_message_373()
   data.maxcellvoltage = rules.highestCellVoltage;
   data.mincellvoltage = rules.lowestCellVoltage;
 
-  send_canbus_message(0x373, (uint8_t *)&data, sizeof(data373));
+  canbus_frame_store(0x373, (uint8_t *)&data, sizeof(data373));
 }
\ No newline at end of file
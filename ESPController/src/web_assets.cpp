@@ -0,0 +1,366 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-www";
+
+#include "web_assets.h"
+#include "webserver.h"
+#include "webserver_helper_funcs.h"
+#include "webserver_buffer_pool.h"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include <esp_rom_crc.h>
+
+static const esp_partition_t *www_partition = nullptr;
+static const uint8_t *www_data = nullptr;
+static spi_flash_mmap_handle_t www_mmap_handle;
+
+static const web_assets_header *www_header = nullptr;
+static const web_assets_entry *www_index = nullptr;
+
+static web_assets_stats stats = {};
+
+static void web_assets_unmap()
+{
+  www_header = nullptr;
+  www_index = nullptr;
+
+  if (www_data != nullptr)
+  {
+    spi_flash_munmap(www_mmap_handle);
+    www_data = nullptr;
+  }
+}
+
+/// @brief Checks the header, index and CRC of the mapped partition
+static bool web_assets_validate(const uint8_t *data, size_t size)
+{
+  auto header = (const web_assets_header *)data;
+
+  if (header->magic != WEB_ASSETS_MAGIC || header->version != WEB_ASSETS_VERSION)
+  {
+    ESP_LOGE(TAG, "Partition not programmed (magic %08x, version %u)", header->magic, header->version);
+    return false;
+  }
+
+  if (header->data_length > size - sizeof(web_assets_header) ||
+      header->count * sizeof(web_assets_entry) > header->data_length)
+  {
+    ESP_LOGE(TAG, "Invalid length %u, %u files", header->data_length, header->count);
+    return false;
+  }
+
+  const size_t end = sizeof(web_assets_header) + header->data_length;
+  auto index = (const web_assets_entry *)(data + sizeof(web_assets_header));
+
+  for (uint16_t i = 0; i < header->count; i++)
+  {
+    const web_assets_entry &entry = index[i];
+
+    // Path and etag are used in place, so they must be terminated.  The index is sorted for the binary search.
+    if (entry.path[WEB_ASSETS_PATH_LENGTH - 1] != 0 || entry.etag[WEB_ASSETS_ETAG_LENGTH - 1] != 0 ||
+        entry.offset > end || entry.length > end - entry.offset ||
+        (i > 0 && strcmp(index[i - 1].path, entry.path) >= 0))
+    {
+      ESP_LOGE(TAG, "Invalid index entry %u", i);
+      return false;
+    }
+  }
+
+  uint32_t crc = esp_rom_crc32_le(0, data + sizeof(web_assets_header), header->data_length);
+  if (crc != header->crc32)
+  {
+    ESP_LOGE(TAG, "CRC mismatch %08x, expected %08x", crc, header->crc32);
+    return false;
+  }
+
+  return true;
+}
+
+/// @brief True if the partition table of this device has the www partition
+/// @note Over the air updates don't change the partition table, a device which was
+/// flashed with an older table can only get the partition by a USB flash
+bool web_assets_partition_present()
+{
+  if (www_partition == nullptr)
+  {
+    www_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)WEB_ASSETS_PARTITION_SUBTYPE, "www");
+  }
+  return www_partition != nullptr;
+}
+
+/// @brief Memory maps the www partition and checks it holds a valid image
+/// @return true if web files can be served
+bool web_assets_init()
+{
+  web_assets_unmap();
+
+  if (!web_assets_partition_present())
+  {
+    ESP_LOGE(TAG, "www partition not found, flash the new partition table over USB");
+    return false;
+  }
+
+  const void *ptr;
+  esp_err_t err = esp_partition_mmap(www_partition, 0, www_partition->size, SPI_FLASH_MMAP_DATA, &ptr, &www_mmap_handle);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "esp_partition_mmap failed (%s)", esp_err_to_name(err));
+    return false;
+  }
+  www_data = (const uint8_t *)ptr;
+
+  if (!web_assets_validate(www_data, www_partition->size))
+  {
+    // Keep the mapping, the upload handler replaces the contents
+    return false;
+  }
+
+  www_header = (const web_assets_header *)www_data;
+  www_index = (const web_assets_entry *)(www_data + sizeof(web_assets_header));
+
+  ESP_LOGI(TAG, "%u files, %u bytes", www_header->count, www_header->data_length);
+  return true;
+}
+
+bool web_assets_valid()
+{
+  return www_header != nullptr;
+}
+
+/// @brief Binary search of the (sorted) index, ignoring any query string on the uri
+static const web_assets_entry *web_assets_find(const char *uri)
+{
+  size_t length = strcspn(uri, "?#");
+
+  int32_t low = 0;
+  int32_t high = (int32_t)www_header->count - 1;
+
+  while (low <= high)
+  {
+    int32_t mid = (low + high) / 2;
+    const char *path = www_index[mid].path;
+
+    int result = strncmp(uri, path, length);
+    if (result == 0 && path[length] != 0)
+    {
+      // uri is a prefix of path, so sorts before it
+      result = -1;
+    }
+
+    if (result == 0)
+    {
+      return &www_index[mid];
+    }
+
+    if (result < 0)
+    {
+      high = mid - 1;
+    }
+    else
+    {
+      low = mid + 1;
+    }
+  }
+
+  return nullptr;
+}
+
+/// @brief Sends the requested file from the memory mapped partition
+esp_err_t web_assets_send(httpd_req_t *req)
+{
+  const web_assets_entry *entry = web_assets_valid() ? web_assets_find(req->uri) : nullptr;
+
+  if (entry == nullptr)
+  {
+    stats.not_found++;
+    ESP_LOGE(TAG, "Not found: %s", req->uri);
+    return httpd_resp_send_404(req);
+  }
+
+  switch (entry->mimetype)
+  {
+  case web_assets_mimetype::application_javascript:
+    httpd_resp_set_type(req, "application/javascript");
+    break;
+  case web_assets_mimetype::text_css:
+    httpd_resp_set_type(req, "text/css");
+    break;
+  case web_assets_mimetype::image_x_icon:
+    httpd_resp_set_type(req, "image/x-icon");
+    break;
+  case web_assets_mimetype::image_png:
+    httpd_resp_set_type(req, "image/png");
+    break;
+  }
+
+  char buffer[50];
+
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", buffer, sizeof(buffer)) == ESP_OK)
+  {
+    if (strcmp(buffer, entry->etag) == 0)
+    {
+      ESP_LOGD(TAG, "Cached: %s", req->uri);
+      stats.not_modified++;
+      httpd_resp_set_status(req, "304 Not Modified");
+      return httpd_resp_send(req, NULL, 0);
+    }
+  }
+
+  if (entry->flags & WEB_ASSETS_FLAG_GZIP)
+  {
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  }
+
+  ESP_LOGD(TAG, "Serve: %s", req->uri);
+  SetCacheAndETag(req, entry->etag);
+
+  stats.served++;
+  stats.bytes_sent += entry->length;
+
+  const char *data = (const char *)(www_data + entry->offset);
+
+  if (entry->length <= WEB_ASSETS_CHUNK_SIZE)
+  {
+    return httpd_resp_send(req, data, entry->length);
+  }
+
+  // Large files (echarts) go out in chunks, directly from flash
+  size_t remaining = entry->length;
+  while (remaining > 0)
+  {
+    size_t length = remaining < WEB_ASSETS_CHUNK_SIZE ? remaining : WEB_ASSETS_CHUNK_SIZE;
+    esp_err_t err = httpd_resp_send_chunk(req, data, length);
+    if (err != ESP_OK)
+    {
+      return err;
+    }
+    data += length;
+    remaining -= length;
+  }
+
+  return httpd_resp_send_chunk(req, nullptr, 0);
+}
+
+/// @brief Replaces the contents of the www partition with an uploaded www.bin image
+esp_err_t web_assets_upload_handler(httpd_req_t *req)
+{
+  if (!validateXSS(req))
+  {
+    // validateXSS has already sent httpd_resp_send_err...
+    return ESP_FAIL;
+  }
+
+  if (!web_assets_partition_present())
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No www partition, flash over USB");
+    return ESP_FAIL;
+  }
+
+  if (req->content_len < sizeof(web_assets_header) || req->content_len > www_partition->size)
+  {
+    ESP_LOGE(TAG, "Invalid size : %d bytes", req->content_len);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid file size");
+    return ESP_FAIL;
+  }
+
+  http_buffer buffer;
+  if (!buffer)
+  {
+    return http_buffer_send_busy(req);
+  }
+
+  ESP_LOGI(TAG, "Upload %u bytes", req->content_len);
+
+  // Partition contents are about to change
+  web_assets_unmap();
+
+  size_t offset = 0;
+  size_t erased = 0;
+  int remaining = req->content_len;
+
+  while (remaining > 0)
+  {
+    int received = httpd_req_recv(req, buffer.data(), remaining < (int)buffer.size() ? remaining : (int)buffer.size());
+    if (received <= 0)
+    {
+      if (received == HTTPD_SOCK_ERR_TIMEOUT)
+      {
+        // Retry if timeout occurred
+        continue;
+      }
+
+      ESP_LOGE(TAG, "Receive failed");
+      web_assets_init();
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
+      return ESP_FAIL;
+    }
+
+    if (offset == 0)
+    {
+      // Reject the wrong file before anything is erased
+      auto header = (const web_assets_header *)buffer.data();
+      if ((size_t)received < sizeof(web_assets_header) || header->magic != WEB_ASSETS_MAGIC || header->version != WEB_ASSETS_VERSION)
+      {
+        ESP_LOGE(TAG, "Not a www.bin file");
+        web_assets_init();
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not a web files image");
+        return ESP_FAIL;
+      }
+    }
+
+    // Erase flash sectors as the writes reach them
+    while (erased < offset + received)
+    {
+      esp_err_t err = esp_partition_erase_range(www_partition, erased, SPI_FLASH_SEC_SIZE);
+      if (err != ESP_OK)
+      {
+        ESP_LOGE(TAG, "Erase failed (%s)", esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Flash erase failed");
+        return ESP_FAIL;
+      }
+      erased += SPI_FLASH_SEC_SIZE;
+    }
+
+    esp_err_t err = esp_partition_write(www_partition, offset, buffer.data(), received);
+    if (err != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Write failed (%s)", esp_err_to_name(err));
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Flash write failed");
+      return ESP_FAIL;
+    }
+
+    offset += received;
+    remaining -= received;
+
+    // Allow other tasks to do stuff (avoid watchdog timeouts)
+    vTaskDelay(10);
+  }
+
+  stats.uploads++;
+
+  if (!web_assets_init())
+  {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Uploaded image is invalid");
+    return ESP_FAIL;
+  }
+
+  ESP_LOGI(TAG, "Upload complete");
+  httpd_resp_set_status(req, HTTPD_200);
+  return httpd_resp_send(req, NULL, 0);
+}
+
+void writeWebAssetStats(httpd_json_writer &json)
+{
+  json.beginObject("www");
+  json.addBool("valid", web_assets_valid());
+  json.addUInt("files", web_assets_valid() ? www_header->count : 0);
+  json.addUInt("bytes", web_assets_valid() ? www_header->data_length : 0);
+  json.addUInt("partition", www_partition == nullptr ? 0 : www_partition->size);
+  json.addUInt("served", stats.served);
+  json.addUInt("notmodified", stats.not_modified);
+  json.addUInt("notfound", stats.not_found);
+  json.addUInt64("sent", stats.bytes_sent);
+  json.addUInt("uploads", stats.uploads);
+  json.endObject();
+}
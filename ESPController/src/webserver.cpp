@@ -11,6 +11,10 @@ static constexpr const char *const TAG = "diybms-web";
 #include "webserver_helper_funcs.h"
 #include "webserver_json_requests.h"
 #include "webserver_json_post.h"
+#include "webserver_websocket.h"
+#include "webserver_buffer_pool.h"
+#include "webserver_metrics.h"
+#include "web_assets.h"
 
 #include <esp_log.h>
 #include <stdarg.h>
@@ -18,9 +22,6 @@ static constexpr const char *const TAG = "diybms-web";
 
 httpd_handle_t _myserver;
 
-// Shared buffer for all HTTP generated replies
-char httpbuf[BUFSIZE];
-
 void setNoStoreCacheControl(httpd_req_t *req)
 {
   httpd_resp_set_hdr(req, "Cache-Control", "no-store");
@@ -88,8 +89,7 @@ esp_err_t SendSuccess(httpd_req_t *req)
   ESP_LOGD(TAG, "Success");
   httpd_resp_set_type(req, "application/json");
   setNoStoreCacheControl(req);
-  int bufferused = snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "{\"success\":true}");
-  return httpd_resp_send(req, httpbuf, bufferused);
+  return httpd_resp_sendstr(req, "{\"success\":true}");
 }
 
 void saveConfiguration()
@@ -105,6 +105,34 @@ esp_err_t default_htm_handler(httpd_req_t *req)
   setNoStoreCacheControl(req);
   setCookie(req);
 
+#ifndef DIYBMS_EMBED_WEB_ASSETS
+  if (!web_assets_partition_present())
+  {
+    // Partition table predates the www partition (updated over the air), an upload can't work
+    static const char usb_flash_htm[] = "<!DOCTYPE html><html><head><title>DIYBMS</title></head><body>"
+                                        "<h1>DIYBMS</h1><p>This controller has an old flash partition table without space for the web files.</p>"
+                                        "<p>Flash the complete firmware release over USB to update the partition table.</p>"
+                                        "</body></html>";
+    ESP_LOGW(TAG, "No www partition, sending USB flash page");
+    return httpd_resp_send(req, usb_flash_htm, sizeof(usb_flash_htm) - 1);
+  }
+
+  if (!web_assets_valid())
+  {
+    // Without the javascript files the normal page is useless, so offer a way to upload them
+    static const char recovery_htm[] = "<!DOCTYPE html><html><head><title>DIYBMS</title></head><body>"
+                                       "<h1>DIYBMS</h1><p>Web files are missing or damaged, upload www.bin from the firmware release.</p>"
+                                       "<input type=\"file\" id=\"f\"/><p id=\"s\"></p><script>"
+                                       "document.getElementById('f').onchange=function(){"
+                                       "var s=document.getElementById('s');s.innerText='Uploading...';"
+                                       "fetch('/wwwupload',{method:'POST',body:this.files[0]}).then(function(r){"
+                                       "if(r.ok){location.reload();}else{s.innerText='Upload failed';}});};"
+                                       "</script></body></html>";
+    ESP_LOGW(TAG, "Web files missing, sending recovery page");
+    return httpd_resp_send(req, recovery_htm, sizeof(recovery_htm) - 1);
+  }
+#endif
+
   char *file_pointer = (char *)file_default_htm;
   size_t max_len = size_file_default_htm;
   char *end_pointer = file_pointer + max_len;
@@ -191,6 +219,10 @@ void SetCacheAndETag(httpd_req_t *req, const char *ETag)
 // Handle static files (images, javascript etc)
 esp_err_t static_content_handler(httpd_req_t *req)
 {
+#ifndef DIYBMS_EMBED_WEB_ASSETS
+  // Served from the www flash partition
+  return web_assets_send(req);
+#else
 
   const char *const mime_text_css = "text/css";
   const char *const mime_application_javascript = "application/javascript";
@@ -297,6 +329,7 @@ esp_err_t static_content_handler(httpd_req_t *req)
   ESP_LOGE(TAG, "Not found: %s", req->uri);
 
   return httpd_resp_send_404(req);
+#endif
 }
 
 /* Our URI handler function to be called during GET /uri request */
@@ -309,15 +342,8 @@ esp_err_t get_root_handler(httpd_req_t *req)
   return ESP_OK;
 }
 
-#ifdef USE_WEBSOCKET_DEBUG_LOG
-// web socket handler
-static esp_err_t ws_handler(httpd_req_t *req)
-{
-  // NO-OP
-  return ESP_OK;
-}
+// web socket handler (live telemetry and optional debug log output)
 static const httpd_uri_t uri_ws_get = {.uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .user_ctx = NULL, .is_websocket = true};
-#endif
 
 static esp_err_t uploadfile_post_handler(httpd_req_t *req)
 {
@@ -364,6 +390,12 @@ static esp_err_t uploadfile_post_handler(httpd_req_t *req)
   // Get the file
   ESP_LOGI(TAG, "Generating LittleFS file %s", filename);
 
+  http_buffer buffer;
+  if (!buffer)
+  {
+    return http_buffer_send_busy(req);
+  }
+
   // SD card not installed, so write to LITTLEFS instead (internal flash)
   File file = LittleFS.open(filename, "w");
 
@@ -375,7 +407,7 @@ static esp_err_t uploadfile_post_handler(httpd_req_t *req)
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
     /* Receive the file part by part into a buffer */
-    if ((received = httpd_req_recv(req, httpbuf, MIN(remaining, BUFSIZE))) <= 0)
+    if ((received = httpd_req_recv(req, buffer.data(), MIN(remaining, (int)buffer.size()))) <= 0)
     {
       if (received == HTTPD_SOCK_ERR_TIMEOUT)
       {
@@ -395,7 +427,7 @@ static esp_err_t uploadfile_post_handler(httpd_req_t *req)
     }
 
     /* Write buffer content to file on storage */
-    if (received && (received != file.write((uint8_t *)httpbuf, received)))
+    if (received && (received != file.write((uint8_t *)buffer.data(), received)))
     {
       /* Couldn't write everything to file! Storage may be full? */
       file.close();
@@ -434,6 +466,23 @@ static esp_err_t ota_post_handler(httpd_req_t *req)
     return false;
   }
 
+#ifndef DIYBMS_EMBED_WEB_ASSETS
+  if (!web_assets_partition_present())
+  {
+    // This firmware serves its web files from the www partition, which an over the air
+    // update can't create.  Accepting the image would leave a controller without a web page.
+    ESP_LOGE(TAG, "OTA refused, no www partition");
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No www partition, flash the firmware over USB");
+    return ESP_FAIL;
+  }
+#endif
+
+  http_buffer buffer;
+  if (!buffer)
+  {
+    return http_buffer_send_busy(req);
+  }
+
   httpd_resp_set_status(req, HTTPD_500); // Assume failure
 
   int ret, remaining = req->content_len;
@@ -465,7 +514,7 @@ static esp_err_t ota_post_handler(httpd_req_t *req)
   {
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
     // Read the data for the request
-    if ((ret = httpd_req_recv(req, httpbuf, MIN(remaining, BUFSIZE))) <= 0)
+    if ((ret = httpd_req_recv(req, buffer.data(), MIN(remaining, (int)buffer.size()))) <= 0)
     {
       if (ret == HTTPD_SOCK_ERR_TIMEOUT)
       {
@@ -479,7 +528,7 @@ static esp_err_t ota_post_handler(httpd_req_t *req)
     size_t bytes_read = ret;
 
     remaining -= bytes_read;
-    err = esp_ota_write(update_handle, httpbuf, bytes_read);
+    err = esp_ota_write(update_handle, buffer.data(), bytes_read);
     if (err != ESP_OK)
     {
       goto return_failure;
@@ -535,8 +584,10 @@ static const httpd_uri_t uri_static_content_get = {.uri = "*", .method = HTTP_GE
 
 static const httpd_uri_t uri_ota_post = {.uri = "/ota", .method = HTTP_POST, .handler = ota_post_handler, .user_ctx = NULL};
 static const httpd_uri_t uri_uploadfile_post = {.uri = "/uploadfile", .method = HTTP_POST, .handler = uploadfile_post_handler, .user_ctx = NULL};
+static const httpd_uri_t uri_wwwupload_post = {.uri = "/wwwupload", .method = HTTP_POST, .handler = web_assets_upload_handler, .user_ctx = NULL};
 
 static const httpd_uri_t uri_homeassist_get = {.uri = "/ha", .method = HTTP_GET, .handler = ha_handler, .user_ctx = NULL};
+static const httpd_uri_t uri_metrics_get = {.uri = "/metrics", .method = HTTP_GET, .handler = metrics_handler, .user_ctx = NULL};
 
 void resetModuleMinMaxVoltage(uint8_t m)
 {
@@ -620,7 +671,7 @@ httpd_handle_t start_webserver(void)
   /* Generate default configuration */
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
-  config.max_uri_handlers = 11;
+  config.max_uri_handlers = 13;
   config.max_open_sockets = 8;
   config.max_resp_headers = 16;
   config.stack_size = 6250;
@@ -648,13 +699,15 @@ httpd_handle_t start_webserver(void)
     // OTA services
     ESP_ERROR_CHECK(httpd_register_uri_handler(server, &uri_ota_post));
     ESP_ERROR_CHECK(httpd_register_uri_handler(server, &uri_uploadfile_post));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(server, &uri_wwwupload_post));
 
     ESP_ERROR_CHECK(httpd_register_uri_handler(server, &uri_homeassist_get));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(server, &uri_metrics_get));
 
 
-#ifdef USE_WEBSOCKET_DEBUG_LOG
     // Websocket
     ESP_ERROR_CHECK(httpd_register_uri_handler(server, &uri_ws_get));
+#ifdef USE_WEBSOCKET_DEBUG_LOG
     esp_log_set_vprintf(log_output_redirector);
 #endif
 
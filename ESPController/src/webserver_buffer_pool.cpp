@@ -0,0 +1,77 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-webbuf";
+
+#include "webserver_buffer_pool.h"
+
+#include <esp_log.h>
+
+static_assert(HTTP_BUFFER_POOL_SIZE <= 8, "in_use_mask only holds 8 buffers");
+
+static char pool[HTTP_BUFFER_POOL_SIZE][BUFSIZE];
+
+// Bit set for each buffer currently lent to a request
+static uint8_t in_use_mask = 0;
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static http_buffer_pool_stats pool_stats = {};
+
+http_buffer::http_buffer() : data_(nullptr), index_(-1)
+{
+    portENTER_CRITICAL(&pool_lock);
+    for (int8_t i = 0; i < HTTP_BUFFER_POOL_SIZE; i++)
+    {
+        if ((in_use_mask & (1U << i)) == 0)
+        {
+            in_use_mask |= (1U << i);
+            index_ = i;
+            pool_stats.acquired++;
+            pool_stats.in_use++;
+            if (pool_stats.in_use > pool_stats.max_in_use)
+            {
+                pool_stats.max_in_use = pool_stats.in_use;
+            }
+            break;
+        }
+    }
+    if (index_ < 0)
+    {
+        pool_stats.exhausted++;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+
+    if (index_ >= 0)
+    {
+        data_ = pool[index_];
+    }
+}
+
+http_buffer::~http_buffer()
+{
+    if (index_ < 0)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&pool_lock);
+    in_use_mask &= ~(1U << index_);
+    pool_stats.in_use--;
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+/// @brief Reply when no buffer is available, tells the browser to try again shortly
+/// rather than queuing behind the requests already in progress.
+/// @param req Incoming HTTPD request handle
+/// @return Error/success status
+esp_err_t http_buffer_send_busy(httpd_req_t *req)
+{
+    ESP_LOGW(TAG, "No free buffer for %s", req->uri);
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    return httpd_resp_send(req, nullptr, 0);
+}
+
+void http_buffer_pool_get_stats(http_buffer_pool_stats *stats)
+{
+    portENTER_CRITICAL(&pool_lock);
+    *stats = pool_stats;
+    portEXIT_CRITICAL(&pool_lock);
+}
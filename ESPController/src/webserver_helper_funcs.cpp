@@ -41,7 +41,7 @@ void setCookieValue()
     snprintf(cookie, sizeof(cookie), "DIYBMS=%s; path=/; HttpOnly; SameSite=Strict", CookieValue);
 }
 
-bool getPostDataIntoBuffer(httpd_req_t *req)
+bool getPostDataIntoBuffer(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
     /* Destination buffer for content of HTTP POST request.
      * httpd_req_recv() accepts char* only, but content could
@@ -49,16 +49,17 @@ bool getPostDataIntoBuffer(httpd_req_t *req)
      * In case of string data, null termination will be absent, and
      * content length would give length of string */
 
-    if (req->content_len > sizeof(httpbuf))
+    // Leave space for the null terminator
+    if (req->content_len >= bufferLen)
     {
         ESP_LOGE(TAG, "Buffer not large enough %u", req->content_len);
         return false;
     }
 
     /* Truncate if content length larger than the buffer */
-    // size_t recv_size = min(req->content_len, sizeof(httpbuf));
+    // size_t recv_size = min(req->content_len, bufferLen);
 
-    int ret = httpd_req_recv(req, httpbuf, req->content_len);
+    int ret = httpd_req_recv(req, buffer, req->content_len);
     if (ret <= 0)
     { /* 0 return value indicates connection closed */
         /* Check if timeout occurred */
@@ -73,9 +74,9 @@ bool getPostDataIntoBuffer(httpd_req_t *req)
     }
 
     // Ensure null terminated
-    httpbuf[ret] = 0;
+    buffer[ret] = 0;
 
-    // ESP_LOGD(TAG, "Post data %s", httpbuf);
+    // ESP_LOGD(TAG, "Post data %s", buffer);
 
     return true;
 }
@@ -4,9 +4,12 @@ static constexpr const char *const TAG = "diybms-webpost";
 #include "webserver.h"
 #include "webserver_json_post.h"
 #include "webserver_helper_funcs.h"
+#include "webserver_buffer_pool.h"
+#include "current_monitors.h"
+#include "json_writer.hpp"
 #include <esp_netif.h>
 
-esp_err_t post_savebankconfig_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savebankconfig_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     uint8_t totalSeriesModules = 1;
     uint8_t totalBanks = 1;
@@ -15,20 +18,20 @@ esp_err_t post_savebankconfig_json_handler(httpd_req_t *req, bool urlEncoded)
 
     uint32_t tempVariable;
 
-    if (GetKeyValue(httpbuf, "totalSeriesModules", &tempVariable, urlEncoded))
+    if (GetKeyValue(buffer, "totalSeriesModules", &tempVariable, urlEncoded))
     {
         // Obviously could overflow
         totalSeriesModules = (uint8_t)tempVariable;
 
-        if (GetKeyValue(httpbuf, "totalBanks", &tempVariable, urlEncoded))
+        if (GetKeyValue(buffer, "totalBanks", &tempVariable, urlEncoded))
         {
             // Obviously could overflow
             totalBanks = (uint8_t)tempVariable;
 
-            if (GetKeyValue(httpbuf, "baudrate", &baudrate, urlEncoded))
+            if (GetKeyValue(buffer, "baudrate", &baudrate, urlEncoded))
             {
 
-                if (GetKeyValue(httpbuf, "interpacketgap", &interpacketgap, urlEncoded))
+                if (GetKeyValue(buffer, "interpacketgap", &interpacketgap, urlEncoded))
                 {
                     if (totalSeriesModules * totalBanks <= maximum_controller_cell_modules)
                     {
@@ -48,23 +51,23 @@ esp_err_t post_savebankconfig_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendFailure(req);
 }
 
-esp_err_t post_saventp_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_saventp_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     // uint32_t tempVariable;
-    if (GetKeyValue(httpbuf, "NTPZoneHour", &mysettings.timeZone, urlEncoded))
+    if (GetKeyValue(buffer, "NTPZoneHour", &mysettings.timeZone, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "NTPZoneMin", &mysettings.minutesTimeZone, urlEncoded))
+    if (GetKeyValue(buffer, "NTPZoneMin", &mysettings.minutesTimeZone, urlEncoded))
     {
     }
 
-    if (GetTextFromKeyValue(httpbuf, "NTPServer", mysettings.ntpServer, sizeof(mysettings.ntpServer), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "NTPServer", mysettings.ntpServer, sizeof(mysettings.ntpServer), urlEncoded))
     {
     }
 
     // HTML Boolean value, so element is not POST'ed if FALSE/OFF
     mysettings.daylight = false;
-    if (GetKeyValue(httpbuf, "NTPDST", &mysettings.daylight, urlEncoded))
+    if (GetKeyValue(buffer, "NTPDST", &mysettings.daylight, urlEncoded))
     {
     }
 
@@ -75,27 +78,30 @@ esp_err_t post_saventp_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_savemqtt_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savemqtt_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     // Default to off
     mysettings.mqtt_enabled = false;
     mysettings.mqtt_basic_cell_reporting = false;
+    mysettings.mqtt_bank_payloads = false;
 
     // Username and password are optional and may not be HTTP posted from web browser
     memset(mysettings.mqtt_username, 0, sizeof(mysettings.mqtt_username));
     memset(mysettings.mqtt_password, 0, sizeof(mysettings.mqtt_password));
 
-    GetKeyValue(httpbuf, "mqttEnabled", &mysettings.mqtt_enabled, urlEncoded);
+    GetKeyValue(buffer, "mqttEnabled", &mysettings.mqtt_enabled, urlEncoded);
 
-    GetKeyValue(httpbuf, "mqttBasicReporting", &mysettings.mqtt_basic_cell_reporting, urlEncoded);
+    GetKeyValue(buffer, "mqttBasicReporting", &mysettings.mqtt_basic_cell_reporting, urlEncoded);
 
-    GetTextFromKeyValue(httpbuf, "mqttTopic", mysettings.mqtt_topic, sizeof(mysettings.mqtt_topic), urlEncoded);
+    GetKeyValue(buffer, "mqttBankPayloads", &mysettings.mqtt_bank_payloads, urlEncoded);
 
-    GetTextFromKeyValue(httpbuf, "mqttUri", mysettings.mqtt_uri, sizeof(mysettings.mqtt_uri), urlEncoded);
+    GetTextFromKeyValue(buffer, "mqttTopic", mysettings.mqtt_topic, sizeof(mysettings.mqtt_topic), urlEncoded);
 
-    GetTextFromKeyValue(httpbuf, "mqttUsername", mysettings.mqtt_username, sizeof(mysettings.mqtt_username), urlEncoded);
+    GetTextFromKeyValue(buffer, "mqttUri", mysettings.mqtt_uri, sizeof(mysettings.mqtt_uri), urlEncoded);
 
-    GetTextFromKeyValue(httpbuf, "mqttPassword", mysettings.mqtt_password, sizeof(mysettings.mqtt_password), urlEncoded);
+    GetTextFromKeyValue(buffer, "mqttUsername", mysettings.mqtt_username, sizeof(mysettings.mqtt_username), urlEncoded);
+
+    GetTextFromKeyValue(buffer, "mqttPassword", mysettings.mqtt_password, sizeof(mysettings.mqtt_password), urlEncoded);
 
     saveConfiguration();
 
@@ -106,12 +112,12 @@ esp_err_t post_savemqtt_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_saveglobalsetting_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_saveglobalsetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
-    if (GetKeyValue(httpbuf, "BypassOverTempShutdown", &mysettings.BypassOverTempShutdown, urlEncoded))
+    if (GetKeyValue(buffer, "BypassOverTempShutdown", &mysettings.BypassOverTempShutdown, urlEncoded))
     {
 
-        if (GetKeyValue(httpbuf, "BypassThresholdmV", &mysettings.BypassThresholdmV, urlEncoded))
+        if (GetKeyValue(buffer, "BypassThresholdmV", &mysettings.BypassThresholdmV, urlEncoded))
         {
 
             if (prg.sendSaveGlobalSetting(mysettings.BypassThresholdmV, mysettings.BypassOverTempShutdown))
@@ -141,7 +147,7 @@ esp_err_t post_saveglobalsetting_json_handler(httpd_req_t *req, bool urlEncoded)
 /*
 Restart controller from web interface
 */
-esp_err_t post_restartcontroller_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_restartcontroller_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     // Reboot!
     ESP.restart();
@@ -149,44 +155,52 @@ esp_err_t post_restartcontroller_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_saveinfluxdbsetting_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_saveinfluxdbsetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     mysettings.influxdb_enabled = false;
-    if (GetKeyValue(httpbuf, "influxEnabled", &mysettings.influxdb_enabled, urlEncoded))
+    if (GetKeyValue(buffer, "influxEnabled", &mysettings.influxdb_enabled, urlEncoded))
     {
     }
 
     mysettings.influxdb_loggingFreqSeconds = 15;
-    if (GetKeyValue(httpbuf, "influxFreq", &mysettings.influxdb_loggingFreqSeconds, urlEncoded))
+    if (GetKeyValue(buffer, "influxFreq", &mysettings.influxdb_loggingFreqSeconds, urlEncoded))
+    {
+    }
+
+    mysettings.influxdb_gzip = false;
+    if (GetKeyValue(buffer, "influxGzip", &mysettings.influxdb_gzip, urlEncoded))
     {
     }
 
-    if (GetTextFromKeyValue(httpbuf, "influxUrl", mysettings.influxdb_serverurl, sizeof(mysettings.influxdb_serverurl), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "influxUrl", mysettings.influxdb_serverurl, sizeof(mysettings.influxdb_serverurl), urlEncoded))
     {
     }
-    if (GetTextFromKeyValue(httpbuf, "influxDatabase", mysettings.influxdb_databasebucket, sizeof(mysettings.influxdb_databasebucket), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "influxDatabase", mysettings.influxdb_databasebucket, sizeof(mysettings.influxdb_databasebucket), urlEncoded))
     {
     }
-    if (GetTextFromKeyValue(httpbuf, "influxOrgId", mysettings.influxdb_orgid, sizeof(mysettings.influxdb_orgid), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "influxOrgId", mysettings.influxdb_orgid, sizeof(mysettings.influxdb_orgid), urlEncoded))
     {
     }
-    if (GetTextFromKeyValue(httpbuf, "influxToken", mysettings.influxdb_apitoken, sizeof(mysettings.influxdb_apitoken), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "influxToken", mysettings.influxdb_apitoken, sizeof(mysettings.influxdb_apitoken), urlEncoded))
     {
     }
 
-    if (mysettings.influxdb_loggingFreqSeconds < 5)
+    if (mysettings.influxdb_loggingFreqSeconds < 1)
     {
         // Safety check
-        mysettings.influxdb_loggingFreqSeconds = 5;
+        mysettings.influxdb_loggingFreqSeconds = 1;
     }
 
     saveConfiguration();
 
+    // URL/token may have changed, so reconnect on next write
+    influx_settings_changed();
+
     return SendSuccess(req);
 }
 
 // Saves all the BMS controller settings to a JSON file in FLASH
-esp_err_t post_saveconfigurationtoflash_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_saveconfigurationtoflash_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     DynamicJsonDocument doc(5000);
     GenerateSettingsJSONDocument(&doc, &mysettings);
@@ -220,7 +234,7 @@ esp_err_t post_saveconfigurationtoflash_json_handler(httpd_req_t *req, bool urlE
     return SendSuccess(req);
 }
 
-esp_err_t post_savewificonfigtosdcard_json_handler(httpd_req_t *req, bool)
+esp_err_t post_savewificonfigtosdcard_json_handler(httpd_req_t *req, char *, size_t, bool)
 {
     if (SaveWIFIJson(&_wificonfig))
     {
@@ -230,11 +244,11 @@ esp_err_t post_savewificonfigtosdcard_json_handler(httpd_req_t *req, bool)
     return SendFailure(req);
 }
 
-esp_err_t post_savesetting_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savesetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     uint32_t tempVariable;
 
-    if (GetKeyValue(httpbuf, "m", &tempVariable, urlEncoded))
+    if (GetKeyValue(buffer, "m", &tempVariable, urlEncoded))
     {
         auto m = (uint8_t)tempVariable;
 
@@ -256,11 +270,11 @@ esp_err_t post_savesetting_json_handler(httpd_req_t *req, bool urlEncoded)
             uint16_t BypassThresholdmV = 0xFFFF;
             float Calibration = 0xFFFF;
 
-            if (GetKeyValue(httpbuf, "BypassOverTempShutdown", &BypassOverTempShutdown, urlEncoded))
+            if (GetKeyValue(buffer, "BypassOverTempShutdown", &BypassOverTempShutdown, urlEncoded))
             {
-                if (GetKeyValue(httpbuf, "BypassThresholdmV", &BypassThresholdmV, urlEncoded))
+                if (GetKeyValue(buffer, "BypassThresholdmV", &BypassThresholdmV, urlEncoded))
                 {
-                    if (GetKeyValue(httpbuf, "Calib", &Calibration, urlEncoded))
+                    if (GetKeyValue(buffer, "Calib", &Calibration, urlEncoded))
                     {
                         if (prg.sendSaveSetting(m, BypassThresholdmV, BypassOverTempShutdown, Calibration))
                         {
@@ -273,12 +287,12 @@ esp_err_t post_savesetting_json_handler(httpd_req_t *req, bool urlEncoded)
                                 uint16_t RunAwayMinmV = 4000;
                                 uint16_t RunAwayDiffmV = 100;
 
-                                GetKeyValue(httpbuf, "FanSwitchOnT", &FanSwitchOnT, urlEncoded);
-                                GetKeyValue(httpbuf, "RelayMinV", &RelayMinV, urlEncoded);
-                                GetKeyValue(httpbuf, "RelayRange", &RelayRangemV, urlEncoded);
+                                GetKeyValue(buffer, "FanSwitchOnT", &FanSwitchOnT, urlEncoded);
+                                GetKeyValue(buffer, "RelayMinV", &RelayMinV, urlEncoded);
+                                GetKeyValue(buffer, "RelayRange", &RelayRangemV, urlEncoded);
 
-                                GetKeyValue(httpbuf, "RunAwayMinmV", &RunAwayMinmV, urlEncoded);
-                                GetKeyValue(httpbuf, "RunAwayDiffmV", &RunAwayDiffmV, urlEncoded);
+                                GetKeyValue(buffer, "RunAwayMinmV", &RunAwayMinmV, urlEncoded);
+                                GetKeyValue(buffer, "RunAwayDiffmV", &RunAwayDiffmV, urlEncoded);
 
                                 prg.sendSaveAdditionalSetting(m, FanSwitchOnT, RelayMinV, RelayRangemV, RunAwayMinmV, RunAwayDiffmV);
                             }
@@ -294,15 +308,15 @@ esp_err_t post_savesetting_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendFailure(req);
 }
 
-esp_err_t post_savestorage_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savestorage_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     // HTML Boolean value, so element is not POST'ed if FALSE/OFF
     mysettings.loggingEnabled = false;
-    if (GetKeyValue(httpbuf, "loggingEnabled", &mysettings.loggingEnabled, urlEncoded))
+    if (GetKeyValue(buffer, "loggingEnabled", &mysettings.loggingEnabled, urlEncoded))
     {
     }
 
-    if (GetKeyValue(httpbuf, "loggingFreq", &mysettings.loggingFrequencySeconds, urlEncoded))
+    if (GetKeyValue(buffer, "loggingFreq", &mysettings.loggingFrequencySeconds, urlEncoded))
     {
     }
 
@@ -317,7 +331,7 @@ esp_err_t post_savestorage_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_visibletiles_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_visibletiles_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     char keyBuffer[16];
 
@@ -326,7 +340,7 @@ esp_err_t post_visibletiles_json_handler(httpd_req_t *req, bool urlEncoded)
         mysettings.tileconfig[i] = 0;
         snprintf(keyBuffer, sizeof(keyBuffer), "v%i", i);
         uint16_t temp;
-        if (GetKeyValue(httpbuf, keyBuffer, &temp, urlEncoded))
+        if (GetKeyValue(buffer, keyBuffer, &temp, urlEncoded))
         {
             ESP_LOGD(TAG, "%s=%u", keyBuffer, temp);
             mysettings.tileconfig[i] = temp;
@@ -338,13 +352,13 @@ esp_err_t post_visibletiles_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_savedisplaysetting_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savedisplaysetting_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
-    if (GetKeyValue(httpbuf, "VoltageHigh", &mysettings.graph_voltagehigh, urlEncoded))
+    if (GetKeyValue(buffer, "VoltageHigh", &mysettings.graph_voltagehigh, urlEncoded))
     {
     }
 
-    if (GetKeyValue(httpbuf, "VoltageLow", &mysettings.graph_voltagelow, urlEncoded))
+    if (GetKeyValue(buffer, "VoltageLow", &mysettings.graph_voltagelow, urlEncoded))
     {
     }
 
@@ -354,7 +368,7 @@ esp_err_t post_savedisplaysetting_json_handler(httpd_req_t *req, bool urlEncoded
         mysettings.graph_voltagelow = 0;
     }
 
-    if (GetTextFromKeyValue(httpbuf, "Language", mysettings.language, sizeof(mysettings.language), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "Language", mysettings.language, sizeof(mysettings.language), urlEncoded))
     {
     }
 
@@ -363,7 +377,7 @@ esp_err_t post_savedisplaysetting_json_handler(httpd_req_t *req, bool urlEncoded
     return SendSuccess(req);
 }
 
-esp_err_t post_resetcounters_json_handler(httpd_req_t *req, bool)
+esp_err_t post_resetcounters_json_handler(httpd_req_t *req, char *, size_t, bool)
 {
     // Ask modules to reset bad packet counters
     // If this fails, queue could be full so return error
@@ -390,7 +404,7 @@ esp_err_t post_resetcounters_json_handler(httpd_req_t *req, bool)
     return SendFailure(req);
 }
 
-esp_err_t post_sdmount_json_handler(httpd_req_t *req, bool)
+esp_err_t post_sdmount_json_handler(httpd_req_t *req, char *, size_t, bool)
 {
     if (_avrsettings.programmingModeEnabled)
     {
@@ -402,7 +416,7 @@ esp_err_t post_sdmount_json_handler(httpd_req_t *req, bool)
 
     return SendSuccess(req);
 }
-esp_err_t post_sdunmount_json_handler(httpd_req_t *req, bool)
+esp_err_t post_sdunmount_json_handler(httpd_req_t *req, char *, size_t, bool)
 {
     if (_avrsettings.programmingModeEnabled)
     {
@@ -417,7 +431,7 @@ esp_err_t post_sdunmount_json_handler(httpd_req_t *req, bool)
     return SendSuccess(req);
 }
 
-esp_err_t post_enableavrprog_json_handler(httpd_req_t *req, bool)
+esp_err_t post_enableavrprog_json_handler(httpd_req_t *req, char *, size_t, bool)
 {
     // unmountSDCard();
 
@@ -425,7 +439,7 @@ esp_err_t post_enableavrprog_json_handler(httpd_req_t *req, bool)
 
     return SendSuccess(req);
 }
-esp_err_t post_disableavrprog_json_handler(httpd_req_t *req, bool)
+esp_err_t post_disableavrprog_json_handler(httpd_req_t *req, char *, size_t, bool)
 {
     _avrsettings.programmingModeEnabled = false;
 
@@ -435,26 +449,26 @@ esp_err_t post_disableavrprog_json_handler(httpd_req_t *req, bool)
     return SendSuccess(req);
 }
 
-esp_err_t post_savers485settings_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savers485settings_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     uint32_t tempVariable;
 
-    if (GetKeyValue(httpbuf, "rs485baudrate", &tempVariable, urlEncoded))
+    if (GetKeyValue(buffer, "rs485baudrate", &tempVariable, urlEncoded))
     {
         mysettings.rs485baudrate = (int)tempVariable;
     }
 
-    if (GetKeyValue(httpbuf, "rs485databit", &tempVariable, urlEncoded))
+    if (GetKeyValue(buffer, "rs485databit", &tempVariable, urlEncoded))
     {
         mysettings.rs485databits = (uart_word_length_t)tempVariable;
     }
 
-    if (GetKeyValue(httpbuf, "rs485parity", &tempVariable, urlEncoded))
+    if (GetKeyValue(buffer, "rs485parity", &tempVariable, urlEncoded))
     {
         mysettings.rs485parity = (uart_parity_t)tempVariable;
     }
 
-    if (GetKeyValue(httpbuf, "rs485stopbit", &tempVariable, urlEncoded))
+    if (GetKeyValue(buffer, "rs485stopbit", &tempVariable, urlEncoded))
     {
         mysettings.rs485stopbits = (uart_stop_bits_t)tempVariable;
     }
@@ -465,14 +479,14 @@ esp_err_t post_savers485settings_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_savechargeconfig_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savechargeconfig_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     uint8_t temp;
 
     // If a user updates the charge config, reset the charging mode as well
     rules.setChargingMode(ChargingMode::standard);
 
-    if (GetKeyValue(httpbuf, "canbusprotocol", &temp, urlEncoded))
+    if (GetKeyValue(buffer, "canbusprotocol", &temp, urlEncoded))
     {
         mysettings.canbusprotocol = (CanBusProtocolEmulation)temp;
     }
@@ -486,82 +500,90 @@ esp_err_t post_savechargeconfig_json_handler(httpd_req_t *req, bool urlEncoded)
 
     // Default value
     mysettings.canbusinverter = CanBusInverter::INVERTER_GENERIC;
-    if (GetKeyValue(httpbuf, "canbusinverter", &temp, urlEncoded))
+    if (GetKeyValue(buffer, "canbusinverter", &temp, urlEncoded))
     {
         mysettings.canbusinverter = (CanBusInverter)temp;
     }
 
-    GetKeyValue(httpbuf, "canbusbaud", &mysettings.canbusbaud, urlEncoded);
+    GetKeyValue(buffer, "canbusbaud", &mysettings.canbusbaud, urlEncoded);
+    GetKeyValue(buffer, "canbusequip", &mysettings.canbus_equipment_addr, urlEncoded);
+    if (mysettings.canbus_equipment_addr > 15)
+    {
+        mysettings.canbus_equipment_addr = 0;
+    }
+
+    mysettings.canbus_multipack = false;
+    GetKeyValue(buffer, "canbusmultipack", &mysettings.canbus_multipack, urlEncoded);
 
-    GetKeyValue(httpbuf, "nominalbatcap", &mysettings.nominalbatcap, urlEncoded);
-    GetKeyValue(httpbuf, "cellminmv", &mysettings.cellminmv, urlEncoded);
-    GetKeyValue(httpbuf, "cellmaxmv", &mysettings.cellmaxmv, urlEncoded);
-    GetKeyValue(httpbuf, "kneemv", &mysettings.kneemv, urlEncoded);
-    GetKeyValue(httpbuf, "cellmaxspikemv", &mysettings.cellmaxspikemv, urlEncoded);
+    GetKeyValue(buffer, "nominalbatcap", &mysettings.nominalbatcap, urlEncoded);
+    GetKeyValue(buffer, "cellminmv", &mysettings.cellminmv, urlEncoded);
+    GetKeyValue(buffer, "cellmaxmv", &mysettings.cellmaxmv, urlEncoded);
+    GetKeyValue(buffer, "kneemv", &mysettings.kneemv, urlEncoded);
+    GetKeyValue(buffer, "cellmaxspikemv", &mysettings.cellmaxspikemv, urlEncoded);
 
     float temp_float;
 
-    if (GetKeyValue(httpbuf, "cur_val1", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "cur_val1", &temp_float, urlEncoded))
     {
         mysettings.current_value1 = (uint16_t)(10 * temp_float);
     }
 
-    if (GetKeyValue(httpbuf, "cur_val2", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "cur_val2", &temp_float, urlEncoded))
     {
         mysettings.current_value2 = (uint16_t)(10 * temp_float);
     }
 
-    if (GetKeyValue(httpbuf, "sensitivity", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "sensitivity", &temp_float, urlEncoded))
     {
         mysettings.sensitivity = (int16_t)(10 * temp_float);
     }
-    if (GetKeyValue(httpbuf, "chargevolt", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "chargevolt", &temp_float, urlEncoded))
     {
         mysettings.chargevolt = (uint16_t)(10 * temp_float);
     }
-    if (GetKeyValue(httpbuf, "chargecurrent", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "chargecurrent", &temp_float, urlEncoded))
     {
         mysettings.chargecurrent = (uint16_t)(10 * temp_float);
     }
-    if (GetKeyValue(httpbuf, "dischargecurrent", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "dischargecurrent", &temp_float, urlEncoded))
     {
         mysettings.dischargecurrent = (uint16_t)(10 * temp_float);
     }
-    if (GetKeyValue(httpbuf, "dischargevolt", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "dischargevolt", &temp_float, urlEncoded))
     {
         mysettings.dischargevolt = (uint16_t)(10 * temp_float);
     }
     mysettings.stopchargebalance = false;
-    GetKeyValue(httpbuf, "stopchargebalance", &mysettings.stopchargebalance, urlEncoded);
+    GetKeyValue(buffer, "stopchargebalance", &mysettings.stopchargebalance, urlEncoded);
 
     mysettings.socoverride = false;
-    GetKeyValue(httpbuf, "socoverride", &mysettings.socoverride, urlEncoded);
+    GetKeyValue(buffer, "socoverride", &mysettings.socoverride, urlEncoded);
 
     mysettings.socforcelow = false;
-    GetKeyValue(httpbuf, "socforcelow", &mysettings.socforcelow, urlEncoded);
+    GetKeyValue(buffer, "socforcelow", &mysettings.socforcelow, urlEncoded);
 
     mysettings.dynamiccharge = false;
-    GetKeyValue(httpbuf, "dynamiccharge", &mysettings.dynamiccharge, urlEncoded);
+    GetKeyValue(buffer, "dynamiccharge", &mysettings.dynamiccharge, urlEncoded);
 
     mysettings.preventcharging = false;
-    GetKeyValue(httpbuf, "preventcharging", &mysettings.preventcharging, urlEncoded);
+    GetKeyValue(buffer, "preventcharging", &mysettings.preventcharging, urlEncoded);
 
     mysettings.preventdischarge = false;
-    GetKeyValue(httpbuf, "preventdischarge", &mysettings.preventdischarge, urlEncoded);
+    GetKeyValue(buffer, "preventdischarge", &mysettings.preventdischarge, urlEncoded);
 
-    GetKeyValue(httpbuf, "chargetemplow", &mysettings.chargetemplow, urlEncoded);
-    GetKeyValue(httpbuf, "chargetemphigh", &mysettings.chargetemphigh, urlEncoded);
-    GetKeyValue(httpbuf, "dischargetemplow", &mysettings.dischargetemplow, urlEncoded);
-    GetKeyValue(httpbuf, "dischargetemphigh", &mysettings.dischargetemphigh, urlEncoded);
+    GetKeyValue(buffer, "chargetemplow", &mysettings.chargetemplow, urlEncoded);
+    GetKeyValue(buffer, "chargetemphigh", &mysettings.chargetemphigh, urlEncoded);
+    GetKeyValue(buffer, "dischargetemplow", &mysettings.dischargetemplow, urlEncoded);
+    GetKeyValue(buffer, "dischargetemphigh", &mysettings.dischargetemphigh, urlEncoded);
 
-    GetKeyValue(httpbuf, "absorptimer", &mysettings.absorptiontimer, urlEncoded);
+    GetKeyValue(buffer, "absorptimer", &mysettings.absorptiontimer, urlEncoded);
 
-    if (GetKeyValue(httpbuf, "floatvolt", &temp_float, urlEncoded))
+    if (GetKeyValue(buffer, "floatvolt", &temp_float, urlEncoded))
     {
         mysettings.floatvoltage = (uint16_t)(10 * temp_float);
     }
-    GetKeyValue(httpbuf, "floattimer", &mysettings.floatvoltagetimer, urlEncoded);
-    GetKeyValue(httpbuf, "socresume", &mysettings.stateofchargeresumevalue, urlEncoded);
+    GetKeyValue(buffer, "floattimer", &mysettings.floatvoltagetimer, urlEncoded);
+    GetKeyValue(buffer, "socresume", &mysettings.stateofchargeresumevalue, urlEncoded);
 
     if (mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_DISABLED)
     {
@@ -583,7 +605,7 @@ esp_err_t post_savechargeconfig_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_savecmrelay_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savecmrelay_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     currentmonitoring_struct newvalues;
     // Set everything to zero/false
@@ -593,36 +615,36 @@ esp_err_t post_savecmrelay_json_handler(httpd_req_t *req, bool urlEncoded)
 
     bool tempBool;
 
-    if (GetKeyValue(httpbuf, "TempCompEnabled", &tempBool, urlEncoded))
+    if (GetKeyValue(buffer, "TempCompEnabled", &tempBool, urlEncoded))
     {
         newvalues.TempCompEnabled = tempBool;
     }
 
-    if (GetKeyValue(httpbuf, "cmTMPOL", &tempBool, urlEncoded))
+    if (GetKeyValue(buffer, "cmTMPOL", &tempBool, urlEncoded))
     {
         newvalues.RelayTriggerTemperatureOverLimit = tempBool;
     }
 
-    if (GetKeyValue(httpbuf, "cmCURROL", &tempBool, urlEncoded))
+    if (GetKeyValue(buffer, "cmCURROL", &tempBool, urlEncoded))
     {
         newvalues.RelayTriggerCurrentOverLimit = tempBool;
     }
 
-    if (GetKeyValue(httpbuf, "cmCURRUL", &tempBool, urlEncoded))
+    if (GetKeyValue(buffer, "cmCURRUL", &tempBool, urlEncoded))
     {
         newvalues.RelayTriggerCurrentUnderLimit = tempBool;
     }
 
-    if (GetKeyValue(httpbuf, "cmVOLTOL", &tempBool, urlEncoded))
+    if (GetKeyValue(buffer, "cmVOLTOL", &tempBool, urlEncoded))
     {
         newvalues.RelayTriggerVoltageOverlimit = tempBool;
     }
 
-    if (GetKeyValue(httpbuf, "cmVOLTUL", &tempBool, urlEncoded))
+    if (GetKeyValue(buffer, "cmVOLTUL", &tempBool, urlEncoded))
     {
         newvalues.RelayTriggerVoltageUnderlimit = tempBool;
     }
-    if (GetKeyValue(httpbuf, "cmPOL", &tempBool, urlEncoded))
+    if (GetKeyValue(buffer, "cmPOL", &tempBool, urlEncoded))
     {
         newvalues.RelayTriggerPowerOverLimit = tempBool;
     }
@@ -646,16 +668,16 @@ esp_err_t post_savecmrelay_json_handler(httpd_req_t *req, bool urlEncoded)
 /// @param req 
 /// @param urlEncoded 
 /// @return 
-esp_err_t post_homeassistant_apikey_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_homeassistant_apikey_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
-    char buffer[32];
+    char value[32];
 
     // Compare existing key to stored value, if they match allow generation of new key
-    if (GetTextFromKeyValue(httpbuf, "haAPI", buffer, sizeof(buffer), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "haAPI", value, sizeof(value), urlEncoded))
     {
-        if (strncmp(mysettings.homeassist_apikey, buffer, strlen(mysettings.homeassist_apikey)) != 0)
+        if (strncmp(mysettings.homeassist_apikey, value, strlen(mysettings.homeassist_apikey)) != 0)
         {
-            ESP_LOGE(TAG, "Incorrect ApiKey in form variable %s", buffer);
+            ESP_LOGE(TAG, "Incorrect ApiKey in form variable %s", value);
             return SendFailure(req);
         }
 
@@ -671,9 +693,9 @@ esp_err_t post_homeassistant_apikey_json_handler(httpd_req_t *req, bool urlEncod
     return SendFailure(req);
 }
 
-esp_err_t post_savenetconfig_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savenetconfig_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
-    char buffer[32];
+    char value[32];
 
     uint32_t new_ip = 0;
     uint32_t new_netmask = 0;
@@ -683,37 +705,37 @@ esp_err_t post_savenetconfig_json_handler(httpd_req_t *req, bool urlEncoded)
 
     ip4_addr_t ipadd;
 
-    if (GetTextFromKeyValue(httpbuf, "new_ip", buffer, sizeof(buffer), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "new_ip", value, sizeof(value), urlEncoded))
     {
-        if (ip4addr_aton(buffer, &ipadd))
+        if (ip4addr_aton(value, &ipadd))
         {
             new_ip = ipadd.addr;
         }
     }
-    if (GetTextFromKeyValue(httpbuf, "new_netmask", buffer, sizeof(buffer), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "new_netmask", value, sizeof(value), urlEncoded))
     {
-        if (ip4addr_aton(buffer, &ipadd))
+        if (ip4addr_aton(value, &ipadd))
         {
             new_netmask = ipadd.addr;
         }
     }
-    if (GetTextFromKeyValue(httpbuf, "new_gw", buffer, sizeof(buffer), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "new_gw", value, sizeof(value), urlEncoded))
     {
-        if (ip4addr_aton(buffer, &ipadd))
+        if (ip4addr_aton(value, &ipadd))
         {
             new_gw = ipadd.addr;
         }
     }
-    if (GetTextFromKeyValue(httpbuf, "new_dns1", buffer, sizeof(buffer), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "new_dns1", value, sizeof(value), urlEncoded))
     {
-        if (ip4addr_aton(buffer, &ipadd))
+        if (ip4addr_aton(value, &ipadd))
         {
             new_dns1 = ipadd.addr;
         }
     }
-    if (GetTextFromKeyValue(httpbuf, "new_dns2", buffer, sizeof(buffer), urlEncoded))
+    if (GetTextFromKeyValue(buffer, "new_dns2", value, sizeof(value), urlEncoded))
     {
-        if (ip4addr_aton(buffer, &ipadd))
+        if (ip4addr_aton(value, &ipadd))
         {
             new_dns2 = ipadd.addr;
         }
@@ -755,10 +777,10 @@ esp_err_t post_savenetconfig_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_setsoc_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_setsoc_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     float new_soc = 0;
-    if (GetKeyValue(httpbuf, "setsoc", &new_soc, urlEncoded))
+    if (GetKeyValue(buffer, "setsoc", &new_soc, urlEncoded))
     {
         if (CurrentMonitorSetSOC(new_soc))
         {
@@ -768,10 +790,10 @@ esp_err_t post_setsoc_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendFailure(req);
 }
 
-esp_err_t post_setBattCyclesCount_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_setBattCyclesCount_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     uint32_t cyclesBatt=0;
-    if (GetKeyValue(httpbuf, "setBattCyclesCount", &cyclesBatt, urlEncoded))
+    if (GetKeyValue(buffer, "setBattCyclesCount", &cyclesBatt, urlEncoded))
     {
         mysettings.numberofbatterycycles=cyclesBatt * 1000;
         saveConfiguration();
@@ -780,7 +802,7 @@ esp_err_t post_setBattCyclesCount_json_handler(httpd_req_t *req, bool urlEncoded
     return SendFailure(req);
 }
 
-esp_err_t post_resetdailyahcount_json_handler(httpd_req_t *req, bool)
+esp_err_t post_resetdailyahcount_json_handler(httpd_req_t *req, char *, size_t, bool)
 {
     if (CurrentMonitorResetDailyAmpHourCounters())
     {
@@ -789,29 +811,29 @@ esp_err_t post_resetdailyahcount_json_handler(httpd_req_t *req, bool)
     return SendFailure(req);
 }
 
-esp_err_t post_savecmbasic_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savecmbasic_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     uint16_t shuntmaxcur = 0;
-    if (GetKeyValue(httpbuf, "shuntmaxcur", &shuntmaxcur, urlEncoded))
+    if (GetKeyValue(buffer, "shuntmaxcur", &shuntmaxcur, urlEncoded))
     {
         uint16_t shuntmv = 0;
-        if (GetKeyValue(httpbuf, "shuntmv", &shuntmv, urlEncoded))
+        if (GetKeyValue(buffer, "shuntmv", &shuntmv, urlEncoded))
         {
             //BOTANETA save parameter voltage divider vbus
             float voltage_divider_vbus=1.0f;
-            if(GetKeyValue(httpbuf, "cm_voltage_divider_vbus", &voltage_divider_vbus, urlEncoded))
+            if(GetKeyValue(buffer, "cm_voltage_divider_vbus", &voltage_divider_vbus, urlEncoded))
             {
                 uint16_t batterycapacity = 0;
-                if (GetKeyValue(httpbuf, "cmbatterycapacity", &batterycapacity, urlEncoded))
+                if (GetKeyValue(buffer, "cmbatterycapacity", &batterycapacity, urlEncoded))
                 {
                     float fullchargevolt = 0;
-                    if (GetKeyValue(httpbuf, "cmfullchargevolt", &fullchargevolt, urlEncoded))
+                    if (GetKeyValue(buffer, "cmfullchargevolt", &fullchargevolt, urlEncoded))
                     {
                         float tailcurrent = 0;
-                        if (GetKeyValue(httpbuf, "cmtailcurrent", &tailcurrent, urlEncoded))
+                        if (GetKeyValue(buffer, "cmtailcurrent", &tailcurrent, urlEncoded))
                         {
                             float chargeefficiency = 0;
-                            if (GetKeyValue(httpbuf, "cmchargeefficiency", &chargeefficiency, urlEncoded))
+                            if (GetKeyValue(buffer, "cmchargeefficiency", &chargeefficiency, urlEncoded))
                             {
                                 CurrentMonitorSetBasicSettings(shuntmv, shuntmaxcur, batterycapacity, fullchargevolt, voltage_divider_vbus, tailcurrent, chargeefficiency);
                                 SaveConfiguration(&mysettings);
@@ -827,7 +849,7 @@ esp_err_t post_savecmbasic_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendFailure(req);
 }
 
-esp_err_t post_savecmadvanced_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savecmadvanced_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     currentmonitoring_struct newvalues;
     // Set everything to zero/false
@@ -835,28 +857,28 @@ esp_err_t post_savecmadvanced_json_handler(httpd_req_t *req, bool urlEncoded)
 
     // TODO: We need more validation here to check values are correct and all supplied.
 
-    if (GetKeyValue(httpbuf, "cmcalibration", &newvalues.modbus.shuntcal, urlEncoded))
+    if (GetKeyValue(buffer, "cmcalibration", &newvalues.modbus.shuntcal, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "cmtemplimit", &newvalues.modbus.temperaturelimit, urlEncoded))
+    if (GetKeyValue(buffer, "cmtemplimit", &newvalues.modbus.temperaturelimit, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "cmundervlimit", &newvalues.modbus.undervoltagelimit, urlEncoded))
+    if (GetKeyValue(buffer, "cmundervlimit", &newvalues.modbus.undervoltagelimit, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "cmovervlimit", &newvalues.modbus.overvoltagelimit, urlEncoded))
+    if (GetKeyValue(buffer, "cmovervlimit", &newvalues.modbus.overvoltagelimit, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "cmoverclimit", &newvalues.modbus.overcurrentlimit, urlEncoded))
+    if (GetKeyValue(buffer, "cmoverclimit", &newvalues.modbus.overcurrentlimit, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "cmunderclimit", &newvalues.modbus.undercurrentlimit, urlEncoded))
+    if (GetKeyValue(buffer, "cmunderclimit", &newvalues.modbus.undercurrentlimit, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "cmoverplimit", &newvalues.modbus.overpowerlimit, urlEncoded))
+    if (GetKeyValue(buffer, "cmoverplimit", &newvalues.modbus.overpowerlimit, urlEncoded))
     {
     }
-    if (GetKeyValue(httpbuf, "cmtempcoeff", &newvalues.modbus.shunttempcoefficient, urlEncoded))
+    if (GetKeyValue(buffer, "cmtempcoeff", &newvalues.modbus.shunttempcoefficient, urlEncoded))
     {
     }
 
@@ -865,28 +887,35 @@ esp_err_t post_savecmadvanced_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_avrprog_json_handler(httpd_req_t *req, bool urlEncoded)
+/// @brief Reply to the AVR programming request, the request body in buffer is no longer needed
+static esp_err_t send_avrprog_reply(httpd_req_t *req, char *buffer, size_t bufferLen, bool started, const char *message)
 {
-    uint16_t filenumber;
+    httpd_resp_set_type(req, "application/json");
+    setNoStoreCacheControl(req);
 
-    if (!GetKeyValue(httpbuf, "file", &filenumber, urlEncoded))
+    httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
+    json.beginObject();
+    if (started)
     {
-        return SendFailure(req);
+        json.addUInt("started", 1);
     }
+    json.addString("message", message);
+    json.endObject();
+    return json.finish();
+}
 
-    DynamicJsonDocument doc(512);
+esp_err_t post_avrprog_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
+{
+    uint16_t filenumber;
 
-    int bufferused = 0;
+    if (!GetKeyValue(buffer, "file", &filenumber, urlEncoded))
+    {
+        return SendFailure(req);
+    }
 
     if (!_avrsettings.programmingModeEnabled)
     {
-        httpd_resp_set_type(req, "application/json");
-        setNoStoreCacheControl(req);
-
-        doc["message"] = "Failed: Programming mode not enabled";
-        bufferused += serializeJson(doc, httpbuf, BUFSIZE);
-
-        return httpd_resp_send(req, httpbuf, bufferused);
+        return send_avrprog_reply(req, buffer, bufferLen, false, "Failed: Programming mode not enabled");
     }
 
     auto manifestfilename = String("/avr/manifest.json");
@@ -935,15 +964,8 @@ esp_err_t post_avrprog_json_handler(httpd_req_t *req, bool urlEncoded)
         ESP_LOGI(TAG, "Notify AVR task");
         // Fire task to start the AVR programming
         xTaskNotify(avrprog_task_handle, 0x00, eNotifyAction::eNoAction);
-        httpd_resp_set_type(req, "application/json");
-        setNoStoreCacheControl(req);
-
-        doc["started"] = 1;
-        doc["message"] = "Started";
 
-        bufferused += serializeJson(doc, httpbuf, BUFSIZE);
-
-        return httpd_resp_send(req, httpbuf, bufferused);
+        return send_avrprog_reply(req, buffer, bufferLen, true, "Started");
     }
     else
     {
@@ -954,23 +976,36 @@ esp_err_t post_avrprog_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendFailure(req);
 }
 
-esp_err_t post_savecurrentmon_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_savecurrentmon_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     mysettings.currentMonitoringEnabled = false;
-    if (GetKeyValue(httpbuf, "CurrentMonEnabled", &mysettings.currentMonitoringEnabled, urlEncoded))
+    if (GetKeyValue(buffer, "CurrentMonEnabled", &mysettings.currentMonitoringEnabled, urlEncoded))
     {
     }
 
-    if (GetKeyValue(httpbuf, "modbusAddress", &mysettings.currentMonitoringModBusAddress, urlEncoded))
+    if (GetKeyValue(buffer, "modbusAddress", &mysettings.currentMonitoringModBusAddress, urlEncoded))
     {
     }
 
     uint8_t CurrentMonDev;
-    if (GetKeyValue(httpbuf, "CurrentMonDev", &CurrentMonDev, urlEncoded))
+    if (GetKeyValue(buffer, "CurrentMonDev", &CurrentMonDev, urlEncoded))
     {
         mysettings.currentMonitoringDevice = (CurrentMonitorDevice)CurrentMonDev;
     }
 
+    // Additional monitors are numbered from 2, the main monitor is 1
+    char keyBuffer[16];
+    for (uint8_t i = 0; i < CURRENTMON_MAXIMUM - 1; i++)
+    {
+        snprintf(keyBuffer, sizeof(keyBuffer), "cm%udev", i + 2);
+        if (GetKeyValue(buffer, keyBuffer, &CurrentMonDev, urlEncoded))
+        {
+            mysettings.currentMonitoring_additional[i].device = (CurrentMonitorDevice)CurrentMonDev;
+        }
+        snprintf(keyBuffer, sizeof(keyBuffer), "cm%uaddr", i + 2);
+        GetKeyValue(buffer, keyBuffer, &mysettings.currentMonitoring_additional[i].address, urlEncoded);
+    }
+
     if (mysettings.currentMonitoringEnabled == false)
     {
         // Switch off current monitor, clear out the values
@@ -980,11 +1015,13 @@ esp_err_t post_savecurrentmon_json_handler(httpd_req_t *req, bool urlEncoded)
         mysettings.currentMonitoringModBusAddress = 90;
     }
 
+    ValidateConfiguration(&mysettings);
     saveConfiguration();
+    currentmon_configure(&mysettings);
 
     return SendSuccess(req);
 }
-esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_saverules_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     char textBuffer[32];
 
@@ -995,7 +1032,7 @@ esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded)
     {
         snprintf(keyBuffer, sizeof(keyBuffer), "relaytype%i", (i + 1));
 
-        if (GetTextFromKeyValue(httpbuf, keyBuffer, textBuffer, sizeof(textBuffer), urlEncoded))
+        if (GetTextFromKeyValue(buffer, keyBuffer, textBuffer, sizeof(textBuffer), urlEncoded))
         {
             ESP_LOGD(TAG, "%s=%s", keyBuffer, textBuffer);
 
@@ -1024,7 +1061,7 @@ esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded)
     {
         snprintf(keyBuffer, sizeof(keyBuffer), "defaultrelay%i", (i + 1));
 
-        if (GetTextFromKeyValue(httpbuf, keyBuffer, textBuffer, sizeof(textBuffer), urlEncoded))
+        if (GetTextFromKeyValue(buffer, keyBuffer, textBuffer, sizeof(textBuffer), urlEncoded))
         {
             ESP_LOGD(TAG, "%s=%s", keyBuffer, textBuffer);
 
@@ -1042,7 +1079,7 @@ esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded)
         snprintf(keyBuffer, sizeof(keyBuffer), "rule%ivalue", rule);
 
         int32_t tempint32;
-        if (GetKeyValue(httpbuf, keyBuffer, &tempint32, urlEncoded))
+        if (GetKeyValue(buffer, keyBuffer, &tempint32, urlEncoded))
         {
             ESP_LOGD(TAG, "%s=%u", keyBuffer, tempint32);
 
@@ -1050,7 +1087,7 @@ esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded)
         }
 
         snprintf(keyBuffer, sizeof(keyBuffer), "rule%ihyst", rule);
-        if (GetKeyValue(httpbuf, keyBuffer, &tempint32, urlEncoded))
+        if (GetKeyValue(buffer, keyBuffer, &tempint32, urlEncoded))
         {
             ESP_LOGD(TAG, "%s=%u", keyBuffer, tempint32);
 
@@ -1062,7 +1099,7 @@ esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded)
         {
             snprintf(keyBuffer, sizeof(keyBuffer), "rule%irelay%i", rule, (i + 1));
 
-            if (GetTextFromKeyValue(httpbuf, keyBuffer, textBuffer, sizeof(textBuffer), urlEncoded))
+            if (GetTextFromKeyValue(buffer, keyBuffer, textBuffer, sizeof(textBuffer), urlEncoded))
             {
                 ESP_LOGD(TAG, "%s=%s", keyBuffer, textBuffer);
                 mysettings.rulerelaystate[rule][i] = strcmp(textBuffer, "X") == 0 ? RELAY_X : strcmp(textBuffer, "On") == 0 ? RelayState::RELAY_ON
@@ -1079,7 +1116,7 @@ esp_err_t post_saverules_json_handler(httpd_req_t *req, bool urlEncoded)
     return SendSuccess(req);
 }
 
-esp_err_t post_restoreconfig_json_handler(httpd_req_t *req, bool urlEncoded)
+esp_err_t post_restoreconfig_json_handler(httpd_req_t *req, char *buffer, size_t bufferLen, bool urlEncoded)
 {
     bool success = false;
 
@@ -1092,14 +1129,14 @@ esp_err_t post_restoreconfig_json_handler(httpd_req_t *req, bool urlEncoded)
     // Prepend "/"
     strcpy(filename, "/");
 
-    if (!GetTextFromKeyValue(httpbuf, "filename", &filename[1], sizeof(filename) - 1, urlEncoded))
+    if (!GetTextFromKeyValue(buffer, "filename", &filename[1], sizeof(filename) - 1, urlEncoded))
     {
         ESP_LOGE(TAG, "Unable to decode filename");
         return SendFailure(req);
     }
 
     uint16_t flashram = 0;
-    if (GetKeyValue(httpbuf, "flashram", &flashram, urlEncoded))
+    if (GetKeyValue(buffer, "flashram", &flashram, urlEncoded))
     {
     }
 
@@ -1210,7 +1247,13 @@ esp_err_t save_data_handler(httpd_req_t *req)
 {
     // ESP_LOGI(TAG, "JSON call");
 
-    if (!getPostDataIntoBuffer(req))
+    http_buffer buffer;
+    if (!buffer)
+    {
+        return http_buffer_send_busy(req);
+    }
+
+    if (!getPostDataIntoBuffer(req, buffer.data(), buffer.size()))
     {
         // Fail...
         return httpd_resp_send_500(req);
@@ -1219,7 +1262,7 @@ esp_err_t save_data_handler(httpd_req_t *req)
     bool urlEncoded = HasURLEncodedHeader(req);
 
     // Need to validate POST variable XSS....
-    if (!validateXSSWithPOST(req, httpbuf, urlEncoded))
+    if (!validateXSSWithPOST(req, buffer.data(), urlEncoded))
     {
         return ESP_FAIL;
     }
@@ -1237,7 +1280,7 @@ esp_err_t save_data_handler(httpd_req_t *req)
         "visibletiles", "dailyahreset", "setsoc",
         "savenetconfig", "newhaapikey", "setBattCyclesCount"};
 
-    std::array<std::function<esp_err_t(httpd_req_t * req, bool urlEncoded)>, 31> func_ptr = {
+    std::array<std::function<esp_err_t(httpd_req_t * req, char *buffer, size_t bufferLen, bool urlEncoded)>, 31> func_ptr = {
         post_savebankconfig_json_handler, post_saventp_json_handler, post_saveglobalsetting_json_handler,
         post_savemqtt_json_handler, post_saveinfluxdbsetting_json_handler,
         post_saveconfigurationtoflash_json_handler, post_savewificonfigtosdcard_json_handler,
@@ -1264,7 +1307,7 @@ esp_err_t save_data_handler(httpd_req_t *req)
         {
             // Found it
             ESP_LOGI(TAG, "API post: %s", name.c_str());
-            return func_ptr.at(i)(req, urlEncoded);
+            return func_ptr.at(i)(req, buffer.data(), buffer.size(), urlEncoded);
         }
     }
 
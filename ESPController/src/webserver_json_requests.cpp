@@ -4,56 +4,62 @@ static constexpr const char *const TAG = "diybms-webreq";
 #include "webserver.h"
 #include "webserver_helper_funcs.h"
 #include "webserver_json_requests.h"
+#include "webserver_buffer_pool.h"
+#include "current_monitors.h"
 #include <esp_netif.h>
 #include <esp_wifi.h>
+#include <esp_system.h>
 extern "C"
 {
 #include "esp_core_dump.h"
 }
 
-esp_err_t content_handler_avrstorage(httpd_req_t *req)
+esp_err_t content_handler_avrstorage(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
   // See if we can open and process the AVR PROGRAMMER manifest file
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "{");
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "ProgModeEnabled", _avrsettings.programmingModeEnabled);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "InProgress", _avrsettings.inProgress);
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"avrprog\":");
+  json.beginObject();
+  json.addBool("ProgModeEnabled", _avrsettings.programmingModeEnabled);
+  json.addBool("InProgress", _avrsettings.inProgress);
 
   auto manifest = String("/avr/manifest.json");
+  File file;
   if (LittleFS.exists(manifest))
   {
-    // Use Dynamic to avoid head issues
-    DynamicJsonDocument doc(3000);
-    File file = LittleFS.open(manifest);
-    DeserializationError error = deserializeJson(doc, file);
-    if (error)
-    {
-      ESP_LOGE(TAG, "Error deserialize Json");
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "{}");
-    }
-    else
+    file = LittleFS.open(manifest);
+  }
+
+  if (file && file.size() > 0)
+  {
+    // Manifest is already JSON, so stream it straight out
+    json.addRaw("avrprog", "", 0);
+    char chunk[128];
+    size_t bytesRead;
+    while ((bytesRead = file.read((uint8_t *)chunk, sizeof(chunk))) > 0)
     {
-      bufferused += serializeJson(doc, &httpbuf[bufferused], BUFSIZE - bufferused);
+      json.appendRaw(chunk, bytesRead);
     }
-    file.close();
   }
   else
   {
     // No files!
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "{}");
+    json.addRaw("avrprog", "{}", 2);
   }
 
-  // The END...
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "}");
+  if (file)
+  {
+    file.close();
+  }
 
-  return httpd_resp_send(req, httpbuf, bufferused);
+  // The END...
+  json.endObject();
+  return json.finish();
 }
 
-esp_err_t content_handler_currentmonitor(httpd_req_t *req)
+esp_err_t content_handler_currentmonitor(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
   // Convert to milliseconds
   uint32_t timestampage = 0;
@@ -62,101 +68,143 @@ esp_err_t content_handler_currentmonitor(httpd_req_t *req)
     timestampage = (uint32_t)((esp_timer_get_time() - currentMonitor.timestamp) / 1000);
   }
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "{");
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "enabled", mysettings.currentMonitoringEnabled);
-
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,                    //--BOTANETA tag--
-                         R"("address":%u,"devicetype":%u,"timestampage":%u,"valid":%s,"voltage_divider_vbus":%.4f,"batterycapacity":%u,"tailcurrent":%.4f,"fullchargevolt":%.4f,"chargeefficiency":%.4f,)",
-                         mysettings.currentMonitoringModBusAddress,
-                         mysettings.currentMonitoringDevice,
-                         timestampage,
-                         currentMonitor.validReadings ? "true" : "false",
-                         mysettings.currentMonitoring_voltage_divider_vbus, //BOTANETA parameter
-                         currentMonitor.modbus.batterycapacityamphour, 
-                         currentMonitor.modbus.tailcurrentamps,
-                         currentMonitor.modbus.fullychargedvoltage, 
-                         currentMonitor.chargeefficiency);
-
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                         R"("voltage":%.4f,"current":%.4f,"mahout":%u,"mahin":%u,"temperature":%i,"watchdog":%u,"power":%.4f,"resistance":%.4f,"calibration":%u,"templimit":%i,"undervlimit":%.4f,"overvlimit":%.4f,"overclimit":%.4f,"underclimit":%.4f,"overplimit":%.4f,"tempcoeff":%u,"model":%u,"firmwarev":%u,"firmwaredate":%u,)",
-                         currentMonitor.modbus.voltage, currentMonitor.modbus.current, currentMonitor.modbus.milliamphour_out, currentMonitor.modbus.milliamphour_in,
-                         currentMonitor.modbus.temperature, currentMonitor.modbus.watchdogcounter, currentMonitor.modbus.power,
-                         currentMonitor.modbus.shuntresistance,
-                         currentMonitor.modbus.shuntcal, currentMonitor.modbus.temperaturelimit,
-                         currentMonitor.modbus.undervoltagelimit, currentMonitor.modbus.overvoltagelimit,
-                         currentMonitor.modbus.overcurrentlimit, currentMonitor.modbus.undercurrentlimit,
-                         currentMonitor.modbus.overpowerlimit, currentMonitor.modbus.shunttempcoefficient,
-                         currentMonitor.modbus.modelnumber, currentMonitor.modbus.firmwareversion,
-                         currentMonitor.modbus.firmwaredatetime);
+  json.beginObject();
+  json.addBool("enabled", mysettings.currentMonitoringEnabled);
+
+  //--BOTANETA tag--
+  json.addUInt("address", mysettings.currentMonitoringModBusAddress);
+  json.addUInt("devicetype", mysettings.currentMonitoringDevice);
+  json.addUInt("timestampage", timestampage);
+  json.addBool("valid", currentMonitor.validReadings);
+  json.addFloat("voltage_divider_vbus", mysettings.currentMonitoring_voltage_divider_vbus); // BOTANETA parameter
+  json.addUInt("batterycapacity", currentMonitor.modbus.batterycapacityamphour);
+  json.addFloat("tailcurrent", currentMonitor.modbus.tailcurrentamps);
+  json.addFloat("fullchargevolt", currentMonitor.modbus.fullychargedvoltage);
+  json.addFloat("chargeefficiency", currentMonitor.chargeefficiency);
+
+  json.addFloat("voltage", currentMonitor.modbus.voltage);
+  json.addFloat("current", currentMonitor.modbus.current);
+  // Lifetime totals for the internal monitor, setting or calibrating the SOC doesn't reset them
+  json.addUInt("mahout", currentMonitor.modbus.milliamphour_out);
+  json.addUInt("mahin", currentMonitor.modbus.milliamphour_in);
+  json.addInt("temperature", currentMonitor.modbus.temperature);
+  json.addUInt("watchdog", currentMonitor.modbus.watchdogcounter);
+  json.addFloat("power", currentMonitor.modbus.power);
+  json.addFloat("resistance", currentMonitor.modbus.shuntresistance);
+  json.addUInt("calibration", currentMonitor.modbus.shuntcal);
+  json.addInt("templimit", currentMonitor.modbus.temperaturelimit);
+  json.addFloat("undervlimit", currentMonitor.modbus.undervoltagelimit);
+  json.addFloat("overvlimit", currentMonitor.modbus.overvoltagelimit);
+  json.addFloat("overclimit", currentMonitor.modbus.overcurrentlimit);
+  json.addFloat("underclimit", currentMonitor.modbus.undercurrentlimit);
+  json.addFloat("overplimit", currentMonitor.modbus.overpowerlimit);
+  json.addUInt("tempcoeff", currentMonitor.modbus.shunttempcoefficient);
+  json.addUInt("model", currentMonitor.modbus.modelnumber);
+  json.addUInt("firmwarev", currentMonitor.modbus.firmwareversion);
+  json.addUInt("firmwaredate", currentMonitor.modbus.firmwaredatetime);
 
   // Boolean flag values
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "TMPOL", currentMonitor.TemperatureOverLimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "CURROL", currentMonitor.CurrentOverLimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "CURRUL", currentMonitor.CurrentUnderLimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "VOLTOL", currentMonitor.VoltageOverlimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "VOLTUL", currentMonitor.VoltageUnderlimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "POL", currentMonitor.PowerOverLimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "TempCompEnabled", currentMonitor.TempCompEnabled);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "ADCRange4096mV", currentMonitor.ADCRange4096mV);
+  json.addBool("TMPOL", currentMonitor.TemperatureOverLimit);
+  json.addBool("CURROL", currentMonitor.CurrentOverLimit);
+  json.addBool("CURRUL", currentMonitor.CurrentUnderLimit);
+  json.addBool("VOLTOL", currentMonitor.VoltageOverlimit);
+  json.addBool("VOLTUL", currentMonitor.VoltageUnderlimit);
+  json.addBool("POL", currentMonitor.PowerOverLimit);
+  json.addBool("TempCompEnabled", currentMonitor.TempCompEnabled);
+  json.addBool("ADCRange4096mV", currentMonitor.ADCRange4096mV);
 
   // Trigger values
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "T_TMPOL", currentMonitor.RelayTriggerTemperatureOverLimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "T_CURROL", currentMonitor.RelayTriggerCurrentOverLimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "T_CURRUL", currentMonitor.RelayTriggerCurrentUnderLimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "T_VOLTOL", currentMonitor.RelayTriggerVoltageOverlimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "T_VOLTUL", currentMonitor.RelayTriggerVoltageUnderlimit);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "T_POL", currentMonitor.RelayTriggerPowerOverLimit);
+  json.addBool("T_TMPOL", currentMonitor.RelayTriggerTemperatureOverLimit);
+  json.addBool("T_CURROL", currentMonitor.RelayTriggerCurrentOverLimit);
+  json.addBool("T_CURRUL", currentMonitor.RelayTriggerCurrentUnderLimit);
+  json.addBool("T_VOLTOL", currentMonitor.RelayTriggerVoltageOverlimit);
+  json.addBool("T_VOLTUL", currentMonitor.RelayTriggerVoltageUnderlimit);
+  json.addBool("T_POL", currentMonitor.RelayTriggerPowerOverLimit);
 
   if (mysettings.currentMonitoringDevice == CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS)
   {
-    bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "RelayState", currentMonitor.RelayState);
+    json.addBool("RelayState", currentMonitor.RelayState);
   }
   else
   {
     // Relay doesn't exist
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"("RelayState":null,)");
+    json.addNull("RelayState");
   }
 
   // Onboard INA229 current monitor chip
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "OnboardCM", currentmon_internal.Available());
+  json.addBool("OnboardCM", currentmon_internal.Available());
+
+  json.addUInt("shuntmv", currentMonitor.modbus.shuntmillivolt);
+  json.addUInt("shuntmaxcur", currentMonitor.modbus.shuntmaxcurrent);
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                         R"("shuntmv":%u,"shuntmaxcur":%u})",
-                         currentMonitor.modbus.shuntmillivolt, currentMonitor.modbus.shuntmaxcurrent);
+  // Additional monitors (numbered 2 onwards)
+  json.beginArray("additional");
+  for (uint8_t i = 0; i < CURRENTMON_MAXIMUM - 1; i++)
+  {
+    json.beginObject();
+    json.addUInt("devicetype", mysettings.currentMonitoring_additional[i].device);
+    json.addUInt("address", mysettings.currentMonitoring_additional[i].address);
+    json.endObject();
+  }
+  json.endArray();
 
-  return httpd_resp_send(req, httpbuf, bufferused);
+  // Readings of each monitor, the values above are the combination of these
+  currentmon_instance_stats monitors[CURRENTMON_MAXIMUM];
+  uint8_t monitor_count = currentmon_get_stats(monitors, CURRENTMON_MAXIMUM, esp_timer_get_time());
+  json.beginArray("monitors");
+  for (uint8_t i = 0; i < monitor_count; i++)
+  {
+    json.beginObject();
+    json.addUInt("devicetype", monitors[i].device);
+    json.addUInt("address", monitors[i].address);
+    json.addBool("valid", monitors[i].valid);
+    json.addBool("stale", monitors[i].stale);
+    json.addFloat("voltage", monitors[i].voltage);
+    json.addFloat("current", monitors[i].current);
+    json.addFloat("power", monitors[i].power);
+    json.addFloat("soc", monitors[i].stateofcharge);
+    json.addUInt("intervalms", monitors[i].interval_ms);
+    json.addUInt("agems", monitors[i].age_ms);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+
+  return json.finish();
 }
 
-esp_err_t content_handler_rs485settings(httpd_req_t *req)
+esp_err_t content_handler_rs485settings(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
-  // Output the first batch of settings/parameters/values
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE,
-                         R"({"baudrate":%i,"databits":%i,"parity":%i,"stopbits":%i})",
-                         mysettings.rs485baudrate, mysettings.rs485databits,
-                         mysettings.rs485parity, mysettings.rs485stopbits);
+  json.beginObject();
+  json.addInt("baudrate", mysettings.rs485baudrate);
+  json.addInt("databits", mysettings.rs485databits);
+  json.addInt("parity", mysettings.rs485parity);
+  json.addInt("stopbits", mysettings.rs485stopbits);
+  json.endObject();
 
-  return httpd_resp_send(req, httpbuf, bufferused);
+  return json.finish();
 }
 
-int fileSystemListDirectory(httpd_req_t *r, char *buffer, size_t bufferLen, fs::FS &fs, const char *dirname, uint8_t)
+/// @brief Output the names of the files in a folder as JSON string array values
+/// @param json Writer, which must be inside an array
+/// @param fs File system
+/// @param dirname Folder to list
+void fileSystemListDirectory(httpd_json_writer &json, fs::FS &fs, const char *dirname)
 {
-  // This needs to check for buffer overrun as too many files are likely to exceed the buffer capacity
-  int bufferused = 0;
   File root = fs.open(dirname);
   if (!root)
   {
     ESP_LOGE(TAG, "Failed to open dir");
-    return 0;
+    return;
   }
   if (!root.isDirectory())
   {
     ESP_LOGE(TAG, "Not a dir");
-    return 0;
+    return;
   }
 
-  uint32_t filecounter = 0;
   File file = root.openNextFile();
   while (file)
   {
@@ -166,39 +214,26 @@ int fileSystemListDirectory(httpd_req_t *r, char *buffer, size_t bufferLen, fs::
     }
     else
     {
-      bufferused += snprintf(&buffer[bufferused], bufferLen - bufferused, "\"%s\",", file.name());
-      filecounter++;
+      json.addString(file.name());
     }
 
     file = root.openNextFile();
-
-    if (filecounter > 50)
-    {
-      // Flush http buffer every X files to prevent overflows
-      httpd_resp_send_chunk(r, buffer, bufferused);
-      bufferused = 0;
-    }
   }
-
-  // Trailing null to cope with trailing ','
-  bufferused += snprintf(&buffer[bufferused], bufferLen - bufferused, "null");
-
-  return bufferused;
 }
 
-esp_err_t content_handler_diagnostic(httpd_req_t *req)
+esp_err_t content_handler_diagnostic(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  return diagnosticJSON(req, httpbuf, BUFSIZE);
+  return diagnosticJSON(req, buffer, bufferLen);
 }
 
-esp_err_t content_handler_history(httpd_req_t *req)
+esp_err_t content_handler_history(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  return history.GenerateJSON(req, httpbuf, BUFSIZE);
+  return history.GenerateJSON(req, buffer, bufferLen);
 }
 
-esp_err_t content_handler_storage(httpd_req_t *req)
+esp_err_t content_handler_storage(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
   bool available;
   uint32_t totalkilobytes;
@@ -232,44 +267,43 @@ esp_err_t content_handler_storage(httpd_req_t *req)
   flash_totalkilobytes = (uint32_t)(LittleFS.totalBytes() / 1024);
   flash_usedkilobytes = (uint32_t)(LittleFS.usedBytes() / 1024);
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"({"storage":{)");
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "logging", mysettings.loggingEnabled);
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"("frequency":%u,"sdcard":{)", mysettings.loggingFrequencySeconds);
-  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "available", available);
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"("total":%u,"used":%u,"files":[)", totalkilobytes, usedkilobytes);
-
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-  bufferused = 0;
+  json.beginObject();
+  json.beginObject("storage");
+  json.addBool("logging", mysettings.loggingEnabled);
+  json.addUInt("frequency", mysettings.loggingFrequencySeconds);
 
+  json.beginObject("sdcard");
+  json.addBool("available", available);
+  json.addUInt("total", totalkilobytes);
+  json.addUInt("used", usedkilobytes);
+  json.beginArray("files");
   // File listing goes here
   if (available)
   {
     if (hal.GetVSPIMutex())
     {
-      bufferused += fileSystemListDirectory(req, &httpbuf[bufferused], BUFSIZE - bufferused, SD, "/", 2);
+      fileSystemListDirectory(json, SD, "/");
       hal.ReleaseVSPIMutex();
     }
   }
+  json.endArray();
+  json.endObject();
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"(]},"flash":{)");
+  json.beginObject("flash");
+  json.addUInt("total", flash_totalkilobytes);
+  json.addUInt("used", flash_usedkilobytes);
+  json.beginArray("files");
+  fileSystemListDirectory(json, LittleFS, "/");
+  json.endArray();
+  json.endObject();
 
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  json.endObject();
+  json.endObject();
 
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"("total":%u,"used":%u,"files":[)", flash_totalkilobytes, flash_usedkilobytes);
-  bufferused += fileSystemListDirectory(req, &httpbuf[bufferused], BUFSIZE - bufferused, LittleFS, "/", 0);
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "]}}}");
-
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-
-  // Indicate last chunk (zero byte length)
-  return httpd_resp_send_chunk(req, httpbuf, 0);
+  return json.finish();
 }
 
-esp_err_t SendFileInChunks(httpd_req_t *req, FS &filesystem, const char *filename)
+esp_err_t SendFileInChunks(httpd_req_t *req, FS &filesystem, const char *filename, char *buffer, size_t bufferLen)
 {
   if (filesystem.exists(filename))
   {
@@ -293,13 +327,13 @@ esp_err_t SendFileInChunks(httpd_req_t *req, FS &filesystem, const char *filenam
     size_t bytesRead = 0;
     do
     {
-      bytesRead = f.read((uint8_t *)httpbuf, BUFSIZE);
+      bytesRead = f.read((uint8_t *)buffer, bufferLen);
       if (bytesRead > 0)
       {
         ESP_LOGD(TAG, "Stream chunk %i", bytesRead);
-        ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_send_chunk(req, httpbuf, bytesRead));
+        ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_send_chunk(req, buffer, bytesRead));
       }
-    } while (bytesRead == BUFSIZE);
+    } while (bytesRead == bufferLen);
     f.close();
 
     free(httpheader);
@@ -321,6 +355,12 @@ esp_err_t content_handler_coredumpdownloadfile(httpd_req_t *req)
 
   ESP_LOGI(TAG, "Download coredump");
 
+  http_buffer buffer;
+  if (!buffer)
+  {
+    return http_buffer_send_busy(req);
+  }
+
   size_t size = 0;
   size_t address = 0;
   if (esp_core_dump_image_get(&address, &size) == ESP_OK)
@@ -341,21 +381,21 @@ esp_err_t content_handler_coredumpdownloadfile(httpd_req_t *req)
       {
         toRead = (size - i * 256) > 256 ? 256 : (size - i * 256);
 
-        esp_err_t er = esp_partition_read(pt, i * 256, httpbuf, toRead);
+        esp_err_t er = esp_partition_read(pt, i * 256, buffer.data(), toRead);
         if (er != ESP_OK)
         {
           ESP_LOGE(TAG, "Coredump download Fail [%x]\n", er);
           break;
         }
 
-        ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_send_chunk(req, httpbuf, 256));
+        ESP_ERROR_CHECK_WITHOUT_ABORT(httpd_resp_send_chunk(req, buffer.data(), 256));
       }
 
       // After download, erase the core dump from flash
       ESP_ERROR_CHECK_WITHOUT_ABORT(esp_core_dump_image_erase());
 
       // Indicate last chunk (zero byte length)
-      return httpd_resp_send_chunk(req, httpbuf, 0);
+      return httpd_resp_send_chunk(req, nullptr, 0);
     }
   }
 
@@ -417,6 +457,12 @@ esp_err_t content_handler_downloadfile(httpd_req_t *req)
 
     ESP_LOGI(TAG, "Download %s from %s", file, type);
 
+    http_buffer buffer;
+    if (!buffer)
+    {
+      return http_buffer_send_busy(req);
+    }
+
     if ((strncmp(type, "sdcard", sizeof(type)) == 0) && _sd_card_installed)
     {
       // Process file from SD card
@@ -424,21 +470,21 @@ esp_err_t content_handler_downloadfile(httpd_req_t *req)
       {
         // Get the file
         // ESP_LOGI(TAG, "Download SDCard file");
-        esp_err_t result = SendFileInChunks(req, SD, file);
+        esp_err_t result = SendFileInChunks(req, SD, file, buffer.data(), buffer.size());
         ESP_LOGD(TAG, "Result %i", result);
         hal.ReleaseVSPIMutex();
         // Indicate last chunk (zero byte length)
-        return httpd_resp_send_chunk(req, httpbuf, 0);
+        return httpd_resp_send_chunk(req, nullptr, 0);
       }
     }
     else if ((strncmp(type, "flash", sizeof(type)) == 0))
     {
       // Process file from flash storage
       // ESP_LOGI(TAG, "Download FLASH file");
-      esp_err_t result = SendFileInChunks(req, LittleFS, file);
+      esp_err_t result = SendFileInChunks(req, LittleFS, file, buffer.data(), buffer.size());
       ESP_LOGD(TAG, "Result %i", result);
       // Indicate last chunk (zero byte length)
-      return httpd_resp_send_chunk(req, httpbuf, 0);
+      return httpd_resp_send_chunk(req, nullptr, 0);
     }
     else
     {
@@ -449,7 +495,7 @@ esp_err_t content_handler_downloadfile(httpd_req_t *req)
   return httpd_resp_send_err(req, httpd_err_code_t::HTTPD_400_BAD_REQUEST, "Bad request");
 }
 
-esp_err_t content_handler_identifymodule(httpd_req_t *req)
+esp_err_t content_handler_identifymodule(httpd_req_t *req, char *, size_t)
 {
   uint8_t c;
   bool valid = false;
@@ -488,7 +534,7 @@ esp_err_t content_handler_identifymodule(httpd_req_t *req)
   return httpd_resp_send_500(req);
 }
 
-esp_err_t content_handler_modules(httpd_req_t *req)
+esp_err_t content_handler_modules(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
   uint8_t c;
   bool valid = false;
@@ -527,238 +573,236 @@ esp_err_t content_handler_modules(httpd_req_t *req)
     prg.sendGetSettingsRequest(c);
   }
 
-  DynamicJsonDocument doc(2048);
-  JsonObject root = doc.to<JsonObject>();
-  JsonObject settings = root.createNestedObject("settings");
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
+
+  json.beginObject();
+  json.beginObject("settings");
 
   uint8_t b = c / mysettings.totalNumberOfSeriesModules;
   uint8_t m = c - (b * mysettings.totalNumberOfSeriesModules);
-  settings["bank"] = b;
-  settings["module"] = m;
-  settings["id"] = c;
-  settings["ver"] = cmi[c].BoardVersionNumber;
-  settings["code"] = cmi[c].CodeVersionNumber;
-  settings["Cached"] = cmi[c].settingsCached;
+  json.addUInt("bank", b);
+  json.addUInt("module", m);
+  json.addUInt("id", c);
+  json.addUInt("ver", cmi[c].BoardVersionNumber);
+  json.addUInt("code", cmi[c].CodeVersionNumber);
+  json.addBool("Cached", cmi[c].settingsCached);
 
   if (cmi[c].settingsCached)
   {
-    settings["BypassOverTempShutdown"] = cmi[c].BypassOverTempShutdown;
-    settings["BypassThresholdmV"] = cmi[c].BypassThresholdmV;
-    settings["LoadRes"] = cmi[c].LoadResistance;
-    settings["Calib"] = cmi[c].Calibration;
-    settings["mVPerADC"] = cmi[c].mVPerADC;
-    settings["IntBCoef"] = cmi[c].Internal_BCoefficient;
-    settings["ExtBCoef"] = cmi[c].External_BCoefficient;
-    settings["Prohibited"] = cmi[c].ChangesProhibited;
-    settings["FanSwitchOnT"] = cmi[c].FanSwitchOnTemperature;
-    settings["RelayMinV"] = cmi[c].RelayMinmV;
-    settings["RelayRange"] = cmi[c].RelayRangemV;
-    settings["Parasite"] = cmi[c].ParasiteVoltagemV;
-    settings["RunAwayMinmV"] = cmi[c].RunAwayCellMinimumVoltagemV;
-    settings["RunAwayDiffmV"] = cmi[c].RunAwayCellDifferentialmV;
-  }
-
-  int bufferused = 0;
-  bufferused += serializeJson(doc, httpbuf, BUFSIZE);
-  return httpd_resp_send(req, httpbuf, bufferused);
+    json.addUInt("BypassOverTempShutdown", cmi[c].BypassOverTempShutdown);
+    json.addUInt("BypassThresholdmV", cmi[c].BypassThresholdmV);
+    json.addFloat("LoadRes", cmi[c].LoadResistance);
+    json.addFloat("Calib", cmi[c].Calibration, 6);
+    json.addFloat("mVPerADC", cmi[c].mVPerADC);
+    json.addUInt("IntBCoef", cmi[c].Internal_BCoefficient);
+    json.addUInt("ExtBCoef", cmi[c].External_BCoefficient);
+    json.addBool("Prohibited", cmi[c].ChangesProhibited);
+    json.addInt("FanSwitchOnT", cmi[c].FanSwitchOnTemperature);
+    json.addUInt("RelayMinV", cmi[c].RelayMinmV);
+    json.addUInt("RelayRange", cmi[c].RelayRangemV);
+    json.addUInt("Parasite", cmi[c].ParasiteVoltagemV);
+    json.addUInt("RunAwayMinmV", cmi[c].RunAwayCellMinimumVoltagemV);
+    json.addUInt("RunAwayDiffmV", cmi[c].RunAwayCellDifferentialmV);
+  }
+
+  json.endObject();
+  json.endObject();
+  return json.finish();
 }
 
-esp_err_t content_handler_avrstatus(httpd_req_t *req)
+esp_err_t content_handler_avrstatus(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
-  StaticJsonDocument<200> doc;
-  doc["inprogress"] = _avrsettings.inProgress ? 1 : 0;
-  doc["result"] = _avrsettings.progresult;
-  doc["duration"] = _avrsettings.duration;
-  doc["size"] = _avrsettings.programsize;
-  doc["mcu"] = _avrsettings.mcu;
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
-  bufferused += serializeJson(doc, httpbuf, BUFSIZE);
+  json.beginObject();
+  json.addUInt("inprogress", _avrsettings.inProgress ? 1 : 0);
+  json.addUInt("result", _avrsettings.progresult);
+  json.addUInt("duration", _avrsettings.duration);
+  json.addUInt("size", _avrsettings.programsize);
+  json.addUInt("mcu", _avrsettings.mcu);
+  json.endObject();
 
-  return httpd_resp_send(req, httpbuf, bufferused);
+  return json.finish();
 }
 
-esp_err_t content_handler_tileconfig(httpd_req_t *req)
+esp_err_t content_handler_tileconfig(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  StaticJsonDocument<200> doc;
-  JsonObject root = doc.to<JsonObject>();
-  JsonObject settings = root.createNestedObject("tileconfig");
-  JsonArray v = settings.createNestedArray("values");
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
+
+  json.beginObject();
+  json.beginObject("tileconfig");
+  json.beginArray("values");
 
   for (auto n : mysettings.tileconfig)
   {
-    v.add(n);
+    json.addUInt(n);
   }
 
-  int bufferused = serializeJson(doc, httpbuf, BUFSIZE);
-  return httpd_resp_send(req, httpbuf, bufferused);
+  json.endArray();
+  json.endObject();
+  json.endObject();
+  return json.finish();
 }
 
-esp_err_t content_handler_chargeconfig(httpd_req_t *req)
+esp_err_t content_handler_chargeconfig(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
-
-  DynamicJsonDocument doc(2048);
-  JsonObject root = doc.to<JsonObject>();
-  JsonObject settings = root.createNestedObject("chargeconfig");
-
-  settings["canbusprotocol"] = mysettings.canbusprotocol;
-  settings["canbusinverter"] = mysettings.canbusinverter;
-  settings["canbusbaud"] = mysettings.canbusbaud;
-  settings["equip_addr"] = mysettings.canbus_equipment_addr;
-  settings["nominalbatcap"] = mysettings.nominalbatcap;
-  settings["chargevolt"] = mysettings.chargevolt;
-  settings["chargecurrent"] = mysettings.chargecurrent;
-  settings["dischargecurrent"] = mysettings.dischargecurrent;
-  settings["dischargevolt"] = mysettings.dischargevolt;
-  settings["chargetemplow"] = mysettings.chargetemplow;
-  settings["chargetemphigh"] = mysettings.chargetemphigh;
-  settings["dischargetemplow"] = mysettings.dischargetemplow;
-  settings["dischargetemphigh"] = mysettings.dischargetemphigh;
-  settings["stopchargebalance"] = mysettings.stopchargebalance;
-  settings["socoverride"] = mysettings.socoverride;
-  settings["socforcelow"] = mysettings.socforcelow;
-  settings["dynamiccharge"] = mysettings.dynamiccharge;
-  settings["preventdischarge"] = mysettings.preventdischarge;
-  settings["preventcharging"] = mysettings.preventcharging;
-  settings["cellminmv"] = mysettings.cellminmv;
-  settings["cellmaxmv"] = mysettings.cellmaxmv;
-  settings["kneemv"] = mysettings.kneemv;
-  settings["sensitivity"] = mysettings.sensitivity;
-  settings["cellmaxspikemv"] = mysettings.cellmaxspikemv;
-
-  settings["cur_val1"] = mysettings.current_value1;
-  settings["cur_val2"] = mysettings.current_value2;
-
-  settings["absorptimer"] = mysettings.absorptiontimer;
-  settings["floattimer"] = mysettings.floatvoltagetimer;
-  settings["socresume"] = mysettings.stateofchargeresumevalue;
-  settings["floatvolt"] = mysettings.floatvoltage;
-
-  bufferused += serializeJson(doc, httpbuf, BUFSIZE);
-
-  return httpd_resp_send(req, httpbuf, bufferused);
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
+
+  json.beginObject();
+  json.beginObject("chargeconfig");
+
+  json.addUInt("canbusprotocol", mysettings.canbusprotocol);
+  json.addUInt("canbusinverter", mysettings.canbusinverter);
+  json.addUInt("canbusbaud", mysettings.canbusbaud);
+  json.addUInt("equip_addr", mysettings.canbus_equipment_addr);
+  json.addBool("multipack", mysettings.canbus_multipack);
+  json.addUInt("nominalbatcap", mysettings.nominalbatcap);
+  json.addUInt("chargevolt", mysettings.chargevolt);
+  json.addUInt("chargecurrent", mysettings.chargecurrent);
+  json.addUInt("dischargecurrent", mysettings.dischargecurrent);
+  json.addUInt("dischargevolt", mysettings.dischargevolt);
+  json.addInt("chargetemplow", mysettings.chargetemplow);
+  json.addInt("chargetemphigh", mysettings.chargetemphigh);
+  json.addInt("dischargetemplow", mysettings.dischargetemplow);
+  json.addInt("dischargetemphigh", mysettings.dischargetemphigh);
+  json.addBool("stopchargebalance", mysettings.stopchargebalance);
+  json.addBool("socoverride", mysettings.socoverride);
+  json.addBool("socforcelow", mysettings.socforcelow);
+  json.addBool("dynamiccharge", mysettings.dynamiccharge);
+  json.addBool("preventdischarge", mysettings.preventdischarge);
+  json.addBool("preventcharging", mysettings.preventcharging);
+  json.addInt("cellminmv", mysettings.cellminmv);
+  json.addInt("cellmaxmv", mysettings.cellmaxmv);
+  json.addInt("kneemv", mysettings.kneemv);
+  json.addInt("sensitivity", mysettings.sensitivity);
+  json.addInt("cellmaxspikemv", mysettings.cellmaxspikemv);
+
+  json.addUInt("cur_val1", mysettings.current_value1);
+  json.addUInt("cur_val2", mysettings.current_value2);
+
+  json.addUInt("absorptimer", mysettings.absorptiontimer);
+  json.addUInt("floattimer", mysettings.floatvoltagetimer);
+  json.addUInt("socresume", mysettings.stateofchargeresumevalue);
+  json.addUInt("floatvolt", mysettings.floatvoltage);
+
+  json.endObject();
+  json.endObject();
+  return json.finish();
 }
-esp_err_t content_handler_rules(httpd_req_t *req)
+
+/// @brief Output relay state as true/false/null (null = don't care)
+static void addRelayState(httpd_json_writer &json, RelayState v)
 {
-  int bufferused = 0;
+  switch (v)
+  {
+  case RELAY_OFF:
+    json.addBool(false);
+    break;
+  case RELAY_ON:
+    json.addBool(true);
+    break;
+  default:
+    // Null value
+    json.addNull();
+    break;
+  }
+}
 
-  DynamicJsonDocument doc(3000);
-  JsonObject root = doc.to<JsonObject>();
+esp_err_t content_handler_rules(httpd_req_t *req, char *buffer, size_t bufferLen)
+{
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
+
+  json.beginObject();
 
   struct tm timeinfo;
   if (!getLocalTime(&timeinfo, 100))
   {
-    root["timenow"] = 0;
+    json.addUInt("timenow", 0);
   }
   else
   {
-    root["timenow"] = (timeinfo.tm_hour * 60) + timeinfo.tm_min;
+    json.addUInt("timenow", (timeinfo.tm_hour * 60) + timeinfo.tm_min);
   }
 
-  root["ControlState"] = _controller_state;
+  json.addUInt("ControlState", _controller_state);
 
-  JsonArray defaultArray = root.createNestedArray("relaydefault");
+  json.beginArray("relaydefault");
   for (auto v : mysettings.rulerelaydefault)
   {
-    switch (v)
-    {
-    case RELAY_OFF:
-      defaultArray.add(false);
-      break;
-    case RELAY_ON:
-      defaultArray.add(true);
-      break;
-    default:
-      // Null value
-      defaultArray.add(nullptr);
-      break;
-    }
+    addRelayState(json, v);
   }
+  json.endArray();
 
-  JsonArray typeArray = root.createNestedArray("relaytype");
+  json.beginArray("relaytype");
   for (auto v : mysettings.relaytype)
   {
     switch (v)
     {
     case RELAY_STANDARD:
-      typeArray.add("Std");
+      json.addString("Std");
       break;
     case RELAY_PULSE:
-      typeArray.add("Pulse");
+      json.addString("Pulse");
       break;
     default:
-      typeArray.add(nullptr);
+      json.addNull();
       break;
     }
   }
+  json.endArray();
 
-  JsonArray bankArray = root.createNestedArray("rules");
-
+  json.beginArray("rules");
   for (uint8_t r = 0; r < RELAY_RULES; r++)
   {
-    JsonObject rule = bankArray.createNestedObject();
-    rule["value"] = mysettings.rulevalue[r];
-    rule["hysteresis"] = mysettings.rulehysteresis[r];
-    rule["triggered"] = rules.ruleOutcome((Rule)r);
-    JsonArray data = rule.createNestedArray("relays");
-
+    json.beginObject();
+    json.addInt("value", mysettings.rulevalue[r]);
+    json.addInt("hysteresis", mysettings.rulehysteresis[r]);
+    json.addBool("triggered", rules.ruleOutcome((Rule)r));
+    json.beginArray("relays");
     for (auto v : mysettings.rulerelaystate[r])
     {
-      switch (v)
-      {
-      case RELAY_OFF:
-        data.add(false);
-        break;
-      case RELAY_ON:
-        data.add(true);
-        break;
-      default:
-        // Null
-        data.add(nullptr);
-        break;
-      }
+      addRelayState(json, v);
     }
+    json.endArray();
+    json.endObject();
   }
+  json.endArray();
 
-  bufferused += serializeJson(doc, httpbuf, BUFSIZE);
-
-  return httpd_resp_send(req, httpbuf, bufferused);
+  json.endObject();
+  return json.finish();
 }
 
-esp_err_t content_handler_settings(httpd_req_t *req)
+esp_err_t content_handler_settings(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
-
-  DynamicJsonDocument doc(2048);
-  JsonObject root = doc.to<JsonObject>();
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
-  JsonObject settings = root.createNestedObject("settings");
+  json.beginObject();
+  json.beginObject("settings");
 
-  settings["totalnumberofbanks"] = mysettings.totalNumberOfBanks;
-  settings["totalseriesmodules"] = mysettings.totalNumberOfSeriesModules;
-  settings["baudrate"] = mysettings.baudRate;
-  settings["interpacketgap"] = mysettings.interpacketgap;
+  json.addUInt("totalnumberofbanks", mysettings.totalNumberOfBanks);
+  json.addUInt("totalseriesmodules", mysettings.totalNumberOfSeriesModules);
+  json.addUInt("baudrate", mysettings.baudRate);
+  json.addUInt("interpacketgap", mysettings.interpacketgap);
 
-  settings["bypassthreshold"] = mysettings.BypassThresholdmV;
-  settings["bypassovertemp"] = mysettings.BypassOverTempShutdown;
+  json.addUInt("bypassthreshold", mysettings.BypassThresholdmV);
+  json.addUInt("bypassovertemp", mysettings.BypassOverTempShutdown);
 
-  settings["NTPServerName"] = mysettings.ntpServer;
-  settings["TimeZone"] = mysettings.timeZone;
-  settings["MinutesTimeZone"] = mysettings.minutesTimeZone;
-  settings["DST"] = mysettings.daylight;
+  json.addString("NTPServerName", mysettings.ntpServer);
+  json.addInt("TimeZone", mysettings.timeZone);
+  json.addInt("MinutesTimeZone", mysettings.minutesTimeZone);
+  json.addBool("DST", mysettings.daylight);
 
-  settings["HostName"] = hostname.c_str();
+  json.addString("HostName", hostname.c_str());
 
   time_t now;
   if (time(&now))
   {
-    settings["now"] = now;
+    json.addUInt64("now", now);
   }
 
   char strftime_buf[64];
   formatCurrentDateTime(strftime_buf, sizeof(strftime_buf));
-  settings["datetime"] = std::string(strftime_buf);
+  json.addString("datetime", strftime_buf);
 
   // Return running network settings
   if (tcpip_adapter_is_netif_up(TCPIP_ADAPTER_IF_STA))
@@ -767,9 +811,9 @@ esp_err_t content_handler_settings(httpd_req_t *req)
     // Get actual/running IP networking for STA adapter...
     if (tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &ipInfo) == ESP_OK)
     {
-      settings["run_ip"] = ip4_to_string(ipInfo.ip.addr);
-      settings["run_netmask"] = ip4_to_string(ipInfo.netmask.addr);
-      settings["run_gw"] = ip4_to_string(ipInfo.gw.addr);
+      json.addString("run_ip", ip4_to_string(ipInfo.ip.addr).c_str());
+      json.addString("run_netmask", ip4_to_string(ipInfo.netmask.addr).c_str());
+      json.addString("run_gw", ip4_to_string(ipInfo.gw.addr).c_str());
     }
 
     tcpip_adapter_dns_info_t dnsInfo = {0};
@@ -778,7 +822,7 @@ esp_err_t content_handler_settings(httpd_req_t *req)
     {
       if (dnsInfo.ip.type == IPADDR_TYPE_V4)
       {
-        settings["run_dns1"] = ip4_to_string(dnsInfo.ip.u_addr.ip4.addr);
+        json.addString("run_dns1", ip4_to_string(dnsInfo.ip.u_addr.ip4.addr).c_str());
       }
     }
     // Secondary DNS
@@ -786,513 +830,664 @@ esp_err_t content_handler_settings(httpd_req_t *req)
     {
       if (dnsInfo.ip.type == IPADDR_TYPE_V4)
       {
-        settings["run_dns2"] = ip4_to_string(dnsInfo.ip.u_addr.ip4.addr);
+        json.addString("run_dns2", ip4_to_string(dnsInfo.ip.u_addr.ip4.addr).c_str());
       }
     }
 
-    settings["man_ip"] = ip4_to_string(_wificonfig.wifi_ip);
-    settings["man_netmask"] = ip4_to_string(_wificonfig.wifi_netmask);
-    settings["man_gw"] = ip4_to_string(_wificonfig.wifi_gateway);
-    settings["man_dns1"] = ip4_to_string(_wificonfig.wifi_dns1);
-    settings["man_dns2"] = ip4_to_string(_wificonfig.wifi_dns2);
+    json.addString("man_ip", ip4_to_string(_wificonfig.wifi_ip).c_str());
+    json.addString("man_netmask", ip4_to_string(_wificonfig.wifi_netmask).c_str());
+    json.addString("man_gw", ip4_to_string(_wificonfig.wifi_gateway).c_str());
+    json.addString("man_dns1", ip4_to_string(_wificonfig.wifi_dns1).c_str());
+    json.addString("man_dns2", ip4_to_string(_wificonfig.wifi_dns2).c_str());
   }
+  json.endObject();
 
-  JsonObject wifi = root.createNestedObject("wifi");
+  json.beginObject("wifi");
 
   if (wifi_isconnected)
   {
     wifi_ap_record_t ap;
     esp_wifi_sta_get_ap_info(&ap);
-    wifi["rssi"] = ap.rssi;
-    wifi["ssid"] = ap.ssid;
+    json.addInt("rssi", ap.rssi);
+    json.addString("ssid", (const char *)ap.ssid);
 
     char macStr[18];
     snprintf(macStr, sizeof(macStr), "%02x:%02x:%02x:%02x:%02x:%02x",
              ap.bssid[0], ap.bssid[1], ap.bssid[2], ap.bssid[3], ap.bssid[4], ap.bssid[5]);
-    wifi["bssid"] = macStr;
+    json.addString("bssid", macStr);
   }
   else
   {
-    wifi["rssi"] = 0;
-    wifi["ssid"] = "";
-    wifi["bssid"] = "";
+    json.addInt("rssi", 0);
+    json.addString("ssid", "");
+    json.addString("bssid", "");
   }
 
-  wifi["rssi_low"] = wifi_count_rssi_low;
-  wifi["sta_start"] = wifi_count_sta_start;
-  wifi["sta_connected"] = wifi_count_sta_connected;
-  wifi["sta_disconnected"] = wifi_count_sta_disconnected;
-  wifi["sta_lost_ip"] = wifi_count_sta_lost_ip;
-  wifi["sta_got_ip"] = wifi_count_sta_got_ip;
+  json.addUInt("rssi_low", wifi_count_rssi_low);
+  json.addUInt("sta_start", wifi_count_sta_start);
+  json.addUInt("sta_connected", wifi_count_sta_connected);
+  json.addUInt("sta_disconnected", wifi_count_sta_disconnected);
+  json.addUInt("sta_lost_ip", wifi_count_sta_lost_ip);
+  json.addUInt("sta_got_ip", wifi_count_sta_got_ip);
+  json.endObject();
 
-  bufferused += serializeJson(doc, httpbuf, BUFSIZE);
-
-  return httpd_resp_send(req, httpbuf, bufferused);
+  json.endObject();
+  return json.finish();
 }
 
-esp_err_t content_handler_integration(httpd_req_t *req)
+esp_err_t content_handler_integration(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
-  int bufferused = 0;
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
-  DynamicJsonDocument doc(1024);
-  JsonObject root = doc.to<JsonObject>();
+  json.beginObject();
 
-  JsonObject ha = root.createNestedObject("ha");
-  ha["api"] = mysettings.homeassist_apikey;
+  json.beginObject("ha");
+  json.addString("api", mysettings.homeassist_apikey);
+  json.endObject();
 
-  JsonObject mqtt = root.createNestedObject("mqtt");
-  mqtt["enabled"] = mysettings.mqtt_enabled;
-  mqtt["basiccellreporting"] = mysettings.mqtt_basic_cell_reporting;
-  mqtt["topic"] = mysettings.mqtt_topic;
-  mqtt["uri"] = mysettings.mqtt_uri;
-  mqtt["username"] = mysettings.mqtt_username;
+  json.beginObject("mqtt");
+  json.addBool("enabled", mysettings.mqtt_enabled);
+  json.addBool("basiccellreporting", mysettings.mqtt_basic_cell_reporting);
+  json.addBool("bankpayloads", mysettings.mqtt_bank_payloads);
+  json.addString("topic", mysettings.mqtt_topic);
+  json.addString("uri", mysettings.mqtt_uri);
+  json.addString("username", mysettings.mqtt_username);
 
-  mqtt["connected"] = mqttClient_connected;
-  mqtt["err_conn_count"] = mqtt_error_connection_count;
-  mqtt["err_trans_count"] = mqtt_error_transport_count;
-  mqtt["conn_count"] = mqtt_connection_count;
-  mqtt["disc_count"] = mqtt_disconnection_count;
+  json.addBool("connected", mqttClient_connected);
+  json.addUInt("err_conn_count", mqtt_error_connection_count);
+  json.addUInt("err_trans_count", mqtt_error_transport_count);
+  json.addUInt("conn_count", mqtt_connection_count);
+  json.addUInt("disc_count", mqtt_disconnection_count);
 
   // We don't output the password in the json file as this could breach security
-  // mqtt["password"] =mysettings.mqtt_password;
+  json.endObject();
+
+  json.beginObject("influxdb");
+  json.addBool("enabled", mysettings.influxdb_enabled);
+  json.addString("url", mysettings.influxdb_serverurl);
+  json.addString("bucket", mysettings.influxdb_databasebucket);
+  json.addString("apitoken", mysettings.influxdb_apitoken);
+  json.addString("orgid", mysettings.influxdb_orgid);
+  json.addUInt("frequency", mysettings.influxdb_loggingFreqSeconds);
+  json.addBool("gzip", mysettings.influxdb_gzip);
+  json.endObject();
+
+  json.endObject();
+  return json.finish();
+}
 
-  JsonObject influxdb = root.createNestedObject("influxdb");
-  influxdb["enabled"] = mysettings.influxdb_enabled;
-  influxdb["url"] = mysettings.influxdb_serverurl;
-  influxdb["bucket"] = mysettings.influxdb_databasebucket;
-  influxdb["apitoken"] = mysettings.influxdb_apitoken;
-  influxdb["orgid"] = mysettings.influxdb_orgid;
-  influxdb["frequency"] = mysettings.influxdb_loggingFreqSeconds;
+// Changed by the snapshot task each time all the modules have been read
+static volatile uint32_t scan_generation = 0;
 
-  bufferused += serializeJson(doc, httpbuf, BUFSIZE);
+/// @brief Called when a scan of all the modules has completed, cached responses (/ha) are rebuilt on their next request
+void api_scan_completed()
+{
+  scan_generation++;
+}
+
+/// Raw little endian values, sent as HTTP chunks each time the buffer fills
+class binary_chunk_writer
+{
+public:
+  binary_chunk_writer(httpd_req_t *req, char *buffer, size_t bufferLen) : sink_(req), buffer_(buffer), bufferLen_(bufferLen) {}
 
-  return httpd_resp_send(req, httpbuf, bufferused);
+  void write(const void *data, size_t length)
+  {
+    const uint8_t *p = (const uint8_t *)data;
+    while (length > 0 && result_ == ESP_OK)
+    {
+      if (used_ == bufferLen_)
+      {
+        result_ = sink_.write(buffer_, used_);
+        used_ = 0;
+      }
+      size_t n = bufferLen_ - used_;
+      if (n > length)
+      {
+        n = length;
+      }
+      memcpy(&buffer_[used_], p, n);
+      used_ += n;
+      p += n;
+      length -= n;
+    }
+  }
+
+  template <typename T>
+  void put(T value) { write(&value, sizeof(value)); }
+
+  esp_err_t finish()
+  {
+    if (result_ == ESP_OK)
+    {
+      result_ = sink_.finish(buffer_, used_);
+    }
+    return result_;
+  }
+
+private:
+  httpd_chunk_sink sink_;
+  char *buffer_;
+  size_t bufferLen_;
+  size_t used_ = 0;
+  esp_err_t result_ = ESP_OK;
+};
+
+/// @brief Module values as little endian typed arrays, for the web UI charts.
+/// Header (16 bytes) then uint16 voltage/minimum/maximum/bad packets/packets received/balance count,
+/// int8 internal/external temperature, uint8 bypass PWM and finally bit-packed valid/bypass/bypass over temperature flags.
+/// Each array has one entry per module, see pagecode.js decodeModuleData()
+esp_err_t content_handler_monitorbin(httpd_req_t *req, char *buffer, size_t bufferLen)
+{
+  const uint8_t totalModules = mysettings.totalNumberOfBanks * mysettings.totalNumberOfSeriesModules;
+
+  httpd_resp_set_type(req, "application/octet-stream");
+
+  binary_chunk_writer out(req, buffer, bufferLen);
+
+  api_module_data_header header = {};
+  header.version = API_MODULE_DATA_VERSION;
+  header.header_length = sizeof(api_module_data_header);
+  header.banks = mysettings.totalNumberOfBanks;
+  header.series = mysettings.totalNumberOfSeriesModules;
+  header.generation = scan_generation;
+  header.uptime = (uint32_t)(esp_timer_get_time() / (uint64_t)1e+6);
+  header.modules = totalModules;
+  out.put(header);
+
+  // Invalid modules are zero, check the valid flags
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<uint16_t>(cmi[i].valid ? cmi[i].voltagemV : 0);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<uint16_t>(cmi[i].valid ? cmi[i].voltagemVMin : 0);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<uint16_t>(cmi[i].valid ? cmi[i].voltagemVMax : 0);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<uint16_t>(cmi[i].valid ? cmi[i].badPacketCount : 0);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<uint16_t>(cmi[i].valid ? cmi[i].PacketReceivedCount : 0);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<uint16_t>(cmi[i].valid ? cmi[i].BalanceCurrentCount : 0);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<int8_t>(cmi[i].valid ? cmi[i].internalTemp : -40);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    out.put<int8_t>(cmi[i].valid ? cmi[i].externalTemp : -40);
+  }
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    uint16_t pwm = (cmi[i].valid && cmi[i].inBypass) ? cmi[i].PWMValue : 0;
+    out.put<uint8_t>(pwm > 255 ? 255 : pwm);
+  }
+
+  // Flags, bit 0 of the first byte is module 0
+  for (uint8_t flag = 0; flag < 3; flag++)
+  {
+    uint8_t bits = 0;
+    for (uint8_t i = 0; i < totalModules; i++)
+    {
+      bool value = cmi[i].valid && (flag == 0 || (flag == 1 ? cmi[i].inBypass : cmi[i].bypassOverTemp));
+      if (value)
+      {
+        bits |= (1 << (i & 7));
+      }
+      if ((i & 7) == 7 || i == totalModules - 1)
+      {
+        out.put(bits);
+        bits = 0;
+      }
+    }
+  }
+
+  return out.finish();
 }
 
-esp_err_t content_handler_monitor3(httpd_req_t *req)
+esp_err_t content_handler_monitor3(httpd_req_t *req, char *buffer, size_t bufferLen)
 {
   uint8_t totalModules = mysettings.totalNumberOfBanks * mysettings.totalNumberOfSeriesModules;
-  uint8_t comma = totalModules - 1;
 
-  int bufferused = 0;
-  const char *nullstring = "null";
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "{\"badpacket\":[");
+  json.beginObject();
 
+  json.beginArray("badpacket");
   for (uint8_t i = 0; i < totalModules; i++)
   {
     if (cmi[i].valid)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].badPacketCount);
+      json.addUInt(cmi[i].badPacketCount);
     }
     else
     {
-      // Return NULL
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
-    }
-    if (i < comma)
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
+      json.addNull();
     }
   }
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-
-  // voltrange
-  bufferused = 0;
-
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],\"balcurrent\":[");
+  json.endArray();
 
+  json.beginArray("balcurrent");
   for (uint8_t i = 0; i < totalModules; i++)
   {
     if (cmi[i].valid)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].BalanceCurrentCount);
+      json.addUInt(cmi[i].BalanceCurrentCount);
     }
     else
     {
-      // Return NULL
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
-    }
-    if (i < comma)
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
+      json.addNull();
     }
   }
+  json.endArray();
 
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-
-  // voltrange
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],\"pktrecvd\":[");
-
+  json.beginArray("pktrecvd");
   for (uint8_t i = 0; i < totalModules; i++)
   {
     if (cmi[i].valid)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].PacketReceivedCount);
+      json.addUInt(cmi[i].PacketReceivedCount);
     }
     else
     {
-      // Return NULL
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
-    }
-    if (i < comma)
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
+      json.addNull();
     }
   }
+  json.endArray();
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "]}");
-
-  // ESP_LOGD(TAG, "bufferused=%i", bufferused);  ESP_LOGD(TAG, "monitor2: %s", buf);
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-
-  // Indicate last chunk (zero byte length)
-  return httpd_resp_send_chunk(req, httpbuf, 0);
+  json.endObject();
+  return json.finish();
 }
 
-esp_err_t content_handler_monitor2(httpd_req_t *req)
+/// @brief Writes the controller summary values (counters, current monitor, errors and warnings)
+/// into the current object.  Shared by monitor2 and the websocket telemetry.
+template <class TSink>
+void writeMonitorSummary(json_writer<TSink> &json)
 {
-  // Don't valid the cookie here, allow it to return basic information
-  // as read only
-  uint8_t totalModules = mysettings.totalNumberOfBanks * mysettings.totalNumberOfSeriesModules;
-
-  int bufferused = 0;
-  const char *nullstring = "null";
-
-  // Output the first batch of settings/parameters/values
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                         R"({"banks":%u,"seriesmodules":%u,"sent":%u,"received":%u,"modulesfnd":%u,"badcrc":%u,"ignored":%u,"roundtrip":%u,"oos":%u,"activerules":%u,"uptime":%u,"can_fail":%u,"can_sent":%u,"can_rec":%u,"can_r_err":%u,"qlen":%u,"cmode":%u,"ctime":%i,)",
-                         mysettings.totalNumberOfBanks,
-                         mysettings.totalNumberOfSeriesModules,
-                         prg.packetsGenerated,
-                         receiveProc.packetsReceived,
-                         receiveProc.totalModulesFound,
-                         receiveProc.totalCRCErrors,
-                         receiveProc.totalNotProcessedErrors,
-                         receiveProc.packetTimerMillisecond,
-                         receiveProc.totalOutofSequenceErrors,
-                         rules.active_rule_count,
-                         (uint32_t)(esp_timer_get_time() / (uint64_t)1e+6),
-                         canbus_messages_failed_sent,
-                         canbus_messages_sent,
-                         canbus_messages_received,
-                         canbus_messages_received_error,
-                         prg.queueLength(),
-                         (unsigned int)rules.getChargingMode(),
-                         rules.getChargingTimerSecondsRemaining());
+  json.addUInt("banks", mysettings.totalNumberOfBanks);
+  json.addUInt("seriesmodules", mysettings.totalNumberOfSeriesModules);
+  json.addUInt("sent", prg.packetsGenerated);
+  json.addUInt("received", receiveProc.packetsReceived);
+  json.addUInt("modulesfnd", receiveProc.totalModulesFound);
+  json.addUInt("badcrc", receiveProc.totalCRCErrors);
+  json.addUInt("ignored", receiveProc.totalNotProcessedErrors);
+  json.addUInt("roundtrip", receiveProc.packetTimerMillisecond);
+  json.addUInt("oos", receiveProc.totalOutofSequenceErrors);
+  json.addUInt("activerules", rules.active_rule_count);
+  json.addUInt("uptime", (uint32_t)(esp_timer_get_time() / (uint64_t)1e+6));
+  json.addUInt("can_fail", canbus_messages_failed_sent);
+  json.addUInt("can_sent", canbus_messages_sent);
+  json.addUInt("can_rec", canbus_messages_received);
+  json.addUInt("can_r_err", canbus_messages_received_error);
+  json.addUInt("qlen", prg.queueLength());
+  json.addUInt("cmode", (unsigned int)rules.getChargingMode());
+  json.addInt("ctime", rules.getChargingTimerSecondsRemaining());
 
   if (mysettings.canbusprotocol != CanBusProtocolEmulation::CANBUS_DISABLED && mysettings.dynamiccharge)
   {
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                           R"("dyncv":%u,"dyncc":%u,)",
-                           rules.DynamicChargeVoltage(),
-                           rules.DynamicChargeCurrent());
+    json.addUInt("dyncv", rules.DynamicChargeVoltage());
+    json.addUInt("dyncc", rules.DynamicChargeCurrent());
   }
 
-  // current
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"current\":[");
-
+  json.beginArray("current");
   if (mysettings.currentMonitoringEnabled && currentMonitor.validReadings)
   {
     // Output current monitor values, this is inside an array, so could be more than 1
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                           R"({"c":%.4f,"v":%.4f,"mahout":%u,"mahin":%u,"p":%.2f,"soc":%.2f,"dmahout":%u,"dmahin":%u)",
-                           currentMonitor.modbus.current, currentMonitor.modbus.voltage, currentMonitor.modbus.milliamphour_out,
-                           currentMonitor.modbus.milliamphour_in, currentMonitor.modbus.power, currentMonitor.stateofcharge,
-                           currentMonitor.modbus.daily_milliamphour_out, currentMonitor.modbus.daily_milliamphour_in);
-
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"(,"time100":%u,"time20":%u,"time10":%u)", time100, time20, time10);
-
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"(,"cyclesbatt":%.2f)", (float)mysettings.numberofbatterycycles/1000.0f);
-
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "}");
+    json.beginObject();
+    json.addFloat("c", currentMonitor.modbus.current);
+    json.addFloat("v", currentMonitor.modbus.voltage);
+    // Lifetime totals (internal monitor), dmahout/dmahin are since midnight
+    json.addUInt("mahout", currentMonitor.modbus.milliamphour_out);
+    json.addUInt("mahin", currentMonitor.modbus.milliamphour_in);
+    json.addFloat("p", currentMonitor.modbus.power, 2);
+    json.addFloat("soc", currentMonitor.stateofcharge, 2);
+    json.addUInt("dmahout", currentMonitor.modbus.daily_milliamphour_out);
+    json.addUInt("dmahin", currentMonitor.modbus.daily_milliamphour_in);
+    json.addUInt("time100", time100);
+    json.addUInt("time20", time20);
+    json.addUInt("time10", time10);
+    json.addFloat("cyclesbatt", (float)mysettings.numberofbatterycycles / 1000.0f, 2);
+    json.endObject();
   }
   else
   {
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
+    json.addNull();
   }
+  json.endArray();
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
-
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE, "\"errors\":[");
-  int count = 0;
+  json.beginArray("errors");
   for (auto v : rules.ErrorCodes)
   {
     if (v != InternalErrorCode::NoError)
     {
-      // Comma if not zero
-      if (count)
-      {
-        bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-      }
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", v);
-      count++;
+      json.addUInt(v);
     }
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],\"warnings\":[");
+  json.endArray();
 
-  count = 0;
+  json.beginArray("warnings");
   for (auto v : rules.WarningCodes)
   {
     if (v != InternalWarningCode::NoWarning)
     {
-      // Comma if not zero
-      if (count)
-      {
-        bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-      }
-
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", v);
-      count++;
+      json.addUInt(v);
     }
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
+  json.endArray();
+}
 
-  // Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+/// @brief Writes the per bank voltage and voltage range arrays into the current object
+template <class TSink>
+void writeBankSummary(json_writer<TSink> &json)
+{
+  json.beginArray("bankv");
+  for (uint8_t i = 0; i < mysettings.totalNumberOfBanks; i++)
+  {
+    json.addUInt(rules.bankvoltage.at(i));
+  }
+  json.endArray();
+
+  json.beginArray("voltrange");
+  for (uint8_t i = 0; i < mysettings.totalNumberOfBanks; i++)
+  {
+    json.addUInt(rules.VoltageRangeInBank(i));
+  }
+  json.endArray();
+}
 
-  // voltages
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"voltages\":[");
+template void writeMonitorSummary(json_writer<httpd_chunk_sink> &json);
+template void writeMonitorSummary(json_writer<fixed_buffer_sink> &json);
+template void writeBankSummary(json_writer<httpd_chunk_sink> &json);
+template void writeBankSummary(json_writer<fixed_buffer_sink> &json);
 
-  for (uint8_t i = 0; i < totalModules; i++)
+esp_err_t content_handler_monitor2(httpd_req_t *req, char *buffer, size_t bufferLen)
+{
+  // Don't valid the cookie here, allow it to return basic information
+  // as read only
+  uint8_t totalModules = mysettings.totalNumberOfBanks * mysettings.totalNumberOfSeriesModules;
+
+  // modules=0 leaves the module arrays empty, when the web UI reads them from /api/monitorbin
+  char query[32];
+  char param[4];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "modules", param, sizeof(param)) == ESP_OK && param[0] == '0')
   {
-    // Comma if not zero
-    if (i)
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-    }
+    totalModules = 0;
+  }
+
+  httpd_json_writer json(httpd_chunk_sink(req), buffer, bufferLen);
+
+  // Output the first batch of settings/parameters/values
+  json.beginObject();
+  writeMonitorSummary(json);
 
+  // Module is not yet valid so return null values...
+  json.beginArray("voltages");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
     if (cmi[i].valid)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].voltagemV);
+      json.addUInt(cmi[i].voltagemV);
     }
     else
     {
-      // Module is not yet valid so return null values...
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
+      json.addNull();
     }
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
-
-  // ESP_LOGD(TAG, "bufferused=%i", bufferused);  ESP_LOGD(TAG, "monitor2: %s", buf);
-
-  // Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  json.endArray();
 
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"minvoltages\":[");
+  json.beginArray("minvoltages");
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-
     if (cmi[i].valid)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].voltagemVMin);
+      json.addUInt(cmi[i].voltagemVMin);
     }
     else
     {
-      // Module is not yet valid so return null values...
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
+      json.addNull();
     }
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
-
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-
-  // maxvoltages
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"maxvoltages\":[");
+  json.endArray();
 
+  json.beginArray("maxvoltages");
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-
     if (cmi[i].valid)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].voltagemVMax);
+      json.addUInt(cmi[i].voltagemVMax);
     }
     else
     {
-      // Module is not yet valid so return null values...
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
+      json.addNull();
     }
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
-
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-
-  // inttemp
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"inttemp\":[");
+  json.endArray();
 
+  json.beginArray("inttemp");
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-
     if (cmi[i].valid && cmi[i].internalTemp != -40)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%i", cmi[i].internalTemp);
+      json.addInt(cmi[i].internalTemp);
     }
     else
     {
-      // Module is not yet valid so return null values...
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
+      json.addNull();
     }
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
-
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
-
-  // exttemp
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"exttemp\":[");
+  json.endArray();
 
+  json.beginArray("exttemp");
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-
     if (cmi[i].valid && cmi[i].externalTemp != -40)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%i", cmi[i].externalTemp);
+      json.addInt(cmi[i].externalTemp);
     }
     else
     {
-      // Module is not yet valid so return null values...
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s", nullstring);
+      json.addNull();
     }
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
+  json.endArray();
 
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  json.beginArray("bypass");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    json.addUInt((cmi[i].valid && cmi[i].inBypass) ? 1 : 0);
+  }
+  json.endArray();
 
-  // bypass
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"bypass\":[");
+  json.beginArray("bypasshot");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    json.addUInt((cmi[i].valid && cmi[i].bypassOverTemp) ? 1 : 0);
+  }
+  json.endArray();
 
+  json.beginArray("bypasspwm");
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
+    json.addUInt((cmi[i].valid && cmi[i].inBypass) ? cmi[i].PWMValue : 0);
+  }
+  json.endArray();
 
-    if (cmi[i].valid && cmi[i].inBypass)
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "1");
-    }
-    else
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "0");
-    }
+  writeBankSummary(json);
+
+  json.endObject();
+  return json.finish();
+}
+
+template <class TSink>
+static void writeHomeAssistant(json_writer<TSink> &json)
+{
+  json.beginObject();
+  json.addUInt("activerules", rules.active_rule_count);
+  json.addUInt("chgmode", (unsigned int)rules.getChargingMode());
+  json.addUInt("lowbankv", rules.lowestBankVoltage);
+  json.addUInt("highbankv", rules.highestBankVoltage);
+  json.addUInt("lowcellv", rules.lowestCellVoltage);
+  json.addUInt("highcellv", rules.highestCellVoltage);
+  json.addInt("highextt", rules.highestExternalTemp);
+  json.addInt("highintt", rules.highestInternalTemp);
+
+  if (mysettings.currentMonitoringEnabled && currentMonitor.validReadings)
+  {
+    json.addFloat("c", currentMonitor.modbus.current);
+    json.addFloat("v", currentMonitor.modbus.voltage);
+    json.addFloat("pwr", currentMonitor.modbus.power, 2);
+    json.addFloat("soc", currentMonitor.stateofcharge, 2);
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (mysettings.canbusprotocol != CanBusProtocolEmulation::CANBUS_DISABLED && mysettings.dynamiccharge)
+  {
+    json.addUInt("dyncv", rules.DynamicChargeVoltage());
+    json.addUInt("dyncc", rules.DynamicChargeCurrent());
+  }
 
-  // bypasshot
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"bypasshot\":[");
+  json.addUInt("chgallow", rules.IsChargeAllowed(&mysettings) ? 1 : 0);
+  json.addUInt("dischgallow", rules.IsDischargeAllowed(&mysettings) ? 1 : 0);
 
-  for (uint8_t i = 0; i < totalModules; i++)
+  // Bank 0 as individual keys, kept for existing Home Assistant configurations
+  char name[16];
+  for (int i = 0; i < mysettings.totalNumberOfSeriesModules; i++)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
+    snprintf(name, sizeof(name), "cell_%u", i);
+    json.addUInt(name, cmi[i].voltagemV);
+  }
 
-    if (cmi[i].valid && cmi[i].bypassOverTemp)
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "1");
-    }
-    else
+  // Every bank, use value_json.banks[B].cells[M] in Home Assistant
+  json.beginArray("banks");
+  uint8_t cell = 0;
+  for (uint8_t bank = 0; bank < mysettings.totalNumberOfBanks; bank++)
+  {
+    json.beginObject();
+    json.addUInt("v", rules.bankvoltage.at(bank));
+    json.addUInt("range", rules.VoltageRangeInBank(bank));
+    json.beginArray("cells");
+    for (uint8_t module = 0; module < mysettings.totalNumberOfSeriesModules; module++)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "0");
+      json.addUInt(cmi[cell].voltagemV);
+      cell++;
     }
+    json.endArray();
+    json.endObject();
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
+  json.endArray();
 
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  json.endObject();
+}
 
-  // bypasspwm
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"bypasspwm\":[");
 
-  for (uint8_t i = 0; i < totalModules; i++)
+// Response is only generated once per scan generation, and shared by every Home Assistant poll.
+// Only used on the httpd task, so no locking is needed.
+static char *ha_cache = nullptr;
+static size_t ha_cache_length = 0;
+static uint32_t ha_cache_generation = 0;
+static bool ha_cache_valid = false;
+static char ha_etag[24];
+static uint32_t ha_boot_id = 0;
+
+static uint32_t ha_requests = 0;
+static uint32_t ha_not_modified = 0;
+static uint32_t ha_rebuilds = 0;
+static uint32_t ha_max_us = 0;
+static uint64_t ha_total_us = 0;
+
+/// @brief Regenerate the cached response if a new scan has completed
+/// @return false if the response can't be cached (out of memory or too large)
+static bool ha_refresh_cache()
+{
+  uint32_t generation = scan_generation;
+  if (ha_cache_valid && ha_cache_generation == generation)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
+    return true;
+  }
 
-    if (cmi[i].valid && cmi[i].inBypass)
-    {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].PWMValue);
-    }
-    else
+  if (ha_cache == nullptr)
+  {
+    ha_cache = (char *)malloc(HA_CACHE_SIZE);
+    if (ha_cache == nullptr)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "0");
+      return false;
     }
+    // Different after a reboot, so clients don't match an old ETag
+    ha_boot_id = esp_random();
   }
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
-
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  json_writer<fixed_buffer_sink> json(fixed_buffer_sink(), ha_cache, HA_CACHE_SIZE);
+  writeHomeAssistant(json);
+  ha_cache_valid = (json.finish() == ESP_OK);
+  ha_cache_length = json.length();
+  ha_cache_generation = generation;
+  ha_rebuilds++;
+  snprintf(ha_etag, sizeof(ha_etag), "\"%08x-%u\"", ha_boot_id, generation);
 
-  // bankv
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"bankv\":[");
-
-  for (uint8_t i = 0; i < mysettings.totalNumberOfBanks; i++)
+  if (!ha_cache_valid)
   {
-    // Comma if not zero
-    if (i)
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
-
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", rules.bankvoltage.at(i));
+    ESP_LOGE(TAG, "HA response larger than %u bytes", HA_CACHE_SIZE);
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
+  return ha_cache_valid;
+}
 
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+/// @brief Output the /ha request statistics
+/// @param json Writer, which must be inside an object
+void writeHomeAssistantStats(httpd_json_writer &json)
+{
+  json.beginObject("ha");
+  json.addUInt("requests", ha_requests);
+  json.addUInt("notmodified", ha_not_modified);
+  json.addUInt("rebuilds", ha_rebuilds);
+  json.addUInt("cachebytes", ha_cache_length);
+  json.addUInt("avg_us", ha_requests == 0 ? 0 : (uint32_t)(ha_total_us / ha_requests));
+  json.addUInt("max_us", ha_max_us);
+  json.endObject();
+}
 
-  // voltrange
-  bufferused = 0;
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"voltrange\":[");
+static esp_err_t ha_send(httpd_req_t *req)
+{
+  httpd_resp_set_type(req, "application/json");
 
-  for (uint8_t i = 0; i < mysettings.totalNumberOfBanks; i++)
+  if (!ha_refresh_cache())
   {
-    // Comma if not zero
-    if (i)
+    // Stream it the old way
+    setNoStoreCacheControl(req);
+
+    http_buffer buffer;
+    if (!buffer)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
+      return http_buffer_send_busy(req);
     }
 
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", rules.VoltageRangeInBank(i));
+    httpd_json_writer json(httpd_chunk_sink(req), buffer.data(), buffer.size());
+    writeHomeAssistant(json);
+    return json.finish();
   }
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "]}");
 
-  //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  char match[sizeof(ha_etag)];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", match, sizeof(match)) == ESP_OK && strcmp(match, ha_etag) == 0)
+  {
+    ha_not_modified++;
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, nullptr, 0);
+  }
 
-  // Indicate last chunk (zero byte length)
-  return httpd_resp_send_chunk(req, httpbuf, 0);
+  // Client must check with us before using its copy
+  httpd_resp_set_hdr(req, "ETag", ha_etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  return httpd_resp_send(req, ha_cache, ha_cache_length);
 }
 
 /// @brief
@@ -1300,13 +1495,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
 /// @return Error/success status
 esp_err_t ha_handler(httpd_req_t *req)
 {
-  httpd_resp_set_type(req, "application/json");
-  setNoStoreCacheControl(req);
-
-  ESP_LOGI(TAG, "home assistant api request");
+  ESP_LOGD(TAG, "home assistant api request");
 
-  char buffer[128];
-  esp_err_t result = httpd_req_get_hdr_value_str(req, "ApiKey", buffer, sizeof(buffer));
+  char apikey[128];
+  esp_err_t result = httpd_req_get_hdr_value_str(req, "ApiKey", apikey, sizeof(apikey));
 
   if (result != ESP_OK)
   {
@@ -1314,58 +1506,84 @@ esp_err_t ha_handler(httpd_req_t *req)
     return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, nullptr);
   }
 
-  if (strncmp(mysettings.homeassist_apikey, buffer, strlen(mysettings.homeassist_apikey)) != 0)
+  if (strncmp(mysettings.homeassist_apikey, apikey, strlen(mysettings.homeassist_apikey)) != 0)
   {
-    ESP_LOGE(TAG, "Unauthorized ApiKey=%s", buffer);
+    ESP_LOGE(TAG, "Unauthorized ApiKey=%s", apikey);
     return httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, nullptr);
   }
-  
-  int bufferused = 0;
 
-  // Output the first batch of settings/parameters/values
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                         R"({"activerules":%u,"chgmode":%u,"lowbankv":%u,"highbankv":%u,"lowcellv":%u,"highcellv":%u,"highextt":%i,"highintt":%i)",
-                         rules.active_rule_count,
-                         (unsigned int)rules.getChargingMode(),
-                         rules.lowestBankVoltage,
-                         rules.highestBankVoltage,
-                         rules.lowestCellVoltage,
-                         rules.highestCellVoltage,
-                         rules.highestExternalTemp,
-                         rules.highestInternalTemp);
+  int64_t start = esp_timer_get_time();
+  result = ha_send(req);
+  uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
 
-  if (mysettings.currentMonitoringEnabled && currentMonitor.validReadings)
+  ha_requests++;
+  ha_total_us += elapsed;
+  if (elapsed > ha_max_us)
   {
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                           R"(,"c":%.4f,"v":%.4f,"pwr":%.2f,"soc":%.2f)",
-                           currentMonitor.modbus.current,
-                           currentMonitor.modbus.voltage,
-                           currentMonitor.modbus.power,
-                           currentMonitor.stateofcharge);
+    ha_max_us = elapsed;
   }
 
-  if (mysettings.canbusprotocol != CanBusProtocolEmulation::CANBUS_DISABLED && mysettings.dynamiccharge)
-  {
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                           R"(,"dyncv":%u,"dyncc":%u)",
-                           rules.DynamicChargeVoltage(),
-                           rules.DynamicChargeCurrent());
-  }
+  return result;
+}
 
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                         R"(,"chgallow":%u,"dischgallow":%u)",
-                         rules.IsChargeAllowed(&mysettings) ? 1 : 0,
-                         rules.IsDischargeAllowed(&mysettings) ? 1 : 0);
+typedef esp_err_t (*api_content_handler)(httpd_req_t *req, char *buffer, size_t bufferLen);
 
-  for(int i=0; i <  mysettings.totalNumberOfSeriesModules; i++){
-    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                         R"(,"cell_%u":%u)", i, cmi[i].voltagemV);
+struct api_route
+{
+  const char *name;
+  api_content_handler handler;
+};
+
+static constexpr api_route api_routes[] = {
+    {"monitor2", content_handler_monitor2},
+    {"monitorbin", content_handler_monitorbin},
+    {"monitor3", content_handler_monitor3},
+    {"integration", content_handler_integration},
+    {"settings", content_handler_settings},
+    {"rules", content_handler_rules},
+    {"rs485settings", content_handler_rs485settings},
+    {"currentmonitor", content_handler_currentmonitor},
+    {"avrstatus", content_handler_avrstatus},
+    {"modules", content_handler_modules},
+    {"identifyModule", content_handler_identifymodule},
+    {"storage", content_handler_storage},
+    {"avrstorage", content_handler_avrstorage},
+    {"chargeconfig", content_handler_chargeconfig},
+    {"tileconfig", content_handler_tileconfig},
+    {"history", content_handler_history},
+    {"diagnostic", content_handler_diagnostic}};
+
+static constexpr size_t api_route_count = sizeof(api_routes) / sizeof(api_routes[0]);
+
+struct api_route_stats
+{
+  uint32_t count;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint64_t bytes;
+};
+
+// Only updated/read on the httpd task, so no locking is needed
+static api_route_stats route_stats[api_route_count];
+
+/// @brief Output the per-endpoint call statistics
+/// @param json Writer, which must be inside an object
+void writeApiRouteStats(httpd_json_writer &json)
+{
+  json.beginArray("api");
+  for (size_t i = 0; i < api_route_count; i++)
+  {
+    const api_route_stats &stats = route_stats[i];
+    json.beginObject();
+    json.addString("name", api_routes[i].name);
+    json.addUInt("count", stats.count);
+    json.addUInt("avg_us", stats.count == 0 ? 0 : (uint32_t)(stats.total_us / stats.count));
+    json.addUInt("max_us", stats.max_us);
+    json.addUInt64("total_us", stats.total_us);
+    json.addUInt64("bytes", stats.bytes);
+    json.endObject();
   }
-
-
-
-  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "}");
-  return httpd_resp_send(req, httpbuf, bufferused);
+  json.endArray();
 }
 
 esp_err_t api_handler(httpd_req_t *req)
@@ -1375,53 +1593,53 @@ esp_err_t api_handler(httpd_req_t *req)
     return ESP_FAIL;
   }
 
-  const std::array<std::string, 16> uri_array = {
-      "monitor2", "monitor3", "integration",
-      "settings", "rules", "rs485settings",
-      "currentmonitor", "avrstatus", "modules",
-      "identifyModule", "storage", "avrstorage",
-      "chargeconfig", "tileconfig", "history",
-      "diagnostic"};
-
-  const std::array<std::function<esp_err_t(httpd_req_t * req)>, 16> func_ptr = {
-      content_handler_monitor2, content_handler_monitor3, content_handler_integration,
-      content_handler_settings, content_handler_rules, content_handler_rs485settings,
-      content_handler_currentmonitor, content_handler_avrstatus, content_handler_modules,
-      content_handler_identifymodule, content_handler_storage, content_handler_avrstorage,
-      content_handler_chargeconfig, content_handler_tileconfig, content_handler_history,
-      content_handler_diagnostic};
-
-  // Ensure arrays are equal length
-  assert(uri_array.size() == func_ptr.size());
-
-  auto name = std::string(req->uri);
-  if (name.rfind("/api/", 0) == 0)
+  const char *name = req->uri;
+  if (strncmp(name, "/api/", 5) == 0)
   {
     // skip over first 5 characters "/api/" characters
-    name = name.substr(5);
+    name += 5;
   }
 
   // Don't forget URLs can have a querystring attached to them!
-  auto questionmark = name.find("?", 0);
-  if (questionmark > 0)
-  {
-    // Strip string at querystring
-    name = name.substr(0, questionmark);
-  }
+  size_t length = strcspn(name, "?");
 
-  for (size_t i = 0; i < uri_array.size(); i++)
+  for (size_t i = 0; i < api_route_count; i++)
   {
-    if (name.compare(uri_array.at(i)) == 0)
+    const api_route &route = api_routes[i];
+    if (strncmp(name, route.name, length) == 0 && route.name[length] == 0)
     {
       // Found it
-      ESP_LOGI(TAG, "API call: %s", name.c_str());
+      ESP_LOGI(TAG, "API call: %s", route.name);
+
+      http_buffer buffer;
+      if (!buffer)
+      {
+        return http_buffer_send_busy(req);
+      }
+
       httpd_resp_set_type(req, "application/json");
       setNoStoreCacheControl(req);
-      return func_ptr.at(i)(req);
+
+      uint32_t bytes_before = httpd_chunk_sink::bytes_sent();
+      int64_t start = esp_timer_get_time();
+
+      esp_err_t result = route.handler(req, buffer.data(), buffer.size());
+
+      uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+      api_route_stats &stats = route_stats[i];
+      stats.count++;
+      stats.total_us += elapsed;
+      if (elapsed > stats.max_us)
+      {
+        stats.max_us = elapsed;
+      }
+      stats.bytes += httpd_chunk_sink::bytes_sent() - bytes_before;
+
+      return result;
     }
   }
 
-  ESP_LOGE(TAG, "No API match: %s", name.c_str());
+  ESP_LOGE(TAG, "No API match: %.*s", (int)length, name);
 
   return httpd_resp_send_500(req);
 }
@@ -0,0 +1,544 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-metrics";
+
+#include "webserver_metrics.h"
+#include "webserver_buffer_pool.h"
+#include "json_writer.hpp"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+
+// Prometheus text exposition format (version 0.0.4), for example
+//
+// # HELP diybms_module_voltage_volts Module (cell) voltage
+// # TYPE diybms_module_voltage_volts gauge
+// diybms_module_voltage_volts{bank="0",module="0"} 3.312
+//
+// Values are copied into a snapshot at the start of the request, so the whole scrape
+// is consistent even though it is sent in several chunks.
+
+struct metrics_module
+{
+  uint16_t voltagemV;
+  uint16_t voltagemVMin;
+  uint16_t voltagemVMax;
+  uint16_t PWMValue;
+  uint16_t badPacketCount;
+  uint16_t PacketReceivedCount;
+  uint16_t BalanceCurrentCount;
+  int8_t internalTemp;
+  int8_t externalTemp;
+  bool valid;
+  bool inBypass;
+  bool bypassOverTemp;
+};
+
+struct metrics_snapshot
+{
+  metrics_module modules[maximum_controller_cell_modules];
+  uint32_t bankvoltage[maximum_number_of_banks];
+  uint16_t bankrange[maximum_number_of_banks];
+  bool rule_outcome[1 + MAXIMUM_RuleNumber];
+  RelayState relay[RELAY_TOTAL];
+  InternalErrorCode errors[1 + MAXIMUM_InternalErrorCode];
+  InternalWarningCode warnings[1 + MAXIMUM_InternalWarningCode];
+  currentmonitoring_struct current;
+  task_stack_info tasks[MAXIMUM_REPORTED_TASKS];
+
+  uint32_t packetsGenerated;
+  uint32_t packetsReceived;
+  uint32_t packetTimerMillisecond;
+  uint32_t can_sent;
+  uint32_t can_received;
+  uint32_t can_failed;
+  uint32_t can_received_error;
+  uint32_t uptime;
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;
+  uint32_t highestBankVoltage;
+  uint32_t lowestBankVoltage;
+  uint16_t totalCRCErrors;
+  uint16_t totalOutofSequenceErrors;
+  uint16_t totalNotProcessedErrors;
+  uint16_t queueLength;
+  uint16_t highestCellVoltage;
+  uint16_t lowestCellVoltage;
+  uint16_t highestBankRange;
+  uint8_t totalModulesFound;
+  uint8_t banks;
+  uint8_t seriesModules;
+  uint8_t active_rule_count;
+  uint8_t chargeMode;
+  uint8_t taskCount;
+  int8_t highestExternalTemp;
+  int8_t lowestExternalTemp;
+  int8_t highestInternalTemp;
+  int8_t lowestInternalTemp;
+  bool currentValid;
+};
+
+// Too large for the httpd task stack, protected by metrics_mutex
+static metrics_snapshot snapshot;
+static SemaphoreHandle_t metrics_mutex = nullptr;
+
+/// @brief Writes Prometheus text format into a fixed buffer, sending each full buffer as a chunk
+class prometheus_writer
+{
+public:
+  prometheus_writer(httpd_req_t *req, char *buffer, size_t bufferLen) : sink_(req), buffer_(buffer), bufferLen_(bufferLen) {}
+
+  /// @brief Output the HELP and TYPE lines which precede the samples of a metric
+  void family(const char *name, const char *type, const char *help)
+  {
+    print("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+  }
+
+  void sample(const char *name, const char *labels, float value, uint8_t decimals = 3)
+  {
+    if (isnan(value) || isinf(value))
+    {
+      print(labels ? "%s{%s} NaN\n" : "%s%s NaN\n", name, labels ? labels : "");
+      return;
+    }
+    print(labels ? "%s{%s} %.*f\n" : "%s%s %.*f\n", name, labels ? labels : "", decimals, value);
+  }
+  void sample(const char *name, const char *labels, uint32_t value)
+  {
+    print(labels ? "%s{%s} %u\n" : "%s%s %u\n", name, labels ? labels : "", value);
+  }
+  void sample(const char *name, const char *labels, int32_t value)
+  {
+    print(labels ? "%s{%s} %i\n" : "%s%s %i\n", name, labels ? labels : "", value);
+  }
+
+  esp_err_t finish() { return result_ == ESP_OK ? sink_.finish(buffer_, used_) : result_; }
+
+private:
+  httpd_chunk_sink sink_;
+  char *buffer_;
+  size_t bufferLen_;
+  size_t used_ = 0;
+  esp_err_t result_ = ESP_OK;
+
+  void print(const char *format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    if (result_ != ESP_OK)
+    {
+      return;
+    }
+
+    for (uint8_t attempt = 0; attempt < 2; attempt++)
+    {
+      va_list args;
+      va_start(args, format);
+      int n = vsnprintf(&buffer_[used_], bufferLen_ - used_, format, args);
+      va_end(args);
+
+      if (n < 0)
+      {
+        return;
+      }
+      if ((size_t)n < bufferLen_ - used_)
+      {
+        used_ += n;
+        return;
+      }
+
+      // Didn't fit, send what we have and try again with an empty buffer
+      if (used_ > 0)
+      {
+        result_ = sink_.write(buffer_, used_);
+        used_ = 0;
+        if (result_ != ESP_OK)
+        {
+          return;
+        }
+      }
+    }
+
+    ESP_LOGE(TAG, "Line too long");
+  }
+};
+
+static void take_snapshot(metrics_snapshot *s)
+{
+  s->banks = mysettings.totalNumberOfBanks;
+  s->seriesModules = mysettings.totalNumberOfSeriesModules;
+
+  uint8_t totalModules = s->banks * s->seriesModules;
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    auto &m = s->modules[i];
+    m.valid = cmi[i].valid;
+    m.inBypass = cmi[i].inBypass;
+    m.bypassOverTemp = cmi[i].bypassOverTemp;
+    m.voltagemV = cmi[i].voltagemV;
+    m.voltagemVMin = cmi[i].voltagemVMin;
+    m.voltagemVMax = cmi[i].voltagemVMax;
+    m.PWMValue = cmi[i].PWMValue;
+    m.internalTemp = cmi[i].internalTemp;
+    m.externalTemp = cmi[i].externalTemp;
+    m.badPacketCount = cmi[i].badPacketCount;
+    m.PacketReceivedCount = cmi[i].PacketReceivedCount;
+    m.BalanceCurrentCount = cmi[i].BalanceCurrentCount;
+  }
+
+  for (uint8_t b = 0; b < s->banks; b++)
+  {
+    s->bankvoltage[b] = rules.bankvoltage.at(b);
+    s->bankrange[b] = rules.VoltageRangeInBank(b);
+  }
+
+  for (uint8_t r = 0; r <= MAXIMUM_RuleNumber; r++)
+  {
+    s->rule_outcome[r] = rules.ruleOutcome((Rule)r);
+  }
+  for (uint8_t r = 0; r < RELAY_TOTAL; r++)
+  {
+    s->relay[r] = previousRelayState[r];
+  }
+  for (uint8_t i = 0; i <= MAXIMUM_InternalErrorCode; i++)
+  {
+    s->errors[i] = rules.ErrorCodes.at(i);
+  }
+  for (uint8_t i = 0; i <= MAXIMUM_InternalWarningCode; i++)
+  {
+    s->warnings[i] = rules.WarningCodes.at(i);
+  }
+
+  s->active_rule_count = rules.active_rule_count;
+  s->chargeMode = (uint8_t)rules.getChargingMode();
+  s->highestBankVoltage = rules.highestBankVoltage;
+  s->lowestBankVoltage = rules.lowestBankVoltage;
+  s->highestCellVoltage = rules.highestCellVoltage;
+  s->lowestCellVoltage = rules.lowestCellVoltage;
+  s->highestBankRange = rules.highestBankRange;
+  s->highestExternalTemp = rules.highestExternalTemp;
+  s->lowestExternalTemp = rules.lowestExternalTemp;
+  s->highestInternalTemp = rules.highestInternalTemp;
+  s->lowestInternalTemp = rules.lowestInternalTemp;
+
+  s->currentValid = mysettings.currentMonitoringEnabled && currentMonitor.validReadings;
+  s->current = currentMonitor;
+
+  s->packetsGenerated = prg.packetsGenerated;
+  s->queueLength = prg.queueLength();
+  s->packetsReceived = receiveProc.packetsReceived;
+  s->totalModulesFound = receiveProc.totalModulesFound;
+  s->totalCRCErrors = receiveProc.totalCRCErrors;
+  s->totalOutofSequenceErrors = receiveProc.totalOutofSequenceErrors;
+  s->totalNotProcessedErrors = receiveProc.totalNotProcessedErrors;
+  s->packetTimerMillisecond = receiveProc.packetTimerMillisecond;
+
+  s->can_sent = canbus_messages_sent;
+  s->can_received = canbus_messages_received;
+  s->can_failed = canbus_messages_failed_sent;
+  s->can_received_error = canbus_messages_received_error;
+
+  s->uptime = (uint32_t)(esp_timer_get_time() / (uint64_t)1e+6);
+  s->freeHeap = ESP.getFreeHeap();
+  s->minFreeHeap = ESP.getMinFreeHeap();
+  s->taskCount = GetTaskStackInfo(s->tasks, MAXIMUM_REPORTED_TASKS);
+}
+
+static void write_modules(prometheus_writer &out, const metrics_snapshot &s)
+{
+  uint8_t totalModules = s.banks * s.seriesModules;
+  char labels[32];
+
+  // Each family lists every module, invalid (not yet replied) modules are skipped
+  out.family("diybms_module_voltage_volts", "gauge", "Module (cell) voltage");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_voltage_volts", labels, s.modules[i].voltagemV / 1000.0f);
+    }
+  }
+
+  out.family("diybms_module_voltage_min_volts", "gauge", "Lowest module voltage since reset");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_voltage_min_volts", labels, s.modules[i].voltagemVMin / 1000.0f);
+    }
+  }
+
+  out.family("diybms_module_voltage_max_volts", "gauge", "Highest module voltage since reset");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_voltage_max_volts", labels, s.modules[i].voltagemVMax / 1000.0f);
+    }
+  }
+
+  // -40 indicates no sensor fitted
+  out.family("diybms_module_internal_temperature_celsius", "gauge", "Module internal (balance resistor) temperature");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid && s.modules[i].internalTemp != -40)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_internal_temperature_celsius", labels, (int32_t)s.modules[i].internalTemp);
+    }
+  }
+
+  out.family("diybms_module_external_temperature_celsius", "gauge", "Module external (cell) temperature");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid && s.modules[i].externalTemp != -40)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_external_temperature_celsius", labels, (int32_t)s.modules[i].externalTemp);
+    }
+  }
+
+  out.family("diybms_module_bypass", "gauge", "Module is balancing (1) or not (0)");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_bypass", labels, (uint32_t)(s.modules[i].inBypass ? 1 : 0));
+    }
+  }
+
+  out.family("diybms_module_bypass_overtemp", "gauge", "Module balancing stopped due to temperature");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_bypass_overtemp", labels, (uint32_t)(s.modules[i].bypassOverTemp ? 1 : 0));
+    }
+  }
+
+  out.family("diybms_module_bypass_pwm", "gauge", "Module balancing PWM duty");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_bypass_pwm", labels, (uint32_t)(s.modules[i].inBypass ? s.modules[i].PWMValue : 0));
+    }
+  }
+
+  // Module counters are 16 bit and wrap, rate() handles this as a counter reset
+  out.family("diybms_module_bad_packets_total", "counter", "Packets the module has received with errors");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_bad_packets_total", labels, (uint32_t)s.modules[i].badPacketCount);
+    }
+  }
+
+  out.family("diybms_module_packets_received_total", "counter", "Packets received by the module");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_packets_received_total", labels, (uint32_t)s.modules[i].PacketReceivedCount);
+    }
+  }
+
+  out.family("diybms_module_balance_current_total", "counter", "Module balance energy counter");
+  for (uint8_t i = 0; i < totalModules; i++)
+  {
+    if (s.modules[i].valid)
+    {
+      snprintf(labels, sizeof(labels), "bank=\"%u\",module=\"%u\"", i / s.seriesModules, i % s.seriesModules);
+      out.sample("diybms_module_balance_current_total", labels, (uint32_t)s.modules[i].BalanceCurrentCount);
+    }
+  }
+}
+
+static void write_banks_and_rules(prometheus_writer &out, const metrics_snapshot &s)
+{
+  char labels[64];
+
+  out.family("diybms_bank_voltage_volts", "gauge", "Total voltage of the bank");
+  for (uint8_t b = 0; b < s.banks; b++)
+  {
+    snprintf(labels, sizeof(labels), "bank=\"%u\"", b);
+    out.sample("diybms_bank_voltage_volts", labels, s.bankvoltage[b] / 1000.0f);
+  }
+
+  out.family("diybms_bank_voltage_range_volts", "gauge", "Difference between highest and lowest module in the bank");
+  for (uint8_t b = 0; b < s.banks; b++)
+  {
+    snprintf(labels, sizeof(labels), "bank=\"%u\"", b);
+    out.sample("diybms_bank_voltage_range_volts", labels, s.bankrange[b] / 1000.0f);
+  }
+
+  out.family("diybms_highest_bank_voltage_volts", "gauge", "Highest bank voltage");
+  out.sample("diybms_highest_bank_voltage_volts", nullptr, s.highestBankVoltage / 1000.0f);
+  out.family("diybms_lowest_bank_voltage_volts", "gauge", "Lowest bank voltage");
+  out.sample("diybms_lowest_bank_voltage_volts", nullptr, s.lowestBankVoltage / 1000.0f);
+  out.family("diybms_highest_bank_range_volts", "gauge", "Highest voltage range of any bank");
+  out.sample("diybms_highest_bank_range_volts", nullptr, s.highestBankRange / 1000.0f);
+  out.family("diybms_highest_cell_voltage_volts", "gauge", "Highest module voltage");
+  out.sample("diybms_highest_cell_voltage_volts", nullptr, s.highestCellVoltage / 1000.0f);
+  out.family("diybms_lowest_cell_voltage_volts", "gauge", "Lowest module voltage");
+  out.sample("diybms_lowest_cell_voltage_volts", nullptr, s.lowestCellVoltage / 1000.0f);
+  out.family("diybms_highest_external_temperature_celsius", "gauge", "Highest module external temperature");
+  out.sample("diybms_highest_external_temperature_celsius", nullptr, (int32_t)s.highestExternalTemp);
+  out.family("diybms_lowest_external_temperature_celsius", "gauge", "Lowest module external temperature");
+  out.sample("diybms_lowest_external_temperature_celsius", nullptr, (int32_t)s.lowestExternalTemp);
+  out.family("diybms_highest_internal_temperature_celsius", "gauge", "Highest module internal temperature");
+  out.sample("diybms_highest_internal_temperature_celsius", nullptr, (int32_t)s.highestInternalTemp);
+  out.family("diybms_lowest_internal_temperature_celsius", "gauge", "Lowest module internal temperature");
+  out.sample("diybms_lowest_internal_temperature_celsius", nullptr, (int32_t)s.lowestInternalTemp);
+
+  out.family("diybms_rule_triggered", "gauge", "Rule is currently triggered (1) or not (0)");
+  for (uint8_t r = 0; r <= MAXIMUM_RuleNumber; r++)
+  {
+    snprintf(labels, sizeof(labels), "rule=\"%u\",name=\"%s\"", r, Rules::RuleTextDescription.at(r).c_str());
+    out.sample("diybms_rule_triggered", labels, (uint32_t)(s.rule_outcome[r] ? 1 : 0));
+  }
+  out.family("diybms_rules_active", "gauge", "Number of triggered rules");
+  out.sample("diybms_rules_active", nullptr, (uint32_t)s.active_rule_count);
+
+  out.family("diybms_relay_state", "gauge", "Relay energised (1) or not (0)");
+  for (uint8_t r = 0; r < RELAY_TOTAL; r++)
+  {
+    snprintf(labels, sizeof(labels), "relay=\"%u\"", r);
+    out.sample("diybms_relay_state", labels, (uint32_t)(s.relay[r] == RelayState::RELAY_ON ? 1 : 0));
+  }
+
+  out.family("diybms_charge_mode", "gauge", "Charging mode (see ChargingMode)");
+  out.sample("diybms_charge_mode", nullptr, (uint32_t)s.chargeMode);
+
+  // Only active codes are output
+  out.family("diybms_error", "gauge", "Active controller error");
+  for (auto v : s.errors)
+  {
+    if (v != InternalErrorCode::NoError)
+    {
+      snprintf(labels, sizeof(labels), "code=\"%u\",name=\"%s\"", v, Rules::InternalErrorCodeDescription.at(v).c_str());
+      out.sample("diybms_error", labels, (uint32_t)1);
+    }
+  }
+  out.family("diybms_warning", "gauge", "Active controller warning");
+  for (auto v : s.warnings)
+  {
+    if (v != InternalWarningCode::NoWarning)
+    {
+      snprintf(labels, sizeof(labels), "code=\"%u\",name=\"%s\"", v, Rules::InternalWarningCodeDescription.at(v).c_str());
+      out.sample("diybms_warning", labels, (uint32_t)1);
+    }
+  }
+}
+
+static void write_current_monitor(prometheus_writer &out, const metrics_snapshot &s)
+{
+  if (!s.currentValid)
+  {
+    return;
+  }
+
+  out.family("diybms_current_voltage_volts", "gauge", "Current monitor voltage");
+  out.sample("diybms_current_voltage_volts", nullptr, s.current.modbus.voltage, 4);
+  out.family("diybms_current_amperes", "gauge", "Current monitor current, negative is discharging");
+  out.sample("diybms_current_amperes", nullptr, s.current.modbus.current, 4);
+  out.family("diybms_current_power_watts", "gauge", "Current monitor power");
+  out.sample("diybms_current_power_watts", nullptr, s.current.modbus.power, 2);
+  out.family("diybms_current_state_of_charge_percent", "gauge", "State of charge");
+  out.sample("diybms_current_state_of_charge_percent", nullptr, s.current.stateofcharge, 2);
+  out.family("diybms_current_temperature_celsius", "gauge", "Current monitor temperature");
+  out.sample("diybms_current_temperature_celsius", nullptr, (int32_t)s.current.modbus.temperature);
+  out.family("diybms_current_milliamphour_in_total", "counter", "Lifetime charge into the battery, not reset by SOC calibration");
+  out.sample("diybms_current_milliamphour_in_total", nullptr, (uint32_t)s.current.modbus.milliamphour_in);
+  out.family("diybms_current_milliamphour_out_total", "counter", "Lifetime charge out of the battery, not reset by SOC calibration");
+  out.sample("diybms_current_milliamphour_out_total", nullptr, (uint32_t)s.current.modbus.milliamphour_out);
+  out.family("diybms_current_daily_milliamphour_in", "gauge", "Charge into the battery today");
+  out.sample("diybms_current_daily_milliamphour_in", nullptr, (uint32_t)s.current.modbus.daily_milliamphour_in);
+  out.family("diybms_current_daily_milliamphour_out", "gauge", "Charge out of the battery today");
+  out.sample("diybms_current_daily_milliamphour_out", nullptr, (uint32_t)s.current.modbus.daily_milliamphour_out);
+}
+
+static void write_controller(prometheus_writer &out, const metrics_snapshot &s)
+{
+  char labels[48];
+
+  out.family("diybms_modules_found", "gauge", "Number of modules replying");
+  out.sample("diybms_modules_found", nullptr, (uint32_t)s.totalModulesFound);
+  out.family("diybms_packets_sent_total", "counter", "Packets sent to the modules");
+  out.sample("diybms_packets_sent_total", nullptr, s.packetsGenerated);
+  out.family("diybms_packets_received_total", "counter", "Packets received from the modules");
+  out.sample("diybms_packets_received_total", nullptr, s.packetsReceived);
+  out.family("diybms_packets_crc_errors_total", "counter", "Packets received with a bad CRC");
+  out.sample("diybms_packets_crc_errors_total", nullptr, (uint32_t)s.totalCRCErrors);
+  out.family("diybms_packets_out_of_sequence_total", "counter", "Packets received out of sequence");
+  out.sample("diybms_packets_out_of_sequence_total", nullptr, (uint32_t)s.totalOutofSequenceErrors);
+  out.family("diybms_packets_ignored_total", "counter", "Packets received but not processed");
+  out.sample("diybms_packets_ignored_total", nullptr, (uint32_t)s.totalNotProcessedErrors);
+  out.family("diybms_packet_roundtrip_seconds", "gauge", "Time for a packet to pass through every module");
+  out.sample("diybms_packet_roundtrip_seconds", nullptr, s.packetTimerMillisecond / 1000.0f);
+  out.family("diybms_packet_queue_length", "gauge", "Packets waiting to be sent to the modules");
+  out.sample("diybms_packet_queue_length", nullptr, (uint32_t)s.queueLength);
+
+  out.family("diybms_canbus_sent_total", "counter", "CAN messages sent");
+  out.sample("diybms_canbus_sent_total", nullptr, s.can_sent);
+  out.family("diybms_canbus_received_total", "counter", "CAN messages received");
+  out.sample("diybms_canbus_received_total", nullptr, s.can_received);
+  out.family("diybms_canbus_send_failed_total", "counter", "CAN messages which failed to send");
+  out.sample("diybms_canbus_send_failed_total", nullptr, s.can_failed);
+  out.family("diybms_canbus_receive_errors_total", "counter", "CAN receive errors");
+  out.sample("diybms_canbus_receive_errors_total", nullptr, s.can_received_error);
+
+  out.family("diybms_uptime_seconds", "counter", "Time since the controller started");
+  out.sample("diybms_uptime_seconds", nullptr, s.uptime);
+  out.family("diybms_heap_free_bytes", "gauge", "Free heap");
+  out.sample("diybms_heap_free_bytes", nullptr, s.freeHeap);
+  out.family("diybms_heap_min_free_bytes", "gauge", "Lowest free heap since start");
+  out.sample("diybms_heap_min_free_bytes", nullptr, s.minFreeHeap);
+
+  out.family("diybms_task_stack_free_bytes", "gauge", "Task stack high water mark (unused stack)");
+  for (uint8_t i = 0; i < s.taskCount; i++)
+  {
+    snprintf(labels, sizeof(labels), "task=\"%s\"", s.tasks[i].name);
+    out.sample("diybms_task_stack_free_bytes", labels, s.tasks[i].hwm);
+  }
+}
+
+/// @brief Prometheus scrape endpoint
+/// @param req Incoming HTTPD request handle
+/// @return Error/success status
+esp_err_t metrics_handler(httpd_req_t *req)
+{
+  if (metrics_mutex == nullptr)
+  {
+    metrics_mutex = xSemaphoreCreateMutex();
+  }
+
+  http_buffer buffer;
+  if (!buffer || xSemaphoreTake(metrics_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
+  {
+    return http_buffer_send_busy(req);
+  }
+
+  take_snapshot(&snapshot);
+
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+  prometheus_writer out(req, buffer.data(), buffer.size());
+  write_modules(out, snapshot);
+  write_banks_and_rules(out, snapshot);
+  write_current_monitor(out, snapshot);
+  write_controller(out, snapshot);
+  esp_err_t result = out.finish();
+
+  xSemaphoreGive(metrics_mutex);
+
+  return result;
+}
@@ -0,0 +1,544 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-ws";
+
+#include "webserver_websocket.h"
+#include "webserver_json_requests.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+// Live telemetry pushed to the browser over the /ws websocket.
+//
+// When a browser connects it receives a full frame (every module), after each completed
+// scan of the modules it receives a delta containing only the modules which have changed.
+//
+// Each client has to acknowledge a frame before the next one is sent, a slow client simply
+// misses updates and is caught up later with the modules which changed in the meantime.
+// Clients which are at the same point receive the same frames, so these are only
+// generated once regardless of the number of browsers connected.
+//
+// Frames (all JSON text)
+//  {"t":"reset","n":<modules>}                   Start of a full frame, client clears its values
+//  {"t":"m","m":[[index,mV,min mV,max mV,int temp,ext temp,flags,pwm,badpkt,pktrecvd,balcurrent],...]}
+//                                                 Module values, invalid modules are sent as [index]
+//  {"t":"s","g":<generation>,...}                 Summary (same values as monitor2), end of update
+//
+// Client replies with "ack" (or "ackd" to also be sent modules when only their packet counters change)
+// and can send "full" to request a full frame.
+
+// Minimum time between updates sent to a single client
+static constexpr int64_t TELEMETRY_MIN_INTERVAL_US = 1000 * 1000;
+// Assume the acknowledgement has been lost after this time
+static constexpr int64_t TELEMETRY_ACK_TIMEOUT_US = 10 * 1000 * 1000;
+
+// Bitmask values for ws_module_values.flags
+static constexpr uint8_t TELEMETRY_FLAG_VALID = 0x01;
+static constexpr uint8_t TELEMETRY_FLAG_BYPASS = 0x02;
+static constexpr uint8_t TELEMETRY_FLAG_BYPASSHOT = 0x04;
+
+struct ws_module_values
+{
+  uint16_t voltagemV;
+  uint16_t voltagemVMin;
+  uint16_t voltagemVMax;
+  uint16_t PWMValue;
+  int8_t internalTemp;
+  int8_t externalTemp;
+  uint8_t flags;
+};
+
+struct ws_module_counters
+{
+  uint16_t badPacketCount;
+  uint16_t PacketReceivedCount;
+  uint16_t BalanceCurrentCount;
+};
+
+struct ws_telemetry_table
+{
+  ws_module_values values[maximum_controller_cell_modules];
+  ws_module_counters counters[maximum_controller_cell_modules];
+  // Generation the values/counters of each module last changed
+  uint32_t value_generation[maximum_controller_cell_modules];
+  uint32_t counter_generation[maximum_controller_cell_modules];
+  uint32_t generation;
+  uint8_t modules;
+};
+
+struct ws_telemetry_client
+{
+  int fd;
+  bool in_use;
+  bool full_required;
+  bool awaiting_ack;
+  // Client also wants modules where only the packet counters have changed (modules page)
+  bool detail;
+  uint32_t generation;
+  int64_t sent_time;
+};
+
+// Updated by the snapshot task after every scan
+static ws_telemetry_table latest;
+// Private copy used by the httpd task whilst sending
+static ws_telemetry_table working;
+static SemaphoreHandle_t telemetry_mutex = nullptr;
+
+// Only accessed from the httpd task
+static ws_telemetry_client clients[WEBSOCKET_MAX_TELEMETRY_CLIENTS];
+static websocket_telemetry_stats stats;
+static char wsbuf[1400];
+static char wssummary[1024];
+
+static volatile uint8_t client_count = 0;
+static volatile bool work_queued = false;
+
+static bool operator!=(const ws_module_values &a, const ws_module_values &b)
+{
+  return a.voltagemV != b.voltagemV || a.voltagemVMin != b.voltagemVMin || a.voltagemVMax != b.voltagemVMax ||
+         a.PWMValue != b.PWMValue || a.internalTemp != b.internalTemp || a.externalTemp != b.externalTemp ||
+         a.flags != b.flags;
+}
+
+static bool operator!=(const ws_module_counters &a, const ws_module_counters &b)
+{
+  return a.badPacketCount != b.badPacketCount || a.PacketReceivedCount != b.PacketReceivedCount ||
+         a.BalanceCurrentCount != b.BalanceCurrentCount;
+}
+
+static void telemetry_work(void *);
+
+static void queue_telemetry_work()
+{
+  if (_myserver == nullptr || work_queued)
+  {
+    return;
+  }
+
+  work_queued = true;
+  if (httpd_queue_work(_myserver, telemetry_work, nullptr) != ESP_OK)
+  {
+    work_queued = false;
+  }
+}
+
+/// @brief Take a copy of the module values, called when a scan of all the modules has completed
+void websocket_telemetry_snapshot()
+{
+  if (telemetry_mutex == nullptr)
+  {
+    telemetry_mutex = xSemaphoreCreateMutex();
+  }
+
+  if (xSemaphoreTake(telemetry_mutex, pdMS_TO_TICKS(50)) != pdTRUE)
+  {
+    return;
+  }
+
+  latest.generation++;
+  latest.modules = mysettings.totalNumberOfBanks * mysettings.totalNumberOfSeriesModules;
+
+  for (uint8_t i = 0; i < latest.modules; i++)
+  {
+    ws_module_values v = {};
+    ws_module_counters c = {};
+
+    if (cmi[i].valid)
+    {
+      v.flags = TELEMETRY_FLAG_VALID | (cmi[i].inBypass ? TELEMETRY_FLAG_BYPASS : 0) | (cmi[i].bypassOverTemp ? TELEMETRY_FLAG_BYPASSHOT : 0);
+      v.voltagemV = cmi[i].voltagemV;
+      v.voltagemVMin = cmi[i].voltagemVMin;
+      v.voltagemVMax = cmi[i].voltagemVMax;
+      v.PWMValue = cmi[i].inBypass ? cmi[i].PWMValue : 0;
+      v.internalTemp = cmi[i].internalTemp;
+      v.externalTemp = cmi[i].externalTemp;
+
+      c.badPacketCount = cmi[i].badPacketCount;
+      c.PacketReceivedCount = cmi[i].PacketReceivedCount;
+      c.BalanceCurrentCount = cmi[i].BalanceCurrentCount;
+    }
+
+    if (v != latest.values[i])
+    {
+      latest.values[i] = v;
+      latest.value_generation[i] = latest.generation;
+    }
+    if (c != latest.counters[i])
+    {
+      latest.counters[i] = c;
+      latest.counter_generation[i] = latest.generation;
+    }
+  }
+
+  xSemaphoreGive(telemetry_mutex);
+
+  if (client_count > 0)
+  {
+    queue_telemetry_work();
+  }
+}
+
+void websocket_telemetry_get_stats(websocket_telemetry_stats *s)
+{
+  *s = stats;
+}
+
+static void remove_client(ws_telemetry_client *c)
+{
+  if (c->in_use)
+  {
+    c->in_use = false;
+    client_count--;
+    stats.clients = client_count;
+    ESP_LOGI(TAG, "Telemetry client fd=%i removed", c->fd);
+  }
+}
+
+static ws_telemetry_client *find_client(int fd)
+{
+  for (auto &c : clients)
+  {
+    if (c.in_use && c.fd == fd)
+    {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+/// @brief Send a text frame to every client in the group
+/// @param group bitmask of the clients array
+/// @return bitmask of clients still connected
+static uint8_t send_to_group(uint8_t group, const char *buffer, size_t length)
+{
+  httpd_ws_frame_t ws_pkt = {};
+  ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+  ws_pkt.payload = (uint8_t *)buffer;
+  ws_pkt.len = length;
+
+  for (uint8_t n = 0; n < WEBSOCKET_MAX_TELEMETRY_CLIENTS; n++)
+  {
+    if ((group & (1U << n)) == 0)
+    {
+      continue;
+    }
+
+    if (httpd_ws_send_frame_async(_myserver, clients[n].fd, &ws_pkt) == ESP_OK)
+    {
+      stats.frames_sent++;
+      stats.bytes_sent += length;
+    }
+    else
+    {
+      stats.send_failures++;
+      ESP_LOGW(TAG, "Send to fd=%i failed", clients[n].fd);
+      httpd_sess_trigger_close(_myserver, clients[n].fd);
+      remove_client(&clients[n]);
+      group &= ~(1U << n);
+    }
+  }
+
+  return group;
+}
+
+static int print_module(char *buffer, size_t bufferLen, uint8_t i)
+{
+  const ws_module_values &v = working.values[i];
+  const ws_module_counters &c = working.counters[i];
+
+  if ((v.flags & TELEMETRY_FLAG_VALID) == 0)
+  {
+    return snprintf(buffer, bufferLen, "[%u]", i);
+  }
+
+  int used = snprintf(buffer, bufferLen, "[%u,%u,%u,%u,", i, v.voltagemV, v.voltagemVMin, v.voltagemVMax);
+
+  // -40 indicates no sensor fitted
+  if (v.internalTemp != -40)
+  {
+    used += snprintf(&buffer[used], bufferLen - used, "%i,", v.internalTemp);
+  }
+  else
+  {
+    used += snprintf(&buffer[used], bufferLen - used, "null,");
+  }
+  if (v.externalTemp != -40)
+  {
+    used += snprintf(&buffer[used], bufferLen - used, "%i,", v.externalTemp);
+  }
+  else
+  {
+    used += snprintf(&buffer[used], bufferLen - used, "null,");
+  }
+
+  used += snprintf(&buffer[used], bufferLen - used, "%u,%u,%u,%u,%u]",
+                   (v.flags >> 1), v.PWMValue, c.badPacketCount, c.PacketReceivedCount, c.BalanceCurrentCount);
+  return used;
+}
+
+/// @brief Send module values (changed since generation) to the group of clients
+/// @return bitmask of clients still connected
+static uint8_t send_modules(uint8_t group, bool full, bool detail, uint32_t generation)
+{
+  const char *header = "{\"t\":\"m\",\"m\":[";
+  const size_t header_len = strlen(header);
+
+  if (full)
+  {
+    int len = snprintf(wsbuf, sizeof(wsbuf), "{\"t\":\"reset\",\"n\":%u}", working.modules);
+    group = send_to_group(group, wsbuf, len);
+  }
+
+  size_t used = 0;
+  for (uint8_t i = 0; i < working.modules && group; i++)
+  {
+    if (!full && working.value_generation[i] <= generation && !(detail && working.counter_generation[i] > generation))
+    {
+      // Client already has these values
+      continue;
+    }
+
+    char item[80];
+    int item_len = print_module(item, sizeof(item), i);
+
+    // Leave space for the closing brackets
+    if (used + item_len + 4 > sizeof(wsbuf))
+    {
+      used += snprintf(&wsbuf[used], sizeof(wsbuf) - used, "]}");
+      group = send_to_group(group, wsbuf, used);
+      used = 0;
+    }
+
+    if (used == 0)
+    {
+      memcpy(wsbuf, header, header_len);
+      used = header_len;
+    }
+    else
+    {
+      wsbuf[used++] = ',';
+    }
+
+    memcpy(&wsbuf[used], item, item_len);
+    used += item_len;
+  }
+
+  if (used > 0 && group)
+  {
+    used += snprintf(&wsbuf[used], sizeof(wsbuf) - used, "]}");
+    group = send_to_group(group, wsbuf, used);
+  }
+
+  return group;
+}
+
+// Runs on the httpd task (via httpd_queue_work) so never competes with the request handlers
+static void telemetry_work(void *)
+{
+  work_queued = false;
+
+  if (telemetry_mutex == nullptr || client_count == 0)
+  {
+    return;
+  }
+
+  if (xSemaphoreTake(telemetry_mutex, pdMS_TO_TICKS(50)) != pdTRUE)
+  {
+    return;
+  }
+  working = latest;
+  xSemaphoreGive(telemetry_mutex);
+
+  const int64_t now = esp_timer_get_time();
+
+  // Work out which clients are ready to receive an update
+  uint8_t ready = 0;
+  for (uint8_t n = 0; n < WEBSOCKET_MAX_TELEMETRY_CLIENTS; n++)
+  {
+    auto &c = clients[n];
+    if (!c.in_use)
+    {
+      continue;
+    }
+
+    if (httpd_ws_get_fd_info(_myserver, c.fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+    {
+      // Browser has gone away
+      remove_client(&c);
+      continue;
+    }
+
+    if (c.awaiting_ack)
+    {
+      if (now - c.sent_time < TELEMETRY_ACK_TIMEOUT_US)
+      {
+        // Still busy with the previous update, it will catch up later
+        stats.backpressure_skipped++;
+        continue;
+      }
+      c.awaiting_ack = false;
+    }
+
+    if (!c.full_required && (c.generation == working.generation || now - c.sent_time < TELEMETRY_MIN_INTERVAL_US))
+    {
+      continue;
+    }
+
+    ready |= (1U << n);
+  }
+
+  if (ready == 0)
+  {
+    return;
+  }
+
+  // Summary is the same for every client
+  json_writer<fixed_buffer_sink> summary(fixed_buffer_sink(), wssummary, sizeof(wssummary));
+  summary.beginObject();
+  summary.addString("t", "s");
+  summary.addUInt("g", working.generation);
+  writeMonitorSummary(summary);
+  writeBankSummary(summary);
+  summary.endObject();
+
+  if (summary.finish() != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Summary truncated");
+    return;
+  }
+  size_t summary_len = summary.length();
+
+  // Clients at the same generation receive identical frames, so group them together
+  while (ready)
+  {
+    uint8_t first = __builtin_ctz(ready);
+    const auto &leader = clients[first];
+
+    uint8_t group = 0;
+    for (uint8_t n = first; n < WEBSOCKET_MAX_TELEMETRY_CLIENTS; n++)
+    {
+      if ((ready & (1U << n)) && clients[n].full_required == leader.full_required &&
+          clients[n].generation == leader.generation && clients[n].detail == leader.detail)
+      {
+        group |= (1U << n);
+      }
+    }
+    ready &= ~group;
+
+    const bool full = leader.full_required;
+    group = send_modules(group, full, leader.detail, leader.generation);
+
+    group = send_to_group(group, wssummary, summary_len);
+
+    for (uint8_t n = 0; n < WEBSOCKET_MAX_TELEMETRY_CLIENTS; n++)
+    {
+      if (group & (1U << n))
+      {
+        clients[n].full_required = false;
+        clients[n].awaiting_ack = true;
+        clients[n].generation = working.generation;
+        clients[n].sent_time = now;
+
+        if (full)
+        {
+          stats.full_updates++;
+        }
+        else
+        {
+          stats.delta_updates++;
+        }
+      }
+    }
+  }
+}
+
+/// @brief Websocket handler for /ws, called on the initial handshake and then for each frame the browser sends
+esp_err_t ws_handler(httpd_req_t *req)
+{
+  int fd = httpd_req_to_sockfd(req);
+
+  if (req->method == HTTP_GET)
+  {
+    // Handshake has completed, register for telemetry
+    ws_telemetry_client *c = find_client(fd);
+    if (c == nullptr)
+    {
+      for (auto &slot : clients)
+      {
+        if (!slot.in_use)
+        {
+          c = &slot;
+          c->in_use = true;
+          client_count++;
+          break;
+        }
+      }
+    }
+
+    if (c == nullptr)
+    {
+      ESP_LOGW(TAG, "Too many telemetry clients");
+      // Closes the connection, browser will fall back to polling
+      return ESP_FAIL;
+    }
+
+    c->fd = fd;
+    c->full_required = true;
+    c->awaiting_ack = false;
+    c->detail = false;
+    c->generation = 0;
+    c->sent_time = 0;
+    stats.clients = client_count;
+
+    ESP_LOGI(TAG, "Telemetry client fd=%i connected", fd);
+
+    // Send the full frame straight away, rather than waiting for the next scan
+    queue_telemetry_work();
+    return ESP_OK;
+  }
+
+  uint8_t command[8];
+  httpd_ws_frame_t ws_pkt = {};
+  ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+
+  // Get the frame length
+  esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
+  if (ret != ESP_OK)
+  {
+    return ret;
+  }
+
+  if (ws_pkt.len >= sizeof(command))
+  {
+    ESP_LOGW(TAG, "Frame too large %u", ws_pkt.len);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  ws_pkt.payload = command;
+  ret = httpd_ws_recv_frame(req, &ws_pkt, sizeof(command) - 1);
+  if (ret != ESP_OK)
+  {
+    return ret;
+  }
+  command[ws_pkt.len] = 0;
+
+  ws_telemetry_client *c = find_client(fd);
+  if (c == nullptr)
+  {
+    return ESP_OK;
+  }
+
+  if (strcmp((char *)command, "ack") == 0 || strcmp((char *)command, "ackd") == 0)
+  {
+    c->awaiting_ack = false;
+    c->detail = (command[3] == 'd');
+  }
+  else if (strcmp((char *)command, "full") == 0)
+  {
+    c->awaiting_ack = false;
+    c->full_required = true;
+    queue_telemetry_work();
+  }
+
+  stats.clients = client_count;
+  return ESP_OK;
+}
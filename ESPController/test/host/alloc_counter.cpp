@@ -0,0 +1,76 @@
+#include "alloc_counter.h"
+
+#include <malloc.h>
+#include <string.h>
+
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t n, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+  void __libc_free(void *ptr);
+}
+
+static alloc_stats stats = {};
+
+static void counted(void *ptr)
+{
+  if (ptr == nullptr)
+  {
+    return;
+  }
+  stats.allocations++;
+  stats.bytes += malloc_usable_size(ptr);
+  if (stats.bytes > stats.peak_bytes)
+  {
+    stats.peak_bytes = stats.bytes;
+  }
+}
+
+static void released(void *ptr)
+{
+  if (ptr == nullptr)
+  {
+    return;
+  }
+  stats.frees++;
+  stats.bytes -= malloc_usable_size(ptr);
+}
+
+extern "C" void *malloc(size_t size)
+{
+  void *ptr = __libc_malloc(size);
+  counted(ptr);
+  return ptr;
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+  void *ptr = __libc_calloc(n, size);
+  counted(ptr);
+  return ptr;
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+  released(ptr);
+  void *result = __libc_realloc(ptr, size);
+  counted(result);
+  return result;
+}
+
+extern "C" void free(void *ptr)
+{
+  released(ptr);
+  __libc_free(ptr);
+}
+
+void alloc_counter_reset()
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+alloc_stats alloc_counter_get()
+{
+  return stats;
+}
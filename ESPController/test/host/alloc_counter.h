@@ -0,0 +1,22 @@
+#ifndef DIYBMS_HOST_ALLOC_COUNTER_H_
+#define DIYBMS_HOST_ALLOC_COUNTER_H_
+
+// Counts heap use of the benchmarks.  alloc_counter.cpp replaces malloc/free (glibc only),
+// operator new uses malloc so C++ allocations are included.
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct alloc_stats
+{
+  uint64_t allocations;
+  uint64_t frees;
+  // Bytes currently allocated since the last reset, and the highest value
+  int64_t bytes;
+  int64_t peak_bytes;
+};
+
+void alloc_counter_reset();
+alloc_stats alloc_counter_get();
+
+#endif
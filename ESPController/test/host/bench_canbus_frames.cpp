@@ -0,0 +1,110 @@
+// Frame generation of the CAN protocols: encoding all frames into the cache (canbus_frames_rebuild,
+// once per rules pass) against sending a cached frame (canbus_frame_send) and a scheduler pass.
+//
+// Before the frame cache every send ran its encoder, the "encode at send" figure is the rebuild
+// time shared out over the frames of the protocol plus the cached send.  The Victron frame rate
+// is the one measured by test_canbus_sim (840 frames a minute).  The transport does nothing so
+// only the controller code is timed, the fixture is the simulator's (canbus_sim_reset).
+
+#include "canbus_sim.h"
+#include "canbus_frames.h"
+#include "canbus_scheduler.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <esp_timer.h>
+
+static const int ITERATIONS = 20000;
+static const uint32_t VICTRON_FRAMES_PER_MINUTE = 840;
+static const uint32_t RULES_PASSES_PER_MINUTE = 60000 / CANBUS_SIM_RULES_PERIOD_MS;
+
+static esp_err_t null_transmit(const twai_message_t &message)
+{
+  return ESP_OK;
+}
+
+static esp_err_t null_receive(twai_message_t &message, uint32_t timeout_ms)
+{
+  return ESP_ERR_TIMEOUT;
+}
+
+static uint8_t null_tx_space()
+{
+  return CANBUS_SIM_TX_QUEUE_LENGTH;
+}
+
+static void null_recover()
+{
+}
+
+static esp_err_t null_wait_tx_done(uint32_t timeout_ms)
+{
+  return ESP_OK;
+}
+
+static const canbus_transport null_transport = {
+    .name = "null",
+    .transmit = null_transmit,
+    .receive = null_receive,
+    .tx_space = null_tx_space,
+    .recover = null_recover,
+    .wait_tx_done = null_wait_tx_done,
+};
+
+template <typename F>
+static double time_ns(F f)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    f(i);
+  }
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+}
+
+static void bench(const char *name, CanBusProtocolEmulation protocol)
+{
+  canbus_sim_reset(protocol);
+  canbus_set_transport(&null_transport);
+  canbus_sim_rules();
+
+  can_frame_stats list[CANBUS_FRAME_CACHE_SIZE];
+  can_frame_cache_stats cache;
+  uint8_t frames = canbus_frames_get_stats(list, CANBUS_FRAME_CACHE_SIZE, &cache);
+
+  double rebuild_ns = time_ns([](int) { canbus_frames_rebuild(); });
+  double send_ns = time_ns([&](int i) {
+    uint32_t identifier = list[i % frames].identifier;
+    canbus_frame_send(identifier, identifier);
+  });
+  double encode_ns = rebuild_ns / frames;
+
+  printf("  %-12s %2u frames  rebuild %7.0f ns (%5.0f ns/frame)  cached send %5.0f ns  encode at send %5.0f ns\n",
+         name, frames, rebuild_ns, encode_ns, send_ns, encode_ns + send_ns);
+
+  if (protocol == CanBusProtocolEmulation::CANBUS_VICTRON)
+  {
+    double before_us = VICTRON_FRAMES_PER_MINUTE * (encode_ns + send_ns) / 1000.0;
+    double after_us = (RULES_PASSES_PER_MINUTE * rebuild_ns + VICTRON_FRAMES_PER_MINUTE * send_ns) / 1000.0;
+    printf("  %-12s per minute: encode at send %.1f us, rebuild per rules pass + cached sends %.1f us\n", "", before_us, after_us);
+
+    // Scheduler pass with nothing due (most wakeups of canbus_tx) and a pass a second later, which
+    // sends every message
+    double idle_ns = time_ns([](int) { canbus_scheduler_service(); });
+    double due_ns = time_ns([](int) {
+      host_clock_advance(1000 * 1000);
+      canbus_scheduler_service();
+    });
+    printf("  %-12s scheduler pass: nothing due %5.0f ns, 1 second later %6.0f ns\n", "", idle_ns, due_ns);
+  }
+}
+
+int main()
+{
+  host_clock_set(1000000);
+  printf("CAN frame generation, %d passes per timing, %u rules passes a minute\n", ITERATIONS, RULES_PASSES_PER_MINUTE);
+  bench("Victron", CanBusProtocolEmulation::CANBUS_VICTRON);
+  bench("Pylontech", CanBusProtocolEmulation::CANBUS_PYLONTECH);
+  bench("PylonForce", CanBusProtocolEmulation::CANBUS_PYLONFORCEH2);
+  return 0;
+}
@@ -0,0 +1,174 @@
+// Receive path of canbus_rx on a busy PylonForce H2 bus, before and after the hardware acceptance
+// filter and dispatch table.
+//
+// The bus trace is the inverter's requests plus unrelated traffic (other battery packs, a J1939
+// style charger and meter), at the rate of a fully loaded 500 kbit/s bus.  The TWAI filter is modelled
+// (twai_filter_model.h) to count the frames which still wake the canbus_rx task, the time per frame
+// is measured for the task's own work.  Times are for this host, the ESP32 adds an interrupt and
+// a task switch for every frame which reaches the receive queue.
+
+#include "canbus_rx_fakes.h"
+#include "twai_filter_model.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+static const int ITERATIONS = 200;
+// Extended frames of 8 bytes are ~130 bits with stuffing, so 500 kbit/s carries ~3800 frames/s
+static const uint32_t BUS_FRAMES_PER_SECOND = 3800;
+
+static std::vector<twai_message_t> trace;
+
+static void add(uint32_t identifier, bool extended, uint8_t byte0)
+{
+  twai_message_t message = {};
+  message.identifier = identifier;
+  message.extd = extended;
+  message.data_length_code = 8;
+  message.data[0] = byte0;
+  trace.push_back(message);
+}
+
+static void build_trace()
+{
+  uint32_t seed = 1;
+  for (int i = 0; i < 4000; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    uint32_t r = (seed >> 16) % 100;
+    if (i % 400 == 0)
+    {
+      // Inverter requests (about 10 per second at this rate)
+      add(0x4200, true, (i / 400) % 2 ? 0x02 : 0x00);
+    }
+    else if (i % 400 == 200)
+    {
+      add(0x305, false, 0);
+    }
+    else if (r < 40)
+    {
+      // Replies from other packs (0x4210-0x42A0 + address)
+      add(0x4210 + ((seed >> 8) % 10) * 0x10 + (seed & 0x7), true, 0);
+    }
+    else if (r < 75)
+    {
+      // J1939 style charger/meter traffic
+      add(0x18FF0000 | ((seed >> 4) & 0xFFFF), true, 0);
+    }
+    else
+    {
+      // Other standard identifiers
+      add(0x100 + (seed >> 5) % 0x600, false, 0);
+    }
+  }
+}
+
+// canbus_rx before the dispatch table (v4 main.cpp), the data copy and both debug lines are kept
+// as they were, the log level is checked at run time like the firmware
+static volatile esp_log_level_t log_level = ESP_LOG_INFO;
+
+static void receive_before(const twai_message_t &message)
+{
+  if (log_level >= ESP_LOG_DEBUG)
+  {
+    printf("CANBUS received message ID: %0x, DLC: %d, flags: %0x\n",
+           message.identifier, message.data_length_code, message.flags);
+  }
+
+  uint8_t data[8];
+  for (uint8_t i = 0; i < message.data_length_code; i++)
+  {
+    data[i] = message.data[i];
+  }
+  if (log_level >= ESP_LOG_DEBUG)
+  {
+    printf("CANBUS received message ID:%04x::%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x\n",
+           message.identifier, data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7]);
+  }
+
+  if (message.identifier == 0x305)
+  {
+    canbus_last_305_message_time = esp_timer_get_time();
+    canbus_no_request_messages_count = 0;
+  }
+
+  if (mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_PYLONFORCEH2)
+  {
+    switch (message.identifier)
+    {
+    case 0x8200:
+    case 0x620:
+    case 0x8210:
+    case 0x621:
+      canbus_no_request_messages_count = 0;
+      break;
+    case 0x4200:
+    case 0x420:
+    {
+      canbus_no_request_messages_count = 0;
+      bool extd = message.extd;
+      if (message.data[0] == 0x02)
+        pylonHV_send_message_info(extd, 0);
+      if (message.data[0] == 0x00)
+        pylonHV_send_message_status(extd, 0);
+    }
+    break;
+    }
+  }
+}
+
+static void receive_after(const twai_message_t &message)
+{
+  canbus_rx_dispatch(message, 0);
+}
+
+static void run(const char *name, const twai_filter_config_t &filter, void (*receive)(const twai_message_t &))
+{
+  std::vector<twai_message_t> queued;
+  for (const auto &message : trace)
+  {
+    if (twai_filter_accepts(filter, message))
+    {
+      queued.push_back(message);
+    }
+  }
+
+  rx_calls = {};
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    for (const auto &message : queued)
+    {
+      receive(message);
+    }
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  double ns_per_frame = queued.empty() ? 0 : (double)elapsed / ITERATIONS / queued.size();
+  double wakeups = (double)BUS_FRAMES_PER_SECOND * queued.size() / trace.size();
+  printf("  %-30s %5.1f%% of bus frames queued  %6.0f wakeups/s  %6.1f ns/frame  capacity %6.1f Mframes/s  task %.4f%% CPU  replies %u/%u\n",
+         name, 100.0 * queued.size() / trace.size(), wakeups, ns_per_frame,
+         ns_per_frame == 0 ? 0 : 1000.0 / ns_per_frame, wakeups * ns_per_frame / 1e7,
+         rx_calls.info / ITERATIONS, rx_calls.status / ITERATIONS);
+}
+
+int main()
+{
+  build_trace();
+  mysettings.canbusprotocol = CanBusProtocolEmulation::CANBUS_PYLONFORCEH2;
+  mysettings.canbus_multipack = false;
+  twai_filter_config_t filter = canbus_rx_select(mysettings.canbusprotocol);
+  twai_filter_config_t accept_all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+  printf("PylonForce H2, %u frame trace at %u frames/s, %d passes per timing\n", (unsigned)trace.size(), BUS_FRAMES_PER_SECOND, ITERATIONS);
+  printf("Filter code=0x%08x mask=0x%08x %s\n", filter.acceptance_code, filter.acceptance_mask, filter.single_filter ? "single" : "dual");
+  run("before (accept all, inline)", accept_all, receive_before);
+  run("table only (accept all)", accept_all, receive_after);
+  run("after (filter + table)", filter, receive_after);
+
+  can_rx_stats stats;
+  canbus_rx_get_stats(&stats);
+  printf("canbus_rx stats: received %u dispatched %u unhandled %u\n", stats.received, stats.dispatched, stats.unhandled);
+  return 0;
+}
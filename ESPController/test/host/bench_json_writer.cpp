@@ -0,0 +1,202 @@
+// Heap use and time per response of json_writer.hpp, and of ArduinoJson (DynamicJsonDocument) when it
+// is available, for a 128 cell monitoring response and one module settings response.
+//
+// ArduinoJson is found in the PlatformIO library folder (.pio/libdeps) or with -DARDUINOJSON_DIR=
+
+#include "alloc_counter.h"
+#include "json_writer.hpp"
+
+#include <chrono>
+#include <stdio.h>
+
+#if defined(HAVE_ARDUINOJSON)
+#define ARDUINOJSON_ENABLE_ARDUINO_STRING 0
+#define ARDUINOJSON_ENABLE_ARDUINO_STREAM 0
+#define ARDUINOJSON_ENABLE_ARDUINO_PRINT 0
+#include <ArduinoJson.h>
+#endif
+
+static const int CELLS = 128;
+static const int ITERATIONS = 2000;
+
+struct cell
+{
+  uint16_t voltage;
+  uint16_t min;
+  uint16_t max;
+  int8_t internal_temp;
+  int8_t external_temp;
+  bool bypass;
+  float load_resistance;
+  float calibration;
+};
+
+static cell cells[CELLS];
+// Same size as the pooled HTTP buffer handed to the handlers
+static char chunk[4096];
+static uint32_t bytes_sent = 0;
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *, const char *, size_t buf_len)
+{
+  bytes_sent += buf_len;
+  return ESP_OK;
+}
+
+static void monitor_writer()
+{
+  httpd_json_writer json(httpd_chunk_sink(nullptr), chunk, sizeof(chunk));
+  json.beginObject();
+  json.beginArray("voltages");
+  for (int i = 0; i < CELLS; i++)
+    json.addUInt(cells[i].voltage);
+  json.endArray();
+  json.beginArray("minvoltages");
+  for (int i = 0; i < CELLS; i++)
+    json.addUInt(cells[i].min);
+  json.endArray();
+  json.beginArray("maxvoltages");
+  for (int i = 0; i < CELLS; i++)
+    json.addUInt(cells[i].max);
+  json.endArray();
+  json.beginArray("inttemp");
+  for (int i = 0; i < CELLS; i++)
+    json.addInt(cells[i].internal_temp);
+  json.endArray();
+  json.beginArray("exttemp");
+  for (int i = 0; i < CELLS; i++)
+    json.addInt(cells[i].external_temp);
+  json.endArray();
+  json.beginArray("bypass");
+  for (int i = 0; i < CELLS; i++)
+    json.addBool(cells[i].bypass);
+  json.endArray();
+  json.endObject();
+  json.finish();
+}
+
+static void module_writer()
+{
+  httpd_json_writer json(httpd_chunk_sink(nullptr), chunk, sizeof(chunk));
+  json.beginObject();
+  json.beginObject("settings");
+  json.addUInt("bank", 0);
+  json.addUInt("module", 5);
+  json.addUInt("id", 5);
+  json.addUInt("ver", 440);
+  json.addUInt("code", 0x1234);
+  json.addBool("Cached", true);
+  json.addUInt("BypassOverTempShutdown", 65);
+  json.addUInt("BypassThresholdmV", 4100);
+  json.addFloat("LoadRes", cells[5].load_resistance);
+  json.addFloat("Calib", cells[5].calibration, 6);
+  json.addFloat("mVPerADC", 2.5F);
+  json.addUInt("IntBCoef", 4150);
+  json.addUInt("ExtBCoef", 4150);
+  json.addBool("Prohibited", false);
+  json.endObject();
+  json.endObject();
+  json.finish();
+}
+
+#if defined(HAVE_ARDUINOJSON)
+static char serialized[16384];
+
+static void monitor_arduinojson()
+{
+  DynamicJsonDocument doc(6 * JSON_ARRAY_SIZE(CELLS) + JSON_OBJECT_SIZE(6));
+  JsonObject root = doc.to<JsonObject>();
+  JsonArray v = root.createNestedArray("voltages");
+  for (int i = 0; i < CELLS; i++)
+    v.add(cells[i].voltage);
+  JsonArray mn = root.createNestedArray("minvoltages");
+  for (int i = 0; i < CELLS; i++)
+    mn.add(cells[i].min);
+  JsonArray mx = root.createNestedArray("maxvoltages");
+  for (int i = 0; i < CELLS; i++)
+    mx.add(cells[i].max);
+  JsonArray it = root.createNestedArray("inttemp");
+  for (int i = 0; i < CELLS; i++)
+    it.add(cells[i].internal_temp);
+  JsonArray et = root.createNestedArray("exttemp");
+  for (int i = 0; i < CELLS; i++)
+    et.add(cells[i].external_temp);
+  JsonArray bp = root.createNestedArray("bypass");
+  for (int i = 0; i < CELLS; i++)
+    bp.add(cells[i].bypass);
+  size_t n = serializeJson(doc, serialized, sizeof(serialized));
+  httpd_resp_send_chunk(nullptr, serialized, n);
+}
+
+static void module_arduinojson()
+{
+  // Same capacity as the old content_handler_modules
+  DynamicJsonDocument doc(2048);
+  JsonObject root = doc.to<JsonObject>();
+  JsonObject settings = root.createNestedObject("settings");
+  settings["bank"] = 0;
+  settings["module"] = 5;
+  settings["id"] = 5;
+  settings["ver"] = 440;
+  settings["code"] = 0x1234;
+  settings["Cached"] = true;
+  settings["BypassOverTempShutdown"] = 65;
+  settings["BypassThresholdmV"] = 4100;
+  settings["LoadRes"] = cells[5].load_resistance;
+  settings["Calib"] = cells[5].calibration;
+  settings["mVPerADC"] = 2.5F;
+  settings["IntBCoef"] = 4150;
+  settings["ExtBCoef"] = 4150;
+  settings["Prohibited"] = false;
+  size_t n = serializeJson(doc, serialized, sizeof(serialized));
+  httpd_resp_send_chunk(nullptr, serialized, n);
+}
+#endif
+
+static void run(const char *name, void (*response)())
+{
+  // Warm up, then measure one response for heap use and many for the time
+  response();
+
+  bytes_sent = 0;
+  alloc_counter_reset();
+  response();
+  alloc_stats heap = alloc_counter_get();
+  uint32_t size = bytes_sent;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    response();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-22s %6u bytes  %3llu allocations  %6lld peak heap bytes  %8.2f us/response\n",
+         name, size, (unsigned long long)heap.allocations, (long long)heap.peak_bytes,
+         elapsed / 1000.0 / ITERATIONS);
+}
+
+int main()
+{
+  for (int i = 0; i < CELLS; i++)
+  {
+    cells[i].voltage = 3300 + (i * 7) % 200;
+    cells[i].min = cells[i].voltage - 12;
+    cells[i].max = cells[i].voltage + 9;
+    cells[i].internal_temp = 20 + i % 15;
+    cells[i].external_temp = 18 + i % 10;
+    cells[i].bypass = (i % 9) == 0;
+    cells[i].load_resistance = 4.4F;
+    cells[i].calibration = 2.21F + i * 0.001F;
+  }
+
+  printf("%d cells, %d responses per timing\n", CELLS, ITERATIONS);
+  run("json_writer monitor", monitor_writer);
+  run("json_writer module", module_writer);
+#if defined(HAVE_ARDUINOJSON)
+  run("ArduinoJson monitor", monitor_arduinojson);
+  run("ArduinoJson module", module_arduinojson);
+#else
+  printf("ArduinoJson not found, comparison skipped (build the firmware once or set ARDUINOJSON_DIR)\n");
+#endif
+  return 0;
+}
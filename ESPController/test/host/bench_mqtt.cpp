@@ -0,0 +1,116 @@
+// Heap use and time of one MQTT cell publish cycle for 128 cells (8 banks of 16), the std::string
+// topics/payloads mqtt.cpp used to build against the topic table and payload arena of mqtt_format.cpp.
+//
+// Publishing is replaced by a function which reads the topic and payload, the copy esp-mqtt makes
+// into its outbox is the same for both and isn't included.
+
+#include "alloc_counter.h"
+#include "mqtt_before.h"
+#include "mqtt_format.h"
+
+#include <chrono>
+#include <stdio.h>
+
+static const uint8_t BANKS = 8;
+static const uint8_t SERIES = 16;
+static const int CELLS = BANKS * SERIES;
+static const int ITERATIONS = 2000;
+// Default topic from the settings
+static const char PREFIX[] = "emon/diybms";
+
+static CellModuleInfo cells[CELLS];
+static uint32_t bytes_published = 0;
+
+static void publish(const char *topic, const char *payload, size_t length)
+{
+  bytes_published += strlen(topic) + length + (payload[0] == '{' ? 0 : 1);
+}
+
+static bool detail = true;
+
+static void cycle_before()
+{
+  std::string status;
+  status.reserve(128);
+  for (uint8_t i = 0; i < CELLS; i++)
+  {
+    mqtt_before_cell_payload(status, cells[i], detail);
+    std::string topic = mqtt_before_cell_topic(PREFIX, i, SERIES);
+    publish(topic.c_str(), status.c_str(), status.length());
+  }
+}
+
+static mqtt_cell_topic_table cell_topics;
+static char payload_arena[MQTT_PAYLOAD_ARENA_SIZE];
+
+static void cycle_after()
+{
+  if (!mqtt_format_cell_topics(&cell_topics, PREFIX, BANKS, SERIES))
+  {
+    return;
+  }
+  for (uint8_t i = 0; i < CELLS; i++)
+  {
+    mqtt_payload_writer json(fixed_buffer_sink(), payload_arena, sizeof(payload_arena));
+    mqtt_cell_payload(json, cells[i], detail);
+    json.finish();
+    publish(mqtt_cell_topic(cell_topics, i), payload_arena, json.length());
+  }
+}
+
+static void measure(const char *name, void (*cycle)())
+{
+  bytes_published = 0;
+  alloc_counter_reset();
+  cycle();
+  alloc_stats heap = alloc_counter_get();
+  uint32_t size = bytes_published;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    cycle();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-26s %6u bytes  %4llu allocations/cycle  %5lld peak heap bytes  %6.3f us/publish\n",
+         name, size, (unsigned long long)heap.allocations, (long long)heap.peak_bytes,
+         elapsed / 1000.0 / ITERATIONS / CELLS);
+}
+
+int main()
+{
+  for (int i = 0; i < CELLS; i++)
+  {
+    memset(&cells[i], 0, sizeof(CellModuleInfo));
+    cells[i].valid = true;
+    cells[i].voltagemV = 3300 + (i * 7) % 200;
+    cells[i].voltagemVMin = cells[i].voltagemV - 12;
+    cells[i].voltagemVMax = cells[i].voltagemV + 9;
+    cells[i].internalTemp = 20 + i % 15;
+    cells[i].externalTemp = 18 + i % 10;
+    cells[i].inBypass = (i % 9) == 0;
+    cells[i].PWMValue = (i * 13) % 256;
+    cells[i].badPacketCount = i;
+    cells[i].BalanceCurrentCount = 1000 + i;
+  }
+
+  printf("%d cells, topic prefix \"%s\", %d cycles per timing\n", CELLS, PREFIX, ITERATIONS);
+
+  // First cycle after connecting formats the cell topics
+  alloc_counter_reset();
+  cycle_after();
+  alloc_stats first = alloc_counter_get();
+  printf("after, first cycle: %llu allocations (cell topic table)\n", (unsigned long long)first.allocations);
+
+  for (int d = 1; d >= 0; d--)
+  {
+    detail = d;
+    printf("%s cell values\n", detail ? "Detailed" : "Basic");
+    measure("  before (std::string)", cycle_before);
+    measure("  after (table + arena)", cycle_after);
+  }
+
+  free(cell_topics.arena);
+  return 0;
+}
@@ -0,0 +1,33 @@
+// Replaces the protocol code canbus_rx.cpp calls, so the receive path can be tested on its own.
+// Each call is counted.
+
+#include "canbus_rx_fakes.h"
+
+diybms_eeprom_settings mysettings;
+uint32_t canbus_no_request_messages_count = 0;
+int64_t canbus_last_305_message_time = 0;
+
+fake_rx_calls rx_calls = {};
+
+void pylonHV_send_message_info(bool extend, int64_t)
+{
+  rx_calls.info++;
+  rx_calls.extended = extend;
+}
+
+void pylonHV_send_message_status(bool extend, int64_t)
+{
+  rx_calls.status++;
+  rx_calls.extended = extend;
+}
+
+bool multipack_is_master()
+{
+  return true;
+}
+
+void multipack_receive(const twai_message_t &message, int64_t)
+{
+  rx_calls.multipack++;
+  rx_calls.multipack_identifier = message.identifier;
+}
@@ -0,0 +1,19 @@
+#ifndef DIYBMS_HOST_CANBUS_RX_FAKES_H_
+#define DIYBMS_HOST_CANBUS_RX_FAKES_H_
+
+#include "canbus_rx.h"
+#include "pylon_canbus.h"
+#include "canbus_multipack.h"
+
+struct fake_rx_calls
+{
+  uint32_t info;
+  uint32_t status;
+  uint32_t multipack;
+  uint32_t multipack_identifier;
+  bool extended;
+};
+
+extern fake_rx_calls rx_calls;
+
+#endif
@@ -0,0 +1,434 @@
+// Inverter simulator, see canbus_sim.h
+
+#include "canbus_sim.h"
+#include "canbus_frames.h"
+#include "canbus_scheduler.h"
+#include "canbus_multipack.h"
+#include "canbus_rx.h"
+#include "twai_filter_model.h"
+
+#include <esp_timer.h>
+
+// Globals of main.cpp used by the CAN code
+diybms_eeprom_settings mysettings;
+Rules rules;
+currentmonitoring_struct currentMonitor;
+std::string hostname;
+ControllerState _controller_state = ControllerState::Unknown;
+uint32_t canbus_messages_received = 0;
+uint32_t canbus_messages_sent = 0;
+uint32_t canbus_messages_failed_sent = 0;
+uint32_t canbus_no_request_messages_count = 0;
+int64_t canbus_last_305_message_time = 0;
+
+uint8_t TotalNumberOfCells() { return mysettings.totalNumberOfBanks * mysettings.totalNumberOfSeriesModules; }
+
+canbus_sim_state sim;
+CellModuleInfo sim_cells[CANBUS_SIM_CELLS];
+
+// 500 kbit/s
+static const int64_t bit_time_us = 2;
+
+/// @brief Bits on the bus for one frame, worst case bit stuffing and the 3 bit intermission
+uint32_t canbus_sim_frame_bits(uint8_t length, bool extended)
+{
+  uint32_t stuffed = (extended ? 54 : 34) + 8 * length;
+  return (extended ? 64 : 44) + 8 * length + (stuffed - 1) / 4 + 3;
+}
+
+static sim_frame &put_on_bus(uint32_t identifier, bool extended, const uint8_t *data, uint8_t length, bool from_inverter)
+{
+  int64_t now = esp_timer_get_time();
+  int64_t start = sim.bus_free_us > now ? sim.bus_free_us : now;
+  sim.bus_free_us = start + canbus_sim_frame_bits(length, extended) * bit_time_us;
+
+  sim_frame f = {};
+  f.time_us = sim.bus_free_us;
+  f.identifier = identifier;
+  f.extended = extended;
+  f.length = length > 8 ? 8 : length;
+  memcpy(f.data, data, f.length);
+  f.from_inverter = from_inverter;
+  sim.bus.push_back(f);
+  return sim.bus.back();
+}
+
+/// @brief Controller frames waiting for the bus, frames leave the queue when their last bit has been sent
+static uint32_t queued()
+{
+  int64_t now = esp_timer_get_time();
+  uint32_t count = 0;
+  for (auto it = sim.bus.rbegin(); it != sim.bus.rend() && it->time_us > now; ++it)
+  {
+    if (!it->from_inverter)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+static esp_err_t sim_transmit(const twai_message_t &message)
+{
+  sim.transmits++;
+  if (sim.bus_off)
+  {
+    sim.rejected++;
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (sim.fail_transmits > 0)
+  {
+    sim.fail_transmits--;
+    sim.rejected++;
+    return ESP_FAIL;
+  }
+  if (queued() >= CANBUS_SIM_TX_QUEUE_LENGTH)
+  {
+    // twai_transmit with no wait
+    sim.rejected++;
+    return ESP_ERR_TIMEOUT;
+  }
+  put_on_bus(message.identifier, message.extd != 0, message.data, message.data_length_code, false);
+  return ESP_OK;
+}
+
+static esp_err_t sim_receive(twai_message_t &message, uint32_t timeout_ms)
+{
+  // canbus_sim_run delivers the inverter frames straight to canbus_rx_dispatch
+  return ESP_ERR_TIMEOUT;
+}
+
+static uint8_t sim_tx_space()
+{
+  if (sim.bus_off)
+  {
+    // Same as the TWAI transport, recovery is started when there is no space
+    sim.recovers++;
+    return 0;
+  }
+  return CANBUS_SIM_TX_QUEUE_LENGTH - queued();
+}
+
+static void sim_recover()
+{
+  sim.recovers++;
+}
+
+static esp_err_t sim_wait_tx_done(uint32_t timeout_ms)
+{
+  if (sim.bus_off)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  int64_t now = esp_timer_get_time();
+  if (sim.bus_free_us <= now)
+  {
+    return ESP_OK;
+  }
+  // The calling task is blocked until the bus has sent the frames
+  if (sim.bus_free_us - now > (int64_t)timeout_ms * 1000)
+  {
+    host_clock_advance((int64_t)timeout_ms * 1000);
+    return ESP_ERR_TIMEOUT;
+  }
+  host_clock_set(sim.bus_free_us);
+  return ESP_OK;
+}
+
+const canbus_transport canbus_sim_transport = {
+    .name = "sim",
+    .transmit = sim_transmit,
+    .receive = sim_receive,
+    .tx_space = sim_tx_space,
+    .recover = sim_recover,
+    .wait_tx_done = sim_wait_tx_done,
+};
+
+static void configure(CanBusProtocolEmulation protocol)
+{
+  // The settings from DefaultConfiguration (settings.cpp) which the CAN code uses, with bank
+  // voltage rules for 16 cells
+  memset(&mysettings, 0, sizeof(mysettings));
+  mysettings.totalNumberOfBanks = 1;
+  mysettings.totalNumberOfSeriesModules = CANBUS_SIM_CELLS;
+  mysettings.canbusprotocol = protocol;
+  mysettings.canbusinverter = CanBusInverter::INVERTER_GENERIC;
+  mysettings.canbus_equipment_addr = 0;
+  mysettings.canbus_multipack = false;
+  mysettings.canbusbaud = 500;
+  mysettings.nominalbatcap = 280;
+  mysettings.chargevolt = 565;
+  mysettings.chargecurrent = 650;
+  mysettings.dischargecurrent = 650;
+  mysettings.dischargevolt = 488;
+  mysettings.chargetemplow = 0;
+  mysettings.chargetemphigh = 50;
+  mysettings.dischargetemplow = -30;
+  mysettings.dischargetemphigh = 55;
+  mysettings.cellminmv = 3050;
+  mysettings.cellmaxmv = 3450;
+  mysettings.kneemv = 3320;
+  mysettings.sensitivity = 30;
+  mysettings.current_value1 = 50;
+  mysettings.current_value2 = 3;
+  mysettings.cellmaxspikemv = 3550;
+  mysettings.dynamiccharge = true;
+  mysettings.stateofchargeresumevalue = 96;
+  mysettings.currentMonitoringEnabled = true;
+  mysettings.currentMonitoringDevice = CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS;
+
+  int32_t *value = mysettings.rulevalue;
+  int32_t *hysteresis = mysettings.rulehysteresis;
+  value[Rule::CurrentMonitorOverCurrentAmps] = 100;
+  value[Rule::ModuleOverVoltage] = 4150;
+  value[Rule::ModuleUnderVoltage] = 3000;
+  value[Rule::ModuleOverTemperatureExternal] = 50;
+  value[Rule::ModuleUnderTemperatureExternal] = 2;
+  value[Rule::ModuleOverTemperatureInternal] = 75;
+  value[Rule::ModuleUnderTemperatureInternal] = 5;
+  value[Rule::CurrentMonitorOverVoltage] = 3600 * CANBUS_SIM_CELLS;
+  value[Rule::CurrentMonitorUnderVoltage] = 3000 * CANBUS_SIM_CELLS;
+  value[Rule::BankOverVoltage] = 3600 * CANBUS_SIM_CELLS;
+  value[Rule::BankUnderVoltage] = 3000 * CANBUS_SIM_CELLS;
+  value[Rule::BankRange] = 30;
+  value[Rule::Timer1] = 60 * 8;
+  value[Rule::Timer2] = 60 * 17;
+  for (uint8_t i = 0; i < RELAY_RULES; i++)
+  {
+    hysteresis[i] = value[i];
+  }
+
+  hostname = "DIYBMS-00ABCDEF";
+  _controller_state = ControllerState::Running;
+
+  // 3.300V cells, highest 3.310V (cell 5), lowest 3.290V (cell 11),
+  // external temperatures 22C, highest 25C (cell 3), lowest 20C (cell 9)
+  memset(sim_cells, 0, sizeof(sim_cells));
+  for (uint8_t i = 0; i < CANBUS_SIM_CELLS; i++)
+  {
+    sim_cells[i].valid = true;
+    sim_cells[i].voltagemV = 3300;
+    sim_cells[i].internalTemp = 30;
+    sim_cells[i].externalTemp = 22;
+  }
+  sim_cells[5].voltagemV = 3310;
+  sim_cells[11].voltagemV = 3290;
+  sim_cells[3].externalTemp = 25;
+  sim_cells[9].externalTemp = 20;
+
+  // Discharging 12.5A at 52.5V, 65.4%
+  memset(&currentMonitor, 0, sizeof(currentMonitor));
+  currentMonitor.validReadings = true;
+  currentMonitor.timestamp = esp_timer_get_time();
+  currentMonitor.modbus.voltage = 52.5F;
+  currentMonitor.modbus.current = -12.5F;
+  currentMonitor.stateofcharge = 65.4F;
+}
+
+/// @brief Fixture settings and pack, empty bus, every CAN module starts again for the protocol
+void canbus_sim_reset(CanBusProtocolEmulation protocol)
+{
+  canbus_set_transport(&canbus_sim_transport);
+
+  // Switching through CANBUS_DISABLED clears the schedule state and the frame cache (with their statistics)
+  mysettings.canbusprotocol = CanBusProtocolEmulation::CANBUS_DISABLED;
+  canbus_scheduler_service();
+  canbus_frames_rebuild();
+
+  configure(protocol);
+  rules = Rules();
+
+  int64_t now = esp_timer_get_time();
+  sim.bus.clear();
+  sim.bus_off = false;
+  sim.fail_transmits = 0;
+  sim.inverter_period_ms = 1000;
+  sim.inverter_extended = true;
+  sim.inverter_request = 0x00;
+  sim.transmits = 0;
+  sim.rejected = 0;
+  sim.recovers = 0;
+  sim.filtered = 0;
+  sim.start_us = now;
+  sim.bus_free_us = now;
+  sim.next_rules_us = now;
+  sim.next_tx_us = now;
+  // The inverter starts talking after the controller
+  sim.next_inverter_us = now + 100000;
+  sim.filter = canbus_rx_select(protocol);
+}
+
+/// @brief The CAN related part of ProcessRules (main.cpp), then multi-pack and the frame cache as rules_task does
+void canbus_sim_rules()
+{
+  rules.ClearValues();
+  rules.ClearWarnings();
+  rules.ClearErrors();
+  rules.setRuleStatus(Rule::BMSError, false);
+
+  rules.highestBankRange = 0;
+  rules.numberOfBalancingModules = 0;
+  uint8_t cellid = 0;
+  for (uint8_t bank = 0; bank < mysettings.totalNumberOfBanks; bank++)
+  {
+    for (uint8_t i = 0; i < mysettings.totalNumberOfSeriesModules; i++)
+    {
+      rules.ProcessCell(bank, cellid, &sim_cells[cellid], mysettings.cellmaxmv);
+      cellid++;
+    }
+    rules.ProcessBank(bank);
+  }
+
+  rules.CalculateChargingMode(&mysettings, &currentMonitor);
+  rules.CalculateDynamicChargeVoltage(&mysettings, sim_cells);
+  rules.CalculateDynamicChargeCurrent(&mysettings);
+  rules.RunRules(mysettings.rulevalue, mysettings.rulehysteresis, false, 0, &currentMonitor);
+
+  multipack_update();
+  canbus_frames_rebuild();
+}
+
+/// @brief A frame from the inverter (or another pack), received by canbus_rx if it passes the acceptance filter
+void canbus_sim_inverter_send(uint32_t identifier, bool extended, const uint8_t *data, uint8_t length)
+{
+  sim_frame f = put_on_bus(identifier, extended, data, length, true);
+  if (f.time_us > esp_timer_get_time())
+  {
+    host_clock_set(f.time_us);
+  }
+
+  twai_message_t message = {};
+  message.extd = extended ? 1 : 0;
+  message.identifier = identifier;
+  message.data_length_code = f.length;
+  memcpy(message.data, f.data, f.length);
+
+  if (!twai_filter_accepts(sim.filter, message))
+  {
+    sim.filtered++;
+    return;
+  }
+  canbus_messages_received++;
+  canbus_rx_dispatch(message, esp_timer_get_time());
+}
+
+static void inverter_poll()
+{
+  uint8_t data[8] = {};
+  if (mysettings.canbusprotocol == CanBusProtocolEmulation::CANBUS_PYLONFORCEH2)
+  {
+    data[0] = sim.inverter_request;
+    if (sim.inverter_extended)
+    {
+      canbus_sim_inverter_send(0x4200, true, data, 8);
+    }
+    else
+    {
+      canbus_sim_inverter_send(0x420, false, data, 8);
+    }
+    return;
+  }
+  // Keep alive
+  canbus_sim_inverter_send(0x305, false, data, 8);
+}
+
+/// @brief Run the controller tasks, the bus and the inverter for ms
+void canbus_sim_run(uint32_t ms)
+{
+  int64_t end = esp_timer_get_time() + (int64_t)ms * 1000;
+
+  for (;;)
+  {
+    int64_t next = sim.next_rules_us < sim.next_tx_us ? sim.next_rules_us : sim.next_tx_us;
+    if (sim.inverter_period_ms > 0 && sim.next_inverter_us < next)
+    {
+      next = sim.next_inverter_us;
+    }
+    // Anything due at the end is left for the next call
+    if (next >= end)
+    {
+      break;
+    }
+    if (next > esp_timer_get_time())
+    {
+      host_clock_set(next);
+    }
+
+    if (sim.next_rules_us <= next)
+    {
+      canbus_sim_rules();
+      sim.next_rules_us += (int64_t)CANBUS_SIM_RULES_PERIOD_MS * 1000;
+    }
+    else if (sim.inverter_period_ms > 0 && sim.next_inverter_us <= next)
+    {
+      inverter_poll();
+      sim.next_inverter_us += (int64_t)sim.inverter_period_ms * 1000;
+    }
+    else
+    {
+      // canbus_tx
+      uint32_t wait_ms = canbus_scheduler_service();
+      uint32_t multipack_ms = multipack_service();
+      if (multipack_ms < wait_ms)
+      {
+        wait_ms = multipack_ms;
+      }
+      sim.next_tx_us = esp_timer_get_time() + (int64_t)wait_ms * 1000;
+    }
+  }
+
+  if (end > esp_timer_get_time())
+  {
+    host_clock_set(end);
+  }
+}
+
+uint32_t canbus_sim_count(uint32_t identifier, int64_t start_us)
+{
+  uint32_t count = 0;
+  for (const sim_frame &f : sim.bus)
+  {
+    if (!f.from_inverter && f.identifier == identifier && f.time_us >= start_us)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+const sim_frame *canbus_sim_last(uint32_t identifier)
+{
+  for (auto it = sim.bus.rbegin(); it != sim.bus.rend(); ++it)
+  {
+    if (!it->from_inverter && it->identifier == identifier)
+    {
+      return &(*it);
+    }
+  }
+  return nullptr;
+}
+
+uint32_t canbus_sim_max_gap_ms(uint32_t identifier, int64_t start_us)
+{
+  int64_t from = start_us > sim.start_us ? start_us : sim.start_us;
+  int64_t previous = from;
+  int64_t gap = 0;
+  for (const sim_frame &f : sim.bus)
+  {
+    if (f.from_inverter || f.identifier != identifier || f.time_us < from)
+    {
+      continue;
+    }
+    if (f.time_us - previous > gap)
+    {
+      gap = f.time_us - previous;
+    }
+    previous = f.time_us;
+  }
+  int64_t now = esp_timer_get_time();
+  if (now - previous > gap)
+  {
+    gap = now - previous;
+  }
+  return (uint32_t)(gap / 1000);
+}
@@ -0,0 +1,94 @@
+#ifndef DIYBMS_HOST_CANBUS_SIM_H_
+#define DIYBMS_HOST_CANBUS_SIM_H_
+
+// Inverter simulator for the CAN bus protocol code.
+//
+// The controller side is the real code (Rules, encoders, frame cache, scheduler, multi-pack and
+// receive dispatch) connected to canbus_sim_transport instead of the TWAI driver.  The tasks of
+// main.cpp are run in turn on the host clock (esp_timer.h shim):
+//   rules_task   every CANBUS_SIM_RULES_PERIOD_MS, the CAN related part of ProcessRules
+//   canbus_tx    canbus_scheduler_service and multipack_service, when they asked to be woken
+//   canbus_rx    frames from the inverter which pass the acceptance filter (twai_filter_model.h)
+// The bus sends the queued frames one after the other at 500 kbit/s, every frame which made it
+// onto the bus is logged with the time its last bit was sent.
+//
+// The inverter sends a keep alive (0x305) or, for PylonForce H2, a status request (0x4200) every
+// inverter_period_ms.  Tests script faults between calls to canbus_sim_run (bus off, failed
+// transmits, frames from other packs).
+
+#include "defines.h"
+#include "Rules.h"
+#include "canbus_transport.h"
+
+#include <vector>
+
+// Same as CANBUS_TX_QUEUE_LENGTH (HAL_ESP32.h)
+#define CANBUS_SIM_TX_QUEUE_LENGTH 32
+// rules_task runs ProcessRules every 3 seconds
+#define CANBUS_SIM_RULES_PERIOD_MS 3000
+
+// Fixture: one bank of 16 LFP cells, see canbus_sim_reset
+#define CANBUS_SIM_CELLS 16
+
+struct sim_frame
+{
+  // Time the frame finished on the bus
+  int64_t time_us;
+  uint32_t identifier;
+  bool extended;
+  uint8_t length;
+  uint8_t data[8];
+  // Sent by the inverter (or another pack) rather than this controller
+  bool from_inverter;
+};
+
+struct canbus_sim_state
+{
+  // Frames on the bus, in the order they were sent
+  std::vector<sim_frame> bus;
+
+  // Faults
+  bool bus_off;
+  // Transmits to fail (ESP_FAIL) before the bus takes frames again
+  uint32_t fail_transmits;
+
+  // Inverter
+  uint32_t inverter_period_ms;
+  bool inverter_extended;
+  // First data byte of the PylonForce request, 0x00 status, 0x02 hardware info
+  uint8_t inverter_request;
+
+  // Transport calls
+  uint32_t transmits;
+  uint32_t rejected;
+  uint32_t recovers;
+  // Inverter frames stopped by the acceptance filter
+  uint32_t filtered;
+
+  int64_t start_us;
+  int64_t bus_free_us;
+  int64_t next_rules_us;
+  int64_t next_tx_us;
+  int64_t next_inverter_us;
+  twai_filter_config_t filter;
+};
+
+extern canbus_sim_state sim;
+extern const canbus_transport canbus_sim_transport;
+extern CellModuleInfo sim_cells[CANBUS_SIM_CELLS];
+
+uint32_t canbus_sim_frame_bits(uint8_t length, bool extended);
+
+void canbus_sim_reset(CanBusProtocolEmulation protocol);
+void canbus_sim_rules();
+void canbus_sim_run(uint32_t ms);
+void canbus_sim_inverter_send(uint32_t identifier, bool extended, const uint8_t *data, uint8_t length);
+
+// Frames sent by the controller since start_us (0 = since the reset)
+uint32_t canbus_sim_count(uint32_t identifier, int64_t start_us = 0);
+const sim_frame *canbus_sim_last(uint32_t identifier);
+// Longest gap between two sends of the identifier, counted from start_us (or the reset) up to now,
+// so a frame which stopped being sent shows up as one long gap
+uint32_t canbus_sim_max_gap_ms(uint32_t identifier, int64_t start_us = 0);
+
+#endif
@@ -0,0 +1,30 @@
+#include "esp_timer.h"
+
+#include <time.h>
+
+static bool manual = false;
+static int64_t manual_us = 0;
+
+int64_t esp_timer_get_time()
+{
+  if (manual)
+  {
+    return manual_us;
+  }
+
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void host_clock_set(int64_t us)
+{
+  manual = true;
+  manual_us = us;
+}
+
+void host_clock_advance(int64_t us)
+{
+  manual = true;
+  manual_us += us;
+}
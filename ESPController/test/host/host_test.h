@@ -0,0 +1,54 @@
+#ifndef DIYBMS_HOST_TEST_H_
+#define DIYBMS_HOST_TEST_H_
+
+// Minimal assertions for the host tests, a test executable returns non-zero if any check failed
+
+#include <stdio.h>
+#include <string.h>
+
+static int host_test_failures = 0;
+
+#define CHECK(condition)                                                     \
+  do                                                                         \
+  {                                                                          \
+    if (!(condition))                                                        \
+    {                                                                        \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition);   \
+      host_test_failures++;                                                  \
+    }                                                                        \
+  } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                                                          \
+  do                                                                                                           \
+  {                                                                                                            \
+    long long e_ = (long long)(expected);                                                                      \
+    long long a_ = (long long)(actual);                                                                        \
+    if (e_ != a_)                                                                                              \
+    {                                                                                                          \
+      printf("%s:%d: CHECK_EQUAL failed: %s, expected %lld got %lld\n", __FILE__, __LINE__, #actual, e_, a_); \
+      host_test_failures++;                                                                                    \
+    }                                                                                                          \
+  } while (0)
+
+#define CHECK_STRING(expected, actual)                                                                      \
+  do                                                                                                        \
+  {                                                                                                         \
+    if (strcmp((expected), (actual)) != 0)                                                                  \
+    {                                                                                                       \
+      printf("%s:%d: CHECK_STRING failed:\n  expected %s\n  got      %s\n", __FILE__, __LINE__, expected, actual); \
+      host_test_failures++;                                                                                 \
+    }                                                                                                       \
+  } while (0)
+
+static inline int host_test_result(const char *name)
+{
+  if (host_test_failures == 0)
+  {
+    printf("%s: all checks passed\n", name);
+    return 0;
+  }
+  printf("%s: %d check(s) failed\n", name, host_test_failures);
+  return 1;
+}
+
+#endif
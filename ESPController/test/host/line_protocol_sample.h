@@ -0,0 +1,47 @@
+#ifndef DIYBMS_HOST_LINE_PROTOCOL_SAMPLE_H_
+#define DIYBMS_HOST_LINE_PROTOCOL_SAMPLE_H_
+
+// Line protocol in the format influx_format_sample (influxdb.cpp) generates, for the gzip test and benchmark.
+// Cell voltages wander a few mV from sample to sample, like a real pack.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+/// @brief Append one snapshot, cells + banks + current monitor + rules
+static inline void line_protocol_sample(std::string &out, uint8_t banks, uint8_t series, uint32_t timestamp, uint32_t seed)
+{
+  char line[160];
+  char ts[16];
+  snprintf(ts, sizeof(ts), " %u", timestamp);
+
+  for (uint8_t i = 0; i < banks * series; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    uint16_t mV = 3300 + (i * 7) % 60 + (seed >> 16) % 8;
+    snprintf(line, sizeof(line), "cells,cell=%u_%u v=%.4f,i=%ii,e=%ii,b=%s%s\n",
+             i / series, i % series, mV / 1000.0f, 24 + (i % 5), 19 + (i % 3),
+             (mV > 3355) ? "true" : "false", ts);
+    out.append(line);
+  }
+
+  for (uint8_t bank = 0; bank < banks; bank++)
+  {
+    snprintf(line, sizeof(line), "banks,bank=%u v=%.4f,r=%ui%s\n", bank, (53120 + bank * 17) / 1000.0f, 41 + bank, ts);
+    out.append(line);
+  }
+
+  snprintf(line, sizeof(line), "current v=%.4f,c=%.4f,p=%.4f,soc=%.2f,in=%ui,out=%ui%s\n",
+           53.1234F, -12.5F + (seed % 100) / 100.0F, -664.02F, 81.25F, 1234567U, 2345678U, ts);
+  out.append(line);
+
+  out.append("rules active=2i");
+  for (uint8_t r = 0; r < 17; r++)
+  {
+    snprintf(line, sizeof(line), ",r%u=%s", r, (r == 3 || r == 11) ? "true" : "false");
+    out.append(line);
+  }
+  out.append(ts).append("\n");
+}
+
+#endif
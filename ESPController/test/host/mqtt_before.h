@@ -0,0 +1,32 @@
+#ifndef DIYBMS_HOST_MQTT_BEFORE_H_
+#define DIYBMS_HOST_MQTT_BEFORE_H_
+
+// Cell messages as mqtt.cpp built them before the topic table and payload arena, a new std::string topic
+// per message and float_to_string for every value. Used as the reference by test_mqtt_format and bench_mqtt.
+
+#include "defines.h"
+#include "string_utils.h"
+
+#include <string>
+
+static inline void mqtt_before_cell_payload(std::string &status, const CellModuleInfo &cell, bool detail)
+{
+  status.clear();
+  status.append("{\"voltage\":").append(float_to_string(cell.voltagemV / 1000.0f)).append(",\"exttemp\":").append(std::to_string(cell.externalTemp));
+  if (detail)
+  {
+    status.append(",\"vMax\":").append(float_to_string(cell.voltagemVMax / 1000.0f)).append(",\"vMin\":").append(float_to_string(cell.voltagemVMin / 1000.0f)).append(",\"inttemp\":").append(std::to_string(cell.internalTemp)).append(",\"bypass\":").append(std::to_string(cell.inBypass ? 1 : 0)).append(",\"PWM\":").append(std::to_string((int)((float)cell.PWMValue / (float)255.0 * 100))).append(",\"bypassT\":").append(std::to_string(cell.bypassOverTemp ? 1 : 0)).append(",\"bpc\":").append(std::to_string(cell.badPacketCount)).append(",\"mAh\":").append(std::to_string(cell.BalanceCurrentCount));
+  }
+  status.append("}");
+}
+
+static inline std::string mqtt_before_cell_topic(const char *prefix, uint8_t cell, uint8_t series)
+{
+  uint8_t bank = cell / series;
+  uint8_t m = cell - (bank * series);
+  std::string topic = prefix;
+  topic.append("/").append(std::to_string(bank)).append("/").append(std::to_string(m));
+  return topic;
+}
+
+#endif
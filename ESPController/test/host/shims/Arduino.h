@@ -0,0 +1,30 @@
+#ifndef DIYBMS_HOST_ARDUINO_H_
+#define DIYBMS_HOST_ARDUINO_H_
+
+// Host build replacement for the parts of Arduino.h used by the controller headers
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <array>
+#include <string>
+
+#include "binary.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#define PROGMEM
+#define IRAM_ATTR
+
+typedef bool boolean;
+
+using std::max;
+using std::min;
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef DIYBMS_HOST_ESP_HTTP_SERVER_H_
+#define DIYBMS_HOST_ESP_HTTP_SERVER_H_
+
+// Host build replacement for the parts of esp_http_server.h used by json_writer.hpp.
+// Tests provide httpd_resp_send_chunk to capture the response.
+
+#include <stddef.h>
+#include "esp_err.h"
+
+struct httpd_req;
+typedef struct httpd_req httpd_req_t;
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, size_t buf_len);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef DIYBMS_HOST_ESP_ROM_CRC_H_
+#define DIYBMS_HOST_ESP_ROM_CRC_H_
+
+// Host build replacement for the ESP32 ROM CRC (host_crc.cpp).
+// Same as the ROM, the value is inverted on input and output so a crc of 0 starts the standard CRC-32.
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef DIYBMS_HOST_ESP_TIMER_H_
+#define DIYBMS_HOST_ESP_TIMER_H_
+
+// Host build replacement for esp_timer_get_time (host_clock.cpp).
+// Runs from the monotonic clock until a test sets the time, after that it only moves when advanced.
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
+
+void host_clock_set(int64_t us);
+void host_clock_advance(int64_t us);
+
+#endif
@@ -0,0 +1,122 @@
+// canbus_rx.cpp, the acceptance filter of each protocol must pass every identifier in its table
+// and frames must reach the right handler
+
+#include "host_test.h"
+#include "canbus_rx_fakes.h"
+#include "twai_filter_model.h"
+
+static twai_message_t frame(uint32_t identifier, bool extended, uint8_t byte0 = 0)
+{
+  twai_message_t message = {};
+  message.identifier = identifier;
+  message.extd = extended;
+  message.data_length_code = 8;
+  message.data[0] = byte0;
+  return message;
+}
+
+static twai_filter_config_t select(CanBusProtocolEmulation protocol, bool multipack)
+{
+  mysettings.canbusprotocol = protocol;
+  mysettings.canbus_multipack = multipack;
+  twai_filter_config_t filter = canbus_rx_select(protocol);
+  CHECK(!canbus_rx_select_needed());
+  return filter;
+}
+
+static uint32_t accepted(const twai_filter_config_t &filter, uint32_t first, uint32_t last, bool extended)
+{
+  uint32_t count = 0;
+  for (uint32_t id = first; id <= last; id++)
+  {
+    count += twai_filter_accepts(filter, frame(id, extended)) ? 1 : 0;
+  }
+  return count;
+}
+
+static void test_filters()
+{
+  static const CanBusProtocolEmulation protocols[] = {CanBusProtocolEmulation::CANBUS_VICTRON,
+                                                       CanBusProtocolEmulation::CANBUS_PYLONTECH,
+                                                       CanBusProtocolEmulation::CANBUS_PYLONFORCEH2};
+  for (auto protocol : protocols)
+  {
+    for (int multipack = 0; multipack < 2; multipack++)
+    {
+      twai_filter_config_t filter = select(protocol, multipack);
+      CHECK(twai_filter_accepts(filter, frame(0x305, false)));
+      for (uint8_t pack = 0; multipack && pack < MULTIPACK_MAXIMUM_PACKS; pack++)
+      {
+        CHECK(twai_filter_accepts(filter, frame(MULTIPACK_SUMMARY_ID + pack, false)));
+      }
+      if (protocol == CanBusProtocolEmulation::CANBUS_PYLONFORCEH2)
+      {
+        CHECK(twai_filter_accepts(filter, frame(0x420, false)));
+        CHECK(twai_filter_accepts(filter, frame(0x620, false)));
+        CHECK(twai_filter_accepts(filter, frame(0x621, false)));
+        CHECK(twai_filter_accepts(filter, frame(0x4200, true)));
+        CHECK(twai_filter_accepts(filter, frame(0x8200, true)));
+        CHECK(twai_filter_accepts(filter, frame(0x8210, true)));
+      }
+    }
+  }
+
+  // Victron/Pylontech only listen to 0x305, nothing else gets through
+  twai_filter_config_t filter = select(CanBusProtocolEmulation::CANBUS_VICTRON, false);
+  CHECK_EQUAL(1, accepted(filter, 0, 0x7FF, false));
+  CHECK_EQUAL(0, accepted(filter, 0x1000, 0x1FFFF, true));
+
+  // PylonForce H2, the standard identifiers 0x305, 0x420, 0x620, 0x621 can't be separated exactly
+  filter = select(CanBusProtocolEmulation::CANBUS_PYLONFORCEH2, false);
+  uint32_t std_accepted = accepted(filter, 0, 0x7FF, false);
+  CHECK(std_accepted >= 4);
+  CHECK(std_accepted < 0x800 / 2);
+  // Extended identifiers away from 0x4200-0x8210 (for example J1939 traffic) are blocked
+  CHECK_EQUAL(0, accepted(filter, 0x18FF0000, 0x18FF0FFF, true));
+}
+
+static void test_dispatch()
+{
+  select(CanBusProtocolEmulation::CANBUS_PYLONFORCEH2, true);
+
+  can_rx_stats before;
+  canbus_rx_get_stats(&before);
+  rx_calls = {};
+
+  canbus_no_request_messages_count = 5;
+  canbus_rx_dispatch(frame(0x4200, true, 0x02), 1000);
+  CHECK_EQUAL(1, rx_calls.info);
+  CHECK(rx_calls.extended);
+  CHECK_EQUAL(0, canbus_no_request_messages_count);
+
+  canbus_rx_dispatch(frame(0x420, false, 0x00), 1000);
+  CHECK_EQUAL(1, rx_calls.status);
+  CHECK(!rx_calls.extended);
+
+  // Same identifier as a request, but the wrong format
+  canbus_rx_dispatch(frame(0x4200, false, 0x00), 1000);
+  CHECK_EQUAL(1, rx_calls.status);
+
+  canbus_rx_dispatch(frame(MULTIPACK_SUMMARY_ID + 3, false), 1000);
+  CHECK_EQUAL(1, rx_calls.multipack);
+  CHECK_EQUAL(MULTIPACK_SUMMARY_ID + 3, rx_calls.multipack_identifier);
+
+  canbus_rx_dispatch(frame(0x306, false), 1000);
+
+  can_rx_stats after;
+  canbus_rx_get_stats(&after);
+  CHECK_EQUAL(5, after.received - before.received);
+  CHECK_EQUAL(3, after.dispatched - before.dispatched);
+  CHECK_EQUAL(2, after.unhandled - before.unhandled);
+
+  // Protocol change is noticed
+  mysettings.canbusprotocol = CanBusProtocolEmulation::CANBUS_VICTRON;
+  CHECK(canbus_rx_select_needed());
+}
+
+int main()
+{
+  test_filters();
+  test_dispatch();
+  return host_test_result("canbus_rx");
+}
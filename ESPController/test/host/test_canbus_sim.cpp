@@ -0,0 +1,475 @@
+// Frame content and timing regression tests of the CAN bus protocols, run against the inverter
+// simulator (canbus_sim.cpp).  Expected payloads are worked out from the fixture in canbus_sim.cpp:
+//   16 cells, 52800mV bank, highest cell 3310mV (5), lowest 3290mV (11)
+//   external temperature 20C (cell 9) to 25C (cell 3)
+//   current monitor 52.5V, -12.5A, 65.4% state of charge
+//   dynamic charge voltage 54.7V: R = min(3450-3310, (3550-3320)/3.0) = 76, the cells add
+//   14*121 + 140 + 103 mV to 52800mV.  Below the knee, so the full 65.0A charge current
+
+#include "host_test.h"
+#include "canbus_sim.h"
+#include "canbus_frames.h"
+#include "canbus_scheduler.h"
+#include "canbus_multipack.h"
+#include "canbus_rx.h"
+#include "pylon_canbus.h"
+
+#include <esp_timer.h>
+
+static void check_frame(uint32_t identifier, const uint8_t *expected, uint8_t length)
+{
+  const sim_frame *f = canbus_sim_last(identifier);
+  if (f == nullptr)
+  {
+    printf("frame 0x%x not sent\n", identifier);
+    CHECK(f != nullptr);
+    return;
+  }
+  CHECK_EQUAL(length, f->length);
+  if (f->length == length && memcmp(f->data, expected, length) != 0)
+  {
+    printf("frame 0x%x payload:", identifier);
+    for (uint8_t i = 0; i < f->length; i++)
+    {
+      printf(" %02X", f->data[i]);
+    }
+    printf("\n");
+    CHECK(memcmp(f->data, expected, length) == 0);
+  }
+}
+
+#define CHECK_FRAME(identifier, ...)                                  \
+  do                                                                  \
+  {                                                                   \
+    const uint8_t expected_[] = {__VA_ARGS__};                        \
+    check_frame((identifier), expected_, sizeof(expected_));          \
+  } while (0)
+
+static uint32_t schedule_stat(uint32_t identifier, can_schedule_stats *found)
+{
+  can_schedule_stats list[CANBUS_SCHEDULE_MAXIMUM];
+  uint8_t count = canbus_scheduler_get_stats(list, CANBUS_SCHEDULE_MAXIMUM);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (list[i].identifier == identifier)
+    {
+      *found = list[i];
+      return 1;
+    }
+  }
+  memset(found, 0, sizeof(can_schedule_stats));
+  return 0;
+}
+
+static uint32_t frame_stat_sent(uint32_t identifier)
+{
+  can_frame_stats list[CANBUS_FRAME_CACHE_SIZE];
+  can_frame_cache_stats cache;
+  uint8_t count = canbus_frames_get_stats(list, CANBUS_FRAME_CACHE_SIZE, &cache);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (list[i].identifier == identifier)
+    {
+      return list[i].sent;
+    }
+  }
+  return 0;
+}
+
+static void test_victron_frames()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_VICTRON);
+  canbus_sim_run(1000);
+
+  // CVL 54.7V, CCL 65.0A, DCL 65.0A, discharge voltage 48.8V
+  CHECK_FRAME(0x351, 0x23, 0x02, 0x8A, 0x02, 0x8A, 0x02, 0xE8, 0x01);
+  // 65%
+  CHECK_FRAME(0x355, 0x41, 0x00);
+  // 52.50V, -12.5A, 25.0C
+  CHECK_FRAME(0x356, 0x82, 0x14, 0x83, 0xFF, 0xFA, 0x00);
+  // Every alarm reported as OK, system online
+  CHECK_FRAME(0x35a, 0xA8, 0x02, 0x80, 0x00, 0x00, 0x00, 0x00, 0x08);
+  CHECK_FRAME(0x35e, 'D', 'I', 'Y', 'B', 'M', 'S');
+  // Local compile has version 0, 280Ah
+  CHECK_FRAME(0x35f, 0x00, 0x00, 0x00, 0x00, 0x18, 0x01);
+  CHECK_FRAME(0x370, 'D', 'I', 'Y', 'B', 'M', 'S', '-', '0');
+  CHECK_FRAME(0x371, '0', 'A', 'B', 'C', 'D', 'E', 'F', 0x00);
+  // 16 modules ok
+  CHECK_FRAME(0x372, 0x10, 0x00);
+  // 3290mV, 3310mV, 293K, 298K
+  CHECK_FRAME(0x373, 0xDA, 0x0C, 0xEE, 0x0C, 0x25, 0x01, 0x2A, 0x01);
+  CHECK_FRAME(0x374, 'b', '0', ' ', 'm', '1', '1', 0x00, 0x00);
+  CHECK_FRAME(0x375, 'b', '0', ' ', 'm', '5', 0x00, 0x00, 0x00);
+  CHECK_FRAME(0x376, 'b', '0', ' ', 'm', '9', 0x00, 0x00, 0x00);
+  CHECK_FRAME(0x377, 'b', '0', ' ', 'm', '3', 0x00, 0x00, 0x00);
+
+  // Charge limit goes first, the whole schedule fits in the transmit queue
+  CHECK(sim.bus.size() >= 14);
+  CHECK_EQUAL(0x351, sim.bus[0].identifier);
+  CHECK_EQUAL(0, sim.rejected);
+
+  // Over temperature stops charge and discharge, and raises the alarm
+  sim_cells[3].externalTemp = 60;
+  canbus_sim_run(CANBUS_SIM_RULES_PERIOD_MS);
+  // CVL drops to the bank voltage (52.8V)
+  CHECK_FRAME(0x351, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0xE8, 0x01);
+  CHECK_FRAME(0x356, 0x82, 0x14, 0x83, 0xFF, 0x58, 0x02);
+  CHECK_FRAME(0x35a, 0x68, 0x02, 0x80, 0x00, 0x00, 0x00, 0x00, 0x08);
+}
+
+static void test_pylon_frames()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_PYLONTECH);
+  canbus_sim_run(1000);
+
+  CHECK_FRAME(0x351, 0x23, 0x02, 0x8A, 0x02, 0x8A, 0x02, 0xE8, 0x01);
+  // 65%, state of health 100%
+  CHECK_FRAME(0x355, 0x41, 0x00, 0x64, 0x00);
+  CHECK_FRAME(0x356, 0x82, 0x14, 0x83, 0xFF, 0xFA, 0x00);
+  // No alarms, 4 x 74Ah modules, "PN"
+  CHECK_FRAME(0x359, 0x00, 0x00, 0x00, 0x00, 0x04, 0x50, 0x4E, 0x00);
+  // Charge and discharge enabled
+  CHECK_FRAME(0x35c, 0xC0);
+  CHECK_FRAME(0x35e, 'P', 'Y', 'L', 'O', 'N', ' ', ' ');
+
+  // Deye inverters are sent 0A limits and the bank voltage rather than 0.1A/0.1V to stop charging
+  mysettings.canbusinverter = CanBusInverter::INVERTER_DEYE;
+  mysettings.preventcharging = true;
+  canbus_sim_run(CANBUS_SIM_RULES_PERIOD_MS);
+  CHECK_FRAME(0x351, 0x10, 0x02, 0x00, 0x00, 0x8A, 0x02, 0xE8, 0x01);
+  CHECK_FRAME(0x35c, 0x40);
+  mysettings.canbusinverter = CanBusInverter::INVERTER_GENERIC;
+  canbus_sim_run(CANBUS_SIM_RULES_PERIOD_MS);
+  CHECK_FRAME(0x351, 0x01, 0x00, 0x01, 0x00, 0x8A, 0x02, 0xE8, 0x01);
+
+  // A discharge current setting of 0 is sent as it is, without multi-pack
+  mysettings.dischargecurrent = 0;
+  canbus_sim_run(CANBUS_SIM_RULES_PERIOD_MS);
+  CHECK_FRAME(0x351, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0xE8, 0x01);
+}
+
+static void test_pylonforce_replies()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_PYLONFORCEH2);
+  mysettings.canbus_equipment_addr = 2;
+  // Only replies, nothing is sent before the first request
+  canbus_sim_run(50);
+  CHECK_EQUAL(0, sim.bus.size());
+
+  canbus_sim_run(1000);
+
+  // Extended identifiers include the equipment address
+  // 52.5V, -12.5A (30000 offset), 25.0C (1000 offset), 65%, 100%
+  CHECK_FRAME(0x4212, 0x0D, 0x02, 0xB3, 0x74, 0xE2, 0x04, 0x41, 0x64);
+  // 54.7V, 48.8V, 65.0A charge, 65.0A discharge
+  CHECK_FRAME(0x4222, 0x23, 0x02, 0xE8, 0x01, 0xBA, 0x77, 0xA6, 0x72);
+  CHECK_FRAME(0x4232, 0xEE, 0x0C, 0xDA, 0x0C, 0x05, 0x00, 0x0B, 0x00);
+  CHECK_FRAME(0x4242, 0xE2, 0x04, 0xB0, 0x04, 0x03, 0x00, 0x09, 0x00);
+  // Discharging, no errors, alarms or protection
+  CHECK_FRAME(0x4252, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+  CHECK_FRAME(0x4262, 0xB4, 0xC3, 0xB4, 0xC3, 0x01, 0x00, 0x01, 0x00);
+  CHECK_FRAME(0x4272, 0xE2, 0x04, 0xB0, 0x04, 0x00, 0x00, 0x00, 0x00);
+  CHECK_FRAME(0x4282, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+  CHECK_FRAME(0x4292, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+  CHECK_FRAME(0x42A2, 0x46, 0x05, 0x46, 0x05, 0x00, 0x00, 0x00, 0x00);
+  CHECK_EQUAL(10, sim.bus.size() - 1);
+  CHECK(sim.bus[1].extended);
+
+  // Hardware information request, 16 series cells in 1 module, 55V, 280Ah
+  sim.inverter_request = 0x02;
+  canbus_sim_run(1000);
+  CHECK_FRAME(0x7312, 0x01, 0x00, 0x02, 0x01, 0x01, 0x02, 0x00, 0x00);
+  CHECK_FRAME(0x7322, 0x10, 0x00, 0x01, 0x10, 0x37, 0x00, 0x18, 0x01);
+  CHECK_FRAME(0x7332, 'D', 'I', 'Y', 'B', 'M', 'S', '-', '0');
+  CHECK_FRAME(0x7342, '0', 'A', 'B', 'C', 'D', 'E', 'F', 0x00);
+
+  // Standard identifier requests get standard identifier replies without the address
+  sim.inverter_request = 0x00;
+  sim.inverter_extended = false;
+  size_t before = sim.bus.size();
+  canbus_sim_run(1000);
+  CHECK_EQUAL(11, sim.bus.size() - before);
+  CHECK_FRAME(0x421, 0x0D, 0x02, 0xB3, 0x74, 0xE2, 0x04, 0x41, 0x64);
+  CHECK_FRAME(0x42A, 0x46, 0x05, 0x46, 0x05, 0x00, 0x00, 0x00, 0x00);
+  CHECK(!sim.bus.back().extended);
+
+  // Reply time, request received to the last frame on the bus: 10 extended (or standard) frames at 500 kbit/s
+  pylonforce_reply_stats stats;
+  pylonHV_get_reply_stats(&stats);
+  CHECK_EQUAL(3, stats.requests);
+  CHECK_EQUAL(0, stats.failed_frames);
+  CHECK_EQUAL(0, stats.timeouts);
+  CHECK(stats.max_us <= 10 * canbus_sim_frame_bits(8, true) * 2);
+  CHECK(stats.last_us <= 10 * canbus_sim_frame_bits(8, false) * 2);
+  printf("PylonForce reply: last %u us, max %u us\n", stats.last_us, stats.max_us);
+
+  // No replies before the controller is running
+  _controller_state = ControllerState::Stabilizing;
+  before = sim.bus.size();
+  canbus_sim_run(2000);
+  CHECK_EQUAL(2, sim.bus.size() - before);
+}
+
+static void test_victron_timing()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_VICTRON);
+  canbus_sim_run(60000);
+
+  // Count and largest gap of each message over one minute, the first send is at the start
+  struct expectation
+  {
+    uint32_t identifier;
+    uint32_t period_ms;
+  };
+  const expectation expected[] = {
+      {0x351, 1000}, {0x35a, 1000}, {0x355, 1000}, {0x356, 1000}, {0x372, 1000}, {0x373, 1000}, {0x374, 1000},
+      {0x375, 1000}, {0x376, 1000}, {0x377, 1000}, {0x35e, 1000}, {0x35f, 1000}, {0x370, 1000}, {0x371, 1000}};
+
+  uint32_t frames = 0;
+  for (const expectation &e : expected)
+  {
+    uint32_t count = canbus_sim_count(e.identifier);
+    CHECK_EQUAL(60000 / e.period_ms, count);
+    uint32_t gap = canbus_sim_max_gap_ms(e.identifier);
+    // Sent within a few frame times of being due
+    if (gap > e.period_ms + 5)
+    {
+      printf("0x%x largest gap %u ms\n", e.identifier, gap);
+      CHECK(gap <= e.period_ms + 5);
+    }
+
+    can_schedule_stats st;
+    CHECK(schedule_stat(e.identifier, &st));
+    CHECK_EQUAL(count, st.sent);
+    CHECK_EQUAL(0, st.missed_deadlines);
+    CHECK_EQUAL(0, st.deferred);
+    CHECK(st.max_jitter_us < 5000);
+    CHECK_EQUAL(count, frame_stat_sent(e.identifier));
+    frames += count;
+  }
+  // Nothing else was sent
+  uint32_t controller_frames = 0;
+  for (const sim_frame &f : sim.bus)
+  {
+    controller_frames += f.from_inverter ? 0 : 1;
+  }
+  CHECK_EQUAL(frames, controller_frames);
+  // Keep alive from the inverter every second
+  CHECK(canbus_last_305_message_time > sim.start_us);
+
+  // Bus load, 840 frames a minute (every message once a second)
+  printf("Victron: %u frames/minute, %.2f%% of the bus\n", frames,
+         frames * canbus_sim_frame_bits(8, false) * 2 / 600000.0);
+
+  // Only the messages which don't need the controller to be running
+  _controller_state = ControllerState::Stabilizing;
+  int64_t from = esp_timer_get_time() + 10000;
+  canbus_sim_run(10000);
+  CHECK(canbus_sim_count(0x351, from) >= 9);
+  CHECK_EQUAL(0, canbus_sim_count(0x355, from));
+  CHECK_EQUAL(0, canbus_sim_count(0x356, from));
+  CHECK_EQUAL(0, canbus_sim_count(0x373, from));
+  // System offline
+  const sim_frame *f = canbus_sim_last(0x35a);
+  CHECK(f != nullptr && f->data[7] == 0x04);
+}
+
+static void test_bus_off()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_VICTRON);
+  canbus_sim_run(10000);
+  uint32_t sent_351 = canbus_sim_count(0x351);
+
+  // 5 seconds bus off, nothing is queued, recovery is requested and the deadline of 0x351 (3s) is missed
+  sim.bus_off = true;
+  int64_t off = esp_timer_get_time();
+  canbus_sim_run(5000);
+  CHECK_EQUAL(sent_351, canbus_sim_count(0x351));
+  CHECK(sim.recovers > 0);
+
+  can_schedule_stats st;
+  schedule_stat(0x351, &st);
+  CHECK_EQUAL(sent_351, st.sent);
+  CHECK_EQUAL(1, st.missed_deadlines);
+  CHECK(st.deferred > 0);
+  // Retried every 10ms
+  CHECK(st.deferred >= 400);
+
+  // Statistics only count frames which were actually queued
+  CHECK_EQUAL(sent_351, frame_stat_sent(0x351));
+
+  sim.bus_off = false;
+  int64_t on = esp_timer_get_time();
+  canbus_sim_run(1000);
+
+  // Charge limits are the first frame after the bus comes back
+  const sim_frame *first = nullptr;
+  for (const sim_frame &f : sim.bus)
+  {
+    if (!f.from_inverter && f.time_us > on)
+    {
+      first = &f;
+      break;
+    }
+  }
+  CHECK(first != nullptr && first->identifier == 0x351);
+  CHECK(first != nullptr && first->time_us - on <= 11000);
+  CHECK_EQUAL(sent_351 + 1, canbus_sim_count(0x351));
+  CHECK(canbus_sim_max_gap_ms(0x351, off - 1000000) >= 5000);
+
+  // Back to the normal period
+  canbus_sim_run(20000);
+  CHECK(canbus_sim_max_gap_ms(0x351, on + 1000000) <= 1005);
+  schedule_stat(0x351, &st);
+  CHECK_EQUAL(1, st.missed_deadlines);
+  CHECK_EQUAL(canbus_sim_count(0x351), st.sent);
+  CHECK_EQUAL(canbus_sim_count(0x351), frame_stat_sent(0x351));
+}
+
+static void test_transmit_failure()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_VICTRON);
+  canbus_sim_run(1000);
+
+  // The driver refuses one frame, the message stays due and goes out on the next pass (10ms)
+  uint32_t sent = canbus_sim_count(0x351);
+  uint32_t failed = canbus_messages_failed_sent;
+  sim.fail_transmits = 1;
+  int64_t due = sim.start_us + 1000000;
+  canbus_sim_run(500);
+  CHECK_EQUAL(sent + 1, canbus_sim_count(0x351));
+  CHECK_EQUAL(failed + 1, canbus_messages_failed_sent);
+  const sim_frame *f = canbus_sim_last(0x351);
+  CHECK(f != nullptr && f->time_us - due >= 10000 && f->time_us - due <= 11000);
+
+  can_schedule_stats st;
+  schedule_stat(0x351, &st);
+  CHECK_EQUAL(1, st.deferred);
+  CHECK_EQUAL(sent + 1, st.sent);
+  CHECK_EQUAL(sent + 1, frame_stat_sent(0x351));
+  CHECK_EQUAL(0, st.missed_deadlines);
+
+  // The queue is almost full when the next messages are due (frames queued by other code).  1ms
+  // before they are due 32 frames are queued, 3 have gone by 2s so the charge limits and the
+  // first 1 second messages take the space, the rest wait for the next pass (10ms)
+  canbus_sim_run(499);
+  uint8_t filler[8] = {};
+  for (uint8_t i = 0; i < CANBUS_SIM_TX_QUEUE_LENGTH; i++)
+  {
+    CHECK(send_canbus_message(0x600 + i, filler, sizeof(filler)));
+  }
+  CHECK(!send_canbus_message(0x620, filler, sizeof(filler)));
+  int64_t second = sim.start_us + 2000000;
+  canbus_sim_run(2001);
+
+  schedule_stat(0x351, &st);
+  CHECK_EQUAL(1, st.deferred);
+  CHECK_EQUAL(4, canbus_sim_count(0x351));
+  schedule_stat(0x356, &st);
+  CHECK_EQUAL(1, st.deferred);
+  CHECK_EQUAL(0, st.missed_deadlines);
+  CHECK_EQUAL(4, canbus_sim_count(0x372));
+
+  // In priority order behind the frames already in the queue, the deferred ones one pass later
+  const uint32_t order[] = {0x351, 0x35a, 0x355, 0x356, 0x372};
+  uint8_t n = 0;
+  int64_t queued_at_2s = 0;
+  for (const sim_frame &frame : sim.bus)
+  {
+    if (!frame.from_inverter && frame.time_us > second && frame.identifier < 0x600 && n < 5)
+    {
+      CHECK_EQUAL(order[n], frame.identifier);
+      if (n == 2)
+      {
+        queued_at_2s = frame.time_us;
+      }
+      if (n == 3)
+      {
+        CHECK(frame.time_us - second >= 10000);
+        CHECK(frame.time_us - queued_at_2s > 1000);
+      }
+      n++;
+    }
+  }
+  CHECK_EQUAL(5, n);
+  CHECK_EQUAL(2, sim.rejected);
+}
+
+static void test_multipack()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_VICTRON);
+  mysettings.canbus_multipack = true;
+  mysettings.canbus_equipment_addr = 1;
+  sim.filter = canbus_rx_select(mysettings.canbusprotocol);
+  // Pack 2 can only charge at 30A
+  uint8_t summary[8] = {0xDA, 0x0C, 0xEE, 0x0C, 60, MULTIPACK_FLAG_RUNNING | MULTIPACK_FLAG_SOC_VALID, 0, 0};
+  uint32_t currents = 30 | (65 << 10);
+  summary[5] |= (currents & 0x0F) << 4;
+  summary[6] = (currents >> 4) & 0xFF;
+  summary[7] = (currents >> 12) & 0xFF;
+
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    canbus_sim_inverter_send(MULTIPACK_SUMMARY_ID + 2, false, summary, 8);
+    canbus_sim_run(500);
+  }
+
+  // Master, sends the combined limits: 2 x 30A charge, 2 x 65A discharge, average state of charge 62%
+  multipack_stats mp;
+  multipack_get_stats(&mp);
+  CHECK(mp.master);
+  CHECK_EQUAL(2, mp.packs);
+  CHECK(mp.sent >= 7);
+  CHECK_FRAME(0x351, 0x23, 0x02, 0x58, 0x02, 0x14, 0x05, 0xE8, 0x01);
+  CHECK_FRAME(0x355, 0x3E, 0x00);
+    // 3290mV, 3310mV, 65%, running with a valid state of charge, 65A charge, 65A discharge
+  CHECK_FRAME(MULTIPACK_SUMMARY_ID + 1, 0xDA, 0x0C, 0xEE, 0x0C, 0x41, 0x13, 0x44, 0x10);
+
+  // Pack 0 appears, it takes over talking to the inverter after the next rules pass
+  summary[4] = 70;
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    canbus_sim_inverter_send(MULTIPACK_SUMMARY_ID, false, summary, 8);
+    canbus_sim_inverter_send(MULTIPACK_SUMMARY_ID + 2, false, summary, 8);
+    canbus_sim_run(500);
+  }
+  multipack_get_stats(&mp);
+  CHECK(!mp.master);
+  CHECK_EQUAL(0, mp.master_address);
+  int64_t from = esp_timer_get_time();
+  for (uint8_t i = 0; i < 10; i++)
+  {
+    canbus_sim_inverter_send(MULTIPACK_SUMMARY_ID, false, summary, 8);
+    canbus_sim_inverter_send(MULTIPACK_SUMMARY_ID + 2, false, summary, 8);
+    canbus_sim_run(500);
+  }
+  CHECK_EQUAL(0, canbus_sim_count(0x351, from));
+  // The summary is still sent
+  CHECK(canbus_sim_count(MULTIPACK_SUMMARY_ID + 1, from) >= 9);
+
+  // Pack 0 and 2 go quiet, this controller is master again and sends straight away
+  canbus_sim_run(CANBUS_SIM_RULES_PERIOD_MS * 2);
+  multipack_get_stats(&mp);
+  CHECK(mp.master);
+  CHECK_EQUAL(1, mp.packs);
+  CHECK(mp.expired >= 2);
+  from = esp_timer_get_time();
+  canbus_sim_run(1000);
+  CHECK(canbus_sim_count(0x351, from) >= 1);
+  CHECK_FRAME(0x351, 0x23, 0x02, 0x8A, 0x02, 0x8A, 0x02, 0xE8, 0x01);
+}
+
+int main()
+{
+  host_clock_set(1000000);
+
+  test_victron_frames();
+  test_pylon_frames();
+  test_pylonforce_replies();
+  test_victron_timing();
+  test_bus_off();
+  test_transmit_failure();
+  test_multipack();
+
+  return host_test_result("canbus_sim");
+}
@@ -0,0 +1,158 @@
+// SocketCAN transport (canbus_transport_socketcan.cpp) against a virtual CAN interface, with a second
+// raw socket on the same interface acting as the inverter.  Returns 77 (skipped) when the interface
+// can't be opened, create it with:
+//   sudo ip link add dev vcan0 type vcan
+//   sudo ip link set up vcan0
+// DIYBMS_SOCKETCAN selects another interface.
+
+#include "host_test.h"
+#include "canbus_sim.h"
+#include "canbus_rx.h"
+#include "twai_filter_model.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <esp_timer.h>
+
+static int inverter = -1;
+
+static bool inverter_open(const char *interface)
+{
+  inverter = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if (inverter < 0)
+  {
+    return false;
+  }
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+  if (ioctl(inverter, SIOCGIFINDEX, &ifr) < 0)
+  {
+    return false;
+  }
+  struct sockaddr_can addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  return bind(inverter, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+}
+
+static bool inverter_read(struct can_frame *frame, int timeout_ms)
+{
+  struct pollfd p = {.fd = inverter, .events = POLLIN, .revents = 0};
+  if (poll(&p, 1, timeout_ms) != 1)
+  {
+    return false;
+  }
+  return read(inverter, frame, sizeof(*frame)) == sizeof(*frame);
+}
+
+static void inverter_write(canid_t id, const uint8_t *data, uint8_t length)
+{
+  struct can_frame frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.can_id = id;
+  frame.can_dlc = length;
+  memcpy(frame.data, data, length);
+  CHECK(write(inverter, &frame, sizeof(frame)) == sizeof(frame));
+}
+
+static void test_frames()
+{
+  const canbus_transport *t = &canbus_socketcan_transport;
+
+  // Standard and extended identifiers to the inverter
+  twai_message_t message = {};
+  message.identifier = 0x351;
+  message.data_length_code = 8;
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    message.data[i] = i + 1;
+  }
+  CHECK_EQUAL(ESP_OK, t->transmit(message));
+  message.extd = 1;
+  message.identifier = 0x4212;
+  message.data_length_code = 2;
+  CHECK_EQUAL(ESP_OK, t->transmit(message));
+  CHECK_EQUAL(ESP_OK, t->wait_tx_done(100));
+
+  struct can_frame frame;
+  CHECK(inverter_read(&frame, 100));
+  CHECK_EQUAL(0x351, frame.can_id);
+  CHECK_EQUAL(8, frame.can_dlc);
+  CHECK_EQUAL(8, frame.data[7]);
+  CHECK(inverter_read(&frame, 100));
+  CHECK_EQUAL(0x4212 | CAN_EFF_FLAG, frame.can_id);
+  CHECK_EQUAL(2, frame.can_dlc);
+
+  // And back
+  const uint8_t request[8] = {0x02};
+  inverter_write(0x4200 | CAN_EFF_FLAG, request, 8);
+  inverter_write(0x305 | CAN_RTR_FLAG, request, 0);
+  twai_message_t received;
+  CHECK_EQUAL(ESP_OK, t->receive(received, 100));
+  CHECK_EQUAL(0x4200, received.identifier);
+  CHECK(received.extd && !received.rtr);
+  CHECK_EQUAL(8, received.data_length_code);
+  CHECK_EQUAL(0x02, received.data[0]);
+  CHECK_EQUAL(ESP_OK, t->receive(received, 100));
+  CHECK_EQUAL(0x305, received.identifier);
+  CHECK(!received.extd && received.rtr);
+
+  int64_t start = esp_timer_get_time();
+  CHECK_EQUAL(ESP_ERR_TIMEOUT, t->receive(received, 20));
+  CHECK(esp_timer_get_time() - start >= 15000);
+}
+
+/// @brief PylonForce H2 status request answered by the controller code over the virtual bus
+static void test_pylonforce_request()
+{
+  canbus_sim_reset(CanBusProtocolEmulation::CANBUS_PYLONFORCEH2);
+  canbus_set_transport(&canbus_socketcan_transport);
+  canbus_sim_rules();
+
+  const uint8_t request[8] = {0x00};
+  inverter_write(0x4200 | CAN_EFF_FLAG, request, 8);
+
+  // canbus_rx
+  twai_message_t received;
+  CHECK_EQUAL(ESP_OK, canbus_get_transport()->receive(received, 100));
+  CHECK(twai_filter_accepts(sim.filter, received));
+  canbus_rx_dispatch(received, esp_timer_get_time());
+
+  struct can_frame frame;
+  for (uint32_t id = 0x4210; id <= 0x42A0; id += 0x10)
+  {
+    CHECK(inverter_read(&frame, 100));
+    CHECK_EQUAL(id | CAN_EFF_FLAG, frame.can_id);
+    CHECK_EQUAL(8, frame.can_dlc);
+  }
+  CHECK(!inverter_read(&frame, 20));
+}
+
+int main()
+{
+  const char *interface = getenv("DIYBMS_SOCKETCAN");
+  if (interface == nullptr)
+  {
+    interface = "vcan0";
+  }
+
+  if (canbus_socketcan_open(interface) != ESP_OK || !inverter_open(interface))
+  {
+    printf("canbus_socketcan: %s not available, skipped\n", interface);
+    return 77;
+  }
+
+  test_frames();
+  test_pylonforce_request();
+
+  close(inverter);
+  return host_test_result("canbus_socketcan");
+}
@@ -0,0 +1,329 @@
+// Replay of current profiles through the shadow coulomb counter (coulomb_counter.cpp), months of
+// charge/discharge cycles in one second steps.
+//
+// The INA229 is modelled as the firmware sees it: the current is measured in CURRENT_LSB steps and
+// summed into the 40 bit signed CHARGE register (positive is charge out of the battery), which
+// CalculateAmpHourCounts (CurrentMonitorINA229.cpp) reads, takes the 40 bit difference of and clears
+// when it gets near overflow.  When the battery is full the charger drops to a float current, which
+// is below the tail current, and after 3 minutes the SOC is calibrated to 100% as the firmware does.
+//
+// The profiles are hourly average currents shaped like an off grid solar install, sunny and cloudy days in
+// a 10 day pattern, with load noise and short heavy loads added.  The battery model stores the
+// charge in at its own efficiency and nothing once it is full.
+//
+// Checked against the exact integral of the current:
+//   lifetime and daily Ah totals, which SOC calibration and register clears/wraps must not disturb
+//   the counter's own arithmetic, against a double precision integration of the measured current
+//   the SOC error (drift) between calibrations, printed per month
+
+#include "host_test.h"
+#include "coulomb_counter.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static const uint32_t CAPACITY_AH = 280;
+static const uint64_t CAPACITY_NC = (uint64_t)CAPACITY_AH * 1000 * COULOMB_COUNTER_NC_PER_MAH;
+// 150A full scale over the 20 bit current register
+static const double CURRENT_LSB_A = 150.0 / 524288.0;
+static const double TAIL_CURRENT_A = 2.0;
+static const double FLOAT_CURRENT_A = 0.5;
+static const int64_t TAIL_SECONDS = 3 * 60;
+static const uint32_t SECONDS_PER_DAY = 24 * 60 * 60;
+
+// Battery current in amps, positive is charging
+static const float sunny_day[24] = {-6, -6, -6, -6, -6, -5, 5, 20, 40, 55, 60, 60, 55, 45, 30, 10, -4, -10, -12, -10, -8, -7, -6, -6};
+static const float cloudy_day[24] = {-6, -6, -6, -6, -6, -6, -7, -5, 2, 8, 18, 22, 22, 18, 8, 2, -8, -12, -12, -10, -8, -7, -6, -6};
+
+struct replay_options
+{
+  uint32_t days;
+  // Coulombic efficiency of the battery and the setting of the counter, 9950 = 99.50%
+  uint32_t battery_efficiency_x100;
+  uint32_t counter_efficiency_x100;
+  // CHARGE register at the start, and whether the firmware clears it near overflow
+  int64_t initial_register;
+  bool clear_register;
+};
+
+struct replay_result
+{
+  // Worst difference between the totals and the exact integral, in mAh
+  double max_total_error_mAh;
+  double max_daily_error_mAh;
+  // Worst difference between the counter's charge and a double precision integration of the
+  // same measured current (its arithmetic), as a fraction of the capacity
+  double max_arithmetic_error;
+  // Worst SOC error in %, and just before a calibration put it back to 100%
+  double max_soc_error;
+  double max_soc_error_at_calibration;
+  uint32_t calibrations;
+  uint32_t register_clears;
+  uint32_t register_wraps;
+  bool totals_decreased;
+  double in_Ah;
+  double out_Ah;
+};
+
+static inline int64_t sign_extend_40(int64_t value)
+{
+  return ((int64_t)((uint64_t)value << 24)) >> 24;
+}
+
+static uint32_t seed = 1;
+static double noise()
+{
+  seed = seed * 1103515245 + 12345;
+  return ((double)((seed >> 8) & 0xFFFF) / 65535.0) * 2.0 - 1.0;
+}
+
+static double profile_current(uint32_t day, uint32_t second)
+{
+  // Three cloudy days then seven sunny ones
+  const float *hours = (day % 10) < 3 ? cloudy_day : sunny_day;
+  uint32_t hour = second / 3600;
+  double amps = hours[hour] + 2.0 * noise();
+
+  // Kettle/cooker in the morning and evening
+  if ((second >= 7 * 3600 && second < 7 * 3600 + 300) || (second >= 18 * 3600 && second < 18 * 3600 + 900))
+  {
+    amps -= 40.0;
+  }
+  return amps;
+}
+
+static replay_result replay(const replay_options &options, bool print)
+{
+  replay_result r = {};
+  uint32_t current_lsb_nA = (uint32_t)(CURRENT_LSB_A * 1000000000.0 + 0.5);
+
+  // Battery, starts full
+  double battery_nC = (double)CAPACITY_NC;
+  // Chip and firmware
+  int64_t charge_register = sign_extend_40(options.initial_register);
+  int64_t last_charge_raw = charge_register;
+  coulomb_counter counter = {};
+  coulomb_counter_calibrate(&counter, CAPACITY_NC, 10000);
+  int64_t tail_seconds = 0;
+  bool calibrated_this_visit = false;
+
+  // Exact integrals
+  double true_in_nC = 0;
+  double true_out_nC = 0;
+  double day_in_nC = 0;
+  double day_out_nC = 0;
+  // Measured current integrated in doubles, from the last calibration
+  double measured_charge_nC = (double)CAPACITY_NC;
+
+  uint32_t last_in_mAh = 0;
+  uint32_t last_out_mAh = 0;
+  double month_max_soc_error = 0;
+  seed = 1;
+
+  if (print)
+  {
+    printf("  month  max SOC error  calibrations  register clears  Ah in     Ah out\n");
+  }
+
+  for (uint32_t day = 0; day < options.days; day++)
+  {
+    for (uint32_t second = 0; second < SECONDS_PER_DAY; second++)
+    {
+      double amps = profile_current(day, second);
+      bool full = battery_nC >= (double)CAPACITY_NC;
+      if (full && amps > 0)
+      {
+        // Charger in float, the current goes to self discharge and balancing
+        amps = FLOAT_CURRENT_A + 0.05 * noise();
+      }
+
+      // Battery
+      if (amps > 0)
+      {
+        battery_nC = fmin((double)CAPACITY_NC, battery_nC + amps * 1e9 * options.battery_efficiency_x100 / 10000.0);
+        true_in_nC += amps * 1e9;
+        day_in_nC += amps * 1e9;
+      }
+      else
+      {
+        battery_nC += amps * 1e9;
+        true_out_nC -= amps * 1e9;
+        day_out_nC -= amps * 1e9;
+      }
+
+      // INA229, one second of conversions summed into CHARGE
+      int64_t current_raw = (int64_t)llround(-amps / CURRENT_LSB_A);
+      int64_t before = charge_register;
+      charge_register = sign_extend_40(charge_register + current_raw);
+      if ((before > 0 && current_raw > 0 && charge_register < 0) || (before < 0 && current_raw < 0 && charge_register > 0))
+      {
+        r.register_wraps++;
+      }
+
+      // CalculateAmpHourCounts
+      int64_t delta_raw = sign_extend_40(charge_register - last_charge_raw);
+      last_charge_raw = charge_register;
+      coulomb_counter_add(&counter, delta_raw * current_lsb_nA);
+      if (options.clear_register && llabs(last_charge_raw) > (1LL << 38))
+      {
+        charge_register = 0;
+        last_charge_raw = 0;
+        r.register_clears++;
+      }
+
+      double measured_nC = -(double)current_raw * current_lsb_nA;
+      measured_charge_nC += measured_nC > 0 ? measured_nC * options.counter_efficiency_x100 / 10000.0 : measured_nC;
+
+      // Tail current at full charge, SOC to 100% after 3 minutes, once per visit
+      if (full && amps > 0 && amps < TAIL_CURRENT_A)
+      {
+        tail_seconds++;
+        if (tail_seconds > TAIL_SECONDS && !calibrated_this_visit)
+        {
+          // Drift since the previous calibration
+          double error = fabs(coulomb_counter_soc(&counter, CAPACITY_NC, options.counter_efficiency_x100) / 100.0 - battery_nC * 100.0 / CAPACITY_NC);
+          if (error > r.max_soc_error_at_calibration)
+          {
+            r.max_soc_error_at_calibration = error;
+          }
+
+          coulomb_counter_calibrate(&counter, CAPACITY_NC, 10000);
+          measured_charge_nC = (double)CAPACITY_NC;
+          calibrated_this_visit = true;
+          r.calibrations++;
+        }
+      }
+      else
+      {
+        tail_seconds = 0;
+        calibrated_this_visit = false;
+      }
+
+      if (second % 60 == 0)
+      {
+        CHECK(battery_nC > 0);
+        double soc_error = fabs(coulomb_counter_soc(&counter, CAPACITY_NC, options.counter_efficiency_x100) / 100.0 - battery_nC * 100.0 / CAPACITY_NC);
+        if (soc_error > month_max_soc_error)
+        {
+          month_max_soc_error = soc_error;
+        }
+
+        double arithmetic = fabs((double)coulomb_counter_charge(&counter, options.counter_efficiency_x100) - measured_charge_nC) / CAPACITY_NC;
+        if (arithmetic > r.max_arithmetic_error)
+        {
+          r.max_arithmetic_error = arithmetic;
+        }
+      }
+    }
+
+    // Midnight, the daily counts are checked then reset as the firmware does
+    double daily_in = fabs(coulomb_counter_mAh(counter.in_nC - counter.daily_in_nC) - day_in_nC / COULOMB_COUNTER_NC_PER_MAH);
+    double daily_out = fabs(coulomb_counter_mAh(counter.out_nC - counter.daily_out_nC) - day_out_nC / COULOMB_COUNTER_NC_PER_MAH);
+    r.max_daily_error_mAh = fmax(r.max_daily_error_mAh, fmax(daily_in, daily_out));
+    coulomb_counter_reset_daily(&counter);
+    day_in_nC = 0;
+    day_out_nC = 0;
+
+    uint32_t in_mAh = coulomb_counter_mAh(counter.in_nC);
+    uint32_t out_mAh = coulomb_counter_mAh(counter.out_nC);
+    r.totals_decreased |= in_mAh < last_in_mAh || out_mAh < last_out_mAh;
+    last_in_mAh = in_mAh;
+    last_out_mAh = out_mAh;
+
+    double total_in = fabs(in_mAh - true_in_nC / COULOMB_COUNTER_NC_PER_MAH);
+    double total_out = fabs(out_mAh - true_out_nC / COULOMB_COUNTER_NC_PER_MAH);
+    r.max_total_error_mAh = fmax(r.max_total_error_mAh, fmax(total_in, total_out));
+
+    r.max_soc_error = fmax(r.max_soc_error, month_max_soc_error);
+    if (print && (day + 1) % 30 == 0)
+    {
+      printf("  %5u  %12.2f%%  %12u  %15u  %8.0f  %8.0f\n", (day + 1) / 30, month_max_soc_error, r.calibrations, r.register_clears,
+           in_mAh / 1000.0, out_mAh / 1000.0);
+      month_max_soc_error = 0;
+    }
+  }
+
+  r.in_Ah = true_in_nC / 1e12;
+  r.out_Ah = true_out_nC / 1e12;
+  return r;
+}
+
+/// @brief Six months with the efficiency set correctly, starting with CHARGE about to be cleared
+static void test_six_months()
+{
+  replay_options options = {};
+  options.days = 180;
+  options.battery_efficiency_x100 = 9950;
+  options.counter_efficiency_x100 = 9950;
+  options.initial_register = (1LL << 38) - 1000000;
+  options.clear_register = true;
+
+  printf("180 days, efficiency 99.50%% set correctly\n");
+  replay_result r = replay(options, true);
+  printf("  total error %.2f mAh, daily error %.2f mAh, arithmetic error %.2e of capacity, SOC error before calibration %.2f%%\n",
+         r.max_total_error_mAh, r.max_daily_error_mAh, r.max_arithmetic_error, r.max_soc_error_at_calibration);
+
+  // One calibration per sunny day, and the first day which started full
+  CHECK_EQUAL(127, r.calibrations);
+  CHECK(r.register_clears >= 1);
+  CHECK(!r.totals_decreased);
+  // Over 20000Ah each way, the error is the rounding of CURRENT_LSB to whole nA (1ppm here)
+  CHECK(r.in_Ah > 20000 && r.out_Ah > 20000);
+  CHECK(r.max_total_error_mAh < 2.0 + r.in_Ah * 1000 * 2e-6);
+  CHECK(r.max_daily_error_mAh < 1.5);
+  CHECK(r.max_arithmetic_error < 1e-6);
+  // The only SOC error is the float current counted in while the battery is full (0.5A for
+  // several hours, about 1%), it doesn't build up from one month to the next
+  CHECK(r.max_soc_error < 1.5);
+  CHECK(r.max_soc_error_at_calibration < 1.5);
+}
+
+/// @brief Efficiency set to 100% for a battery of 99%, the drift builds up over the cloudy days
+/// and is removed by the next calibration
+static void test_wrong_efficiency()
+{
+  replay_options options = {};
+  options.days = 90;
+  options.battery_efficiency_x100 = 9900;
+  options.counter_efficiency_x100 = 10000;
+  options.clear_register = true;
+
+  printf("90 days, efficiency 100%% for a 99%% battery\n");
+  replay_result r = replay(options, true);
+  printf("  SOC error before calibration %.2f%%\n", r.max_soc_error_at_calibration);
+
+  CHECK(!r.totals_decreased);
+  CHECK(r.max_total_error_mAh < 2.0 + r.in_Ah * 1000 * 2e-6);
+  CHECK(r.max_arithmetic_error < 1e-6);
+  // 1% of the charge in on top of the float current, bounded by the calibration every sunny day
+  CHECK(r.max_soc_error < 4.0);
+  CHECK(r.max_soc_error_at_calibration < 4.0);
+}
+
+/// @brief CHARGE isn't cleared and wraps round its 40 bits, the totals carry on
+static void test_register_wrap()
+{
+  replay_options options = {};
+  options.days = 20;
+  options.battery_efficiency_x100 = 9950;
+  options.counter_efficiency_x100 = 9950;
+  options.initial_register = (1LL << 39) - 1000000;
+  options.clear_register = false;
+
+  replay_result r = replay(options, false);
+
+  CHECK(r.register_wraps >= 1);
+  CHECK_EQUAL(0, r.register_clears);
+  CHECK(!r.totals_decreased);
+  CHECK(r.max_total_error_mAh < 2.0 + r.in_Ah * 1000 * 2e-6);
+  CHECK(r.max_daily_error_mAh < 1.5);
+  CHECK(r.max_arithmetic_error < 1e-6);
+}
+
+int main()
+{
+  test_six_months();
+  test_wrong_efficiency();
+  test_register_wrap();
+  return host_test_result("coulomb_counter");
+}
@@ -0,0 +1,171 @@
+// current_monitors.cpp, polling of the RS485 monitors when a poll fails or the settings change.
+//
+// ModbusRequestFailed (main.cpp) calls currentmon_poll_complete(address, false, now) for timeouts,
+// bad replies and exception replies (modbus_master.cpp).  The poll must complete straight away, the
+// readings of that monitor become invalid and the next poll goes out after the normal bus idle time
+// rather than after CURRENTMON_POLL_TIMEOUT_MS.
+
+#include "host_test.h"
+#include "current_monitors.h"
+
+static const int64_t START = 10 * 1000000LL;
+
+static diybms_eeprom_settings settings;
+
+// Two DIYBMS MODBUS monitors (addresses 90 and 91), both with a fresh valid reading
+static void configure()
+{
+  memset(&settings, 0, sizeof(settings));
+  settings.currentMonitoringEnabled = true;
+  settings.currentMonitoringDevice = CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS;
+  settings.currentMonitoringModBusAddress = 90;
+  settings.currentMonitoring_additional[0].device = CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS;
+  settings.currentMonitoring_additional[0].address = 91;
+  currentmon_configure(&settings);
+  CHECK_EQUAL(2, currentmon_count());
+
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    currentmonitoring_struct cm = {};
+    cm.validReadings = true;
+    cm.timestamp = START;
+    cm.modbus.voltage = 52.0F;
+    cm.modbus.current = 5.0F;
+    currentmon_store(i, cm);
+  }
+}
+
+/// @brief currentmon_next_poll, the device and address returned with the index must match the list
+static int8_t next_poll(int64_t now, uint32_t *wait_ms)
+{
+  CurrentMonitorDevice device;
+  uint8_t address;
+  int8_t index = currentmon_next_poll(now, wait_ms, &device, &address);
+  if (index >= 0)
+  {
+    CurrentMonitorDevice listed_device;
+    uint8_t listed_address;
+    CHECK(currentmon_identity(index, &listed_device, &listed_address));
+    CHECK_EQUAL(listed_device, device);
+    CHECK_EQUAL(listed_address, address);
+  }
+  return index;
+}
+
+static currentmon_instance_stats stats(uint8_t index, int64_t now)
+{
+  currentmon_instance_stats list[CURRENTMON_MAXIMUM];
+  CHECK(currentmon_get_stats(list, CURRENTMON_MAXIMUM, now) > index);
+  return list[index];
+}
+
+static bool aggregate_valid(int64_t now)
+{
+  currentmonitoring_struct total;
+  currentmon_aggregate(&total, now);
+  return total.validReadings;
+}
+
+/// @brief An exception reply 30ms after the poll, reported through ModbusRequestFailed
+static void test_failed_poll_completes()
+{
+  configure();
+  uint32_t wait_ms = 0;
+  CHECK(aggregate_valid(START));
+
+  CHECK_EQUAL(0, next_poll(START, &wait_ms));
+  CHECK_EQUAL(50, wait_ms);
+  // Nothing else goes out while the poll is outstanding
+  CHECK_EQUAL(-1, next_poll(START + 20000, &wait_ms));
+
+  int64_t failed = START + 30000;
+  currentmon_poll_complete(90, false, failed);
+
+  currentmon_instance_stats s = stats(0, failed);
+  CHECK_EQUAL(1, s.polls);
+  CHECK_EQUAL(0, s.replies);
+  CHECK_EQUAL(1, s.failures);
+  CHECK(!s.valid);
+  CHECK_EQUAL(30000, s.busy_us);
+  CHECK(!aggregate_valid(failed));
+  // The other monitor keeps its reading
+  CHECK(stats(1, failed).valid);
+
+  // Bus idle for as long as the failed poll took (50% budget), then the next monitor
+  CHECK_EQUAL(-1, next_poll(failed + 29000, &wait_ms));
+  CHECK_EQUAL(1, next_poll(failed + 30000, &wait_ms));
+  currentmon_poll_complete(91, true, failed + 50000);
+  CHECK_EQUAL(1, stats(1, failed + 50000).replies);
+
+  // The failed monitor is polled again at its normal interval
+  int64_t again = START + (int64_t)CURRENTMON_POLL_INTERVAL_MS * 1000;
+  CHECK_EQUAL(-1, next_poll(again - 1000, &wait_ms));
+  CHECK_EQUAL(0, next_poll(again, &wait_ms));
+  currentmonitoring_struct cm = {};
+  cm.validReadings = true;
+  cm.timestamp = again + 20000;
+  currentmon_store(0, cm);
+  currentmon_poll_complete(90, true, again + 20000);
+  CHECK(stats(0, again + 20000).valid);
+  CHECK_EQUAL(1, stats(0, again + 20000).replies);
+}
+
+/// @brief A poll which nothing is reported for is only given up after CURRENTMON_POLL_TIMEOUT_MS
+static void test_lost_poll_times_out()
+{
+  configure();
+  uint32_t wait_ms = 0;
+
+  CHECK_EQUAL(0, next_poll(START, &wait_ms));
+  int64_t timeout = START + (int64_t)CURRENTMON_POLL_TIMEOUT_MS * 1000;
+  CHECK_EQUAL(-1, next_poll(timeout, &wait_ms));
+  CHECK_EQUAL(0, stats(0, timeout).failures);
+  CHECK(stats(0, timeout).valid);
+
+  // The failed poll doesn't count towards the bus budget, the next monitor goes straight away
+  CHECK_EQUAL(1, next_poll(timeout + 1, &wait_ms));
+  currentmon_instance_stats s = stats(0, timeout + 1);
+  CHECK_EQUAL(1, s.failures);
+  CHECK(!s.valid);
+}
+
+/// @brief Settings saved while a poll is outstanding, the list is rebuilt and old indexes are out of range
+static void test_configure_during_poll()
+{
+  configure();
+  uint32_t wait_ms = 0;
+  CurrentMonitorDevice device;
+  uint8_t address;
+
+  CHECK_EQUAL(0, currentmon_next_poll(START, &wait_ms, &device, &address));
+  CHECK_EQUAL(90, address);
+  CHECK_EQUAL(CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS, device);
+
+  // Second monitor removed and the main one changed to a PZEM-017 at address 5
+  settings.currentMonitoringDevice = CurrentMonitorDevice::PZEM_017;
+  settings.currentMonitoringModBusAddress = 5;
+  settings.currentMonitoring_additional[0].address = 0;
+  currentmon_configure(&settings);
+  CHECK_EQUAL(1, currentmon_count());
+  CHECK(!currentmon_identity(1, &device, &address));
+  CHECK_EQUAL(-1, currentmon_find_address(90));
+  CHECK_EQUAL(-1, currentmon_find_address(91));
+
+  // The late reply to the old poll isn't matched to the new monitor
+  currentmon_poll_complete(90, true, START + 20000);
+  CHECK_EQUAL(0, stats(0, START + 20000).replies);
+
+  CHECK_EQUAL(0, currentmon_find_address(5, &device));
+  CHECK_EQUAL(CurrentMonitorDevice::PZEM_017, device);
+  CHECK_EQUAL(0, currentmon_next_poll(START + 30000, &wait_ms, &device, &address));
+  CHECK_EQUAL(5, address);
+  CHECK_EQUAL(CurrentMonitorDevice::PZEM_017, device);
+}
+
+int main()
+{
+  test_failed_poll_completes();
+  test_lost_poll_times_out();
+  test_configure_during_poll();
+  return host_test_result("current_monitors");
+}
@@ -0,0 +1,151 @@
+// gzip_deflate.cpp, every stream is decompressed with zlib and must give back the input
+
+#include "host_test.h"
+#include "gzip_deflate.h"
+#include "line_protocol_sample.h"
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+static uint16_t hash_table[GZIP_HASH_SIZE];
+
+static bool inflate_gzip(const uint8_t *data, size_t length, std::string &out)
+{
+  z_stream z = {};
+  // 16 + window bits, expect a gzip header and trailer (checks the CRC and length)
+  if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK)
+  {
+    return false;
+  }
+
+  std::vector<uint8_t> buffer(GZIP_MAXIMUM_INPUT + 1);
+  z.next_in = (Bytef *)data;
+  z.avail_in = length;
+  z.next_out = buffer.data();
+  z.avail_out = buffer.size();
+  int result = inflate(&z, Z_FINISH);
+  bool ok = result == Z_STREAM_END && z.avail_in == 0;
+  out.assign((const char *)buffer.data(), z.total_out);
+  inflateEnd(&z);
+  return ok;
+}
+
+static size_t round_trip(const std::string &input)
+{
+  std::vector<uint8_t> compressed(input.length() + input.length() / 4 + 64);
+  size_t n = gzip_compress((const uint8_t *)input.data(), input.length(), compressed.data(), compressed.size(), hash_table);
+  CHECK(n > 0);
+  if (n == 0)
+  {
+    return 0;
+  }
+
+  // Header, deflate with no flags and "unknown" operating system
+  CHECK_EQUAL(0x1f, compressed[0]);
+  CHECK_EQUAL(0x8b, compressed[1]);
+  CHECK_EQUAL(8, compressed[2]);
+  CHECK_EQUAL(0, compressed[3]);
+
+  std::string output;
+  CHECK(inflate_gzip(compressed.data(), n, output));
+  CHECK_EQUAL(input.length(), output.length());
+  CHECK(input == output);
+  return n;
+}
+
+static void test_small()
+{
+  round_trip("");
+  round_trip("a");
+  round_trip("ab");
+  round_trip("abc");
+  round_trip("aaaa");
+}
+
+static void test_line_protocol()
+{
+  std::string batch;
+  line_protocol_sample(batch, 8, 16, 1700000000, 1);
+  size_t n = round_trip(batch);
+  // Repetitive text, must be well under half the size
+  CHECK(n < batch.length() / 2);
+
+  // Live sample plus replayed samples, as large as the line buffer allows
+  std::string replay;
+  for (uint32_t s = 0; replay.length() + batch.length() < 8192; s++)
+  {
+    line_protocol_sample(replay, 8, 16, 1700000000 + s * 30, s);
+  }
+  round_trip(replay);
+}
+
+static void test_matches()
+{
+  // Longest match (258), and runs which overlap the text they copy
+  round_trip(std::string(1000, 'x'));
+  round_trip(std::string(259, 'y') + "z" + std::string(258, 'y'));
+
+  // Copies from the far end of the 32KB window, and beyond it
+  std::string block;
+  uint32_t seed = 7;
+  for (int i = 0; i < 300; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    block.push_back((char)('a' + (seed >> 16) % 26));
+  }
+  std::string filler;
+  for (int i = 0; filler.length() < 32768 - block.length(); i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    filler.push_back((char)(seed >> 16));
+  }
+  round_trip(block + filler + block);
+  round_trip(block + filler + "!" + block);
+}
+
+static void test_incompressible()
+{
+  // Random bytes grow a little, but must still decompress
+  std::string input;
+  uint32_t seed = 99;
+  for (int i = 0; i < 10000; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    input.push_back((char)(seed >> 16));
+  }
+  round_trip(input);
+
+  // Largest input allowed
+  input.clear();
+  while (input.length() < GZIP_MAXIMUM_INPUT - 1)
+  {
+    line_protocol_sample(input, 8, 16, 1700000000 + input.length(), input.length());
+  }
+  input.resize(GZIP_MAXIMUM_INPUT - 1);
+  round_trip(input);
+}
+
+static void test_limits()
+{
+  std::string batch;
+  line_protocol_sample(batch, 8, 16, 1700000000, 1);
+  std::vector<uint8_t> output(batch.length());
+
+  // Output buffer too small
+  CHECK_EQUAL(0, gzip_compress((const uint8_t *)batch.data(), batch.length(), output.data(), 100, hash_table));
+  // Input too large
+  std::vector<uint8_t> large(GZIP_MAXIMUM_INPUT, 'a');
+  CHECK_EQUAL(0, gzip_compress(large.data(), large.size(), output.data(), output.size(), hash_table));
+}
+
+int main()
+{
+  test_small();
+  test_line_protocol();
+  test_matches();
+  test_incompressible();
+  test_limits();
+  return host_test_result("gzip_deflate");
+}
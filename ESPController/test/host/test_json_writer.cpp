@@ -0,0 +1,121 @@
+// Output of json_writer.hpp: commas, escaping, number formatting and chunked output
+
+#include "host_test.h"
+#include "json_writer.hpp"
+
+#include <float.h>
+#include <string>
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *, const char *, size_t)
+{
+  return ESP_OK;
+}
+
+struct string_sink
+{
+  std::string *out;
+  esp_err_t write(const char *data, size_t length)
+  {
+    out->append(data, length);
+    return ESP_OK;
+  }
+  esp_err_t finish(const char *data, size_t length) { return write(data, length); }
+};
+
+static std::string document(size_t bufferLen)
+{
+  std::string out;
+  char buffer[256];
+  json_writer<string_sink> json(string_sink{&out}, buffer, bufferLen);
+  json.beginObject();
+  json.addUInt("a", 1);
+  json.addInt("b", -2);
+  json.beginArray("c");
+  json.addUInt(3);
+  json.addBool(true);
+  json.addNull();
+  json.beginObject();
+  json.endObject();
+  json.endArray();
+  json.addString("d", "quote\" slash\\ tab\t nl\n \x01");
+  json.addFloat("e", 3.14159F, 2);
+  json.addUInt64("f", 12345678901234ULL);
+  json.endObject();
+  CHECK_EQUAL(ESP_OK, json.finish());
+  CHECK_EQUAL(out.length(), json.length());
+  return out;
+}
+
+static void test_structure()
+{
+  const char *expected = "{\"a\":1,\"b\":-2,\"c\":[3,true,null,{}],\"d\":\"quote\\\" slash\\\\ tab\\t nl\\n \\u0001\",\"e\":3.14,\"f\":12345678901234}";
+  CHECK_STRING(expected, document(256).c_str());
+  // Same output when the buffer has to be flushed many times
+  CHECK_STRING(expected, document(7).c_str());
+  CHECK_STRING(expected, document(1).c_str());
+}
+
+static std::string one_float(float value, uint8_t decimals)
+{
+  std::string out;
+  char buffer[16];
+  json_writer<string_sink> json(string_sink{&out}, buffer, sizeof(buffer));
+  json.beginArray();
+  json.addFloat(value, decimals);
+  json.endArray();
+  json.finish();
+  return out;
+}
+
+static void test_integers()
+{
+  std::string out;
+  char buffer[256];
+  json_writer<string_sink> json(string_sink{&out}, buffer, sizeof(buffer));
+  json.beginArray();
+  json.addUInt(0);
+  json.addUInt(UINT32_MAX);
+  json.addInt(0);
+  json.addInt(-1);
+  json.addInt(INT32_MAX);
+  json.addInt(INT32_MIN);
+  json.addUInt64(0);
+  json.addUInt64(UINT64_MAX);
+  json.endArray();
+  CHECK_EQUAL(ESP_OK, json.finish());
+  CHECK_STRING("[0,4294967295,0,-1,2147483647,-2147483648,0,18446744073709551615]", out.c_str());
+}
+
+static void test_floats()
+{
+  CHECK_STRING("[null]", one_float(NAN, 4).c_str());
+  CHECK_STRING("[null]", one_float(INFINITY, 4).c_str());
+  CHECK_STRING("[-0.5000]", one_float(-0.5F, 4).c_str());
+
+  // Longer than the old 24 byte buffer, must be the complete number
+  CHECK_STRING("[1000000015047466219876688855040.0000]", one_float(1e30F, 4).c_str());
+  CHECK_STRING("[-340282346638528859811704183484516925440.00000000]", one_float(-FLT_MAX, 8).c_str());
+
+  // Too many decimals for the buffer, falls back to the exponent form
+  CHECK_STRING("[3.40282347e+38]", one_float(FLT_MAX, 200).c_str());
+}
+
+static void test_sink_error()
+{
+  // fixed_buffer_sink can't flush, output stops and the error is reported
+  char buffer[8];
+  json_writer<fixed_buffer_sink> json(fixed_buffer_sink(), buffer, sizeof(buffer));
+  json.beginObject();
+  json.addString("name", "longer than eight bytes");
+  json.endObject();
+  CHECK_EQUAL(ESP_ERR_NO_MEM, json.finish());
+}
+
+int main()
+{
+  test_structure();
+  test_integers();
+  test_floats();
+  test_sink_error();
+  return host_test_result("test_json_writer");
+}
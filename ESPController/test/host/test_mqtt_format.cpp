@@ -0,0 +1,102 @@
+// mqtt_format.cpp, topics and cell payloads must be the same as the std::string versions they replaced
+
+#include "host_test.h"
+#include "mqtt_before.h"
+#include "mqtt_format.h"
+
+static CellModuleInfo make_cell(uint8_t i)
+{
+  CellModuleInfo cell;
+  memset(&cell, 0, sizeof(cell));
+  cell.valid = true;
+  cell.voltagemV = 3300 + (i * 7) % 200;
+  cell.voltagemVMin = cell.voltagemV - 12;
+  cell.voltagemVMax = cell.voltagemV + 9;
+  cell.internalTemp = 20 + i % 15;
+  cell.externalTemp = (i % 5) == 0 ? -5 : 18 + i % 10;
+  cell.inBypass = (i % 9) == 0;
+  cell.bypassOverTemp = (i % 27) == 0;
+  cell.PWMValue = (i * 13) % 256;
+  cell.badPacketCount = i * 3;
+  cell.BalanceCurrentCount = 1000 + i;
+  return cell;
+}
+
+static void test_topics()
+{
+  mqtt_topic_table topics;
+  mqtt_format_topics(&topics, "emon/diybms", 90);
+  CHECK_STRING("emon/diybms/status", topics.status);
+  CHECK_STRING("emon/diybms/rule", topics.rule);
+  CHECK_STRING("emon/diybms/output", topics.output);
+  CHECK_STRING("emon/diybms/replay", topics.replay);
+  CHECK_STRING("emon/diybms/modbus_A90", topics.current);
+  CHECK_STRING("emon/diybms/bank/0", topics.bank[0]);
+  CHECK_STRING("emon/diybms/cells/3", topics.cells[3]);
+
+  mqtt_format_current_topic(&topics, "emon/diybms", 255);
+  CHECK_EQUAL(255, topics.current_address);
+  CHECK_STRING("emon/diybms/modbus_A255", topics.current);
+
+  // Longest prefix the settings allow
+  char prefix[sizeof(diybms_eeprom_settings::mqtt_topic)];
+  memset(prefix, 'x', sizeof(prefix) - 1);
+  prefix[sizeof(prefix) - 1] = 0;
+  mqtt_format_topics(&topics, prefix, 255);
+  CHECK_EQUAL(strlen(prefix) + strlen("/modbus_A255"), strlen(topics.current));
+}
+
+static void test_cell_topics()
+{
+  mqtt_cell_topic_table table;
+  memset(&table, 0, sizeof(table));
+
+  CHECK(mqtt_format_cell_topics(&table, "emon/diybms", 8, 16));
+  for (uint8_t i = 0; i < 128; i++)
+  {
+    CHECK_STRING(mqtt_before_cell_topic("emon/diybms", i, 16).c_str(), mqtt_cell_topic(table, i));
+  }
+
+  // Same configuration keeps the table
+  const char *arena = table.arena;
+  CHECK(mqtt_format_cell_topics(&table, "emon/diybms", 8, 16));
+  CHECK(arena == table.arena);
+
+  // New configuration, and forced rebuild for a new prefix
+  CHECK(mqtt_format_cell_topics(&table, "emon/diybms", 4, 32));
+  CHECK_STRING("emon/diybms/3/31", mqtt_cell_topic(table, 127));
+  table.banks = 0;
+  CHECK(mqtt_format_cell_topics(&table, "b", 4, 32));
+  CHECK_STRING("b/1/0", mqtt_cell_topic(table, 32));
+
+  free(table.arena);
+}
+
+static void test_cell_payload()
+{
+  char payload[MQTT_PAYLOAD_ARENA_SIZE];
+  std::string before;
+
+  for (uint8_t i = 0; i < 128; i++)
+  {
+    CellModuleInfo cell = make_cell(i);
+    for (int detail = 0; detail < 2; detail++)
+    {
+      mqtt_payload_writer json(fixed_buffer_sink(), payload, sizeof(payload));
+      mqtt_cell_payload(json, cell, detail);
+      CHECK_EQUAL(ESP_OK, json.finish());
+      payload[json.length()] = 0;
+
+      mqtt_before_cell_payload(before, cell, detail);
+      CHECK_STRING(before.c_str(), payload);
+    }
+  }
+}
+
+int main()
+{
+  test_topics();
+  test_cell_topics();
+  test_cell_payload();
+  return host_test_result("mqtt_format");
+}
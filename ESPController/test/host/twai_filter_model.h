@@ -0,0 +1,51 @@
+#ifndef DIYBMS_HOST_TWAI_FILTER_MODEL_H_
+#define DIYBMS_HOST_TWAI_FILTER_MODEL_H_
+
+// Acceptance filter of the ESP32 TWAI controller (ESP32 technical reference manual, "Acceptance Filter"),
+// to check which frames reach the receive queue with a filter from canbus_rx_select.
+// A mask bit of 1 means "don't care".
+
+#include <driver/twai.h>
+
+static inline bool twai_filter_compare(uint32_t bits, uint32_t code, uint32_t mask)
+{
+  return ((bits ^ code) & ~mask) == 0;
+}
+
+static inline bool twai_filter_accepts(const twai_filter_config_t &filter, const twai_message_t &message)
+{
+  const uint32_t rtr = message.rtr ? 1 : 0;
+  const uint8_t byte1 = message.data_length_code > 0 ? message.data[0] : 0;
+  const uint8_t byte2 = message.data_length_code > 1 ? message.data[1] : 0;
+
+  if (filter.single_filter)
+  {
+    if (message.extd)
+    {
+      // ID 28:0 in bits 31:3, RTR in bit 2
+      uint32_t bits = (message.identifier << 3) | (rtr << 2);
+      return twai_filter_compare(bits, filter.acceptance_code, filter.acceptance_mask | 0x3);
+    }
+    // ID 10:0 in bits 31:21, RTR in bit 20, first two data bytes in bits 15:0
+    uint32_t bits = (message.identifier << 21) | (rtr << 20) | (byte1 << 8) | byte2;
+    return twai_filter_compare(bits, filter.acceptance_code, filter.acceptance_mask | 0x000F0000);
+  }
+
+  if (message.extd)
+  {
+    // Both filters compare ID 28:13
+    uint32_t id = (message.identifier >> 13) & 0xFFFF;
+    return twai_filter_compare(id << 16, filter.acceptance_code & 0xFFFF0000, filter.acceptance_mask | 0x0000FFFF) ||
+           twai_filter_compare(id, filter.acceptance_code & 0x0000FFFF, filter.acceptance_mask | 0xFFFF0000);
+  }
+
+  // Filter 1: ID in bits 31:21, RTR bit 20, first data byte in bits 19:16 and 3:0
+  uint32_t first = (message.identifier << 21) | (rtr << 20) | ((byte1 >> 4) << 16) | (byte1 & 0x0F);
+  bool filter1 = twai_filter_compare(first, filter.acceptance_code & 0xFFFF000F, filter.acceptance_mask | 0x0000FFF0);
+  // Filter 2: ID in bits 15:5, RTR bit 4
+  uint32_t second = (message.identifier << 5) | (rtr << 4);
+  bool filter2 = twai_filter_compare(second, filter.acceptance_code & 0x0000FFF0, filter.acceptance_mask | 0xFFFF000F);
+  return filter1 || filter2;
+}
+
+#endif
@@ -113,6 +113,32 @@ function upload_firmware() {
     return false;
 }
 
+function upload_webfiles() {
+    $("#progress").show();
+    $("#status_div").text("Upload in progress");
+    let data = document.getElementById("www_sel").files[0];
+    xhr = new XMLHttpRequest();
+    xhr.open("POST", "/wwwupload", true);
+    xhr.setRequestHeader('X-Requested-With', 'XMLHttpRequest');
+    xhr.upload.addEventListener("progress", function (event) {
+        if (event.lengthComputable) {
+            document.getElementById("progress").style.width = (event.loaded / event.total) * 100 + "%";
+        }
+    });
+    xhr.onreadystatechange = function () {
+        if (xhr.readyState === XMLHttpRequest.DONE) {
+            var status = xhr.status;
+            if (status >= 200 && status < 400) {
+                $("#status_div").text("Web files updated, reload the page.");
+            } else {
+                $("#status_div").text("Upload rejected!");
+            }
+            $("#progress").hide();
+        }
+    };
+    xhr.send(data);
+    return false;
+}
 
 function CalculateChargeCurrent(value1, value2, highestCellVoltage, maximumchargecurrent, kneemv, cellmaxmv) {
     if (highestCellVoltage < kneemv) {
@@ -272,6 +298,26 @@ function refreshCurrentMonitorValues() {
             $("#modbusAddress").val(data.address);
             $("#CurrentMonDev").val(data.devicetype);
 
+            $("#cmadditional tbody").empty();
+            $.each(data.additional, function (index, value) {
+                var n = index + 2;
+                $("#cmadditional tbody").append("<tr><td>" + n + "</td><td><select name='cm" + n + "dev' id='cm" + n + "dev'>"
+                    + "<option value='0'>DIYBMS Current Monitor [MODBUS]</option><option value='1'>PeaceFair PZEM-017</option></select></td>"
+                    + "<td><input type='number' name='cm" + n + "addr' id='cm" + n + "addr' min='0' max='247' step='1' /></td></tr>");
+                $("#cm" + n + "dev").val(value.devicetype);
+                $("#cm" + n + "addr").val(value.address);
+            });
+
+            var devicenames = ["MODBUS", "PZEM-017", "Internal"];
+            $("#cmmonitors").empty();
+            $("#cmmonitors").append("<thead><tr><th>Number</th><th>Device</th><th>Address</th><th>Voltage</th><th>Current</th><th>Power</th><th>SoC %</th><th>Interval (ms)</th><th>Age (ms)</th><th>Status</th></tr></thead>");
+            $.each(data.monitors, function (index, value) {
+                var status = value.stale ? "Stale" : (value.valid ? "OK" : "Invalid");
+                $("#cmmonitors").append("<tr><td>" + (index + 1) + "</td><td>" + devicenames[value.devicetype] + "</td><td>" + value.address
+                    + "</td><td>" + value.voltage.toFixed(2) + "</td><td>" + value.current.toFixed(2) + "</td><td>" + value.power.toFixed(1)
+                    + "</td><td>" + value.soc.toFixed(1) + "</td><td>" + value.intervalms + "</td><td>" + value.agems + "</td><td>" + status + "</td></tr>");
+            });
+
             $("#shuntmaxcur").val(data.shuntmaxcur);
             $("#shuntmv").val(data.shuntmv);
             $("#cmvalid").val(data.valid);
@@ -655,311 +701,319 @@ function secondsToHms(seconds) {
     return dDisplay + hDisplay + mDisplay + sDisplay;
 }
 
-function queryBMS() {
-    $.getJSON("/api/monitor2", function (jsondata) {
-        var labels = [];
-        var cells = [];
-        var bank = [];
-        var voltages = [];
-        var voltagesmin = [];
-        var voltagesmax = [];
-        var tempint = [];
-        var tempext = [];
-        var pwm = [];
-
-        var minVoltage = DEFAULT_GRAPH_MIN_VOLTAGE / 1000.0;
-        var maxVoltage = DEFAULT_GRAPH_MAX_VOLTAGE / 1000.0;
-
-        var minExtTemp = 999;
-        var maxExtTemp = -999;
-
-        var bankNumber = 0;
-        var cellsInBank = 0;
-
-        // Need one color for each bank, could make it colourful I suppose :-)
-        const colours = [
-            '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
-            '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
-            '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
-            '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
-        ]
-
-        const red = '#B44247'
-
-        const highestCell = '#8c265d'
-        const lowestCell = '#b6a016'
-
-        var markLineData = [];
-
-        markLineData.push({ name: 'avg', type: 'average', lineStyle: { color: '#ddd', width: 2, type: 'dotted', opacity: 0.3 }, label: { distance: [10, 0], position: 'start', color: "#eeeeee", textBorderColor: '#313131', textBorderWidth: 2 } });
-        //markLineData.push({ name: 'min', type: 'min', lineStyle: { color: '#ddd', width: 2, type: 'dotted', opacity: 0.3 }, label: { distance: [10, 0], position: 'start', color: "#eeeeee", textBorderColor: '#313131', textBorderWidth: 2 } });
-        //markLineData.push({ name: 'max', type: 'max', lineStyle: { color: '#ddd', width: 2, type: 'dotted', opacity: 0.3 }, label: { distance: [10, 0], position: 'start', color: "#eeeeee", textBorderColor: '#313131', textBorderWidth: 2 } });
-
-        var xAxis = 0;
-        for (let index = 0; index < jsondata.banks; index++) {
-            markLineData.push({ name: "Bank " + index, xAxis: xAxis, lineStyle: { color: colours[index], width: 4, type: 'dashed', opacity: 0.5 }, label: { show: true, distance: [0, 0], formatter: '{b}', color: '#eeeeee', textBorderColor: colours[index], textBorderWidth: 2 } });
-            xAxis += jsondata.seriesmodules;
-        }
+function renderMonitor(jsondata) {
+    var labels = [];
+    var cells = [];
+    var bank = [];
+    var voltages = [];
+    var voltagesmin = [];
+    var voltagesmax = [];
+    var tempint = [];
+    var tempext = [];
+    var pwm = [];
+
+    var minVoltage = DEFAULT_GRAPH_MIN_VOLTAGE / 1000.0;
+    var maxVoltage = DEFAULT_GRAPH_MAX_VOLTAGE / 1000.0;
+
+    var minExtTemp = 999;
+    var maxExtTemp = -999;
+
+    var bankNumber = 0;
+    var cellsInBank = 0;
+
+    // Need one color for each bank, could make it colourful I suppose :-)
+    const colours = [
+        '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
+        '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
+        '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
+        '#55a1ea', '#33628f', '#498FD0', '#6D8EA0',
+    ]
+
+    const red = '#B44247'
+
+    const highestCell = '#8c265d'
+    const lowestCell = '#b6a016'
+
+    var markLineData = [];
+
+    markLineData.push({ name: 'avg', type: 'average', lineStyle: { color: '#ddd', width: 2, type: 'dotted', opacity: 0.3 }, label: { distance: [10, 0], position: 'start', color: "#eeeeee", textBorderColor: '#313131', textBorderWidth: 2 } });
+    //markLineData.push({ name: 'min', type: 'min', lineStyle: { color: '#ddd', width: 2, type: 'dotted', opacity: 0.3 }, label: { distance: [10, 0], position: 'start', color: "#eeeeee", textBorderColor: '#313131', textBorderWidth: 2 } });
+    //markLineData.push({ name: 'max', type: 'max', lineStyle: { color: '#ddd', width: 2, type: 'dotted', opacity: 0.3 }, label: { distance: [10, 0], position: 'start', color: "#eeeeee", textBorderColor: '#313131', textBorderWidth: 2 } });
+
+    var xAxis = 0;
+    for (let index = 0; index < jsondata.banks; index++) {
+        markLineData.push({ name: "Bank " + index, xAxis: xAxis, lineStyle: { color: colours[index], width: 4, type: 'dashed', opacity: 0.5 }, label: { show: true, distance: [0, 0], formatter: '{b}', color: '#eeeeee', textBorderColor: colours[index], textBorderWidth: 2 } });
+        xAxis += jsondata.seriesmodules;
+    }
 
-        if (jsondata.voltages) {
-            //Clone array of voltages
-            tempArray = [];
-            for (i = 0; i < jsondata.voltages.length; i++) {
-                tempArray[i] = jsondata.voltages[i];
-            }
+    if (jsondata.voltages) {
+        //Clone array of voltages
+        tempArray = [];
+        for (i = 0; i < jsondata.voltages.length; i++) {
+            tempArray[i] = jsondata.voltages[i];
+        }
 
-            //Split voltages into banks
-            sorted_voltages = [];
-            for (i = 0; i < jsondata.banks; i++) {
-                unsorted = tempArray.splice(0, jsondata.seriesmodules);
-                sorted_voltages.push(unsorted.sort());
-            }
+        //Split voltages into banks
+        sorted_voltages = [];
+        for (i = 0; i < jsondata.banks; i++) {
+            unsorted = tempArray.splice(0, jsondata.seriesmodules);
+            sorted_voltages.push(unsorted.sort());
+        }
 
-            for (let i = 0; i < jsondata.voltages.length; i++) {
-                labels.push(bankNumber + "/" + i);
+        for (let i = 0; i < jsondata.voltages.length; i++) {
+            labels.push(bankNumber + "/" + i);
 
-                // Make different banks different colours (stripes)
-                var stdcolor = colours[bankNumber];
+            // Make different banks different colours (stripes)
+            var stdcolor = colours[bankNumber];
 
-                var color = stdcolor;
+            var color = stdcolor;
 
-                //Highlight lowest cell voltage in this bank
-                if (jsondata.voltages[i] === sorted_voltages[bankNumber][0]) {
-                    color = lowestCell;
-                }
-                //Highlight highest cell voltage in this bank
-                if (jsondata.voltages[i] === sorted_voltages[bankNumber][jsondata.seriesmodules - 1]) {
-                    color = highestCell;
-                }
-                // Red
-                if (jsondata.bypass[i] === 1) {
-                    color = red;
-                }
+            //Highlight lowest cell voltage in this bank
+            if (jsondata.voltages[i] === sorted_voltages[bankNumber][0]) {
+                color = lowestCell;
+            }
+            //Highlight highest cell voltage in this bank
+            if (jsondata.voltages[i] === sorted_voltages[bankNumber][jsondata.seriesmodules - 1]) {
+                color = highestCell;
+            }
+            // Red
+            if (jsondata.bypass[i] === 1) {
+                color = red;
+            }
 
-                var v = (parseFloat(jsondata.voltages[i]) / 1000.0);
-                voltages.push({ value: v, itemStyle: { color: color } });
+            var v = (parseFloat(jsondata.voltages[i]) / 1000.0);
+            voltages.push({ value: v, itemStyle: { color: color } });
 
-                //Auto scale graph is outside of normal bounds
-                if (v > maxVoltage) { maxVoltage = v; }
-                if (v < minVoltage) { minVoltage = v; }
+            //Auto scale graph is outside of normal bounds
+            if (v > maxVoltage) { maxVoltage = v; }
+            if (v < minVoltage) { minVoltage = v; }
 
-                if (jsondata.minvoltages) {
-                    voltagesmin.push((parseFloat(jsondata.minvoltages[i]) / 1000.0));
-                }
-                if (jsondata.maxvoltages) {
-                    voltagesmax.push((parseFloat(jsondata.maxvoltages[i]) / 1000.0));
-                }
+            if (jsondata.minvoltages) {
+                voltagesmin.push((parseFloat(jsondata.minvoltages[i]) / 1000.0));
+            }
+            if (jsondata.maxvoltages) {
+                voltagesmax.push((parseFloat(jsondata.maxvoltages[i]) / 1000.0));
+            }
 
-                bank.push(bankNumber);
-                cells.push(i);
+            bank.push(bankNumber);
+            cells.push(i);
 
 
-                cellsInBank++;
-                if (cellsInBank == jsondata.seriesmodules) {
-                    cellsInBank = 0;
-                    bankNumber++;
-                }
+            cellsInBank++;
+            if (cellsInBank == jsondata.seriesmodules) {
+                cellsInBank = 0;
+                bankNumber++;
+            }
 
-                color = jsondata.bypasshot[i] == 1 ? red : stdcolor;
-                tempint.push({ value: jsondata.inttemp[i], itemStyle: { color: color } });
-                var exttemp = (jsondata.exttemp[i] == -40 ? 0 : jsondata.exttemp[i]);
-                tempext.push({ value: exttemp, itemStyle: { color: stdcolor } });
+            color = jsondata.bypasshot[i] == 1 ? red : stdcolor;
+            tempint.push({ value: jsondata.inttemp[i], itemStyle: { color: color } });
+            var exttemp = (jsondata.exttemp[i] == -40 ? 0 : jsondata.exttemp[i]);
+            tempext.push({ value: exttemp, itemStyle: { color: stdcolor } });
 
-                if (jsondata.exttemp[i] != null) {
-                    if (exttemp > maxExtTemp) {
-                        maxExtTemp = exttemp;
-                    }
-                    if (exttemp < minExtTemp) {
-                        minExtTemp = exttemp;
-                    }
+            if (jsondata.exttemp[i] != null) {
+                if (exttemp > maxExtTemp) {
+                    maxExtTemp = exttemp;
                 }
+                if (exttemp < minExtTemp) {
+                    minExtTemp = exttemp;
+                }
+            }
 
 
-                pwm.push({ value: jsondata.bypasspwm[i] == 0 ? null : Math.trunc(jsondata.bypasspwm[i] / 255 * 100) });
-            }
+            pwm.push({ value: jsondata.bypasspwm[i] == 0 ? null : Math.trunc(jsondata.bypasspwm[i] / 255 * 100) });
         }
+    }
 
-        //Scale down for low voltages
-        if (minVoltage < 0) { minVoltage = 0; }
-
-        if (jsondata) {
-            $("#badcrc .v").html(jsondata.badcrc);
-            $("#ignored .v").html(jsondata.ignored);
-            $("#sent .v").html(jsondata.sent);
-            $("#received .v").html(jsondata.received);
-            $("#roundtrip .v").html(jsondata.roundtrip);
-            $("#oos .v").html(jsondata.oos);
-            $("#canfail .v").html(jsondata.can_fail);
-            $("#canrecerr .v").html(jsondata.can_r_err);
-            $("#cansent .v").html(jsondata.can_sent);
-            $("#canrecd .v").html(jsondata.can_rec);
-            $("#qlen .v").html(jsondata.qlen);
-            $("#uptime .v").html(secondsToHms(jsondata.uptime));
-            if (minExtTemp == 999 || maxExtTemp == -999) {
-                $("#celltemp .v").html("");
-            } else {
-                $("#celltemp .v").html(minExtTemp + "/" + maxExtTemp + "&deg;C");
-            }
+    //Scale down for low voltages
+    if (minVoltage < 0) { minVoltage = 0; }
+
+    if (jsondata) {
+        $("#badcrc .v").html(jsondata.badcrc);
+        $("#ignored .v").html(jsondata.ignored);
+        $("#sent .v").html(jsondata.sent);
+        $("#received .v").html(jsondata.received);
+        $("#roundtrip .v").html(jsondata.roundtrip);
+        $("#oos .v").html(jsondata.oos);
+        $("#canfail .v").html(jsondata.can_fail);
+        $("#canrecerr .v").html(jsondata.can_r_err);
+        $("#cansent .v").html(jsondata.can_sent);
+        $("#canrecd .v").html(jsondata.can_rec);
+        $("#qlen .v").html(jsondata.qlen);
+        $("#uptime .v").html(secondsToHms(jsondata.uptime));
+        if (minExtTemp == 999 || maxExtTemp == -999) {
+            $("#celltemp .v").html("");
+        } else {
+            $("#celltemp .v").html(minExtTemp + "/" + maxExtTemp + "&deg;C");
+        }
 
-            if (jsondata.activerules == 0) {
-                $("#activerules").hide();
-            } else {
-                $("#activerules").html(jsondata.activerules);
-                $("#activerules").show(400);
-            }
+        if (jsondata.activerules == 0) {
+            $("#activerules").hide();
+        } else {
+            $("#activerules").html(jsondata.activerules);
+            $("#activerules").show(400);
+        }
 
-            if (jsondata.dyncv) {
-                $("#dyncvolt .v").html(parseFloat(jsondata.dyncv / 10).toFixed(2) + "V");
-            } else { $("#dyncvolt .v").html(""); }
+        if (jsondata.dyncv) {
+            $("#dyncvolt .v").html(parseFloat(jsondata.dyncv / 10).toFixed(2) + "V");
+        } else { $("#dyncvolt .v").html(""); }
 
-            if (jsondata.dyncc) {
-                $("#dynccurr .v").html(parseFloat(jsondata.dyncc / 10).toFixed(2) + "A");
-            } else { $("#dynccurr .v").html(""); }
+        if (jsondata.dyncc) {
+            $("#dynccurr .v").html(parseFloat(jsondata.dyncc / 10).toFixed(2) + "A");
+        } else { $("#dynccurr .v").html(""); }
 
 
 
-            switch (jsondata.cmode) {
-                case 0: $("#chgmode .v").html("Standard"); break;
-                case 1: $("#chgmode .v").html("Absorb " + secondsToHms(jsondata.ctime)); break;
-                case 2: $("#chgmode .v").html("Float " + secondsToHms(jsondata.ctime)); break;
-                case 3: $("#chgmode .v").html("Dynamic"); break;
-                case 4: $("#chgmode .v").html("Stopped"); break;
-                default: $("#chgmode .v").html("Unknown");
-            }
+        switch (jsondata.cmode) {
+            case 0: $("#chgmode .v").html("Standard"); break;
+            case 1: $("#chgmode .v").html("Absorb " + secondsToHms(jsondata.ctime)); break;
+            case 2: $("#chgmode .v").html("Float " + secondsToHms(jsondata.ctime)); break;
+            case 3: $("#chgmode .v").html("Dynamic"); break;
+            case 4: $("#chgmode .v").html("Stopped"); break;
+            default: $("#chgmode .v").html("Unknown");
         }
+    }
 
-        if (jsondata.bankv) {
-            for (var bankNumber = 0; bankNumber < jsondata.bankv.length; bankNumber++) {
-                $("#voltage" + bankNumber + " .v").html((parseFloat(jsondata.bankv[bankNumber]) / 1000.0).toFixed(2) + "V");
-                $("#range" + bankNumber + " .v").html(jsondata.voltrange[bankNumber] + "mV");
-                $("#voltage" + bankNumber).removeClass("hide");
-                $("#range" + bankNumber).removeClass("hide");
-            }
+    if (jsondata.bankv) {
+        for (var bankNumber = 0; bankNumber < jsondata.bankv.length; bankNumber++) {
+            $("#voltage" + bankNumber + " .v").html((parseFloat(jsondata.bankv[bankNumber]) / 1000.0).toFixed(2) + "V");
+            $("#range" + bankNumber + " .v").html(jsondata.voltrange[bankNumber] + "mV");
+            $("#voltage" + bankNumber).removeClass("hide");
+            $("#range" + bankNumber).removeClass("hide");
+        }
 
-            for (var bankNumber = jsondata.bankv.length; bankNumber < MAXIMUM_NUMBER_OF_BANKS; bankNumber++) {
-                $("#voltage" + bankNumber).hide().addClass("hide");
-                $("#range" + bankNumber).hide().addClass("hide");
-            }
+        for (var bankNumber = jsondata.bankv.length; bankNumber < MAXIMUM_NUMBER_OF_BANKS; bankNumber++) {
+            $("#voltage" + bankNumber).hide().addClass("hide");
+            $("#range" + bankNumber).hide().addClass("hide");
         }
+    }
 
 
-        if (jsondata.current) {
-            if (jsondata.current[0] == null) {
-                $("#current .v").html("");
-                $("#shuntv .v").html("");
-                $("#soc .v").html("");
-                $("#power .v").html("");
-                $("#amphout .v").html("");
-                $("#amphin .v").html("");
-                $("#damphout .v").html("");
-                $("#damphin .v").html("");
-                $("#time100 .v").html("");
-                $("#time10 .v").html("");
-                $("#time20 .v").html("");
-                $("#cyclesbatt .v").html("");
-            } else {
-                var data = jsondata.current[0];
-                $("#current .v").html(parseFloat(data.c).toFixed(2) + "A");
-                $("#shuntv .v").html(parseFloat(data.v).toFixed(2) + "V");
-                $("#soc .v").html(parseFloat(data.soc).toFixed(2) + "%");
-                $("#power .v").html(parseFloat(data.p) + "W");
-                $("#amphout .v").html((parseFloat(data.mahout) / 1000).toFixed(3));
-                $("#amphin .v").html((parseFloat(data.mahin) / 1000).toFixed(3));
-                $("#damphout .v").html((parseFloat(data.dmahout) / 1000).toFixed(3));
-                $("#damphin .v").html((parseFloat(data.dmahin) / 1000).toFixed(3));
-                $("#cyclesbatt .v").html(parseFloat(data.cyclesbatt).toFixed(2));
-                if (data.time100 > 0) {
-                    $("#time100 .v").html(secondsToHms(data.time100));
-                } else { $("#time100 .v").html("&infin;"); }
-                if (data.time20 > 0) {
-                    $("#time20 .v").html(secondsToHms(data.time20));
-                } else { $("#time20 .v").html("&infin;"); }
-                if (data.time10 > 0) {
-                    $("#time10 .v").html(secondsToHms(data.time10));
-                } else { $("#time10 .v").html("&infin;"); }
-            }
+    if (jsondata.current) {
+        if (jsondata.current[0] == null) {
+            $("#current .v").html("");
+            $("#shuntv .v").html("");
+            $("#soc .v").html("");
+            $("#power .v").html("");
+            $("#amphout .v").html("");
+            $("#amphin .v").html("");
+            $("#damphout .v").html("");
+            $("#damphin .v").html("");
+            $("#time100 .v").html("");
+            $("#time10 .v").html("");
+            $("#time20 .v").html("");
+            $("#cyclesbatt .v").html("");
+        } else {
+            var data = jsondata.current[0];
+            $("#current .v").html(parseFloat(data.c).toFixed(2) + "A");
+            $("#shuntv .v").html(parseFloat(data.v).toFixed(2) + "V");
+            $("#soc .v").html(parseFloat(data.soc).toFixed(2) + "%");
+            $("#power .v").html(parseFloat(data.p) + "W");
+            $("#amphout .v").html((parseFloat(data.mahout) / 1000).toFixed(3));
+            $("#amphin .v").html((parseFloat(data.mahin) / 1000).toFixed(3));
+            $("#damphout .v").html((parseFloat(data.dmahout) / 1000).toFixed(3));
+            $("#damphin .v").html((parseFloat(data.dmahin) / 1000).toFixed(3));
+            $("#cyclesbatt .v").html(parseFloat(data.cyclesbatt).toFixed(2));
+            if (data.time100 > 0) {
+                $("#time100 .v").html(secondsToHms(data.time100));
+            } else { $("#time100 .v").html("&infin;"); }
+            if (data.time20 > 0) {
+                $("#time20 .v").html(secondsToHms(data.time20));
+            } else { $("#time20 .v").html("&infin;"); }
+            if (data.time10 > 0) {
+                $("#time10 .v").html(secondsToHms(data.time10));
+            } else { $("#time10 .v").html("&infin;"); }
         }
+    }
 
-        //Loop size needs increasing when more warnings are added
-        if (jsondata.warnings) {
-            for (let warning = 1; warning <= 9; warning++) {
-                if (jsondata.warnings.includes(warning)) {
-                    //Once a warning has triggered, hide it from showing in the future
-                    if ($("#warning" + warning).data("notify") == undefined) {
-                        $("#warning" + warning).data("notify", 1);
-                        $.notify($("#warning" + warning).text(), { autoHideDelay: 15000, globalPosition: 'top left', className: 'warn' });
-                    }
+    //Loop size needs increasing when more warnings are added
+    if (jsondata.warnings) {
+        for (let warning = 1; warning <= 9; warning++) {
+            if (jsondata.warnings.includes(warning)) {
+                //Once a warning has triggered, hide it from showing in the future
+                if ($("#warning" + warning).data("notify") == undefined) {
+                    $("#warning" + warning).data("notify", 1);
+                    $.notify($("#warning" + warning).text(), { autoHideDelay: 15000, globalPosition: 'top left', className: 'warn' });
                 }
             }
+        }
 
-            //Allow charge/discharge warnings to reappear
-            if (jsondata.warnings.includes(7) == false) {
-                $("#warning7").removeData("notify");
-            }
-            if (jsondata.warnings.includes(8) == false) {
-                $("#warning8").removeData("notify");
-            }
+        //Allow charge/discharge warnings to reappear
+        if (jsondata.warnings.includes(7) == false) {
+            $("#warning7").removeData("notify");
         }
+        if (jsondata.warnings.includes(8) == false) {
+            $("#warning8").removeData("notify");
+        }
+    }
 
-        //Needs increasing when more errors are added
-        if (jsondata.errors) {
-            for (let error = 1; error <= 7; error++) {
-                if (jsondata.errors.includes(error)) {
-                    $("#error" + error).show();
+    //Needs increasing when more errors are added
+    if (jsondata.errors) {
+        for (let error = 1; error <= 7; error++) {
+            if (jsondata.errors.includes(error)) {
+                $("#error" + error).show();
 
-                    if (error == INTERNALERRORCODE.ModuleCountMismatch) {
-                        $("#missingmodule1").html(jsondata.modulesfnd);
-                        $("#missingmodule2").html(jsondata.banks * jsondata.seriesmodules);
-                    }
-                } else {
-                    $("#error" + error).hide();
+                if (error == INTERNALERRORCODE.ModuleCountMismatch) {
+                    $("#missingmodule1").html(jsondata.modulesfnd);
+                    $("#missingmodule2").html(jsondata.banks * jsondata.seriesmodules);
                 }
+            } else {
+                $("#error" + error).hide();
             }
         }
+    }
 
-        $("#info").show();
-        $("#iperror").hide();
+    $("#info").show();
+    $("#iperror").hide();
 
-        if ($('#modulesPage').is(':visible')) {
-            //The modules page is visible
-            var tbody = $("#modulesRows");
+    if ($('#modulesPage').is(':visible')) {
+        //The modules page is visible
+        var tbody = $("#modulesRows");
 
-            if ($('#modulesRows tr').length != cells.length) {
-                $("#settingConfig").hide();
+        if ($('#modulesRows tr').length != cells.length) {
+            $("#settingConfig").hide();
 
-                //Add rows if they dont exist (or incorrect amount)
-                $(tbody).find("tr").remove();
+            //Add rows if they dont exist (or incorrect amount)
+            $(tbody).find("tr").remove();
 
-                $.each(cells, function (index, value) {
-                    $(tbody).append("<tr><td>"
-                        + bank[index]
-                        + "</td><td>" + value + "</td><td></td><td class='hide'></td><td class='hide'></td>"
-                        + "<td class='hide'></td><td class='hide'></td><td class='hide'></td><td class='hide'></td><td class='hide'></td><td class='hide'></td>"
-                        + "<td><button type='button' onclick='return identifyModule(this," + index + ");'>Identify</button>"
-                        + "<button type='button' onclick='return configureModule(this," + index + ",10);'>Configure</button></td></tr>")
-                });
-            }
+            $.each(cells, function (index, value) {
+                $(tbody).append("<tr><td>"
+                    + bank[index]
+                    + "</td><td>" + value + "</td><td></td><td class='hide'></td><td class='hide'></td>"
+                    + "<td class='hide'></td><td class='hide'></td><td class='hide'></td><td class='hide'></td><td class='hide'></td><td class='hide'></td>"
+                    + "<td><button type='button' onclick='return identifyModule(this," + index + ");'>Identify</button>"
+                    + "<button type='button' onclick='return configureModule(this," + index + ",10);'>Configure</button></td></tr>")
+            });
+        }
 
-            var rows = $(tbody).find("tr");
+        var rows = $(tbody).find("tr");
 
+        $.each(cells, function (index, value) {
+            var columns = $(rows[index]).find("td");
+            $(columns[2]).html(voltages[index].value.toFixed(3));
+            if (voltagesmin.length > 0) {
+                $(columns[3]).html(voltagesmin[index].toFixed(3));
+            } else {
+                $(columns[3]).html("n/a");
+            }
+            if (voltagesmax.length > 0) {
+                $(columns[4]).html(voltagesmax[index].toFixed(3));
+            } else {
+                $(columns[4]).html("n/a");
+            }
+            $(columns[5]).html(tempint[index].value);
+            $(columns[6]).html(tempext[index].value);
+            $(columns[7]).html(pwm[index].value);
+        });
+
+        if (jsondata.badpacket) {
+            //Websocket telemetry already carries the per module counters
             $.each(cells, function (index, value) {
                 var columns = $(rows[index]).find("td");
-                $(columns[2]).html(voltages[index].value.toFixed(3));
-                if (voltagesmin.length > 0) {
-                    $(columns[3]).html(voltagesmin[index].toFixed(3));
-                } else {
-                    $(columns[3]).html("n/a");
-                }
-                if (voltagesmax.length > 0) {
-                    $(columns[4]).html(voltagesmax[index].toFixed(3));
-                } else {
-                    $(columns[4]).html("n/a");
-                }
-                $(columns[5]).html(tempint[index].value);
-                $(columns[6]).html(tempext[index].value);
-                $(columns[7]).html(pwm[index].value);
+                $(columns[8]).html(jsondata.badpacket[index]);
+                $(columns[9]).html(jsondata.pktrecvd[index]);
+                $(columns[10]).html(jsondata.balcurrent[index]);
             });
-
+        } else {
             //As the module page is open, we refresh the last 3 columns using seperate JSON web service to keep the monitor2
             //packets as small as possible
 
@@ -974,316 +1028,487 @@ function queryBMS() {
                 });
             });
         }
+    }
 
 
-        if ($('#homePage').is(':visible')) {
-            if (window.g1 == null && $('#graph1').css('display') != 'none') {
-                // based on prepared DOM, initialize echarts instance
-                window.g1 = echarts.init(document.getElementById('graph1'))
+    if ($('#homePage').is(':visible')) {
+        if (window.g1 == null && $('#graph1').css('display') != 'none') {
+            // based on prepared DOM, initialize echarts instance
+            window.g1 = echarts.init(document.getElementById('graph1'))
 
-                // specify chart configuration item and data
-                var option = {
-                    tooltip: {
-                        show: true, axisPointer: {
-                            type: 'cross', label: {
-                                backgroundColor: '#6a7985'
-                            }
+            // specify chart configuration item and data
+            var option = {
+                tooltip: {
+                    show: true, axisPointer: {
+                        type: 'cross', label: {
+                            backgroundColor: '#6a7985'
+                        }
+                    }
+                },
+                legend: {
+                    show: false
+                },
+                xAxis: [{
+                    gridIndex: 0, type: 'category', axisLine: {
+                        lineStyle: {
+                            color: '#c1bdbd'
+                        }
+                    }
+                }, {
+                    gridIndex: 1, type: 'category', axisLine: {
+                        lineStyle: { color: '#c1bdbd' }
+                    }
+                }],
+                yAxis: [{
+                    id: 0, gridIndex: 0, name: 'Volts', type: 'value', min: 2.5, max: 4.5, interval: 0.25, position: 'left',
+                    axisLine: {
+                        lineStyle: {
+                            color: '#c1bdbd'
                         }
                     },
-                    legend: {
-                        show: false
+                    axisLabel: {
+                        formatter: function (value, index) {
+                            return value.toFixed(2);
+                        }
+                    }
+                },
+                {
+                    id: 1,
+                    gridIndex: 0, name: 'Bypass', type: 'value', min: 0,
+                    max: 100, interval: 10, position: 'right',
+                    axisLabel: { formatter: '{value}%' },
+                    splitLine: { show: false },
+                    axisLine: { lineStyle: { type: 'dotted', color: '#c1bdbd' } },
+                    axisTick: { show: false }
+                },
+                {
+                    id: 2,
+                    gridIndex: 1,
+                    name: 'Temperature',
+                    type: 'value',
+                    interval: 10,
+                    position: 'left',
+                    axisLine: {
+                        lineStyle: { color: '#c1bdbd' }
                     },
-                    xAxis: [{
-                        gridIndex: 0, type: 'category', axisLine: {
-                            lineStyle: {
-                                color: '#c1bdbd'
+                    axisLabel: { formatter: '{value}°C' }
+                }],
+                series: [
+                    {
+                        xAxisIndex: 0,
+                        name: 'Voltage',
+                        yAxisIndex: 0,
+                        type: 'bar',
+                        data: [],
+                        markLine: {
+                            silent: true, symbol: 'none', data: markLineData
+                        },
+                        itemStyle: { color: '#55a1ea', barBorderRadius: [8, 8, 0, 0] },
+                        label: {
+                            normal: {
+                                show: true, position: 'insideBottom', distance: 10, align: 'left', verticalAlign: 'middle', rotate: 90, formatter: '{c}V', fontSize: 24, color: '#eeeeee', fontFamily: 'Share Tech Mono'
                             }
                         }
                     }, {
-                        gridIndex: 1, type: 'category', axisLine: {
-                            lineStyle: { color: '#c1bdbd' }
-                        }
-                    }],
-                    yAxis: [{
-                        id: 0, gridIndex: 0, name: 'Volts', type: 'value', min: 2.5, max: 4.5, interval: 0.25, position: 'left',
-                        axisLine: {
-                            lineStyle: {
-                                color: '#c1bdbd'
+                        xAxisIndex: 0,
+                        name: 'Min V',
+                        yAxisIndex: 0,
+                        type: 'line',
+                        data: [],
+                        label: {
+                            normal: {
+                                show: true, position: 'bottom', distance: 5, formatter: '{c}V', fontSize: 14, color: '#eeeeee', fontFamily: 'Share Tech Mono'
                             }
                         },
-                        axisLabel: {
-                            formatter: function (value, index) {
-                                return value.toFixed(2);
+                        symbolSize: 16,
+                        symbol: ['circle'],
+                        itemStyle: {
+                            normal: {
+                                color: "#c1bdbd", lineStyle: { color: 'transparent' }
                             }
                         }
-                    },
-                    {
-                        id: 1,
-                        gridIndex: 0, name: 'Bypass', type: 'value', min: 0,
-                        max: 100, interval: 10, position: 'right',
-                        axisLabel: { formatter: '{value}%' },
-                        splitLine: { show: false },
-                        axisLine: { lineStyle: { type: 'dotted', color: '#c1bdbd' } },
-                        axisTick: { show: false }
-                    },
-                    {
-                        id: 2,
-                        gridIndex: 1,
-                        name: 'Temperature',
-                        type: 'value',
-                        interval: 10,
-                        position: 'left',
-                        axisLine: {
-                            lineStyle: { color: '#c1bdbd' }
-                        },
-                        axisLabel: { formatter: '{value}°C' }
-                    }],
-                    series: [
-                        {
-                            xAxisIndex: 0,
-                            name: 'Voltage',
-                            yAxisIndex: 0,
-                            type: 'bar',
-                            data: [],
-                            markLine: {
-                                silent: true, symbol: 'none', data: markLineData
-                            },
-                            itemStyle: { color: '#55a1ea', barBorderRadius: [8, 8, 0, 0] },
-                            label: {
-                                normal: {
-                                    show: true, position: 'insideBottom', distance: 10, align: 'left', verticalAlign: 'middle', rotate: 90, formatter: '{c}V', fontSize: 24, color: '#eeeeee', fontFamily: 'Share Tech Mono'
-                                }
-                            }
-                        }, {
-                            xAxisIndex: 0,
-                            name: 'Min V',
-                            yAxisIndex: 0,
-                            type: 'line',
-                            data: [],
-                            label: {
-                                normal: {
-                                    show: true, position: 'bottom', distance: 5, formatter: '{c}V', fontSize: 14, color: '#eeeeee', fontFamily: 'Share Tech Mono'
-                                }
-                            },
-                            symbolSize: 16,
-                            symbol: ['circle'],
-                            itemStyle: {
-                                normal: {
-                                    color: "#c1bdbd", lineStyle: { color: 'transparent' }
-                                }
+                    }
+                    , {
+                        xAxisIndex: 0,
+                        name: 'Max V',
+                        yAxisIndex: 0,
+                        type: 'line',
+                        data: [],
+                        label: {
+                            normal: {
+                                show: true, position: 'top', distance: 5, formatter: '{c}V', fontSize: 14, color: '#c1bdbd', fontFamily: 'Share Tech Mono'
                             }
-                        }
-                        , {
-                            xAxisIndex: 0,
-                            name: 'Max V',
-                            yAxisIndex: 0,
-                            type: 'line',
-                            data: [],
-                            label: {
-                                normal: {
-                                    show: true, position: 'top', distance: 5, formatter: '{c}V', fontSize: 14, color: '#c1bdbd', fontFamily: 'Share Tech Mono'
-                                }
-                            },
-                            symbolSize: 16,
-                            symbol: ['arrow'],
-                            itemStyle: {
-                                normal: {
-                                    color: "#c1bdbd", lineStyle: { color: 'transparent' }
-                                }
+                        },
+                        symbolSize: 16,
+                        symbol: ['arrow'],
+                        itemStyle: {
+                            normal: {
+                                color: "#c1bdbd", lineStyle: { color: 'transparent' }
                             }
                         }
+                    }
 
-                        , {
-                            xAxisIndex: 0,
-                            name: 'Bypass',
-                            yAxisIndex: 1,
-                            type: 'line',
-                            data: [],
-                            label: {
-                                normal: {
-                                    show: true, position: 'right', distance: 5, formatter: '{c}%', fontSize: 14, color: '#f0e400', fontFamily: 'Share Tech Mono'
-                                }
-                            },
-                            symbolSize: 16,
-                            symbol: ['square'],
-                            itemStyle: { normal: { color: "#f0e400", lineStyle: { color: 'transparent' } } }
-                        }
+                    , {
+                        xAxisIndex: 0,
+                        name: 'Bypass',
+                        yAxisIndex: 1,
+                        type: 'line',
+                        data: [],
+                        label: {
+                            normal: {
+                                show: true, position: 'right', distance: 5, formatter: '{c}%', fontSize: 14, color: '#f0e400', fontFamily: 'Share Tech Mono'
+                            }
+                        },
+                        symbolSize: 16,
+                        symbol: ['square'],
+                        itemStyle: { normal: { color: "#f0e400", lineStyle: { color: 'transparent' } } }
+                    }
 
-                        , {
-                            xAxisIndex: 1,
-                            yAxisIndex: 2,
-                            name: 'BypassTemperature',
-                            type: 'bar',
-                            data: [],
-                            itemStyle: {
-                                color: '#55a1ea', barBorderRadius: [8, 8, 0, 0]
-                            },
-                            label: {
-                                normal: {
-                                    show: true, position: 'insideBottom', distance: 8,
-                                    align: 'left', verticalAlign: 'middle',
-                                    rotate: 90, formatter: '{c}°C', fontSize: 20, color: '#eeeeee', fontFamily: 'Share Tech Mono'
-                                }
+                    , {
+                        xAxisIndex: 1,
+                        yAxisIndex: 2,
+                        name: 'BypassTemperature',
+                        type: 'bar',
+                        data: [],
+                        itemStyle: {
+                            color: '#55a1ea', barBorderRadius: [8, 8, 0, 0]
+                        },
+                        label: {
+                            normal: {
+                                show: true, position: 'insideBottom', distance: 8,
+                                align: 'left', verticalAlign: 'middle',
+                                rotate: 90, formatter: '{c}°C', fontSize: 20, color: '#eeeeee', fontFamily: 'Share Tech Mono'
                             }
                         }
+                    }
 
-                        , {
-                            xAxisIndex: 1,
-                            yAxisIndex: 2,
-                            name: 'CellTemperature',
-                            type: 'bar',
-                            data: [],
-                            itemStyle: {
-                                color: '#55a1ea', barBorderRadius: [8, 8, 0, 0]
-                            },
-                            label: {
-                                normal: {
-                                    show: true, position: 'insideBottom', distance: 8,
-                                    align: 'left', verticalAlign: 'middle', rotate: 90,
-                                    formatter: '{c}°C', fontSize: 20, color: '#eeeeee', fontFamily: 'Share Tech Mono'
-                                }
+                    , {
+                        xAxisIndex: 1,
+                        yAxisIndex: 2,
+                        name: 'CellTemperature',
+                        type: 'bar',
+                        data: [],
+                        itemStyle: {
+                            color: '#55a1ea', barBorderRadius: [8, 8, 0, 0]
+                        },
+                        label: {
+                            normal: {
+                                show: true, position: 'insideBottom', distance: 8,
+                                align: 'left', verticalAlign: 'middle', rotate: 90,
+                                formatter: '{c}°C', fontSize: 20, color: '#eeeeee', fontFamily: 'Share Tech Mono'
                             }
-
                         }
-                    ],
-                    grid: [
-                        {
-                            containLabel: false, left: '4%', right: '4%', bottom: '30%'
 
-                        }, {
-                            containLabel: false, left: '4%', right: '4%', top: '76%'
-                        }]
-                };
+                    }
+                ],
+                grid: [
+                    {
+                        containLabel: false, left: '4%', right: '4%', bottom: '30%'
+
+                    }, {
+                        containLabel: false, left: '4%', right: '4%', top: '76%'
+                    }]
+            };
 
-                // use configuration item and data specified to show chart
-                g1.setOption(option);
+            // use configuration item and data specified to show chart
+            g1.setOption(option);
 
-            }
+        }
 
-            if (window.g2 == null && $('#graph2').css('display') != 'none' && window.Graph3DAvailable === true) {
-                window.g2 = echarts.init(document.getElementById('graph2'));
-
-                var Option3dBar = {
-                    tooltip: {},
-                    visualMap: { max: 4, inRange: { color: ['#313695', '#4575b4', '#74add1', '#abd9e9', '#e0f3f8', '#ffffbf', '#fee090', '#fdae61', '#f46d43', '#d73027', '#a50026'] } },
-                    xAxis3D: { type: 'category', data: [], name: 'Cell', nameTextStyle: { color: '#ffffff' } },
-                    yAxis3D: { type: 'category', data: [], name: 'Bank', nameTextStyle: { color: '#ffffff' } },
-                    zAxis3D: { type: 'value', name: 'Voltage', nameTextStyle: { color: '#ffffff' } },
-                    grid3D: {
-                        boxWidth: 200,
-                        boxDepth: 80,
-                        viewControl: {
-                            // projection: 'orthographic'
-                        },
-                        light: {
-                            main: {
-                                intensity: 1.2,
-                                shadow: true
-                            },
-                            ambient: {
-                                intensity: 0.3
-                            }
-                        }
+        if (window.g2 == null && $('#graph2').css('display') != 'none' && window.Graph3DAvailable === true) {
+            window.g2 = echarts.init(document.getElementById('graph2'));
+
+            var Option3dBar = {
+                tooltip: {},
+                visualMap: { max: 4, inRange: { color: ['#313695', '#4575b4', '#74add1', '#abd9e9', '#e0f3f8', '#ffffbf', '#fee090', '#fdae61', '#f46d43', '#d73027', '#a50026'] } },
+                xAxis3D: { type: 'category', data: [], name: 'Cell', nameTextStyle: { color: '#ffffff' } },
+                yAxis3D: { type: 'category', data: [], name: 'Bank', nameTextStyle: { color: '#ffffff' } },
+                zAxis3D: { type: 'value', name: 'Voltage', nameTextStyle: { color: '#ffffff' } },
+                grid3D: {
+                    boxWidth: 200,
+                    boxDepth: 80,
+                    viewControl: {
+                        // projection: 'orthographic'
                     },
-                    series: [{
-                        type: 'bar3D',
-                        data: [],
-                        shading: 'lambert',
-                        label: { textStyle: { fontSize: 16, borderWidth: 1, color: '#ffffff' } },
-
-                        emphasis: {
-                            label: {
-                                textStyle: {
-                                    fontSize: 16,
-                                    color: '#aaa'
-                                }
-                            },
-                            itemStyle: { color: '#fff' }
+                    light: {
+                        main: {
+                            intensity: 1.2,
+                            shadow: true
+                        },
+                        ambient: {
+                            intensity: 0.3
                         }
-                    }]
-                };
+                    }
+                },
+                series: [{
+                    type: 'bar3D',
+                    data: [],
+                    shading: 'lambert',
+                    label: { textStyle: { fontSize: 16, borderWidth: 1, color: '#ffffff' } },
+
+                    emphasis: {
+                        label: {
+                            textStyle: {
+                                fontSize: 16,
+                                color: '#aaa'
+                            }
+                        },
+                        itemStyle: { color: '#fff' }
+                    }
+                }]
+            };
 
-                g2.setOption(Option3dBar);
-            }
+            g2.setOption(Option3dBar);
+        }
 
 
-            if (window.g1 != null && $('#graph1').css('display') != 'none') {
-                g1.setOption({
-                    markLine: { data: markLineData },
-                    xAxis: { data: labels },
-                    yAxis: [{ gridIndex: 0, min: minVoltage, max: maxVoltage }]
-                    , series: [{ name: 'Voltage', data: voltages }
-                        , { name: 'Min V', data: voltagesmin }
-                        , { name: 'Max V', data: voltagesmax }
-                        , { name: 'Bypass', data: pwm }
-                        , { name: 'BypassTemperature', data: tempint }
-                        , { name: 'CellTemperature', data: tempext }]
-                });
-            }
+        if (window.g1 != null && $('#graph1').css('display') != 'none') {
+            g1.setOption({
+                markLine: { data: markLineData },
+                xAxis: { data: labels },
+                yAxis: [{ gridIndex: 0, min: minVoltage, max: maxVoltage }]
+                , series: [{ name: 'Voltage', data: voltages }
+                    , { name: 'Min V', data: voltagesmin }
+                    , { name: 'Max V', data: voltagesmax }
+                    , { name: 'Bypass', data: pwm }
+                    , { name: 'BypassTemperature', data: tempint }
+                    , { name: 'CellTemperature', data: tempext }]
+            });
+        }
+
 
 
+        if (window.g2 != null && $('#graph2').css('display') != 'none') {
+            //Format the data to show as 3D Bar chart
+            var cells3d = [];
+            var banks3d = [];
 
-            if (window.g2 != null && $('#graph2').css('display') != 'none') {
-                //Format the data to show as 3D Bar chart
-                var cells3d = [];
-                var banks3d = [];
+            for (var seriesmodules = 0; seriesmodules < jsondata.seriesmodules; seriesmodules++) {
+                cells3d.push({ value: 'Cell ' + seriesmodules, textStyle: { color: '#ffffff' } });
+            }
 
+            var data3d = [];
+            var cell = 0;
+            for (var bankNumber = 0; bankNumber < jsondata.banks; bankNumber++) {
+                banks3d.push({ value: 'Bank ' + bankNumber, textStyle: { color: '#ffffff' } });
+                //Build up 3d array for cell data
                 for (var seriesmodules = 0; seriesmodules < jsondata.seriesmodules; seriesmodules++) {
-                    cells3d.push({ value: 'Cell ' + seriesmodules, textStyle: { color: '#ffffff' } });
+                    data3d.push({ value: [seriesmodules, bankNumber, voltages[cell].value], itemStyle: voltages[cell].itemStyle });
+                    cell++;
                 }
+            }
 
-                var data3d = [];
-                var cell = 0;
-                for (var bankNumber = 0; bankNumber < jsondata.banks; bankNumber++) {
-                    banks3d.push({ value: 'Bank ' + bankNumber, textStyle: { color: '#ffffff' } });
-                    //Build up 3d array for cell data
-                    for (var seriesmodules = 0; seriesmodules < jsondata.seriesmodules; seriesmodules++) {
-                        data3d.push({ value: [seriesmodules, bankNumber, voltages[cell].value], itemStyle: voltages[cell].itemStyle });
-                        cell++;
-                    }
+            g2.setOption({
+                xAxis3D: { data: cells3d },
+                yAxis3D: { data: banks3d },
+                zAxis3D: { min: minVoltage, max: maxVoltage },
+                series: [{ data: data3d }]
+
+                , grid3D: {
+                    boxWidth: 20 * jsondata.seriesmodules > 200 ? 200 : 20 * jsondata.seriesmodules,
+                    boxDepth: 20 * jsondata.banks > 100 ? 100 : 20 * jsondata.banks
                 }
+            }
 
-                g2.setOption({
-                    xAxis3D: { data: cells3d },
-                    yAxis3D: { data: banks3d },
-                    zAxis3D: { min: minVoltage, max: maxVoltage },
-                    series: [{ data: data3d }]
+            );
+        }
 
-                    , grid3D: {
-                        boxWidth: 20 * jsondata.seriesmodules > 200 ? 200 : 20 * jsondata.seriesmodules,
-                        boxDepth: 20 * jsondata.banks > 100 ? 100 : 20 * jsondata.banks
-                    }
-                }
+    }//end homepage visible
 
-                );
-            }
+    $("#homePage").css({ opacity: 1.0 });
+    $("#loading").hide();
 
-        }//end homepage visible
+    loadVisibleTileData();
+}
 
-        $("#homePage").css({ opacity: 1.0 });
-        $("#loading").hide();
-        //Call again in a few seconds
+//Live values pushed from the controller over the websocket, replaces polling monitor2/monitor3
+var telemetrySocket = null;
+var telemetry = null;
+
+function startTelemetry() {
+    if (!("WebSocket" in window)) {
+        return;
+    }
+
+    var ws = new WebSocket((location.protocol === "https:" ? "wss://" : "ws://") + location.host + "/ws");
+    telemetrySocket = ws;
+
+    ws.onmessage = function (evt) {
+        processTelemetryFrame(ws, evt.data);
+    };
+
+    ws.onclose = function () {
+        telemetrySocket = null;
+        telemetry = null;
+        //queryBMS polling takes over, try the websocket again later
+        setTimeout(startTelemetry, 15000);
+    };
+}
+
+function processTelemetryFrame(ws, data) {
+    var frame;
+    try {
+        frame = JSON.parse(data);
+    } catch (e) {
+        //Debug log output can also be sent over the websocket
+        console.log(data);
+        return;
+    }
+
+    if (frame.t === "reset") {
+        telemetry = {
+            voltages: [], minvoltages: [], maxvoltages: [], inttemp: [], exttemp: [],
+            bypass: [], bypasshot: [], bypasspwm: [], badpacket: [], pktrecvd: [], balcurrent: []
+        };
+        for (let i = 0; i < frame.n; i++) {
+            setTelemetryModule([i]);
+        }
+        return;
+    }
+
+    if (telemetry == null) {
+        return;
+    }
+
+    if (frame.t === "m") {
+        $.each(frame.m, function (index, m) { setTelemetryModule(m); });
+        return;
+    }
+
+    if (frame.t === "s") {
+        if (telemetry.voltages.length != frame.banks * frame.seriesmodules) {
+            //Number of modules has changed
+            ws.send("full");
+            return;
+        }
+
+        renderMonitor($.extend({}, frame, telemetry));
+        //Controller sends nothing more until this frame has been processed
+        ws.send($('#modulesPage').is(':visible') ? "ackd" : "ack");
+    }
+}
+
+function setTelemetryModule(m) {
+    var i = m[0];
+    if (m.length == 1) {
+        //Module is not valid (yet)
+        telemetry.voltages[i] = null;
+        telemetry.minvoltages[i] = null;
+        telemetry.maxvoltages[i] = null;
+        telemetry.inttemp[i] = null;
+        telemetry.exttemp[i] = null;
+        telemetry.bypass[i] = 0;
+        telemetry.bypasshot[i] = 0;
+        telemetry.bypasspwm[i] = 0;
+        telemetry.badpacket[i] = null;
+        telemetry.pktrecvd[i] = null;
+        telemetry.balcurrent[i] = null;
+        return;
+    }
+    telemetry.voltages[i] = m[1];
+    telemetry.minvoltages[i] = m[2];
+    telemetry.maxvoltages[i] = m[3];
+    telemetry.inttemp[i] = m[4];
+    telemetry.exttemp[i] = m[5];
+    telemetry.bypass[i] = (m[6] & 1);
+    telemetry.bypasshot[i] = (m[6] & 2) >> 1;
+    telemetry.bypasspwm[i] = m[7];
+    telemetry.badpacket[i] = m[8];
+    telemetry.pktrecvd[i] = m[9];
+    telemetry.balcurrent[i] = m[10];
+}
+
+function queryBMS() {
+    //Values are pushed over the websocket whilst it is connected, no need to poll
+    if (telemetrySocket != null && telemetrySocket.readyState == WebSocket.OPEN) {
         setTimeout(queryBMS, 3500);
+        return;
+    }
 
-        loadVisibleTileData();
+    fetchModuleData(function (modules) {
+        //Module arrays come from the binary response, monitor2 just supplies the summary
+        $.getJSON("/api/monitor2", { modules: 0 }, function (jsondata) {
+            renderMonitor($.extend(jsondata, modules));
+            //Call again in a few seconds
+            setTimeout(queryBMS, 3500);
+        }).fail(queryBMSFailed);
+    }, queryBMSFailed);
+}
 
-    }).fail(function (jqXHR, textStatus, errorThrown) {
+function queryBMSFailed(jqXHR) {
+    if (jqXHR.status == 400 && jqXHR.responseJSON && jqXHR.responseJSON.error === "Invalid cookie") {
+        if ($("#warningXSS").data("notify") == undefined) {
+            $("#warningXSS").data("notify", 1);
+            $.notify($("#warningXSS").text(), { autoHide: false, globalPosition: 'top left', className: 'error' });
+        }
+    } else {
+        //Other type of error
+        $("#iperror").show();
+        //Try again in a few seconds (2 seconds if errored)
+        setTimeout(queryBMS, 2000);
+        $("#loading").hide();
+    }
+    //Dim the main home page graph
+    $("#homePage").css({ opacity: 0.1 });
+}
 
-        if (jqXHR.status == 400 && jqXHR.responseJSON.error === "Invalid cookie") {
-            if ($("#warningXSS").data("notify") == undefined) {
-                $("#warningXSS").data("notify", 1);
-                $.notify($("#warningXSS").text(), { autoHide: false, globalPosition: 'top left', className: 'error' });
-            }
-        } else {
-            //Other type of error
-            $("#iperror").show();
-            //Try again in a few seconds (2 seconds if errored)
-            setTimeout(queryBMS, 2000);
-            $("#loading").hide();
+//Reads /api/monitorbin (little endian typed arrays, see content_handler_monitorbin) into the same arrays as monitor2
+function fetchModuleData(success, failure) {
+    var xhr = new XMLHttpRequest();
+    xhr.open("GET", "/api/monitorbin");
+    xhr.responseType = "arraybuffer";
+    xhr.onload = function () {
+        var modules = (xhr.status == 200) ? decodeModuleData(new DataView(xhr.response)) : null;
+        if (modules != null) {
+            success(modules);
+            return;
         }
-        //Dim the main home page graph
-        $("#homePage").css({ opacity: 0.1 });
-    });
+        var error = { status: xhr.status };
+        try {
+            error.responseJSON = JSON.parse(new TextDecoder().decode(xhr.response));
+        } catch (e) { }
+        failure(error);
+    };
+    xhr.onerror = function () { failure({ status: 0 }); };
+    xhr.send();
+}
+
+function decodeModuleData(view) {
+    if (view.byteLength < 16 || view.getUint8(0) != 1) {
+        return null;
+    }
+    var n = view.getUint16(12, true);
+    var offset = view.getUint8(1);
+    var bitmaps = offset + n * 15;
+    if (view.byteLength < bitmaps + Math.ceil(n / 8) * 3) {
+        return null;
+    }
+
+    function flag(f, i) {
+        return (view.getUint8(bitmaps + f * Math.ceil(n / 8) + (i >> 3)) >> (i & 7)) & 1;
+    }
+    function uint16(a, i) { return view.getUint16(offset + (a * n + i) * 2, true); }
+    function int8(a, i) { return view.getInt8(offset + n * 12 + a * n + i); }
+
+    var m = {
+        voltages: [], minvoltages: [], maxvoltages: [], inttemp: [], exttemp: [],
+        bypass: [], bypasshot: [], bypasspwm: [], badpacket: [], pktrecvd: [], balcurrent: []
+    };
+    for (var i = 0; i < n; i++) {
+        var valid = flag(0, i) == 1;
+        m.voltages.push(valid ? uint16(0, i) : null);
+        m.minvoltages.push(valid ? uint16(1, i) : null);
+        m.maxvoltages.push(valid ? uint16(2, i) : null);
+        m.badpacket.push(valid ? uint16(3, i) : null);
+        m.pktrecvd.push(valid ? uint16(4, i) : null);
+        m.balcurrent.push(valid ? uint16(5, i) : null);
+        m.inttemp.push(valid && int8(0, i) != -40 ? int8(0, i) : null);
+        m.exttemp.push(valid && int8(1, i) != -40 ? int8(1, i) : null);
+        m.bypasspwm.push(view.getUint8(offset + n * 14 + i));
+        m.bypass.push(flag(1, i));
+        m.bypasshot.push(flag(2, i));
+    }
+    return m;
 }
 
 $(window).on('resize', function () {
@@ -1750,6 +1975,7 @@ $(function () {
 
                 $("#mqttEnabled").prop("checked", data.mqtt.enabled);
                 $("#mqttBasicReporting").prop("checked", data.mqtt.basiccellreporting);
+                $("#mqttBankPayloads").prop("checked", data.mqtt.bankpayloads);
                 $("#mqttTopic").val(data.mqtt.topic);
                 $("#mqttUri").val(data.mqtt.uri);
                 $("#mqttUsername").val(data.mqtt.username);
@@ -1767,6 +1993,7 @@ $(function () {
                 $("#influxToken").val(data.influxdb.apitoken);
                 $("#influxOrgId").val(data.influxdb.orgid);
                 $("#influxFreq").val(data.influxdb.frequency);
+                $("#influxGzip").prop("checked", data.influxdb.gzip);
 
                 $("#haUrl").val(window.location.origin+"/ha");
                 $("#haAPI").val(data.ha.api);                
@@ -2003,6 +2230,8 @@ $(function () {
                 $("#canbusprotocol").val(data.chargeconfig.canbusprotocol);
                 $("#canbusinverter").val(data.chargeconfig.canbusinverter);
                 $("#canbusbaud").val(data.chargeconfig.canbusbaud);
+                $("#canbusequip").val(data.chargeconfig.equip_addr);
+                $("#canbusmultipack").prop("checked", data.chargeconfig.multipack);
                 $("#nominalbatcap").val(data.chargeconfig.nominalbatcap);
 
                 $("#chargevolt").val((data.chargeconfig.chargevolt / 10.0).toFixed(1));
@@ -2300,6 +2529,9 @@ $(function () {
     $("#file_sel").change(function () { upload_firmware(); });
     $("#uploadfw").click(function () { $("#file_sel").click(); });
 
+    $("#www_sel").change(function () { upload_webfiles(); });
+    $("#uploadwww").click(function () { $("#www_sel").click(); });
+
     $("#uploadfile").click(function () { $("#uploadfile_sel").click(); });
     $("#uploadfile_sel").change(function () { upload_file(); });
 
@@ -2340,6 +2572,7 @@ $(function () {
 
 
     //On page ready
+    startTelemetry();
     queryBMS();
 
 